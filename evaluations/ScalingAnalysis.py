@@ -0,0 +1,21 @@
+from parser import gather_data
+import os
+
+# Index creation time and speedup over the single thread run of every run of scripts/scaling_script.sh (run from the evaluations directory),
+# for the build that inserts one node at a time and for the batch build
+scaling_data = [ gather_data('scaling/'+filename) for filename in os.listdir('scaling/') ]
+scaling_data = sorted([ data for data in scaling_data if "index_creation_time" in data ], key=lambda data: data["n_threads"])
+
+for batch_build in [False, True]:
+    build_data = [ data for data in scaling_data if data.get("batch_build", False) == batch_build ]
+    if not build_data:
+        continue
+
+    serial = next((data["index_creation_time"] for data in build_data if data["n_threads"] == 1), None)
+
+    print("Batch build" if batch_build else "Build")
+    print(f"{'threads':>8} {'creation time (s)':>18} {'speedup':>8} {'edges':>10}")
+    for data in build_data:
+        seconds = data["index_creation_time"].total_seconds()
+        speedup = f"{serial.total_seconds() / seconds:.2f}" if serial is not None else "-"
+        print(f"{data['n_threads']:>8} {seconds:>18.1f} {speedup:>8} {data.get('n_edges', '-'):>10}")
@@ -119,10 +119,26 @@ def gather_data(file_name):
             data["p_queue"] = True
             return
         
+        if "Prefetch distance:" in line:
+            data["prefetch_distance"] = int(get_value(line))
+            return
+
+        if "Query batch:" in line:
+            data["query_batch"] = int(get_value(line))
+            return
+
         if "Not using rgraph initialization" in line:
             data["no_rgraph"] = True
             return
         
+        if "Batch build" in line:
+            data["batch_build"] = True
+            return
+
+        if "Seed:" in line:
+            data["seed"] = int(get_value(line))
+            return
+
         if "Number of edges:" in line:
             data["n_edges"] = int(get_value(line))
             return
@@ -165,7 +181,7 @@ def gather_data(file_name):
     data["unf_max_recall"] = max_unf_recall
     data["unf_avg_recall"] = avg_unf_recall
 
-    if not data['unfiltered']:
+    if not data['unfiltered'] or 'unf_querying_time' not in data:   # no queries (e.g. --no_query)
         data['unf_querying_time'] = timedelta()
     
     # Filtered
@@ -182,7 +198,7 @@ def gather_data(file_name):
     data["f_max_recall"] = max_f_recall
     data["f_avg_recall"] = avg_f_recall
 
-    if not data['filtered']:
+    if not data['filtered'] or 'f_querying_time' not in data:
         data['f_querying_time'] = timedelta()
 
     # Both (Filtered + Unfiltered)
@@ -196,20 +212,20 @@ def gather_data(file_name):
     querying_time = data["f_querying_time"] + data["unf_querying_time"]
     data["querying_time"] = querying_time
 
-    if data['filtered']:
+    if data['filtered'] and data["f_querying_time"]:
         f_QPS = len(data["f_queries_recalls"]) / data["f_querying_time"].total_seconds()
         data["f_QPS"] = f_QPS
         f_avg_query_time = 1/f_QPS if f_QPS else -1
         data["f_avg_query_time"] = f_avg_query_time
     
-    if data['unfiltered']:
+    if data['unfiltered'] and data["unf_querying_time"]:
         unf_QPS = len(data["unf_queries_recalls"]) / data["unf_querying_time"].total_seconds()
         data["unf_QPS"] = unf_QPS
         unf_avg_query_time = 1/unf_QPS if unf_QPS else -1
         data["unf_avg_query_time"] = unf_avg_query_time
 
     
-    QPS = total_queries / querying_time.total_seconds()
+    QPS = total_queries / querying_time.total_seconds() if querying_time.total_seconds() else 0
     data["QPS"] = QPS
 
     avg_query_time = 1/QPS if QPS else -1
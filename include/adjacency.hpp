@@ -0,0 +1,313 @@
+#pragma once
+
+#include "util.hpp"
+
+using namespace std;
+
+// Included by types.hpp right after the definition of Id.
+// This file implements the AdjacencyStore class, the storage engine for the outgoing edges of a DirectedGraph.
+//
+// While an index is being built, the out-neighbors of node i live in the fixed block of width() slots starting at i * width(),
+// plus a degree counter: adding or removing an edge is a scan over at most width() contiguous ids, with no hashing.
+// If a node runs out of slots, the whole store is re-laid out with a larger width. Reserve the expected width (R + 1 for Vamana) before
+// any parallel phase and pin() the store meanwhile: a re-layout of a pinned store throws, instead of freeing the slots concurrent readers use.
+//
+// A frozen index can be compact()-ed into Compressed Sparse Row form (offsets + ids, no unused slots).
+// Searching reads the same contiguous neighbor blocks in both forms. Any modification of a compacted store expands it back into slots.
+// The CSR arrays can also be served in place from external read-only memory (e.g. a memory-mapped index file, see attachCompact()).
+//
+// Threads that modify different nodes at once (see NodeLocks) use replace() and append(): they write the block of one node and leave the
+// edge count alone (the count is shared by all the nodes), so each thread adds up its own changes and commits them with addEdgeCount().
+
+
+// Read-only view over the contiguous out-neighbors of a node
+class NeighborRange{
+
+    private:
+        const Id* _begin;
+        const Id* _end;
+
+    public:
+        NeighborRange(const Id* begin = nullptr, const Id* end = nullptr) : _begin(begin), _end(end) {}
+
+        const Id* begin() const { return this->_begin; }
+        const Id* end() const { return this->_end; }
+        int size() const { return this->_end - this->_begin; }
+        bool empty() const { return this->_begin == this->_end; }
+};
+
+
+class AdjacencyStore{
+
+    private:
+        int _n_nodes;               // number of nodes (rows) in the store
+        int _width;                 // slots per node while expanded (R_max)
+        int _n_edges;               // total number of stored edges
+        vector<Id> _slots;          // expanded form: _n_nodes * _width slots, node i owns [i * _width, i * _width + _degree[i])
+        vector<int> _degree;        // expanded form: out-degree of each node
+        bool _compacted;            // true if the edges currently live in the CSR arrays below
+        vector<Id> _csr_ids;        // compact form: out-neighbors of all nodes back to back
+        vector<int> _csr_offsets;   // compact form: node i owns [_csr_offsets[i], _csr_offsets[i+1])
+        const Id* _ids;             // compact form: _csr_ids.data(), or external memory
+        const int* _offsets;        // compact form: _csr_offsets.data(), or external memory
+        bool _pinned;               // true while several threads share the slots: no re-layout (see pin)
+
+        // Moves every node to a block of width slots
+        void _reshape(int width){
+            if (this->_pinned) { throw invalid_argument("Cannot re-lay out a pinned adjacency store.\n"); }
+
+            vector<Id> slots((size_t) this->_n_nodes * width);
+            for (int i = 0; i < this->_n_nodes; i++)
+                copy_n(this->_slots.begin() + (size_t) i * this->_width, this->_degree[i], slots.begin() + (size_t) i * width);
+
+            this->_slots.swap(slots);
+            this->_width = width;
+        }
+
+        // Expands the compact form back into slot blocks (before any modification)
+        void _expand(){
+            if (!this->_compacted) { return; }
+
+            this->_width = max(this->_width, this->maxDegree());
+            this->_slots.assign((size_t) this->_n_nodes * this->_width, Id());
+            this->_degree.assign(this->_n_nodes, 0);
+
+            for (int i = 0; i < this->_n_nodes; i++){
+                this->_degree[i] = this->_offsets[i+1] - this->_offsets[i];
+                copy_n(this->_ids + this->_offsets[i], this->_degree[i], this->_slots.begin() + (size_t) i * this->_width);
+            }
+
+            vector<Id>().swap(this->_csr_ids);
+            vector<int>().swap(this->_csr_offsets);
+            this->_ids = nullptr;
+            this->_offsets = nullptr;
+            this->_compacted = false;
+        }
+
+        Id* _block(Id id) { return this->_slots.data() + (size_t) id * this->_width; }
+
+    public:
+
+        // Constructor: Initialize an empty store with width slots per node
+        AdjacencyStore(int width = 0) : _n_nodes(0), _width(width), _n_edges(0), _compacted(false), _ids(nullptr), _offsets(nullptr), _pinned(false) {}
+
+        AdjacencyStore(const AdjacencyStore&) = delete;
+        AdjacencyStore& operator=(const AdjacencyStore&) = delete;
+
+        int size() const { return this->_n_nodes; }
+        int width() const { return this->_width; }
+        int n_edges() const { return this->_n_edges; }
+        bool compacted() const { return this->_compacted; }
+
+        // Pins the slots while several threads read and write them (a node that runs out of slots then throws), or unpins them
+        void pin(bool pinned) { this->_pinned = pinned; }
+
+        // Total number of bytes held by the edge arrays
+        size_t bytes() const {
+            return this->_slots.capacity() * sizeof(Id) + this->_degree.capacity() * sizeof(int)
+                 + this->_csr_ids.capacity() * sizeof(Id) + this->_csr_offsets.capacity() * sizeof(int);
+        }
+
+        // Returns the out-degree of a node
+        int degree(Id id) const {
+            return (this->_compacted) ? this->_offsets[id+1] - this->_offsets[id] : this->_degree[id];
+        }
+
+        // Returns the largest out-degree in the store
+        int maxDegree() const {
+            int max_degree = 0;
+            for (int i = 0; i < this->_n_nodes; i++) max_degree = max(max_degree, this->degree(i));
+            return max_degree;
+        }
+
+        // Returns the out-neighbors of a node as a contiguous range
+        NeighborRange neighbors(Id id) const {
+            if (this->_compacted){
+                return NeighborRange(this->_ids + this->_offsets[id], this->_ids + this->_offsets[id+1]);
+            }
+            const Id* block = this->_slots.data() + (size_t) id * this->_width;
+            return NeighborRange(block, block + this->_degree[id]);
+        }
+
+        // Prefetches the out-neighbors of a node (e.g. of a candidate a search is about to expand)
+        void prefetch(Id id) const {
+            NeighborRange nb = this->neighbors(id);
+            prefetchRow(nb.begin(), nb.size() * sizeof(Id));
+        }
+
+        // Checks whether the edge (from->to) exists
+        bool contains(Id from, Id to) const {
+            NeighborRange nb = this->neighbors(from);
+            return find(nb.begin(), nb.end(), to) != nb.end();
+        }
+
+        // Sets the number of nodes. New nodes have no out-neighbors.
+        void resize(int n_nodes){
+            if (n_nodes < this->_n_nodes) { throw invalid_argument("Cannot shrink the adjacency store.\n"); }
+            this->_expand();
+            this->_slots.resize((size_t) n_nodes * this->_width);
+            this->_degree.resize(n_nodes, 0);
+            this->_n_nodes = n_nodes;
+        }
+
+        // Adds a node with no out-neighbors
+        void addNode() { this->resize(this->_n_nodes + 1); }
+
+        // Makes room for n_nodes nodes of width slots each, so that no re-layout happens while they are filled.
+        void reserve(int n_nodes, int width){
+            this->_expand();
+            if (width > this->_width) this->_reshape(width);
+            this->_slots.reserve((size_t) n_nodes * this->_width);
+            this->_degree.reserve(n_nodes);
+        }
+
+        // Adds the edge (from->to). Returns false if it already exists.
+        bool insert(Id from, Id to){
+            this->_expand();
+
+            if (this->contains(from, to)) { return false; }
+
+            if (this->_degree[from] == this->_width)
+                this->_reshape(max(4, 2 * this->_width));   // out of slots: amortized re-layout
+
+            this->_block(from)[this->_degree[from]++] = to;
+            this->_n_edges++;
+            return true;
+        }
+
+        // Removes the edge (from->to). Returns false if it does not exist.
+        bool erase(Id from, Id to){
+            this->_expand();
+
+            Id* block = this->_block(from);
+            Id* last = block + this->_degree[from];
+            Id* it = find(block, last, to);
+            if (it == last) { return false; }
+
+            *it = *(last - 1);     // order of neighbors is irrelevant: fill the gap with the last one
+            this->_degree[from]--;
+            this->_n_edges--;
+            return true;
+        }
+
+        // Replaces the out-neighbors of an expanded node with the n ids (at most width()). Returns the change of its degree, not counted in n_edges().
+        int replace(Id id, const Id* ids, int n){
+            if (this->_compacted || n > this->_width) { throw invalid_argument("Cannot replace the neighbors of a compacted store or beyond its width.\n"); }
+
+            int change = n - this->_degree[id];
+            copy_n(ids, n, this->_block(id));
+            this->_degree[id] = n;
+            return change;
+        }
+
+        // Adds the edge (from->to) to an expanded node with a free slot. Returns false if it already exists (or there is no free slot).
+        // Not counted in n_edges().
+        bool append(Id from, Id to){
+            if (this->_compacted) { throw invalid_argument("Cannot append to a compacted store.\n"); }
+
+            if (this->_degree[from] == this->_width || this->contains(from, to)) { return false; }
+            this->_block(from)[this->_degree[from]++] = to;
+            return true;
+        }
+
+        // Adds the changes of the degrees made by replace() and append() to the edge count
+        void addEdgeCount(int change) { this->_n_edges += change; }
+
+        // Removes all out-neighbors of a node. Returns how many edges were removed.
+        int clear(Id id){
+            this->_expand();
+
+            int removed = this->_degree[id];
+            this->_degree[id] = 0;
+            this->_n_edges -= removed;
+            return removed;
+        }
+
+        // Removes all edges, keeping the nodes and the width
+        void clearAll(){
+            this->_expand();
+            fill(this->_degree.begin(), this->_degree.end(), 0);
+            this->_n_edges = 0;
+        }
+
+        // Removes all nodes and edges
+        void reset(){
+            this->_n_nodes = 0;
+            this->_n_edges = 0;
+            this->_compacted = false;
+            this->_ids = nullptr;
+            this->_offsets = nullptr;
+            vector<Id>().swap(this->_slots);
+            vector<int>().swap(this->_degree);
+            vector<Id>().swap(this->_csr_ids);
+            vector<int>().swap(this->_csr_offsets);
+        }
+
+        // CSR arrays of a compacted store (size() + 1 offsets, n_edges() ids)
+        const int* csrOffsets() const { return this->_offsets; }
+        const Id* csrIds() const { return this->_ids; }
+
+        // Copies the edges into CSR arrays, whatever the current form of the store
+        void copyCompact(vector<int>& offsets, vector<Id>& ids) const {
+            offsets.resize(this->_n_nodes + 1);
+            ids.resize(this->_n_edges);
+
+            int offset = 0;
+            for (int i = 0; i < this->_n_nodes; i++){
+                offsets[i] = offset;
+                NeighborRange nb = this->neighbors(i);
+                copy(nb.begin(), nb.end(), ids.begin() + offset);
+                offset += nb.size();
+            }
+            offsets[this->_n_nodes] = offset;
+        }
+
+        // Replaces the contents of the store with the given CSR arrays (e.g. read from an index file). The store is left compacted.
+        void assignCompact(vector<int>&& offsets, vector<Id>&& ids){
+            if (offsets.empty() || offsets.back() != (int) ids.size()) { throw invalid_argument("Invalid CSR arrays.\n"); }
+
+            this->reset();
+            this->_n_nodes = offsets.size() - 1;
+            this->_n_edges = ids.size();
+            this->_csr_offsets = move(offsets);
+            this->_csr_ids = move(ids);
+            this->_offsets = this->_csr_offsets.data();
+            this->_ids = this->_csr_ids.data();
+            this->_compacted = true;
+        }
+
+        // Serves the given CSR arrays in place from external read-only memory (not copied, not owned). The store is left compacted.
+        // The memory must outlive the store (or the next modification, which copies the edges back into owned slots).
+        void attachCompact(const int* offsets, const Id* ids, int n_nodes, int n_edges){
+            if (offsets[n_nodes] != n_edges) { throw invalid_argument("Invalid CSR arrays.\n"); }
+
+            this->reset();
+            this->_n_nodes = n_nodes;
+            this->_n_edges = n_edges;
+            this->_offsets = offsets;
+            this->_ids = ids;
+            this->_compacted = true;
+        }
+
+        // Converts the store into its compact CSR form, releasing the unused slots
+        void compact(){
+            if (this->_compacted) { return; }
+
+            this->_csr_offsets.resize(this->_n_nodes + 1);
+            this->_csr_ids.resize(this->_n_edges);
+
+            int offset = 0;
+            for (int i = 0; i < this->_n_nodes; i++){
+                this->_csr_offsets[i] = offset;
+                copy_n(this->_slots.begin() + (size_t) i * this->_width, this->_degree[i], this->_csr_ids.begin() + offset);
+                offset += this->_degree[i];
+            }
+            this->_csr_offsets[this->_n_nodes] = offset;
+            this->_offsets = this->_csr_offsets.data();
+            this->_ids = this->_csr_ids.data();
+
+            vector<Id>().swap(this->_slots);
+            vector<int>().swap(this->_degree);
+            this->_compacted = true;
+        }
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -46,6 +47,69 @@ enum SortOrder {
     DESCENDING
 };
 
+// Distance metric of an index (stored in the binary index header, see index_io.hpp)
+enum Metric {
+    METRIC_L2,          // squared euclidean distance
+    METRIC_IP,          // inner product, searched directly (negative inner product as distance)
+    METRIC_COSINE,      // cosine similarity: values are normalized to unit length when inserted, queries when searched
+    METRIC_MIPS         // inner product through the MIPS-to-L2 transform: an extra coordinate gives every value the same norm, then L2
+};
+
+inline string metricName(Metric metric){
+    switch (metric){
+        case METRIC_IP: return "ip";
+        case METRIC_COSINE: return "cosine";
+        case METRIC_MIPS: return "mips";
+        default: return "l2";
+    }
+}
+
+// Scalar quantization of the values for the compressed greedy search (see sq.hpp and DirectedGraph::trainSQ)
+enum ScalarQuantization {
+    SQ_NONE,
+    SQ_INT8,            // 1 byte per element, scale and offset per dimension
+    SQ_INT8_VECTOR,     // 1 byte per element, scale per vector (integer dot products)
+    SQ_FP16             // 2 bytes per element, IEEE half precision
+};
+
+inline string sqName(ScalarQuantization type){
+    switch (type){
+        case SQ_INT8: return "int8";
+        case SQ_INT8_VECTOR: return "int8v";
+        case SQ_FP16: return "fp16";
+        default: return "none";
+    }
+}
+
+// Element type of the values of a graph (stored in the binary index header, see index_io.hpp)
+enum ElementType {
+    ELEMENT_FLOAT,      // 32-bit floating point (.fvecs, .fbin, contest .bin)
+    ELEMENT_UINT8,      // unsigned bytes (.bvecs, .u8bin, e.g. BIGANN)
+    ELEMENT_INT8        // signed bytes (.i8bin, e.g. SPACEV)
+};
+
+inline string elementName(ElementType type){
+    switch (type){
+        case ELEMENT_UINT8: return "uint8";
+        case ELEMENT_INT8: return "int8";
+        default: return "float";
+    }
+}
+
+// Element type of values of type E (other types are recorded as float: their element size tells them apart)
+template <typename E>
+constexpr ElementType elementTypeOf(){
+    return is_same<E, uint8_t>::value ? ELEMENT_UINT8 : is_same<E, int8_t>::value ? ELEMENT_INT8 : ELEMENT_FLOAT;
+}
+
+// Element type of a dataset file, from its extension: .bvecs and .u8bin hold uint8 values, .i8bin int8 values, any other file floats
+inline ElementType elementTypeOfFile(const string& path){
+    auto hasSuffix = [&](const string& suffix) { return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0; };
+    if (hasSuffix(".bvecs") || hasSuffix(".u8bin")) return ELEMENT_UINT8;
+    if (hasSuffix(".i8bin")) return ELEMENT_INT8;
+    return ELEMENT_FLOAT;
+}
+
 // Struct containing all possible arguments from the CLI.
 // call Args::parseArgs with argc and argv to initialize the struct
 struct Args{
@@ -73,15 +137,31 @@ struct Args{
     string queries_path = "";
     string groundtruth_path = "";
     bool no_create = false;           // flag whether to create new vamana index using the vamana algorithm
+    bool mmapIndex = false;           // memory-map the index given with -load and use it in place (read-only) instead of copying it
     bool no_query = false;
     bool dummy = false;
 
     // arguments regarding optimization
-    int euclideanType = 1;      // 0 - normal euclidean, 1 - simd euclidean, 2 - parallel euclidean, 3 - custom distance function
+    int euclideanType = 1;      // 0 - normal euclidean, 1 - simd euclidean (widest of AVX-512 / AVX2 / scalar kernels, picked from CPUID), 2 - parallel euclidean, 3 - custom distance function
+    ElementType elementType = ELEMENT_FLOAT;    // -type float | uint8 | int8, otherwise from the extension of the data file (see elementTypeOfFile)
+    bool elementTypeGiven = false;
+    Metric metric = METRIC_L2;  // -distance l2 | ip | cosine | mips (SIMD kernels). 0 and 1 also work with the other metrics, 2 and 3 are euclidean only.
     bool randomStart = false;   // false = medoid, true = random sample
-    bool usePQueue = false;     // false = Lc is set O(1) insertion, & use closestN O(N), true = Lc is a Pqueue, closest N is optimized but insertion is O(logL)
     bool useRGraph = true;      // true = Use Rgraph in Vamana, false = skip Random Initialization.
+    bool batchBuild = false;    // true = the Vamana build inserts batches of doubling size, searched in parallel on the graph of the previous batches (see DirectedGraph::_batch_Vamana)
+    int seed = -1;              // seed of the permutation of the batch build: the same seed gives the same graph on any number of threads (-1 = a random seed)
     int extraRandomEdges = 0;     // <=0 = don't add extra random edges <after index creation>, >0 = add them (after index creation because index creation assumes unique subgraphs)
+    ScalarQuantization sq = SQ_NONE;    // != SQ_NONE = also evaluate the queries with the SQ greedy search on scalar-quantized values (see DirectedGraph::trainSQ)
+    bool sqRerank = false;      // re-rank the final candidates of the SQ greedy search with the full precision distance
+    int sketchBits = 0;         // >0 = binary sketches of sketchBits bits prefilter the exact distances of the greedy searches and robustPrune (see DirectedGraph::enableSketch)
+    int sketchMargin = -1;      // bits by which a sketch distance must exceed the reference one to skip an exact distance (default: sketchBits / 16)
+    int pcaLeading = 0;         // >0 = the values are rotated onto their principal components at ingest, and distances are computed in two tiers on the first pcaLeading coordinates (see DirectedGraph::applyPCA)
+    int fastScanSubspaces = 0;  // >0 = also evaluate the queries with the fast-scan blocks of 4-bit codes of fastScanSubspaces subspaces (see DirectedGraph::buildFastScan)
+    float fastScanMargin = 0.05f;   // relative slack of the fast-scan estimates over the distance of the worst candidate
+    int queryBatch = 1;         // >1 = every query thread searches queryBatch queries at once, one hop of each in turn, in chunks of at most BATCH_MAX_QUERIES (see DirectedGraph::searchBatch)
+    int prefetchDistance = 2;   // the greedy searches prefetch the out-neighbors of the next prefetchDistance candidates, the nodes prefetchDistance neighbors ahead and the rows to score (0 = no prefetching)
+    bool earlyAbandon = false;  // true = the greedy searches and the prunes abandon the distances that exceed their bound (see DirectedGraph::distanceBounded)
+    int pqSubspaces = 0;        // >0 = also evaluate the queries with the PQ greedy search, on codes of pqSubspaces bytes per vector (see DirectedGraph::trainPQ)
     bool accumulateUnfiltered = false;  // uses accumulation and aggregation of |C| filtered queries for the final result (as if unfiltered = all filters)
     string greedySearchIndexStatsPath = "";
     string greedySearchQueryStatsPath = "";
@@ -115,6 +195,7 @@ struct Args{
 
             else if (currentArg == "-store")            { this->graph_store_path = argv[++i]; }
             else if (currentArg == "-load")             { this->graph_load_path = argv[++i]; this->no_create = true; }
+            else if (currentArg == "--mmap")            { this->mmapIndex = true; }
 
             else if (currentArg == "-data")             { this->data_path = argv[++i]; } 
             else if (currentArg == "-queries")          { this->queries_path = argv[++i]; }
@@ -132,11 +213,24 @@ struct Args{
             // optimizations
             else if (currentArg == "-n_threads")        { this->n_threads = atoi(argv[++i]); }
             else if (currentArg == "--random_start")    { this->randomStart = true; }
-            else if (currentArg == "-distance")         { this->euclideanType = atoi(argv[++i]); }
-            else if (currentArg == "--pqueue")          { this->usePQueue = true; }
+            else if (currentArg == "-distance")         { this->parseDistance(argv[++i]); }
+            else if (currentArg == "-type")             { this->parseElementType(argv[++i]); }
             else if (currentArg == "--no_rgraph")       { this->useRGraph = false; }
+            else if (currentArg == "--batch_build")     { this->batchBuild = true; }
+            else if (currentArg == "-seed")             { this->seed = atoi(argv[++i]); }
             else if (currentArg == "-extra_edges")      { this->extraRandomEdges = atoi(argv[++i]); }
             else if (currentArg == "--acc_unfiltered")  { this->accumulateUnfiltered = true; }
+            else if (currentArg == "-pq")               { this->pqSubspaces = atoi(argv[++i]); }
+            else if (currentArg == "-sq")               { this->parseSQ(argv[++i]); }
+            else if (currentArg == "--sq_rerank")       { this->sqRerank = true; }
+            else if (currentArg == "-sketch")           { this->sketchBits = atoi(argv[++i]); }
+            else if (currentArg == "-sketch_margin")    { this->sketchMargin = atoi(argv[++i]); }
+            else if (currentArg == "--early_abandon")   { this->earlyAbandon = true; }
+            else if (currentArg == "-prefetch")         { this->prefetchDistance = atoi(argv[++i]); }
+            else if (currentArg == "-query_batch")      { this->queryBatch = atoi(argv[++i]); }
+            else if (currentArg == "-pca")              { this->pcaLeading = atoi(argv[++i]); }
+            else if (currentArg == "-fastscan")         { this->fastScanSubspaces = atoi(argv[++i]); }
+            else if (currentArg == "-fastscan_margin")  { this->fastScanMargin = atof(argv[++i]); }
 
             // evaluation
             else if (currentArg == "-collect_data_index")   { this->greedySearchIndexStatsPath = argv[++i]; }
@@ -154,11 +248,19 @@ struct Args{
         if (this->n_threads == -1)  this->n_threads = 1;
         if (this->threshold == -1)  this->threshold = (this->index_type == VAMANA) ? 0.1 : 0.5f;
         if (this->Rsmall == -1)     this->Rsmall = 14;
+        if (this->sketchMargin == -1)   this->sketchMargin = this->sketchBits / 16;
+        if (this->prefetchDistance < 0) { throw invalid_argument("The prefetch distance must be >= 0.\n"); }
+        if (this->queryBatch < 1) { throw invalid_argument("The query batch must be >= 1.\n"); }
+        if (this->seed < -1) { throw invalid_argument("The seed must be >= 0 (or -1 for a random seed).\n"); }
 
         if (this->graph_load_path == "" && this->no_create) {
             throw invalid_argument("Please specify a load path when using --no_create using -load your/path/here");
         }
 
+        if (this->graph_load_path == "" && this->mmapIndex) {
+            throw invalid_argument("Please specify a load path when using --mmap using -load your/path/here");
+        }
+
         if (this->dummy){
             this->n_data = 10000;
             this->n_queries = 10000;
@@ -192,18 +294,9 @@ struct Args{
             if (this->queries_path == "") this->queries_path = "data/siftsmall/siftsmall_query.fvecs";
             if (this->groundtruth_path == "") this->groundtruth_path = "data/siftsmall/siftsmall_groundtruth.ivecs";
 
-            if (this->greedySearchIndexStatsPath == "") {
-                if (this->usePQueue)
-                    this->greedySearchIndexStatsPath =  "./evaluations/PQ_VAMANA_greedySearchIndexStats.csv";
-                else
-                    this->greedySearchIndexStatsPath =  "./evaluations/SET_VAMANA_greedySearchIndexStats.csv";
-            }
-            if (this->greedySearchQueryStatsPath == "") {
-                if(this->usePQueue)
-                    this->greedySearchQueryStatsPath =  "./evaluations/PQ_VAMANA_greedySearchQueryStats.csv";
-                else
-                    this->greedySearchQueryStatsPath = "./evaluations/SET_VAMANA_greedySearchQueryStats.csv";
-            }
+            // greedy search statistics (the PQ_ names of the former priority queue searches, now the only ones: see evaluations/PQAnalysis)
+            if (this->greedySearchIndexStatsPath == "") this->greedySearchIndexStatsPath = "./evaluations/PQ_VAMANA_greedySearchIndexStats.csv";
+            if (this->greedySearchQueryStatsPath == "") this->greedySearchQueryStatsPath = "./evaluations/PQ_VAMANA_greedySearchQueryStats.csv";
         }
         else if (this->index_type == FILTERED_VAMANA || this->index_type == STITCHED_VAMANA){
 
@@ -219,36 +312,56 @@ struct Args{
             // Stitched
             if (this->index_type == STITCHED_VAMANA){
                 this->R = 14;  // R = Rstitched
-                if (this->greedySearchIndexStatsPath == "") {
-                if (this->usePQueue)
-                    this->greedySearchIndexStatsPath =  "./evaluations/PQ_STITCHED_greedySearchIndexStats.csv";
-                else
-                    this->greedySearchIndexStatsPath =  "./evaluations/SET_STITCHED_greedySearchIndexStats.csv";
-                }
-            if (this->greedySearchQueryStatsPath == "") {
-                if(this->usePQueue)
-                    this->greedySearchQueryStatsPath =  "./evaluations/PQ_STITCHED_greedySearchQueryStats.csv";
-                else
-                    this->greedySearchQueryStatsPath = "./evaluations/SET_STITCHED_greedySearchQueryStats.csv";
-                }
+                if (this->greedySearchIndexStatsPath == "") this->greedySearchIndexStatsPath = "./evaluations/PQ_STITCHED_greedySearchIndexStats.csv";
+                if (this->greedySearchQueryStatsPath == "") this->greedySearchQueryStatsPath = "./evaluations/PQ_STITCHED_greedySearchQueryStats.csv";
             }
             // Filtered
             else{
-                if (this->greedySearchIndexStatsPath == "") {
-                if (this->usePQueue)
-                    this->greedySearchIndexStatsPath =  "./evaluations/PQ_FILTERED_greedySearchIndexStats.csv";
-                else
-                    this->greedySearchIndexStatsPath =  "./evaluations/SET_FILTERED_greedySearchIndexStats.csv";
+                if (this->greedySearchIndexStatsPath == "") this->greedySearchIndexStatsPath = "./evaluations/PQ_FILTERED_greedySearchIndexStats.csv";
+                if (this->greedySearchQueryStatsPath == "") this->greedySearchQueryStatsPath = "./evaluations/PQ_FILTERED_greedySearchQueryStats.csv";
+            }
+        }
+        else throw invalid_argument("You must specify the Index Type. Valid options: [--vamana, --filtered, --stitched]\n");
+
+        if (!this->elementTypeGiven) this->elementType = elementTypeOfFile(this->data_path);
+    }
+
+    // -distance accepts a metric name (SIMD kernels) or the number (0-3) of a euclidean distance implementation
+    void parseDistance(const string& value){
+        for (Metric metric : {METRIC_L2, METRIC_IP, METRIC_COSINE, METRIC_MIPS}){
+            if (value == metricName(metric)){
+                this->metric = metric;
+                return;
             }
-            if (this->greedySearchQueryStatsPath == "") {
-                if(this->usePQueue)
-                    this->greedySearchQueryStatsPath =  "./evaluations/PQ_FILTERED_greedySearchQueryStats.csv";
-                else
-                    this->greedySearchQueryStatsPath = "./evaluations/SET_FILTERED_greedySearchQueryStats.csv";
+        }
+        if (value.size() == 1 && value[0] >= '0' && value[0] <= '3'){
+            this->euclideanType = value[0] - '0';
+            return;
+        }
+        throw invalid_argument("-distance must be one of: l2, ip, cosine, mips, 0, 1, 2, 3\n");
+    }
+
+    // -type accepts float, uint8 or int8
+    void parseElementType(const string& value){
+        for (ElementType type : {ELEMENT_FLOAT, ELEMENT_UINT8, ELEMENT_INT8}){
+            if (value == elementName(type)){
+                this->elementType = type;
+                this->elementTypeGiven = true;
+                return;
             }
+        }
+        throw invalid_argument("-type must be one of: float, uint8, int8\n");
+    }
+
+    // -sq accepts int8 (scale and offset per dimension), int8v (scale per vector) or fp16
+    void parseSQ(const string& value){
+        for (ScalarQuantization type : {SQ_INT8, SQ_INT8_VECTOR, SQ_FP16}){
+            if (value == sqName(type)){
+                this->sq = type;
+                return;
             }
         }
-        else throw invalid_argument("You must specify the Index Type. Valid options: [--vamana, --filtered, --stitched]\n");
+        throw invalid_argument("-sq must be one of: int8, int8v, fp16\n");
     }
 
     // Print argument values for each indexing type
@@ -263,6 +376,8 @@ struct Args{
         cout << "L: " << this->L << endl;
         cout << "R: " << this->R << endl;
         cout << "a: " << this->a << endl;
+        if (this->metric != METRIC_L2) cout << "Metric: " << metricName(this->metric) << endl;
+        if (this->elementType != ELEMENT_FLOAT) cout << "Element type: " << elementName(this->elementType) << endl;
 
         if(this->index_type == FILTERED_VAMANA) cout << "threshold: " << this->threshold << endl;
 
@@ -272,8 +387,18 @@ struct Args{
         if (this->unfiltered) cout << "Unfiltered" << endl;
         if (this->filtered) cout << "Filtered" << endl;
         if (this->accumulateUnfiltered) cout << "Accumulate unfiltered" << endl;
-        if (this->usePQueue) cout << "Using priority queue" << endl;
         if (!this->useRGraph) cout << "Not using rgraph initialization" << endl;
+        if (this->batchBuild) cout << "Batch build" << endl;
+        if (this->seed >= 0) cout << "Seed: " << this->seed << endl;
+        if (this->mmapIndex) cout << "Memory-mapped index" << endl;
+        if (this->sketchBits > 0) cout << "Sketch prefilter: " << this->sketchBits << " bits, margin of " << this->sketchMargin << " bits" << endl;
+        if (this->pcaLeading > 0) cout << "PCA rotation: " << this->pcaLeading << " leading components" << endl;
+        if (this->earlyAbandon) cout << "Early-abandoning distances" << endl;
+        cout << "Prefetch distance: " << this->prefetchDistance << endl;
+        if (this->queryBatch > 1) cout << "Query batch: " << this->queryBatch << endl;
+        if (this->pqSubspaces > 0) cout << "PQ subspaces: " << this->pqSubspaces << endl;
+        if (this->fastScanSubspaces > 0) cout << "Fast-scan blocks: " << this->fastScanSubspaces << " subspaces, margin of " << this->fastScanMargin << endl;
+        if (this->sq != SQ_NONE) cout << "Scalar quantization: " << sqName(this->sq) << ((this->sqRerank) ? " (re-ranked)" : "") << endl;
 
     }
 };
@@ -0,0 +1,1128 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <immintrin.h>  // compiler intrinsics for SIMD optimization
+
+using namespace std;
+
+// This file implements the SIMD kernels for the squared euclidean distance and the inner product between float vectors.
+//
+// Every kernel exists in three families, picked once at startup from the CPUID flags of the host (see detectSimdLevel):
+//   SIMD_AVX512    16 floats per instruction (512-bit registers, masked tail)
+//   SIMD_AVX2      8 floats per instruction (256-bit registers + fused multiply-add, masked tail)
+//   SIMD_SCALAR    plain loop, for hosts without AVX2/FMA
+// The AVX2 and AVX-512 kernels are compiled for their instruction set with target attributes, whatever the flags of the rest of the build.
+//
+// There are two kinds of kernels:
+//   row kernels      both rows are VECTOR_ALIGNMENT-byte aligned and zero-padded up to a multiple of 16 floats (VectorStore rows, AlignedRow buffers).
+//                    They use aligned loads and process the padding instead of a tail: (0 - 0)^2 adds nothing to the sum.
+//   vector kernels   arbitrary pointers and dimensions (e.g. the data of two std::vector). Unaligned loads, the tail is processed with a masked load.
+// The common dimensions (96, 100, 128 and 960) get compile-time specializations with fully unrolled loops.
+//
+// Batch row kernels compute the distances from one query row to a list of rows (e.g. all out-neighbors of a node) in a single call:
+// the query is loaded into registers once for the whole batch, and the next row is prefetched while the current one is processed.
+//
+// The inner product kernels (row and batch kernels only) serve the inner product and cosine metrics (see Metric in config.hpp).
+//
+// The 8-bit row kernels (uint8 and int8 rows, e.g. BIGANN and SPACEV) compute the squared euclidean distance exactly in integers:
+// 32 elements per step are widened to int16, and _mm256_madd_epi16 squares and pairwise adds the differences into int32 lanes.
+// Their rows are zero-padded to a multiple of 64 elements (one cache line), so the steps never need a tail.
+// AVX-512 hosts use the AVX2 kernels, since the AVX-512 family only requires AVX-512F (no byte and word instructions).
+//
+// The many-to-many row kernels compute the distances of every pair of two lists of rows (e.g. all pairs of the medoid sample, the base rows
+// of an exact k-NN scan) as a matrix product: the inner products go through register blocks of 3 x 4 rows (4 x 4 with AVX-512), so every
+// element loaded into a register serves 3 or 4 fused multiply-adds instead of one, and the squared euclidean distances are recovered from
+// precomputed squared norms as ||x||^2 + ||y||^2 - 2 <x, y>. Callers go through tiles of DISTANCE_TILE_QUERIES x distanceTileRows(dim)
+// rows, so that the second side of a tile is read from the L2 cache by all the blocks of the first side.
+//
+// The bounded row kernels (L2 only) abandon a distance as soon as its partial sum exceeds a bound, e.g. the distance of the worst candidate
+// of a search: the partial sum is reduced every DISTANCE_BOUND_BLOCK elements, and once it exceeds the bound the rest of the row is not read.
+//
+// At the end of the file, the distance policies that parameterize DirectedGraph (see types.hpp).
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// Distance kernel on two float arrays of dimension dim
+using DistanceKernel = float (*)(const float*, const float*, int);
+
+// Returns the widest kernel family supported by the host CPU
+inline SimdLevel detectSimdLevel(){
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+    return SIMD_SCALAR;
+}
+
+inline string simdLevelName(SimdLevel level){
+    switch (level){
+        case SIMD_AVX512: return "AVX-512";
+        case SIMD_AVX2: return "AVX2+FMA";
+        default: return "scalar";
+    }
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Scalar
+
+inline float l2Scalar(const float* t1, const float* t2, int dim){
+    float sum = 0.0f;
+    for (int i = 0; i < dim; i++){
+        float diff = t1[i] - t2[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- AVX2 + FMA
+
+__attribute__((target("avx2,fma")))
+inline float _hsum256(__m256 v){
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));   // 8 -> 4
+    sum = _mm_hadd_ps(sum, sum);                                                       // 4 -> 2
+    sum = _mm_hadd_ps(sum, sum);                                                       // 2 -> 1
+    return _mm_cvtss_f32(sum);
+}
+
+// Vector kernel. DIM > 0 fixes the dimension at compile time (the dim argument is then ignored).
+template <int DIM>
+__attribute__((target("avx2,fma")))
+float l2Avx2(const float* t1, const float* t2, int dim){
+
+    if (DIM > 0) dim = DIM;
+
+    __m256 sum0 = _mm256_setzero_ps();  // two accumulators to hide the latency of the fused multiply-add
+    __m256 sum1 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 16 <= dim; i += 16){
+        __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(t1 + i), _mm256_loadu_ps(t2 + i));
+        __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(t1 + i + 8), _mm256_loadu_ps(t2 + i + 8));
+        sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);     // sum = diff*diff + sum
+        sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+    }
+    if (i + 8 <= dim){
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(t1 + i), _mm256_loadu_ps(t2 + i));
+        sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+        i += 8;
+    }
+    if (i < dim){
+        // tail: load only the remaining dim - i < 8 values, the masked lanes read as zero
+        __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(dim - i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 diff = _mm256_sub_ps(_mm256_maskload_ps(t1 + i, mask), _mm256_maskload_ps(t2 + i, mask));
+        sum1 = _mm256_fmadd_ps(diff, diff, sum1);
+    }
+
+    return _hsum256(_mm256_add_ps(sum0, sum1));
+}
+
+// Row kernel. PADDED_DIM > 0 fixes the padded dimension at compile time (the dim argument is then ignored).
+template <int PADDED_DIM>
+__attribute__((target("avx2,fma")))
+float l2RowAvx2(const float* t1, const float* t2, int dim){
+
+    int padded = (PADDED_DIM > 0) ? PADDED_DIM : (dim + 7) & ~7;   // the padding up to 16 floats is zero as well, 8 is enough
+
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 16 <= padded; i += 16){
+        __m256 diff0 = _mm256_sub_ps(_mm256_load_ps(t1 + i), _mm256_load_ps(t2 + i));
+        __m256 diff1 = _mm256_sub_ps(_mm256_load_ps(t1 + i + 8), _mm256_load_ps(t2 + i + 8));
+        sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+    }
+    if (i < padded){
+        __m256 diff = _mm256_sub_ps(_mm256_load_ps(t1 + i), _mm256_load_ps(t2 + i));
+        sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+    }
+
+    return _hsum256(_mm256_add_ps(sum0, sum1));
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- AVX-512
+
+// Vector kernel. DIM > 0 fixes the dimension at compile time (the dim argument is then ignored).
+template <int DIM>
+__attribute__((target("avx512f")))
+float l2Avx512(const float* t1, const float* t2, int dim){
+
+    if (DIM > 0) dim = DIM;
+
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+
+    int i = 0;
+    for (; i + 32 <= dim; i += 32){
+        __m512 diff0 = _mm512_sub_ps(_mm512_loadu_ps(t1 + i), _mm512_loadu_ps(t2 + i));
+        __m512 diff1 = _mm512_sub_ps(_mm512_loadu_ps(t1 + i + 16), _mm512_loadu_ps(t2 + i + 16));
+        sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+    }
+    if (i + 16 <= dim){
+        __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(t1 + i), _mm512_loadu_ps(t2 + i));
+        sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+        i += 16;
+    }
+    if (i < dim){
+        // tail: load only the remaining dim - i < 16 values, the masked lanes read as zero
+        __mmask16 mask = (__mmask16) ((1u << (dim - i)) - 1);
+        __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, t1 + i), _mm512_maskz_loadu_ps(mask, t2 + i));
+        sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+    }
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+// Row kernel. PADDED_DIM > 0 fixes the padded dimension at compile time (the dim argument is then ignored).
+template <int PADDED_DIM>
+__attribute__((target("avx512f")))
+float l2RowAvx512(const float* t1, const float* t2, int dim){
+
+    int padded = (PADDED_DIM > 0) ? PADDED_DIM : (dim + 15) & ~15;
+
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+
+    int i = 0;
+    for (; i + 32 <= padded; i += 32){
+        __m512 diff0 = _mm512_sub_ps(_mm512_load_ps(t1 + i), _mm512_load_ps(t2 + i));
+        __m512 diff1 = _mm512_sub_ps(_mm512_load_ps(t1 + i + 16), _mm512_load_ps(t2 + i + 16));
+        sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+    }
+    if (i < padded){
+        __m512 diff = _mm512_sub_ps(_mm512_load_ps(t1 + i), _mm512_load_ps(t2 + i));
+        sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+    }
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Batch row kernels
+
+constexpr int DISTANCE_BATCH_SIZE = 64;     // rows per batch call of DirectedGraph::distanceBatch
+
+// Prefetches (the first 8 cache lines of) a row into all cache levels
+inline void prefetchRow(const void* row, size_t bytes){
+    const char* ptr = (const char*) row;
+    for (size_t offset = 0; offset < bytes && offset < 8 * 64; offset += 64)
+        _mm_prefetch(ptr + offset, _MM_HINT_T0);
+}
+
+// out[i] = distance of rows[i] to xq. PADDED_DIM / 8 ymm registers hold the query for the whole batch (PADDED_DIM <= 64).
+template <int PADDED_DIM>
+__attribute__((target("avx2,fma")))
+void l2RowBatchAvx2(const float* xq, const float* const* rows, int n, float* out){
+
+    constexpr int N_REGS = PADDED_DIM / 8;
+    __m256 q[N_REGS];
+    for (int j = 0; j < N_REGS; j++) q[j] = _mm256_load_ps(xq + 8 * j);
+
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], PADDED_DIM * sizeof(float));
+
+        __m256 sum = _mm256_setzero_ps();
+        for (int j = 0; j < N_REGS; j++){
+            __m256 diff = _mm256_sub_ps(_mm256_load_ps(rows[i] + 8 * j), q[j]);
+            sum = _mm256_fmadd_ps(diff, diff, sum);
+        }
+        out[i] = _hsum256(sum);
+    }
+}
+
+// out[i] = distance of rows[i] to xq. PADDED_DIM / 16 zmm registers hold the query for the whole batch (PADDED_DIM <= 128).
+template <int PADDED_DIM>
+__attribute__((target("avx512f")))
+void l2RowBatchAvx512(const float* xq, const float* const* rows, int n, float* out){
+
+    constexpr int N_REGS = PADDED_DIM / 16;
+    __m512 q[N_REGS];
+    for (int j = 0; j < N_REGS; j++) q[j] = _mm512_load_ps(xq + 16 * j);
+
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], PADDED_DIM * sizeof(float));
+
+        __m512 sum = _mm512_setzero_ps();
+        for (int j = 0; j < N_REGS; j++){
+            __m512 diff = _mm512_sub_ps(_mm512_load_ps(rows[i] + 16 * j), q[j]);
+            sum = _mm512_fmadd_ps(diff, diff, sum);
+        }
+        out[i] = _mm512_reduce_add_ps(sum);
+    }
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Dispatch
+
+// Vector kernels of every family, with the compile-time specializations for the common dimensions
+template <SimdLevel LEVEL>
+float l2Dispatch(const float* t1, const float* t2, int dim){
+    if (LEVEL == SIMD_AVX512){
+        switch (dim){
+            case 96: return l2Avx512<96>(t1, t2, dim);
+            case 100: return l2Avx512<100>(t1, t2, dim);
+            case 128: return l2Avx512<128>(t1, t2, dim);
+            case 960: return l2Avx512<960>(t1, t2, dim);
+            default: return l2Avx512<0>(t1, t2, dim);
+        }
+    }
+    if (LEVEL == SIMD_AVX2){
+        switch (dim){
+            case 96: return l2Avx2<96>(t1, t2, dim);
+            case 100: return l2Avx2<100>(t1, t2, dim);
+            case 128: return l2Avx2<128>(t1, t2, dim);
+            case 960: return l2Avx2<960>(t1, t2, dim);
+            default: return l2Avx2<0>(t1, t2, dim);
+        }
+    }
+    return l2Scalar(t1, t2, dim);
+}
+
+// Row kernels of every family, with the compile-time specializations for the common dimensions (by padded dimension: 100 -> 112)
+template <SimdLevel LEVEL>
+float l2RowDispatch(const float* t1, const float* t2, int dim){
+    if (LEVEL == SIMD_AVX512){
+        switch ((dim + 15) & ~15){
+            case 96: return l2RowAvx512<96>(t1, t2, dim);
+            case 112: return l2RowAvx512<112>(t1, t2, dim);
+            case 128: return l2RowAvx512<128>(t1, t2, dim);
+            case 960: return l2RowAvx512<960>(t1, t2, dim);
+            default: return l2RowAvx512<0>(t1, t2, dim);
+        }
+    }
+    if (LEVEL == SIMD_AVX2){
+        switch ((dim + 15) & ~15){
+            case 96: return l2RowAvx2<96>(t1, t2, dim);
+            case 112: return l2RowAvx2<112>(t1, t2, dim);
+            case 128: return l2RowAvx2<128>(t1, t2, dim);
+            case 960: return l2RowAvx2<960>(t1, t2, dim);
+            default: return l2RowAvx2<0>(t1, t2, dim);
+        }
+    }
+    return l2Scalar(t1, t2, dim);   // the padding is not needed
+}
+
+// Batch row kernels of every family. The query stays in registers up to 128 (AVX-512) or 64 (AVX2) padded dimensions,
+// wider rows are processed one by one with the row kernel (still prefetching the next row).
+template <SimdLevel LEVEL>
+void l2RowBatchDispatch(const float* xq, const float* const* rows, int n, int dim, float* out){
+    int padded = (dim + 15) & ~15;
+    if (LEVEL == SIMD_AVX512){
+        switch (padded){
+            case 16: return l2RowBatchAvx512<16>(xq, rows, n, out);
+            case 32: return l2RowBatchAvx512<32>(xq, rows, n, out);
+            case 48: return l2RowBatchAvx512<48>(xq, rows, n, out);
+            case 64: return l2RowBatchAvx512<64>(xq, rows, n, out);
+            case 80: return l2RowBatchAvx512<80>(xq, rows, n, out);
+            case 96: return l2RowBatchAvx512<96>(xq, rows, n, out);
+            case 112: return l2RowBatchAvx512<112>(xq, rows, n, out);
+            case 128: return l2RowBatchAvx512<128>(xq, rows, n, out);
+            default: break;
+        }
+    }
+    if (LEVEL == SIMD_AVX2){
+        switch (padded){
+            case 16: return l2RowBatchAvx2<16>(xq, rows, n, out);
+            case 32: return l2RowBatchAvx2<32>(xq, rows, n, out);
+            case 48: return l2RowBatchAvx2<48>(xq, rows, n, out);
+            case 64: return l2RowBatchAvx2<64>(xq, rows, n, out);
+            default: break;
+        }
+    }
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], padded * sizeof(float));
+        out[i] = l2RowDispatch<LEVEL>(rows[i], xq, dim);
+    }
+}
+
+// Returns the vector kernel of a family
+inline DistanceKernel l2Kernel(SimdLevel level){
+    switch (level){
+        case SIMD_AVX512: return l2Dispatch<SIMD_AVX512>;
+        case SIMD_AVX2: return l2Dispatch<SIMD_AVX2>;
+        default: return l2Dispatch<SIMD_SCALAR>;
+    }
+}
+
+// Returns the row kernel of a family
+inline DistanceKernel l2RowKernel(SimdLevel level){
+    switch (level){
+        case SIMD_AVX512: return l2RowDispatch<SIMD_AVX512>;
+        case SIMD_AVX2: return l2RowDispatch<SIMD_AVX2>;
+        default: return l2RowDispatch<SIMD_SCALAR>;
+    }
+}
+
+// Family and kernels of the host, resolved once at startup
+inline const SimdLevel simd_level = detectSimdLevel();
+inline const DistanceKernel simd_l2_kernel = l2Kernel(simd_level);
+inline const DistanceKernel simd_row_l2_kernel = l2RowKernel(simd_level);
+
+
+// euclidean distance leveraging SIMD parallelism (widest registers of the host), for float vectors of any dimension.
+inline float simd_euclideanDistance(const vector<float>& t1, const vector<float>& t2){
+
+    if (t1.size() != t2.size()){ throw invalid_argument("Dimension Mismatch between Arguments"); }
+    if (t1.empty()){ throw invalid_argument("Argument Containers are empty"); }
+
+    return simd_l2_kernel(t1.data(), t2.data(), t1.size());
+}
+
+// euclidean distance leveraging SIMD parallelism (widest registers of the host), for raw float rows of any dimension.
+// Both rows must be VECTOR_ALIGNMENT-byte aligned and zero-padded up to the next multiple of 16 floats (VectorStore rows and AlignedRow buffers are).
+inline float simd_row_euclideanDistance(const float* t1, const float* t2, int dim){
+    return simd_row_l2_kernel(t1, t2, dim);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Inner product
+
+inline float dotScalar(const float* t1, const float* t2, int dim){
+    float sum = 0.0f;
+    for (int i = 0; i < dim; i++) sum += t1[i] * t2[i];
+    return sum;
+}
+
+// Row kernel. PADDED_DIM > 0 fixes the padded dimension at compile time (the dim argument is then ignored).
+template <int PADDED_DIM>
+__attribute__((target("avx2,fma")))
+float dotRowAvx2(const float* t1, const float* t2, int dim){
+
+    int padded = (PADDED_DIM > 0) ? PADDED_DIM : (dim + 7) & ~7;   // 0 * 0 adds nothing either
+
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 16 <= padded; i += 16){
+        sum0 = _mm256_fmadd_ps(_mm256_load_ps(t1 + i), _mm256_load_ps(t2 + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_load_ps(t1 + i + 8), _mm256_load_ps(t2 + i + 8), sum1);
+    }
+    if (i < padded) sum0 = _mm256_fmadd_ps(_mm256_load_ps(t1 + i), _mm256_load_ps(t2 + i), sum0);
+
+    return _hsum256(_mm256_add_ps(sum0, sum1));
+}
+
+// Row kernel. PADDED_DIM > 0 fixes the padded dimension at compile time (the dim argument is then ignored).
+template <int PADDED_DIM>
+__attribute__((target("avx512f")))
+float dotRowAvx512(const float* t1, const float* t2, int dim){
+
+    int padded = (PADDED_DIM > 0) ? PADDED_DIM : (dim + 15) & ~15;
+
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+
+    int i = 0;
+    for (; i + 32 <= padded; i += 32){
+        sum0 = _mm512_fmadd_ps(_mm512_load_ps(t1 + i), _mm512_load_ps(t2 + i), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_load_ps(t1 + i + 16), _mm512_load_ps(t2 + i + 16), sum1);
+    }
+    if (i < padded) sum0 = _mm512_fmadd_ps(_mm512_load_ps(t1 + i), _mm512_load_ps(t2 + i), sum0);
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+// out[i] = inner product of rows[i] and xq, with the query in PADDED_DIM / 8 ymm registers (PADDED_DIM <= 64)
+template <int PADDED_DIM>
+__attribute__((target("avx2,fma")))
+void dotRowBatchAvx2(const float* xq, const float* const* rows, int n, float* out){
+
+    constexpr int N_REGS = PADDED_DIM / 8;
+    __m256 q[N_REGS];
+    for (int j = 0; j < N_REGS; j++) q[j] = _mm256_load_ps(xq + 8 * j);
+
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], PADDED_DIM * sizeof(float));
+
+        __m256 sum = _mm256_setzero_ps();
+        for (int j = 0; j < N_REGS; j++) sum = _mm256_fmadd_ps(_mm256_load_ps(rows[i] + 8 * j), q[j], sum);
+        out[i] = _hsum256(sum);
+    }
+}
+
+// out[i] = inner product of rows[i] and xq, with the query in PADDED_DIM / 16 zmm registers (PADDED_DIM <= 128)
+template <int PADDED_DIM>
+__attribute__((target("avx512f")))
+void dotRowBatchAvx512(const float* xq, const float* const* rows, int n, float* out){
+
+    constexpr int N_REGS = PADDED_DIM / 16;
+    __m512 q[N_REGS];
+    for (int j = 0; j < N_REGS; j++) q[j] = _mm512_load_ps(xq + 16 * j);
+
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], PADDED_DIM * sizeof(float));
+
+        __m512 sum = _mm512_setzero_ps();
+        for (int j = 0; j < N_REGS; j++) sum = _mm512_fmadd_ps(_mm512_load_ps(rows[i] + 16 * j), q[j], sum);
+        out[i] = _mm512_reduce_add_ps(sum);
+    }
+}
+
+// Inner product row kernels of every family, with the same specializations as l2RowDispatch
+template <SimdLevel LEVEL>
+float dotRowDispatch(const float* t1, const float* t2, int dim){
+    if (LEVEL == SIMD_AVX512){
+        switch ((dim + 15) & ~15){
+            case 96: return dotRowAvx512<96>(t1, t2, dim);
+            case 112: return dotRowAvx512<112>(t1, t2, dim);
+            case 128: return dotRowAvx512<128>(t1, t2, dim);
+            case 960: return dotRowAvx512<960>(t1, t2, dim);
+            default: return dotRowAvx512<0>(t1, t2, dim);
+        }
+    }
+    if (LEVEL == SIMD_AVX2){
+        switch ((dim + 15) & ~15){
+            case 96: return dotRowAvx2<96>(t1, t2, dim);
+            case 112: return dotRowAvx2<112>(t1, t2, dim);
+            case 128: return dotRowAvx2<128>(t1, t2, dim);
+            case 960: return dotRowAvx2<960>(t1, t2, dim);
+            default: return dotRowAvx2<0>(t1, t2, dim);
+        }
+    }
+    return dotScalar(t1, t2, dim);
+}
+
+// Inner product batch row kernels of every family (same register limits as l2RowBatchDispatch)
+template <SimdLevel LEVEL>
+void dotRowBatchDispatch(const float* xq, const float* const* rows, int n, int dim, float* out){
+    int padded = (dim + 15) & ~15;
+    if (LEVEL == SIMD_AVX512){
+        switch (padded){
+            case 16: return dotRowBatchAvx512<16>(xq, rows, n, out);
+            case 32: return dotRowBatchAvx512<32>(xq, rows, n, out);
+            case 48: return dotRowBatchAvx512<48>(xq, rows, n, out);
+            case 64: return dotRowBatchAvx512<64>(xq, rows, n, out);
+            case 80: return dotRowBatchAvx512<80>(xq, rows, n, out);
+            case 96: return dotRowBatchAvx512<96>(xq, rows, n, out);
+            case 112: return dotRowBatchAvx512<112>(xq, rows, n, out);
+            case 128: return dotRowBatchAvx512<128>(xq, rows, n, out);
+            default: break;
+        }
+    }
+    if (LEVEL == SIMD_AVX2){
+        switch (padded){
+            case 16: return dotRowBatchAvx2<16>(xq, rows, n, out);
+            case 32: return dotRowBatchAvx2<32>(xq, rows, n, out);
+            case 48: return dotRowBatchAvx2<48>(xq, rows, n, out);
+            case 64: return dotRowBatchAvx2<64>(xq, rows, n, out);
+            default: break;
+        }
+    }
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], padded * sizeof(float));
+        out[i] = dotRowDispatch<LEVEL>(rows[i], xq, dim);
+    }
+}
+
+// Returns the inner product row kernel of a family
+inline DistanceKernel dotRowKernel(SimdLevel level){
+    switch (level){
+        case SIMD_AVX512: return dotRowDispatch<SIMD_AVX512>;
+        case SIMD_AVX2: return dotRowDispatch<SIMD_AVX2>;
+        default: return dotRowDispatch<SIMD_SCALAR>;
+    }
+}
+
+// Inner product row kernel of the host, resolved once at startup
+inline const DistanceKernel simd_row_dot_kernel = dotRowKernel(simd_level);
+
+
+// --------------------------------------------------------------------------------------------------------------- 8-bit rows
+
+// Squared euclidean distance of two uint8 or int8 rows, summed in integers
+template <typename I>
+inline float l2IntScalar(const I* t1, const I* t2, int dim){
+    int32_t sum = 0;
+    for (int i = 0; i < dim; i++){
+        int32_t diff = (int32_t) t1[i] - (int32_t) t2[i];
+        sum += diff * diff;
+    }
+    return (float) sum;
+}
+
+// Squared differences of 16 widened elements, pairwise added into 8 int32 lanes
+__attribute__((target("avx2")))
+inline __m256i _l2Epi16Avx2(__m256i a, __m256i b){
+    __m256i diff = _mm256_sub_epi16(a, b);      // |diff| <= 255: no overflow in int16
+    return _mm256_madd_epi16(diff, diff);       // <= 2 * 255^2 per lane
+}
+
+// Row kernel for uint8 (I = uint8_t) or int8 (I = int8_t) rows: 32 elements per step, widened to int16 (exact up to ~250000 dimensions)
+template <typename I>
+__attribute__((target("avx2")))
+float l2IntRowAvx2(const I* t1, const I* t2, int dim){
+
+    int padded = (dim + 31) & ~31;
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < padded; i += 32){
+        __m256i a = _mm256_load_si256((const __m256i*) (t1 + i));
+        __m256i b = _mm256_load_si256((const __m256i*) (t2 + i));
+        __m128i a_lo = _mm256_castsi256_si128(a), a_hi = _mm256_extracti128_si256(a, 1);
+        __m128i b_lo = _mm256_castsi256_si128(b), b_hi = _mm256_extracti128_si256(b, 1);
+        if constexpr (is_signed<I>::value){
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepi8_epi16(a_lo), _mm256_cvtepi8_epi16(b_lo)));
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepi8_epi16(a_hi), _mm256_cvtepi8_epi16(b_hi)));
+        }
+        else{
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepu8_epi16(a_lo), _mm256_cvtepu8_epi16(b_lo)));
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepu8_epi16(a_hi), _mm256_cvtepu8_epi16(b_hi)));
+        }
+    }
+
+    __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));   // 8 -> 4
+    sum4 = _mm_hadd_epi32(sum4, sum4);                                                              // 4 -> 2
+    sum4 = _mm_hadd_epi32(sum4, sum4);                                                              // 2 -> 1
+    return (float) _mm_cvtsi128_si32(sum4);
+}
+
+// 8-bit row kernels of every family (the AVX-512 family runs the AVX2 kernels)
+template <SimdLevel LEVEL, typename I>
+float l2IntRowDispatch(const I* t1, const I* t2, int dim){
+    if (LEVEL >= SIMD_AVX2) return l2IntRowAvx2(t1, t2, dim);
+    return l2IntScalar(t1, t2, dim);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Bounded row kernels
+
+constexpr int DISTANCE_BOUND_BLOCK = 32;    // float elements between two checks of the partial sum (64 for 8-bit rows: one cache line)
+
+// Squared euclidean distance of two rows that stops as soon as the partial sum exceeds bound. Returns the exact distance if it is at most bound
+// (the same value as the row kernel), otherwise a partial sum greater than bound: every term is non-negative, so the distance is greater as well.
+inline float l2BoundedScalar(const float* t1, const float* t2, int dim, float bound){
+    float sum = 0.0f;
+    for (int i = 0; i < dim; i++){
+        float diff = t1[i] - t2[i];
+        sum += diff * diff;
+        if ((i + 1) % DISTANCE_BOUND_BLOCK == 0 && sum > bound) return sum;
+    }
+    return sum;
+}
+
+// Bounded row kernel. PADDED_DIM > 0 fixes the padded dimension at compile time (the dim argument is then ignored).
+template <int PADDED_DIM>
+__attribute__((target("avx2,fma")))
+float l2RowBoundedAvx2(const float* t1, const float* t2, int dim, float bound){
+
+    int padded = (PADDED_DIM > 0) ? PADDED_DIM : (dim + 7) & ~7;
+
+    __m256 sum0 = _mm256_setzero_ps();  // the accumulators of l2RowAvx2: the distances that are not abandoned are the same
+    __m256 sum1 = _mm256_setzero_ps();
+
+    // one block of DISTANCE_BOUND_BLOCK floats per iteration, in the order of the steps of l2RowAvx2
+    int i = 0;
+    for (; i + DISTANCE_BOUND_BLOCK < padded; i += DISTANCE_BOUND_BLOCK){
+        for (int j = i; j < i + DISTANCE_BOUND_BLOCK; j += 16){
+            __m256 diff0 = _mm256_sub_ps(_mm256_load_ps(t1 + j), _mm256_load_ps(t2 + j));
+            __m256 diff1 = _mm256_sub_ps(_mm256_load_ps(t1 + j + 8), _mm256_load_ps(t2 + j + 8));
+            sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+        }
+
+        float partial = _hsum256(_mm256_add_ps(sum0, sum1));
+        if (partial > bound) return partial;
+    }
+    for (; i + 16 <= padded; i += 16){
+        __m256 diff0 = _mm256_sub_ps(_mm256_load_ps(t1 + i), _mm256_load_ps(t2 + i));
+        __m256 diff1 = _mm256_sub_ps(_mm256_load_ps(t1 + i + 8), _mm256_load_ps(t2 + i + 8));
+        sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+    }
+    if (i < padded){
+        __m256 diff = _mm256_sub_ps(_mm256_load_ps(t1 + i), _mm256_load_ps(t2 + i));
+        sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+    }
+
+    return _hsum256(_mm256_add_ps(sum0, sum1));
+}
+
+// Bounded row kernel. PADDED_DIM > 0 fixes the padded dimension at compile time (the dim argument is then ignored).
+template <int PADDED_DIM>
+__attribute__((target("avx512f")))
+float l2RowBoundedAvx512(const float* t1, const float* t2, int dim, float bound){
+
+    int padded = (PADDED_DIM > 0) ? PADDED_DIM : (dim + 15) & ~15;
+
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+
+    int i = 0;
+    for (; i + 32 <= padded; i += 32){
+        __m512 diff0 = _mm512_sub_ps(_mm512_load_ps(t1 + i), _mm512_load_ps(t2 + i));
+        __m512 diff1 = _mm512_sub_ps(_mm512_load_ps(t1 + i + 16), _mm512_load_ps(t2 + i + 16));
+        sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+
+        if (i + 32 < padded){
+            float partial = _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+            if (partial > bound) return partial;
+        }
+    }
+    if (i < padded){
+        __m512 diff = _mm512_sub_ps(_mm512_load_ps(t1 + i), _mm512_load_ps(t2 + i));
+        sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+    }
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+// Bounded row kernel for uint8 or int8 rows: the steps of l2IntRowAvx2, with a check of the partial sum every 64 elements
+template <typename I>
+__attribute__((target("avx2")))
+float l2IntRowBoundedAvx2(const I* t1, const I* t2, int dim, float bound){
+
+    int padded = (dim + 31) & ~31;
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < padded; i += 32){
+        __m256i a = _mm256_load_si256((const __m256i*) (t1 + i));
+        __m256i b = _mm256_load_si256((const __m256i*) (t2 + i));
+        __m128i a_lo = _mm256_castsi256_si128(a), a_hi = _mm256_extracti128_si256(a, 1);
+        __m128i b_lo = _mm256_castsi256_si128(b), b_hi = _mm256_extracti128_si256(b, 1);
+        if constexpr (is_signed<I>::value){
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepi8_epi16(a_lo), _mm256_cvtepi8_epi16(b_lo)));
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepi8_epi16(a_hi), _mm256_cvtepi8_epi16(b_hi)));
+        }
+        else{
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepu8_epi16(a_lo), _mm256_cvtepu8_epi16(b_lo)));
+            sum = _mm256_add_epi32(sum, _l2Epi16Avx2(_mm256_cvtepu8_epi16(a_hi), _mm256_cvtepu8_epi16(b_hi)));
+        }
+
+        if ((i + 32) % (2 * DISTANCE_BOUND_BLOCK) == 0 && i + 32 < padded){
+            __m128i partial = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+            partial = _mm_hadd_epi32(partial, partial);
+            partial = _mm_hadd_epi32(partial, partial);
+            if ((float) _mm_cvtsi128_si32(partial) > bound) return (float) _mm_cvtsi128_si32(partial);
+        }
+    }
+
+    __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum4 = _mm_hadd_epi32(sum4, sum4);
+    sum4 = _mm_hadd_epi32(sum4, sum4);
+    return (float) _mm_cvtsi128_si32(sum4);
+}
+
+// Squared euclidean distance of two uint8 or int8 rows, stopping once the partial sum exceeds bound
+template <typename I>
+inline float l2IntBoundedScalar(const I* t1, const I* t2, int dim, float bound){
+    int32_t sum = 0;
+    for (int i = 0; i < dim; i++){
+        int32_t diff = (int32_t) t1[i] - (int32_t) t2[i];
+        sum += diff * diff;
+        if ((i + 1) % (2 * DISTANCE_BOUND_BLOCK) == 0 && (float) sum > bound) return (float) sum;
+    }
+    return (float) sum;
+}
+
+// Bounded row kernels of every family, with the specializations of l2RowDispatch
+template <SimdLevel LEVEL>
+float l2RowBoundedDispatch(const float* t1, const float* t2, int dim, float bound){
+    if (LEVEL == SIMD_AVX512){
+        switch ((dim + 15) & ~15){
+            case 96: return l2RowBoundedAvx512<96>(t1, t2, dim, bound);
+            case 112: return l2RowBoundedAvx512<112>(t1, t2, dim, bound);
+            case 128: return l2RowBoundedAvx512<128>(t1, t2, dim, bound);
+            case 960: return l2RowBoundedAvx512<960>(t1, t2, dim, bound);
+            default: return l2RowBoundedAvx512<0>(t1, t2, dim, bound);
+        }
+    }
+    if (LEVEL == SIMD_AVX2){
+        switch ((dim + 15) & ~15){
+            case 96: return l2RowBoundedAvx2<96>(t1, t2, dim, bound);
+            case 112: return l2RowBoundedAvx2<112>(t1, t2, dim, bound);
+            case 128: return l2RowBoundedAvx2<128>(t1, t2, dim, bound);
+            case 960: return l2RowBoundedAvx2<960>(t1, t2, dim, bound);
+            default: return l2RowBoundedAvx2<0>(t1, t2, dim, bound);
+        }
+    }
+    return l2BoundedScalar(t1, t2, dim, bound);
+}
+
+// Bounded 8-bit row kernels of every family (the AVX-512 family runs the AVX2 kernels)
+template <SimdLevel LEVEL, typename I>
+float l2IntRowBoundedDispatch(const I* t1, const I* t2, int dim, float bound){
+    if (LEVEL >= SIMD_AVX2) return l2IntRowBoundedAvx2(t1, t2, dim, bound);
+    return l2IntBoundedScalar(t1, t2, dim, bound);
+}
+
+// out[i] = bounded distance of rows[i] to xq with bound bounds[i]. Rows of a single block cannot be abandoned: they go through the batch kernel.
+template <SimdLevel LEVEL>
+void l2RowBoundedBatchDispatch(const float* xq, const float* const* rows, int n, int dim, const float* bounds, float* out){
+    int padded = (dim + 15) & ~15;
+    if (padded <= DISTANCE_BOUND_BLOCK) return l2RowBatchDispatch<LEVEL>(xq, rows, n, dim, out);
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], padded * sizeof(float));
+        out[i] = l2RowBoundedDispatch<LEVEL>(rows[i], xq, dim, bounds[i]);
+    }
+}
+
+// out[i] = bounded distance of the 8-bit rows[i] to xq with bound bounds[i]
+template <SimdLevel LEVEL, typename I>
+void l2IntRowBoundedBatchDispatch(const I* xq, const I* const* rows, int n, int dim, const float* bounds, float* out){
+    int padded = (dim + 63) & ~63;
+    for (int i = 0; i < n; i++){
+        if (i + 1 < n) prefetchRow(rows[i + 1], padded * sizeof(I));
+        out[i] = (padded <= 2 * DISTANCE_BOUND_BLOCK) ? l2IntRowDispatch<LEVEL>(rows[i], xq, dim) : l2IntRowBoundedDispatch<LEVEL>(rows[i], xq, dim, bounds[i]);
+    }
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Many-to-many row kernels
+
+constexpr int DISTANCE_TILE_QUERIES = 64;           // rows on the first side of a many-to-many tile (see distanceTileRows for the second)
+constexpr int MEDOID_TILE_STRIPES = 32;             // fixed stripes of row tiles of the tiled medoid sums, summed in parallel (see DirectedGraph::_tiledMedoid)
+constexpr int DISTANCE_TILE_BYTES = 256 * 1024;     // bytes of the second side of a tile: it stays in the L2 cache while the first side goes through it
+
+// Rows on the second side of a many-to-many tile of padded rows of dimension dim
+inline int distanceTileRows(int dim){
+    return max(16, DISTANCE_TILE_BYTES / (int) (((dim + 15) & ~15) * sizeof(float)));
+}
+
+// Horizontal sums of 4 ymm registers, as the 4 lanes of an xmm register
+__attribute__((target("avx2,fma")))
+inline __m128 _hsum4x256(__m256 v0, __m256 v1, __m256 v2, __m256 v3){
+    __m256 sum = _mm256_hadd_ps(_mm256_hadd_ps(v0, v1), _mm256_hadd_ps(v2, v3));   // lanes: v0 v1 v2 v3 of each 128-bit half
+    return _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+}
+
+// out[i * ldo + j] = <a[i], b[j]> for MR x NR rows: MR * NR ymm accumulators, every loaded element of a row is used NR (or MR) times.
+// The MR rows of a stay in registers while the NR rows of b go through one register.
+template <int MR, int NR>
+__attribute__((target("avx2,fma")))
+inline void _dotBlockAvx2(const float* const* a, const float* const* b, int padded, float* out, int ldo){
+
+    __m256 acc[MR][NR];
+    for (int i = 0; i < MR; i++)
+        for (int j = 0; j < NR; j++) acc[i][j] = _mm256_setzero_ps();
+
+    for (int k = 0; k < padded; k += 8){
+        __m256 ak[MR];
+        for (int i = 0; i < MR; i++) ak[i] = _mm256_load_ps(a[i] + k);
+        for (int j = 0; j < NR; j++){
+            __m256 bk = _mm256_load_ps(b[j] + k);
+            for (int i = 0; i < MR; i++) acc[i][j] = _mm256_fmadd_ps(ak[i], bk, acc[i][j]);
+        }
+    }
+
+    for (int i = 0; i < MR; i++){
+        if (NR == 4) _mm_storeu_ps(out + i * ldo, _hsum4x256(acc[i][0], acc[i][1 % NR], acc[i][2 % NR], acc[i][3 % NR]));
+        else for (int j = 0; j < NR; j++) out[i * ldo + j] = _hsum256(acc[i][j]);
+    }
+}
+
+// MR rows of a against all the rows of b, in blocks of 4 rows of b
+template <int MR>
+__attribute__((target("avx2,fma")))
+inline void _dotRowsAvx2(const float* const* a, const float* const* b, int n, int padded, float* out, int ldo){
+    int j = 0;
+    for (; j + 4 <= n; j += 4) _dotBlockAvx2<MR, 4>(a, b + j, padded, out + j, ldo);
+    switch (n - j){
+        case 3: _dotBlockAvx2<MR, 3>(a, b + j, padded, out + j, ldo); break;
+        case 2: _dotBlockAvx2<MR, 2>(a, b + j, padded, out + j, ldo); break;
+        case 1: _dotBlockAvx2<MR, 1>(a, b + j, padded, out + j, ldo); break;
+        default: break;
+    }
+}
+
+// out[i * ldo + j] = <a[i], b[j]> for m rows a and n rows b, in 3 x 4 register blocks (12 accumulators + 3 rows of a + 1 row of b: the 16 ymm registers)
+__attribute__((target("avx2,fma")))
+inline void dotTileAvx2(const float* const* a, int m, const float* const* b, int n, int dim, float* out, int ldo){
+    int padded = (dim + 7) & ~7;
+    int i = 0;
+    for (; i + 3 <= m; i += 3) _dotRowsAvx2<3>(a + i, b, n, padded, out + (size_t) i * ldo, ldo);
+    if (m - i == 2) _dotRowsAvx2<2>(a + i, b, n, padded, out + (size_t) i * ldo, ldo);
+    else if (m - i == 1) _dotRowsAvx2<1>(a + i, b, n, padded, out + (size_t) i * ldo, ldo);
+}
+
+// out[i * ldo + j] = <a[i], b[j]> for MR x NR rows, with zmm accumulators
+template <int MR, int NR>
+__attribute__((target("avx512f")))
+inline void _dotBlockAvx512(const float* const* a, const float* const* b, int padded, float* out, int ldo){
+
+    __m512 acc[MR][NR];
+    for (int i = 0; i < MR; i++)
+        for (int j = 0; j < NR; j++) acc[i][j] = _mm512_setzero_ps();
+
+    for (int k = 0; k < padded; k += 16){
+        __m512 bk[NR];
+        for (int j = 0; j < NR; j++) bk[j] = _mm512_load_ps(b[j] + k);
+        for (int i = 0; i < MR; i++){
+            __m512 ak = _mm512_load_ps(a[i] + k);
+            for (int j = 0; j < NR; j++) acc[i][j] = _mm512_fmadd_ps(ak, bk[j], acc[i][j]);
+        }
+    }
+
+    for (int i = 0; i < MR; i++)
+        for (int j = 0; j < NR; j++) out[i * ldo + j] = _mm512_reduce_add_ps(acc[i][j]);
+}
+
+// MR rows of a against all the rows of b, in blocks of 4 rows of b
+template <int MR>
+__attribute__((target("avx512f")))
+inline void _dotRowsAvx512(const float* const* a, const float* const* b, int n, int padded, float* out, int ldo){
+    int j = 0;
+    for (; j + 4 <= n; j += 4) _dotBlockAvx512<MR, 4>(a, b + j, padded, out + j, ldo);
+    switch (n - j){
+        case 3: _dotBlockAvx512<MR, 3>(a, b + j, padded, out + j, ldo); break;
+        case 2: _dotBlockAvx512<MR, 2>(a, b + j, padded, out + j, ldo); break;
+        case 1: _dotBlockAvx512<MR, 1>(a, b + j, padded, out + j, ldo); break;
+        default: break;
+    }
+}
+
+// out[i * ldo + j] = <a[i], b[j]> for m rows a and n rows b, in 4 x 4 register blocks
+__attribute__((target("avx512f")))
+inline void dotTileAvx512(const float* const* a, int m, const float* const* b, int n, int dim, float* out, int ldo){
+    int padded = (dim + 15) & ~15;
+    int i = 0;
+    for (; i + 4 <= m; i += 4) _dotRowsAvx512<4>(a + i, b, n, padded, out + (size_t) i * ldo, ldo);
+    switch (m - i){
+        case 3: _dotRowsAvx512<3>(a + i, b, n, padded, out + (size_t) i * ldo, ldo); break;
+        case 2: _dotRowsAvx512<2>(a + i, b, n, padded, out + (size_t) i * ldo, ldo); break;
+        case 1: _dotRowsAvx512<1>(a + i, b, n, padded, out + (size_t) i * ldo, ldo); break;
+        default: break;
+    }
+}
+
+// out[i * ldo + j] = <a[i], b[j]>, one pair at a time
+inline void dotTileScalar(const float* const* a, int m, const float* const* b, int n, int dim, float* out, int ldo){
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++) out[(size_t) i * ldo + j] = dotScalar(a[i], b[j], dim);
+}
+
+// Inner products of m rows a and n rows b (out is m x n, row-major), with the tile kernel of a family
+template <SimdLevel LEVEL>
+void dotTileDispatch(const float* const* a, int m, const float* const* b, int n, int dim, float* out){
+    if (LEVEL == SIMD_AVX512) return dotTileAvx512(a, m, b, n, dim, out, n);
+    if (LEVEL == SIMD_AVX2) return dotTileAvx2(a, m, b, n, dim, out, n);
+    dotTileScalar(a, m, b, n, dim, out, n);
+}
+
+// Squared euclidean distances of m rows a and n rows b (out is m x n, row-major), given their squared norms: ||x||^2 + ||y||^2 - 2 <x, y>.
+// The rounding of the decomposition can make the distance of (almost) equal rows slightly negative: it is clamped to 0.
+template <SimdLevel LEVEL>
+void l2TileDispatch(const float* const* a, const float* a_norms, int m, const float* const* b, const float* b_norms, int n, int dim, float* out){
+    dotTileDispatch<LEVEL>(a, m, b, n, dim, out);
+    for (int i = 0; i < m; i++){
+        float* row = out + (size_t) i * n;
+        for (int j = 0; j < n; j++) row[j] = max(0.0f, a_norms[i] + b_norms[j] - 2.0f * row[j]);
+    }
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Distance policies
+
+// A distance policy is the second template parameter of DirectedGraph: a copyable type with float operator()(const E* t1, const E* t2, int dim) const,
+// called on two rows of the graph's VectorStore. The graph calls the policy directly, so the kernel of a stateless policy is known at compile time
+// and inlined into the search and prune loops (as long as the build targets its instruction set, e.g. -mavx2 -mfma for L2Distance<SIMD_AVX2>).
+
+// A policy can also provide void batch(const E* xq, const E* const* rows, int n, int dim, float* out) const, the distances of n rows to xq
+// in a single call (see distanceBatchRows). Policies without it are called once per row.
+
+// A policy whose partial sums only grow (L2) can also provide void bounded(const E* xq, const E* const* rows, int n, int dim, const float* bounds, float* out) const:
+// out[i] is the distance of rows[i] to xq if it is at most bounds[i], otherwise any value greater than bounds[i] (see distanceBoundedRows).
+// Policies without it compute the exact distances, which satisfy the bounds as well.
+
+// A policy can also provide void matrix(const E* const* a, const float* a_norms, int m, const E* const* b, const float* b_norms, int n, int dim, float* out) const:
+// out[i * n + j] is the distance of a[i] to b[j], through the many-to-many kernels, given the squared norms of the rows (see rowNorms, only
+// the L2 policy reads them). Policies without it are called once per pair (see distanceMatrixRows).
+
+// Squared euclidean distance on rows (float, uint8 or int8), with the kernels of one family
+template <SimdLevel LEVEL>
+struct L2Distance{
+    float operator()(const float* t1, const float* t2, int dim) const { return l2RowDispatch<LEVEL>(t1, t2, dim); }
+    float operator()(const uint8_t* t1, const uint8_t* t2, int dim) const { return l2IntRowDispatch<LEVEL>(t1, t2, dim); }
+    float operator()(const int8_t* t1, const int8_t* t2, int dim) const { return l2IntRowDispatch<LEVEL>(t1, t2, dim); }
+
+    void batch(const float* xq, const float* const* rows, int n, int dim, float* out) const { l2RowBatchDispatch<LEVEL>(xq, rows, n, dim, out); }
+
+    void bounded(const float* xq, const float* const* rows, int n, int dim, const float* bounds, float* out) const {
+        l2RowBoundedBatchDispatch<LEVEL>(xq, rows, n, dim, bounds, out);
+    }
+    void bounded(const uint8_t* xq, const uint8_t* const* rows, int n, int dim, const float* bounds, float* out) const {
+        l2IntRowBoundedBatchDispatch<LEVEL>(xq, rows, n, dim, bounds, out);
+    }
+    void bounded(const int8_t* xq, const int8_t* const* rows, int n, int dim, const float* bounds, float* out) const {
+        l2IntRowBoundedBatchDispatch<LEVEL>(xq, rows, n, dim, bounds, out);
+    }
+
+    void matrix(const float* const* a, const float* a_norms, int m, const float* const* b, const float* b_norms, int n, int dim, float* out) const {
+        l2TileDispatch<LEVEL>(a, a_norms, m, b, b_norms, n, dim, out);
+    }
+};
+
+// Negative inner product on rows (METRIC_IP): the larger the inner product, the closer. Distances can be negative.
+template <SimdLevel LEVEL>
+struct IPDistance{
+    float operator()(const float* t1, const float* t2, int dim) const { return -dotRowDispatch<LEVEL>(t1, t2, dim); }
+
+    void batch(const float* xq, const float* const* rows, int n, int dim, float* out) const {
+        dotRowBatchDispatch<LEVEL>(xq, rows, n, dim, out);
+        for (int i = 0; i < n; i++) out[i] = -out[i];
+    }
+
+    void matrix(const float* const* a, const float*, int m, const float* const* b, const float*, int n, int dim, float* out) const {
+        dotTileDispatch<LEVEL>(a, m, b, n, dim, out);
+        for (size_t i = 0; i < (size_t) m * n; i++) out[i] = -out[i];
+    }
+};
+
+// Cosine distance on rows (METRIC_COSINE): 1 - inner product, for rows and queries normalized to unit length by the graph
+template <SimdLevel LEVEL>
+struct CosineDistance{
+    float operator()(const float* t1, const float* t2, int dim) const { return 1.0f - dotRowDispatch<LEVEL>(t1, t2, dim); }
+
+    void batch(const float* xq, const float* const* rows, int n, int dim, float* out) const {
+        dotRowBatchDispatch<LEVEL>(xq, rows, n, dim, out);
+        for (int i = 0; i < n; i++) out[i] = 1.0f - out[i];
+    }
+
+    void matrix(const float* const* a, const float*, int m, const float* const* b, const float*, int n, int dim, float* out) const {
+        dotTileDispatch<LEVEL>(a, m, b, n, dim, out);
+        for (size_t i = 0; i < (size_t) m * n; i++) out[i] = 1.0f - out[i];
+    }
+};
+
+// Type-erased distance on rows: wraps any function (e.g. a custom distance), at the cost of an indirect call per distance.
+// Default policy of DirectedGraph.
+template <typename E>
+class DynamicDistance{
+
+    private:
+        function<float(const E*, const E*, int)> _fn;
+
+    public:
+        DynamicDistance(function<float(const E*, const E*, int)> fn = nullptr) : _fn(fn) {}
+
+        float operator()(const E* t1, const E* t2, int dim) const { return this->_fn(t1, t2, dim); }
+};
+
+
+// True if the distance policy provides a batch kernel for rows of type E
+template <typename Distance, typename E, typename = void>
+struct HasBatchDistance : false_type {};
+
+template <typename Distance, typename E>
+struct HasBatchDistance<Distance, E, void_t<decltype(declval<const Distance&>().batch((const E*) nullptr, (const E* const*) nullptr, 0, 0, (float*) nullptr))>> : true_type {};
+
+// out[i] = d(rows[i], xq) for the n rows, through the batch kernel of the policy if it has one
+template <typename Distance, typename E>
+void distanceBatchRows(const Distance& d, const E* xq, const E* const* rows, int n, int dim, float* out){
+    if constexpr (HasBatchDistance<Distance, E>::value){
+        d.batch(xq, rows, n, dim, out);
+    }
+    else{
+        for (int i = 0; i < n; i++){
+            if (i + 1 < n) prefetchRow(rows[i + 1], dim * sizeof(E));
+            out[i] = d(rows[i], xq, dim);
+        }
+    }
+}
+
+// True if the distance policy provides bounded kernels for rows of type E
+template <typename Distance, typename E, typename = void>
+struct HasBoundedDistance : false_type {};
+
+template <typename Distance, typename E>
+struct HasBoundedDistance<Distance, E, void_t<decltype(declval<const Distance&>().bounded((const E*) nullptr, (const E* const*) nullptr, 0, 0, (const float*) nullptr, (float*) nullptr))>> : true_type {};
+
+// out[i] = d(rows[i], xq) if it is at most bounds[i], otherwise any value greater than bounds[i]: through the bounded kernels of the policy
+// if it has them (the computation of a row stops once its partial sum exceeds its bound), otherwise the exact distances
+template <typename Distance, typename E>
+void distanceBoundedRows(const Distance& d, const E* xq, const E* const* rows, int n, int dim, const float* bounds, float* out){
+    if constexpr (HasBoundedDistance<Distance, E>::value){
+        d.bounded(xq, rows, n, dim, bounds, out);
+    }
+    else{
+        distanceBatchRows(d, xq, rows, n, dim, out);
+    }
+}
+
+// out[i] = squared norm of rows[i], for the many-to-many kernels of the L2 policy (host kernel)
+inline void rowNorms(const float* const* rows, int n, int dim, float* out){
+    for (int i = 0; i < n; i++) out[i] = simd_row_dot_kernel(rows[i], rows[i], dim);
+}
+
+// True if the distance policy provides many-to-many kernels for rows of type E
+template <typename Distance, typename E, typename = void>
+struct HasMatrixDistance : false_type {};
+
+template <typename Distance, typename E>
+struct HasMatrixDistance<Distance, E, void_t<decltype(declval<const Distance&>().matrix((const E* const*) nullptr, (const float*) nullptr, 0, (const E* const*) nullptr, (const float*) nullptr, 0, 0, (float*) nullptr))>> : true_type {};
+
+// out[i * n + j] = d(a[i], b[j]) for m rows a and n rows b, through the many-to-many kernels of the policy if it has one (the norms are
+// then the squared norms of the rows, see rowNorms), otherwise one pair at a time (the norms are not read)
+template <typename Distance, typename E>
+void distanceMatrixRows(const Distance& d, const E* const* a, const float* a_norms, int m, const E* const* b, const float* b_norms, int n, int dim, float* out){
+    if constexpr (HasMatrixDistance<Distance, E>::value){
+        d.matrix(a, a_norms, m, b, b_norms, n, dim, out);
+    }
+    else{
+        for (int i = 0; i < m; i++)
+            for (int j = 0; j < n; j++) out[(size_t) i * n + j] = d(a[i], b[j], dim);
+    }
+}
+
+// Exact k nearest rows of every query: out[q] holds the indices into rows of the (at most) k rows closest to queries[q], closest first.
+// The distances go through tiles of the many-to-many kernels of the policy, and a max-heap of k candidates per query keeps the nearest ones.
+template <typename Distance>
+void exactNeighbors(const Distance& d, const float* const* queries, int n_queries, const float* const* rows, int n_rows, int dim, int k, vector<vector<int>>& out){
+
+    out.assign(n_queries, vector<int>());
+    if (n_rows == 0 || k <= 0) return;
+
+    vector<float> query_norms(n_queries), row_norms(n_rows);
+    if constexpr (HasMatrixDistance<Distance, float>::value){
+        rowNorms(queries, n_queries, dim, query_norms.data());
+        rowNorms(rows, n_rows, dim, row_norms.data());
+    }
+
+    int tile = distanceTileRows(dim);
+    vector<float> distances((size_t) DISTANCE_TILE_QUERIES * tile);
+    vector<vector<pair<float, int>>> heaps(DISTANCE_TILE_QUERIES);
+
+    for (int q0 = 0; q0 < n_queries; q0 += DISTANCE_TILE_QUERIES){
+        int m = min(DISTANCE_TILE_QUERIES, n_queries - q0);
+        for (int q = 0; q < m; q++) heaps[q].clear();
+
+        for (int r0 = 0; r0 < n_rows; r0 += tile){
+            int n = min(tile, n_rows - r0);
+            distanceMatrixRows(d, queries + q0, query_norms.data() + q0, m, rows + r0, row_norms.data() + r0, n, dim, distances.data());
+
+            for (int q = 0; q < m; q++){
+                vector<pair<float, int>>& heap = heaps[q];
+                const float* row = distances.data() + (size_t) q * n;
+                for (int j = 0; j < n; j++){
+                    if ((int) heap.size() < k){
+                        heap.push_back({row[j], r0 + j});
+                        push_heap(heap.begin(), heap.end());
+                    }
+                    else if (row[j] < heap.front().first){
+                        pop_heap(heap.begin(), heap.end());
+                        heap.back() = {row[j], r0 + j};
+                        push_heap(heap.begin(), heap.end());
+                    }
+                }
+            }
+        }
+
+        for (int q = 0; q < m; q++){
+            sort_heap(heaps[q].begin(), heaps[q].end());
+            for (const pair<float, int>& candidate : heaps[q]) out[q0 + q].push_back(candidate.second);
+        }
+    }
+}
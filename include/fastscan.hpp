@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+#include "util.hpp"
+#include "vector_store.hpp"
+#include "pq.hpp"
+
+using namespace std;
+
+// Included by types.hpp right after the adjacency store (needs Id and AdjacencyStore).
+// This file implements the fast-scan neighbor blocks of a graph: 4-bit PQ codes of the out-neighbors of every node, stored next to
+// their ids, so that a greedy search estimates the distances of all the neighbors of a node without reading their rows (see DirectedGraph::buildFastScan).
+//
+// The values are encoded by a product quantizer of FASTSCAN_CENTROIDS centroids per subspace: 4 bits per subspace. The out-neighbors of a node
+// are cut into blocks of FASTSCAN_BLOCK neighbors whose codes are transposed: for every pair of subspaces (2p, 2p + 1) a block holds 32 bytes,
+// the first 16 for subspace 2p and the last 16 for subspace 2p + 1. Byte j of each half holds the code of neighbor j in its low nibble and
+// the code of neighbor j + 16 in its high nibble. The ids and the code blocks of a node are contiguous: expanding a node reads a single region.
+//
+// A search quantizes the ADC table of its query to bytes once (a 16-byte table per subspace, see prepareQuery). A pair of subspaces of a block
+// then costs two _mm256_shuffle_epi8 lookups (each 128-bit lane looks up its own 16-byte table): the byte distances of the 32 neighbors on both
+// subspaces, accumulated in 16-bit lanes. Only the neighbors whose estimate beats the bound of the search get an exact distance.
+
+constexpr int FASTSCAN_CENTROIDS = 16;      // centroids per subspace (4-bit codes)
+constexpr int FASTSCAN_BLOCK = 32;          // neighbors per block of codes
+constexpr int FASTSCAN_MAX_SUBSPACES = 256; // 255 * M quantized units must fit the 16-bit accumulators
+
+// Out-neighbors of a node in the fast-scan blocks
+struct FastScanNeighbors{
+    const Id* ids;              // degree ids (in the order of the adjacency store)
+    const uint8_t* codes;       // blocks() transposed code blocks
+    int degree;
+
+    int blocks() const { return (this->degree + FASTSCAN_BLOCK - 1) / FASTSCAN_BLOCK; }
+};
+
+// ADC table of a query, quantized to bytes (see FastScanBlocks::prepareQuery)
+struct FastScanQuery{
+    vector<uint8_t> lut;        // 32 bytes per pair of subspaces: the 16 distances of subspace 2p, then the 16 of subspace 2p + 1
+    float bias;                 // sum of the smallest table entry of every subspace
+    float scale;                // quantized units per unit of distance
+    vector<float> table;        // buffers of prepareQuery, kept to prepare the next query without allocations
+    vector<float> minimum;
+};
+
+
+// --------------------------------------------------------------------------------------------------------------- Scan kernels
+
+// out[j] = sum of the byte distances of neighbor j of a block (FASTSCAN_BLOCK values), on pairs pairs of subspaces
+__attribute__((target("avx2")))
+inline void fastScanBlockAvx2(const uint8_t* codes, const uint8_t* lut, int pairs, uint16_t* out){
+
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    // 16-bit sums of neighbors 0-7, 8-15, 16-23 and 24-31: lane 0 sums the even subspaces, lane 1 the odd ones
+    __m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+    for (int p = 0; p < pairs; p++, codes += 32, lut += 32){
+        __m256i c = _mm256_loadu_si256((const __m256i*) codes);
+        __m256i table = _mm256_loadu_si256((const __m256i*) lut);
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(c, low_nibbles));                        // neighbors 0-15
+        __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(c, 4), low_nibbles));  // neighbors 16-31
+        acc0 = _mm256_add_epi16(acc0, _mm256_unpacklo_epi8(lo, zero));
+        acc1 = _mm256_add_epi16(acc1, _mm256_unpackhi_epi8(lo, zero));
+        acc2 = _mm256_add_epi16(acc2, _mm256_unpacklo_epi8(hi, zero));
+        acc3 = _mm256_add_epi16(acc3, _mm256_unpackhi_epi8(hi, zero));
+    }
+
+    _mm_storeu_si128((__m128i*) (out + 0), _mm_add_epi16(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1)));
+    _mm_storeu_si128((__m128i*) (out + 8), _mm_add_epi16(_mm256_castsi256_si128(acc1), _mm256_extracti128_si256(acc1, 1)));
+    _mm_storeu_si128((__m128i*) (out + 16), _mm_add_epi16(_mm256_castsi256_si128(acc2), _mm256_extracti128_si256(acc2, 1)));
+    _mm_storeu_si128((__m128i*) (out + 24), _mm_add_epi16(_mm256_castsi256_si128(acc3), _mm256_extracti128_si256(acc3, 1)));
+}
+
+// Scalar fallback of fastScanBlockAvx2, on the same layout
+inline void fastScanBlockScalar(const uint8_t* codes, const uint8_t* lut, int pairs, uint16_t* out){
+    for (int j = 0; j < FASTSCAN_BLOCK; j++) out[j] = 0;
+    for (int p = 0; p < pairs; p++, codes += 32, lut += 32){
+        for (int half = 0; half < 2; half++){
+            for (int j = 0; j < 16; j++){
+                uint8_t c = codes[16 * half + j];
+                out[j] += lut[16 * half + (c & 0x0f)];
+                out[j + 16] += lut[16 * half + (c >> 4)];
+            }
+        }
+    }
+}
+
+
+class FastScanBlocks{
+
+    private:
+        ProductQuantizer _pq;           // 4-bit quantizer of the values
+        int _pairs;                     // pairs of subspaces in a block (an odd M gets a last subspace of zero codes and distances)
+        vector<size_t> _offsets;        // the region of node i starts at byte _offsets[i] of _data: the ids (padded to whole blocks), then the code blocks
+        vector<int> _degree;            // out-degree of every node
+        vector<uint8_t> _data;
+
+        static bool _avx2() { return simd_level >= SIMD_AVX2; }
+
+        int _blockBytes() const { return this->_pairs * 32; }
+
+    public:
+
+        // Blocks of 4-bit codes of M subspaces of rows of dimension dim (M <= FASTSCAN_MAX_SUBSPACES)
+        FastScanBlocks(int dim, int M) : _pq(dim, M, false, FASTSCAN_CENTROIDS), _pairs((M + 1) / 2) {
+            if (M > FASTSCAN_MAX_SUBSPACES) { throw invalid_argument("The number of fast-scan subspaces must be in [1, min(dim, 256)].\n"); }
+        }
+
+        int M() const { return this->_pq.M(); }
+        int size() const { return this->_degree.size(); }
+
+        // Bytes held by the blocks (ids and codes) and the codebooks
+        size_t bytes() const { return this->_data.size() + this->_offsets.size() * sizeof(size_t) + this->_degree.size() * sizeof(int) + this->_pq.bytes(); }
+
+        // The 4-bit quantizer of the values
+        const ProductQuantizer& quantizer() const { return this->_pq; }
+
+        // Trains the codebooks on the rows of the vector store and encodes every row
+        template <typename E>
+        void train(const VectorStore<E>& vectors){
+            this->_pq.train(vectors);
+            this->_pq.encode(vectors);
+        }
+
+        // Lays out the out-neighbors of every node of the adjacency store with their codes. rowOf(id) is the row of a node in the encoded
+        // vector store (-1 for a node without value: zero codes).
+        void build(const AdjacencyStore& adjacency, const function<int(Id)>& rowOf){
+
+            int n_nodes = adjacency.size(), M = this->M();
+            this->_offsets.resize(n_nodes + 1);
+            this->_degree.resize(n_nodes);
+
+            size_t offset = 0;
+            for (int i = 0; i < n_nodes; i++){
+                this->_offsets[i] = offset;
+                this->_degree[i] = adjacency.degree(i);
+                int blocks = (this->_degree[i] + FASTSCAN_BLOCK - 1) / FASTSCAN_BLOCK;
+                offset += (size_t) blocks * (FASTSCAN_BLOCK * sizeof(Id) + this->_blockBytes());
+            }
+            this->_offsets[n_nodes] = offset;
+            this->_data.assign(offset, 0);
+
+            for (int i = 0; i < n_nodes; i++){
+                NeighborRange nb = adjacency.neighbors(i);
+                int blocks = (nb.size() + FASTSCAN_BLOCK - 1) / FASTSCAN_BLOCK;
+                uint8_t* region = this->_data.data() + this->_offsets[i];
+                memcpy(region, nb.begin(), nb.size() * sizeof(Id));
+
+                uint8_t* codes = region + (size_t) blocks * FASTSCAN_BLOCK * sizeof(Id);
+                for (int j = 0; j < nb.size(); j++){
+                    int row = rowOf(nb.begin()[j]);
+                    if (row < 0) continue;
+                    const uint8_t* code = this->_pq.code(row);
+                    uint8_t* block = codes + (size_t) (j / FASTSCAN_BLOCK) * this->_blockBytes();
+                    int slot = j % FASTSCAN_BLOCK, shift = (slot < 16) ? 0 : 4;
+                    for (int m = 0; m < M; m++) block[32 * (m / 2) + 16 * (m % 2) + slot % 16] |= code[m] << shift;
+                }
+            }
+        }
+
+        // Out-neighbors of a node, with their codes
+        FastScanNeighbors neighbors(Id id) const {
+            const uint8_t* region = this->_data.data() + this->_offsets[id];
+            int degree = this->_degree[id];
+            int blocks = (degree + FASTSCAN_BLOCK - 1) / FASTSCAN_BLOCK;
+            return FastScanNeighbors{(const Id*) region, region + (size_t) blocks * FASTSCAN_BLOCK * sizeof(Id), degree};
+        }
+
+        // Prefetches the ids and the code blocks of the out-neighbors of a node (e.g. of a candidate a search is about to expand)
+        void prefetch(Id id) const {
+            const char* region = (const char*) this->_data.data() + this->_offsets[id];
+            size_t bytes = this->_offsets[id + 1] - this->_offsets[id];
+            for (size_t offset = 0; offset < bytes; offset += 64) _mm_prefetch(region + offset, _MM_HINT_T0);
+        }
+
+        // Quantizes the ADC table of the query xq: every subspace loses its smallest entry (summed into the bias), and all the entries share
+        // the scale that maps the widest range of a subspace to [0, 255]
+        template <typename E>
+        void prepareQuery(const E* xq, FastScanQuery& q) const {
+
+            int M = this->M();
+            vector<float>& table = q.table;
+            vector<float>& minimum = q.minimum;
+            table.resize(this->_pq.tableSize());
+            minimum.resize(M);
+            this->_pq.computeTable(xq, table.data());
+
+            int ksub = this->_pq.centroids();
+            float range = 0.0f;
+            q.bias = 0.0f;
+            for (int m = 0; m < M; m++){
+                const float* t = table.data() + m * PQ_CENTROIDS;
+                minimum[m] = *min_element(t, t + ksub);
+                range = max(range, *max_element(t, t + ksub) - minimum[m]);
+                q.bias += minimum[m];
+            }
+            q.scale = (range > 0.0f) ? 255.0f / range : 1.0f;
+
+            q.lut.assign(this->_blockBytes(), 0);
+            for (int m = 0; m < M; m++){
+                const float* t = table.data() + m * PQ_CENTROIDS;
+                uint8_t* lut = q.lut.data() + 32 * (m / 2) + 16 * (m % 2);
+                for (int k = 0; k < ksub; k++) lut[k] = (uint8_t) min(255.0f, roundf((t[k] - minimum[m]) * q.scale));
+            }
+        }
+
+        // out[j] = quantized estimate of the distance of the query to neighbor j (nb.blocks() * FASTSCAN_BLOCK values, see estimate)
+        void scan(const FastScanQuery& q, const FastScanNeighbors& nb, uint16_t* out) const {
+            const uint8_t* codes = nb.codes;
+            for (int b = 0; b < nb.blocks(); b++, codes += this->_blockBytes(), out += FASTSCAN_BLOCK){
+                if (_avx2()) fastScanBlockAvx2(codes, q.lut.data(), this->_pairs, out);
+                else fastScanBlockScalar(codes, q.lut.data(), this->_pairs, out);
+            }
+        }
+
+        // Distance estimated by a quantized estimate of scan
+        float estimate(const FastScanQuery& q, uint16_t quantized) const { return q.bias + quantized / q.scale; }
+
+        // Largest quantized estimate of scan whose distance estimate is at most distance (-1 if none is)
+        int limit(const FastScanQuery& q, float distance) const {
+            float units = (distance - q.bias) * q.scale;
+            if (units < 0.0f) return -1;
+            return (units >= 65535.0f) ? 65535 : (int) units;
+        }
+};
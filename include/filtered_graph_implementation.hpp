@@ -6,8 +6,8 @@
 
 
 // medoids
-template <typename T>
-const unordered_map<int, Id> DirectedGraph<T>::findMedoids(float threshold){
+template <typename T, typename Distance>
+const unordered_map<int, Id> DirectedGraph<T, Distance>::findMedoids(float threshold){
     
     c_log << "Filtered Medoids\n";
 
@@ -18,8 +18,8 @@ const unordered_map<int, Id> DirectedGraph<T>::findMedoids(float threshold){
     return _filtered_medoid(threshold);
 }
 
-template <typename T>
-const unordered_map<int, Id> DirectedGraph<T>::_filtered_medoid(float threshold){
+template <typename T, typename Distance>
+const unordered_map<int, Id> DirectedGraph<T, Distance>::_filtered_medoid(float threshold){
 
     // Initialize T_counter (counts how many times a specific node has been selected as a medoid)
     vector<int> T_counter(this->n_nodes, 0);
@@ -53,8 +53,8 @@ const unordered_map<int, Id> DirectedGraph<T>::_filtered_medoid(float threshold)
 }
 
 // Returns a filtered set
-template <typename T>
-unordered_set<Id> DirectedGraph<T>::filterSet(unordered_set<Id> S, int filter){
+template <typename T, typename Distance>
+unordered_set<Id> DirectedGraph<T, Distance>::filterSet(unordered_set<Id> S, int filter){
     if (filter == -1){
         return S;
     }
@@ -70,15 +70,49 @@ unordered_set<Id> DirectedGraph<T>::filterSet(unordered_set<Id> S, int filter){
     return filtered;
 }
 
-template <typename T>
-const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T>::filteredGreedySearch(Id s, Query<T> q, int k, int L){
+// Returns the out-neighbors of node p that are not in V and belong to the category filter (all categories for filter = -1)
+template <typename T, typename Distance>
+unordered_set<Id> DirectedGraph<T, Distance>::_filteredNeighbors(Id p, const unordered_set<Id>& V, int filter){
+    unordered_set<Id> filtered;
+
+    for (const Id& neighbor : this->Nout.neighbors(p)){
+        if ((filter == -1 || this->nodes[neighbor].category == filter) && !setIn(neighbor, V)){
+            filtered.insert(neighbor);
+        }
+    }
+
+    return filtered;
+}
+
+template <typename T, typename Distance>
+const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T, Distance>::filteredGreedySearch(Id s, const Query<T>& q, int k, int L){
 
     c_log << "Filtered Greedy Search\n";
 
+    SearchContext& ctx = searchContext();
+    this->_filteredGreedySearch(s, q, k, L, ctx);
+    return this->_searchSets(ctx);
+}
+
+// Same as filteredGreedySearch, returns the k closest neighbors with their distances by increasing distance
+template <typename T, typename Distance>
+vector<pair<Id, float>> DirectedGraph<T, Distance>::filteredGreedySearchRanked(Id s, const Query<T>& q, int k, int L){
+    SearchContext& ctx = searchContext();
+    this->_filteredGreedySearch(s, q, k, L, ctx);
+    return ctx.results;
+}
+
+// Filtered Greedy Search of a query on the search context ctx
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_filteredGreedySearch(Id s, const Query<T>& q, int k, int L, SearchContext& ctx){
+
     // Argument checks
 
     // No filters are present, perform unfiltered greedy search
-    if (q.empty()) { return this->greedySearch(this->startingNode(), q.value, k, L); }
+    if (q.empty()) {
+        if (this->isEmpty(q.value)){ throw invalid_argument("No query was provided.\n"); }
+        return this->search(this->startingNode(), q.value.data(), q.value.size(), k, L, ctx);
+    }
 
     if (s == -1){ throw invalid_argument("No start node was provided.\n"); }
 
@@ -86,152 +120,83 @@ const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T>::filteredGreed
 
     if (L < k){ throw invalid_argument("L must be greater or equal to K.\n"); }
 
-    return (args.usePQueue)
-        ? this->_pqueue_filteredGreedySearch(s, q, k, L)
-        : this->_set_filteredGreedySearch(s, q, k, L);
-
-    
+    this->_filteredGreedySearch(s, this->_padQuery(q.value.data(), q.value.size(), ctx), q.category, k, L, ctx);
 }
 
-// Set Filtered Greedy Search
-template <typename T>
-const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T>::_set_filteredGreedySearch(Id s, Query<T> q, int k, int L){
+// Filtered Greedy Search on a padded query row (e.g. a row of the vector store) of the given category
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_filteredGreedySearch(Id s, const Elem* xq, int category, int k, int L, SearchContext& ctx){
+
+    if (this->_pq != nullptr || this->_sq != nullptr){
+        this->_withCodeDistance(xq, ctx, [&](const auto& codeDist, bool rerank) { this->_compressedFilteredGreedySearch(s, xq, category, k, L, codeDist, rerank, ctx); });
+    }
+    else this->_beam_filteredGreedySearch(s, xq, category, k, L, ctx);
+}
 
-    // ofstream outFile = GS_costs_init();
-    // float _cost = 0;
+// Beam Filtered Greedy Search
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_beam_filteredGreedySearch(Id s, const Elem* xq, int category, int k, int L, SearchContext& ctx){
 
-    // Create empty sets
-    unordered_set<Id> Lc, V, diff;
-    Node<T> sNode;
+    // Same traversal as the Beam Greedy Search, on the nodes of the query's category
+    ctx.beam.reset(L);
+    ctx.visited.reset(this->n_nodes);
+    ctx.expanded.clear();
 
-    // Get node using id from s
-    sNode = this->nodes[s];
-    
     // Category match
-    if (sNode.category == q.category) {
-        // _cost = 0;
-        Lc.insert(s);
+    ctx.visited.insert(s);
+    if (this->nodes[s].category == category) {
+        float ds;
+        this->distanceBatch(xq, &s, 1, &ds);
+        ctx.beam.insert(ds, s);
     }
 
-    // GS_costs_write(outFile, _cost);
-
-    while (!(diff = setSubtraction(Lc,V)).empty()){
-        Id pmin = _myArgMin(diff, q.value);     // pmin is the node with the minimum distance from query xq
+    int ahead = args.prefetchDistance;     // prefetching as in the Beam Greedy Search
 
-        V.insert(pmin);
+    vector<Id>& neighbors = ctx.ids;
+    Id pmin;
+    while ((pmin = ctx.beam.next()) != -1){    // pmin is the unexpanded candidate with the minimum distance from query xq
 
-        unordered_set<Id> filteredNoutPmin;
-        if (mapKeyExists(pmin, this->Nout))
-            filteredNoutPmin = this->filterSet(setSubtraction(this->Nout[pmin], V), q.category);
+        ctx.expanded.push_back(pmin);
+        if (ahead > 0) this->_prefetchCandidates(ctx.beam);
 
-        // int sz_before = Lc.size();
-        Lc.insert(filteredNoutPmin.begin(), filteredNoutPmin.end());
-        // int sz_after = Lc.size();
-        // _cost = sz_after - sz_before;    // how many successful insertions
-
-        if (Lc.size() > L){
-            // _cost += Lc.size();
-            Lc = _closestN(L, Lc, q.value); // function: find N closest points from a specific xq from given set and return them
-        }
-        // GS_costs_write(outFile, _cost);
+        // distances of the unseen out-neighbors of pmin of the category in one batch, abandoned beyond the distance of the worst candidate once the beam is full
+        neighbors.clear();
+        this->_unseenNeighbors(pmin, category, true, ctx.visited, ctx);
+        this->_beamDistances(xq, neighbors.data(), neighbors.size(), ctx);
+        for (int i = 0; i < neighbors.size(); i++) ctx.beam.insert(ctx.dists[i], neighbors[i]);
     }
-    
-    pair<unordered_set<Id>, unordered_set<Id>> ret;
-
-    // if (k < Lc.size())
-    //     _cost = Lc.size();
-    // else
-    //     _cost = 0;
-    // GS_costs_write(outFile, _cost);
-
-    ret.first = _closestN(k, Lc, q.value);
-    ret.second = V;
-
-    // outFile.close();
-    // greedySearchCount++;
 
-    return ret;
+    this->_collectResults(k, ctx);
 }
 
-// Pqueue Filtered Greedy Search
-template <typename T>
-const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T>::_pqueue_filteredGreedySearch(Id s, Query<T> q, int k, int L){
+// Compressed Filtered Greedy Search
+template <typename T, typename Distance>
+template <typename CodeDistance>
+void DirectedGraph<T, Distance>::_compressedFilteredGreedySearch(Id s, const Elem* xq, int category, int k, int L, const CodeDistance& codeDist, bool rerank, SearchContext& ctx){
 
-    // ofstream outFile = GS_costs_init();
-    // float _cost = 0;
+    ctx.beam.reset(L);
+    ctx.visited.reset(this->n_nodes);
+    ctx.expanded.clear();
 
-    // Create empty sets and initialize the priority queue
-    unordered_set<Id> V, diff; 
-    function<bool(Id, Id)> comparator = 
-        [q,this] (int id1, int id2) {
-            return (this->d(q.value, this->nodes[id1].value) < this->d(q.value, this->nodes[id2].value));   // descending comparator (maxHeap)
-        };
-
-    priority_queue<Id, vector<Id>, function<bool(Id, Id)>> Lc(comparator);
-
-    Node<T> sNode;
-
-    // Get node using id from s
-    sNode = this->nodes[s];
-    
     // Category match
-    if (sNode.category == q.category) {
-        // _cost += log(1); // = 0 ...
-        Lc.push(s);
-    }
-    // GS_costs_write(outFile, _cost);
-
-    while (!(diff = PQSubtraction(Lc,V)).empty()){
-        Id pmin = _myArgMin(diff, q.value);     // pmin is the node with the minimum distance from query xq
-
-        V.insert(pmin);
-
-        unordered_set<Id> filteredNoutPmin;
-        if (mapKeyExists(pmin, this->Nout)){
-            filteredNoutPmin = this->filterSet(setSubtraction(this->Nout[pmin], V), q.category);
-            // _cost = 0;
-        }
-
-        // if should insert
-        for (const Id& neighbor : filteredNoutPmin){
-            if (Lc.size() < L){
-                // _cost += log(Lc.size());
-                Lc.push(neighbor);
-            }
-            else if (this->d(this->nodes[neighbor].value, q.value) < this->d(this->nodes[Lc.top()].value, q.value)){
-                Lc.pop();
-                // _cost += log(Lc.size());
-                Lc.push(neighbor);
-            }
+    ctx.visited.insert(s);
+    if (this->nodes[s].category == category) ctx.beam.insert(codeDist(s), s);
+
+    Id pmin;
+    while ((pmin = ctx.beam.next()) != -1){
+        ctx.expanded.push_back(pmin);
+        for (const Id& j : this->_readNeighbors(pmin, ctx.neighbors)){
+            if (this->nodes[j].category == category && ctx.visited.insert(j)) ctx.beam.insert(codeDist(j), j);
         }
-        // GS_costs_write(outFile, _cost);
-    }
-    
-    pair<unordered_set<Id>, unordered_set<Id>> ret;
-    
-    // _cost = Lc.size();
-    // GS_costs_write(outFile, _cost);
-
-    int Lsize = Lc.size();
-    for (int i = 0; i < Lsize - k; i++){
-        if (!Lc.empty()){ Lc.pop(); }
-    }
-
-    Lsize = Lc.size();
-    for (int i = 0; i < Lsize; i++){
-        ret.first.insert(Lc.top());
-        if (!Lc.empty()){ Lc.pop(); }
     }
-    ret.second = V;
 
-    // outFile.close();
-    // greedySearchCount++;
-    
-    return ret;
+    // the k results are the closest of the final L candidates by full precision distance
+    if (rerank) this->_rerank(xq, ctx);
+    this->_collectResults(k, ctx);
 }
 
-template <typename T>
-void DirectedGraph<T>::filteredRobustPrune(Id p, unordered_set<Id> V, float a, int R){
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::filteredRobustPrune(Id p, unordered_set<Id> V, float a, int R){
 
     c_log << "Filtered Robust Prune\n";
 
@@ -244,34 +209,66 @@ void DirectedGraph<T>::filteredRobustPrune(Id p, unordered_set<Id> V, float a, i
 
     if (this->nodes[p].empty()) { throw invalid_argument("No node was provided.\n"); }
 
-    if (mapKeyExists(p, this->Nout))
-        V.insert(this->Nout[p].begin(), this->Nout[p].end());
-    
+    this->_checkMutable();
+
+    // the candidates are V and the current out-neighbors of p, which are replaced by the selected ones at once (see robustPrune)
+    NeighborRange nout_p = this->Nout.neighbors(p);
+    V.insert(nout_p.begin(), nout_p.end());
     V.erase(p);
-    this->clearNeighbors(p);
 
-    while (!V.empty()){
-        Id pmin = this->_myArgMin(V, this->nodes[p].value);
-        this->addEdge(p, pmin);
+    vector<Id> candidates(V.begin(), V.end()), selected;
+    this->_filteredRobustPruneSelect(p, candidates, a, R, selected);
 
-        if (this->Nout[p].size() == R)  break;
+    this->_replaceNeighbors(p, selected);
+}
 
-        // pmin = p*, pv = p', p = p (as seen in paper)
-        // *it = pv
-        
-        // safe iteration on V for deletions
-        for (auto it = V.begin(); it != V.end(); /*no increment here*/){ // safe set iteration with mutable set during the iteration
-            if (this->nodes[*it].category == this->nodes[p].category && this->nodes[p].category != this->nodes[pmin].category) {it++; continue;}
-            if (a * this->d(this->nodes[pmin].value, this->nodes[*it].value) <= this->d(this->nodes[p].value, this->nodes[*it].value)){
-                it = V.erase(it); // it now points to the next element in the set
+// Filtered robust prune selection of the out-neighbors of p among the candidates
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_filteredRobustPruneSelect(Id p, vector<Id>& candidates, float a, int R, vector<Id>& selected){
+
+    selected.clear();
+
+    // distances of the candidates from p, computed once (in one batch)
+    vector<float> dist_p(candidates.size()), dist_min(candidates.size()), bounds;
+    this->distanceBatch(this->getRow(p), candidates.data(), candidates.size(), dist_p.data());
+
+    while (!candidates.empty()){
+
+        // pmin = candidate closest to p
+        int i_min = 0;
+        for (int i = 1; i < candidates.size(); i++){
+            if (dist_p[i] <= dist_p[i_min]) i_min = i;
+        }
+        Id pmin = candidates[i_min];
+        selected.push_back(pmin);
+
+        if ((int) selected.size() == R)  break;
+
+        // pmin = p*, pv = p', p = p (as seen in paper). Only the distances up to d(p, pv) / a decide a removal, the others are abandoned beyond it.
+        bounds.resize(candidates.size());
+        for (int i = 0; i < candidates.size(); i++) bounds[i] = dist_p[i] / a;
+        this->distanceBounded(this->getRow(pmin), candidates.data(), candidates.size(), bounds.data(), dist_min.data());
+
+        // keep pv unless a * d(p*, pv) <= d(p, pv), compacting the candidates in place (p* itself is removed: d(p*, p*) = 0)
+        int kept = 0;
+        for (int i = 0; i < candidates.size(); i++){
+            Id pv = candidates[i];
+            bool keep = (this->nodes[pv].category == this->nodes[p].category && this->nodes[p].category != this->nodes[pmin].category)
+                     || a * dist_min[i] > dist_p[i];
+
+            if (keep){
+                candidates[kept] = pv;
+                dist_p[kept] = dist_p[i];
+                kept++;
             }
-            else { it++; }
         }
+        candidates.resize(kept);
+        dist_p.resize(kept);
     }
 }
 
-template <typename T>
-bool DirectedGraph<T>::filteredVamanaAlgorithm(int L, int R, float a, float t){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::filteredVamanaAlgorithm(int L, int R, float a, float t){
 
     if (R <= 0){ throw invalid_argument("R must be a positive, non-zero integer.\n"); }
 
@@ -281,6 +278,8 @@ bool DirectedGraph<T>::filteredVamanaAlgorithm(int L, int R, float a, float t){
 
     if (t <= 0 || t > 1) { throw invalid_argument("Parameter t must be between (0,1]"); }
 
+    this->_checkMutable();
+
     if (this->nodes.size() == 1) return true;   // no edges possible
 
     c_log << "Filtered Vamana\n";
@@ -290,6 +289,9 @@ bool DirectedGraph<T>::filteredVamanaAlgorithm(int L, int R, float a, float t){
     if(this->clearEdges() == false)
         return false;
 
+    // R neighbors + the reverse edge added before pruning (see vamanaAlgorithm)
+    this->Nout.reserve(this->n_nodes, R + 1);
+
     if (args.n_threads == 1){
 
         vector<Id> nodes_ids(this->n_nodes);
@@ -328,36 +330,37 @@ bool DirectedGraph<T>::filteredVamanaAlgorithm(int L, int R, float a, float t){
     return rv;
 }
 
-template <typename T>
-bool DirectedGraph<T>::_serial_filteredVamana(int L, int  R, float a, float t, vector<Id>& perm){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_serial_filteredVamana(int L, int  R, float a, float t, vector<Id>& perm){
+
+    SearchContext ctx;      // reused by all the searches of the build
 
     for (Id& si_id : perm){
 
         Node<T> si = this->nodes[si_id];
 
-        // create query with si value to pass to filteredGreedySearch
-        Query<T> q(si.id, si.category, true, si.value, this->isEmpty);
-
-        unordered_set<Id> Vi = this->filteredGreedySearch(this->startingNode(q.category), q, 0, L).second;
+        // search with si's row in the vector store as the query (category of si)
+        this->_filteredGreedySearch(this->startingNode(si.category), this->getRow(si.id), si.category, 0, L, ctx);
+        unordered_set<Id> Vi(ctx.expanded.begin(), ctx.expanded.end());
 
         filteredRobustPrune(si.id, Vi, a, R);
 
-        if (mapKeyExists(si.id, this->Nout)){
-            
-            for (const Id j : this->Nout[si.id]){  // for every neighbor j of si
+        NeighborRange nout_si = this->Nout.neighbors(si.id);
+        vector<Id> noutCopy_si(nout_si.begin(), nout_si.end());    // copy: adding edges may re-layout the adjacency store
 
-                this->addEdge(j, si.id);   // does it in either case (simpler code, robust prune clears all neighbors after copying to candidate set V anyway)
-                int noutSize = this->Nout[j].size();
-                if (noutSize > R)
-                    filteredRobustPrune(j, this->Nout[j], a, R);
-            }
+        for (const Id j : noutCopy_si){  // for every neighbor j of si
+
+            this->addEdge(j, si.id);   // does it in either case (simpler code, robust prune clears all neighbors after copying to candidate set V anyway)
+            int noutSize = this->Nout.degree(j);
+            if (noutSize > R)
+                filteredRobustPrune(j, this->_neighborSet(j), a, R);
         }
     }
     return true;
 }
 
-template <typename T>
-bool DirectedGraph<T>::_parallel_filteredVamana(int L, int  R, float a, float t, vector<pair<int, vector<Id>>>& sorted_categories){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_parallel_filteredVamana(int L, int  R, float a, float t, vector<pair<int, vector<Id>>>& sorted_categories){
 
     int current_index = 0;
     mutex mx_index;
@@ -365,11 +368,12 @@ bool DirectedGraph<T>::_parallel_filteredVamana(int L, int  R, float a, float t,
     vector<thread> threads;
 
     vector<char> rvs(args.n_threads, true);   // return values of threads - actually bool type
+    vector<int> edges(args.n_threads, 0);     // change of the edge count by every thread
 
     if (!args.randomStart)
         this->findMedoids(t);   // pre-computing medoids for sync issues
 
-    this->Nout.reserve(this->n_nodes);  // avoid unnecessary rehashing
+    this->Nout.pin(true);     // the slots reserved by filteredVamanaAlgorithm are never re-laid out while the threads read them
 
     for (int i = 0; i < args.n_threads; i++){
 
@@ -383,12 +387,19 @@ bool DirectedGraph<T>::_parallel_filteredVamana(int L, int  R, float a, float t,
             ref(current_index),
             ref(mx_index),
             ref(rvs[i]),
-            ref(sorted_categories)));
+            ref(sorted_categories),
+            ref(edges[i])));
     }
 
     for (thread& th : threads)
         th.join();
 
+    this->Nout.pin(false);
+
+    int change = accumulate(edges.begin(), edges.end(), 0);
+    this->Nout.addEdgeCount(change);
+    this->n_edges += change;
+
     // Verify that all threads completed successfully
     for (bool rv : rvs){
         if (rv == false){
@@ -401,9 +412,14 @@ bool DirectedGraph<T>::_parallel_filteredVamana(int L, int  R, float a, float t,
 
 }
 
-template <typename T>
-void DirectedGraph<T>::_thread_filteredVamana_fn(int& L, int& R, float& a, float& t, int& current_index, mutex& mx, char& rv, vector<pair<int, vector<Id>>>& sorted_categories){
+// Thread function of the parallel filtered Vamana build. Every node is written under its own lock only (see _thread_Vamana_fn), in one
+// replace() or append(), and the edge count is added up per thread in edges.
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_thread_filteredVamana_fn(int& L, int& R, float& a, float& t, int& current_index, mutex& mx, char& rv, vector<pair<int, vector<Id>>>& sorted_categories, int& edges){
     
+    SearchContext ctx;      // reused by all the searches of the thread
+    vector<Id> candidates, selected, pruned;
+
     mx.lock();
     while(current_index < sorted_categories.size()){
         int my_index = current_index++;
@@ -415,23 +431,38 @@ void DirectedGraph<T>::_thread_filteredVamana_fn(int& L, int& R, float& a, float
 
             Node<T> si = this->nodes[si_id];
             
-            // create query with si value to pass to filteredGreedySearch
-            Query<T> q(si.id, si.category, true, si.value, this->isEmpty);
-
-            unordered_set<Id> Vi = this->filteredGreedySearch(this->startingNode(q.category), q, 0, L).second;
-
-            filteredRobustPrune(si.id, Vi, a, R);
-
-            if (mapKeyExists(si.id, this->Nout)){
-
-                for (const Id j : this->Nout[si.id]){  // for every neighbor j of si
+            // search with si's row in the vector store as the query (category of si)
+            this->_filteredGreedySearch(this->startingNode(si.category), this->getRow(si.id), si.category, 0, L, ctx);
+
+            // filtered robust prune of si on the expanded nodes and its current neighbors. The nodes of a category are written by the
+            // thread of the category only: the neighbors of si do not change meanwhile
+            candidates.assign(ctx.expanded.begin(), ctx.expanded.end());
+            NeighborRange nout_si = this->Nout.neighbors(si.id);
+            candidates.insert(candidates.end(), nout_si.begin(), nout_si.end());
+            sort(candidates.begin(), candidates.end());
+            candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+            candidates.erase(remove(candidates.begin(), candidates.end(), si.id), candidates.end());
+            this->_filteredRobustPruneSelect(si.id, candidates, a, R, selected);
+            {
+                NodeLockGuard lock(this->_node_locks, si.id);
+                edges += this->Nout.replace(si.id, selected.data(), selected.size());
+            }
 
-                    this->addEdge(j, si.id);   // does it in either case (simpler code, robust prune clears all neighbors after copying to candidate set V anyway)
-                    int noutSize = this->Nout[j].size();
-                    if (noutSize > R)
-                        filteredRobustPrune(j, this->Nout[j], a, R);
+            // reverse edges: every neighbor j of si gets the edge (j->si), and is pruned if it exceeds R neighbors
+            for (const Id j : selected){
+                NodeLockGuard lock(this->_node_locks, j);
+                if (this->Nout.contains(j, si.id)) continue;
 
+                if (this->Nout.degree(j) < R){
+                    edges += this->Nout.append(j, si.id);
+                    continue;
                 }
+
+                NeighborRange nout_j = this->Nout.neighbors(j);
+                candidates.assign(nout_j.begin(), nout_j.end());
+                candidates.push_back(si.id);
+                this->_filteredRobustPruneSelect(j, candidates, a, R, pruned);
+                edges += this->Nout.replace(j, pruned.data(), pruned.size());
             }
         }
         mx.lock();
@@ -440,8 +471,8 @@ void DirectedGraph<T>::_thread_filteredVamana_fn(int& L, int& R, float& a, float
 
 }
 
-template <typename T>
-bool DirectedGraph<T>::stitchedVamanaAlgorithm(int L, int Rstitched, int Rsmall, float a){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::stitchedVamanaAlgorithm(int L, int Rstitched, int Rsmall, float a){
 
     c_log << "Stitched Vamana\n";
 
@@ -455,6 +486,8 @@ bool DirectedGraph<T>::stitchedVamanaAlgorithm(int L, int Rstitched, int Rsmall,
 
     if (args.n_threads <= 0) throw invalid_argument("args.n_threads constant is invalid. Value must be args.n_threads >= 1.\n");
 
+    this->_checkMutable();
+
     int extraRandomEdges = args.extraRandomEdges;
     if (args.extraRandomEdges > 0) args.extraRandomEdges = 0;   // Vamana for specific category should not add additional random edges
 
@@ -480,20 +513,20 @@ bool DirectedGraph<T>::stitchedVamanaAlgorithm(int L, int Rstitched, int Rsmall,
     return rv;
 }
 
-template <typename T>
-bool DirectedGraph<T>::_serial_stitchedVamana(int L, int Rstitched, int Rsmall, float a){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_serial_stitchedVamana(int L, int Rstitched, int Rsmall, float a){
 
     // initialize G as an empty graph => clear all edges
     if(this->clearEdges() == false)
         return false;
 
-    DirectedGraph<T> DGf(this->d, this->isEmpty);
+    DirectedGraph<T, Distance> DGf(this->d, this->isEmpty);
     for (pair<int, unordered_set<Id>> cpair : this->categories){
         
         vector<Id> original_id;                         // a vector that maps DGf node ids to the original this ids
 
         for (Id node : cpair.second){
-            DGf.createNode(this->nodes[node].value);    // create nodes as unfiltered data (specific category)
+            DGf.createNode(this->getRow(node), this->vectors.dim());    // create nodes as unfiltered data (specific category)
             original_id.push_back(node);
         }
 
@@ -510,15 +543,14 @@ bool DirectedGraph<T>::_serial_stitchedVamana(int L, int Rstitched, int Rsmall,
         
         c_log << "Pruning.\n";
         for (Node<T>& node : DGf.nodes){
-            DGf.robustPrune(node.id, DGf.Nout[node.id], a, Rstitched);
+            DGf.robustPrune(node.id, DGf._neighborSet(node.id), a, Rstitched);
         }
         
         c_log << "Pruning complete.Stitching with main graph.\n";
 
         // union of edges: this->Nout ∪= DGf.Nout
-        for (pair<Id, unordered_set<Id>> edge : DGf.get_Nout()){
-            Id from = edge.first;
-            for (Id to : edge.second)
+        for (Id from = 0; from < DGf.n_nodes; ++from){
+            for (const Id& to : DGf.getNeighbors(from))
                 this->addEdge(original_id[from], original_id[to]);
         }
         this->filteredMedoids[cpair.first] = original_id[DGf.medoid()];
@@ -533,8 +565,8 @@ bool DirectedGraph<T>::_serial_stitchedVamana(int L, int Rstitched, int Rsmall,
 }
 
 
-template <typename T>
-void DirectedGraph<T>::_thread_stitchedVamana_fn(int& L, int& Rstitched, int& Rsmall, float& a, int& category_index, mutex& mx_category_index, mutex& mx_merge, vector<int>& category_names, char& rv){
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_thread_stitchedVamana_fn(int& L, int& Rstitched, int& Rsmall, float& a, int& category_index, mutex& mx_category_index, mutex& mx_merge, vector<int>& category_names, char& rv){
     
 
     mx_category_index.lock();
@@ -546,10 +578,10 @@ void DirectedGraph<T>::_thread_stitchedVamana_fn(int& L, int& Rstitched, int& Rs
 
         vector<Id> original_id;                         // a vector that maps DGf node ids to the original this ids
 
-        DirectedGraph<T> DGf(this->d, this->isEmpty);
+        DirectedGraph<T, Distance> DGf(this->d, this->isEmpty);
 
         for (Id node : this->categories[my_category]){
-            DGf.createNode(this->nodes[node].value);    // create nodes as unfiltered data (specific category)
+            DGf.createNode(this->getRow(node), this->vectors.dim());    // create nodes as unfiltered data (specific category)
             original_id.push_back(node);
         }
 
@@ -566,16 +598,15 @@ void DirectedGraph<T>::_thread_stitchedVamana_fn(int& L, int& Rstitched, int& Rs
 
         c_log << "Pruning.\n";
         for (Node<T>& node : DGf.nodes){
-            DGf.robustPrune(node.id, DGf.Nout[node.id], a, Rstitched);
+            DGf.robustPrune(node.id, DGf._neighborSet(node.id), a, Rstitched);
         }
 
         c_log << "Pruning complete.Stitching with main graph.\n";
         
         mx_merge.lock();
         // union of edges: this->Nout ∪= DGf.Nout
-        for (pair<Id, unordered_set<Id>> edge : DGf.get_Nout()){
-            Id from = edge.first;
-            for (Id to : edge.second)
+        for (Id from = 0; from < DGf.n_nodes; ++from){
+            for (const Id& to : DGf.getNeighbors(from))
                 this->addEdge(original_id[from], original_id[to]);
         }
         this->filteredMedoids[my_category] = original_id[DGf.medoid()];
@@ -592,8 +623,8 @@ void DirectedGraph<T>::_thread_stitchedVamana_fn(int& L, int& Rstitched, int& Rs
     mx_category_index.unlock();
 }
 
-template <typename T>
-bool DirectedGraph<T>::_parallel_stitchedVamana(int L, int Rstitched, int Rsmall, float a){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_parallel_stitchedVamana(int L, int Rstitched, int Rsmall, float a){
 
     // initialize G as an empty graph => clear all edges
     if(this->clearEdges() == false)
@@ -662,8 +693,8 @@ bool DirectedGraph<T>::_parallel_stitchedVamana(int L, int Rstitched, int Rsmall
     return true;
 }
 
-template <typename T>
-const Id DirectedGraph<T>::startingNode(optional<int> category){
+template <typename T, typename Distance>
+const Id DirectedGraph<T, Distance>::startingNode(optional<int> category){
 
     if (category == nullopt){  // category doesn't matter. Medoid or Sample from all nodes in graph
         if (args.randomStart) return sampleFromContainer(this->nodes).id;
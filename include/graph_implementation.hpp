@@ -5,14 +5,58 @@
 // This file implements member functions of the DirectedGraph class template declared in the types.hpp header file.
 
 // Creates a node, adds it in the graph and returns it
-template<typename T>
-Id DirectedGraph<T>::createNode(const T& value, int category){
-    // https://cplusplus.com/reference/set/set/insert/ - return values of insert
+template<typename T, typename Distance>
+Id DirectedGraph<T, Distance>::createNode(const T& value, int category){
 
-    Node<T> node(this->n_nodes, category, value, this->isEmpty);
+    // empty values are not stored: the node gets no row (Node::empty)
+    if (this->isEmpty(value)){
+        return this->createNode(nullptr, 0, category);
+    }
+
+    return this->createNode(value.data(), value.size(), category);
+}
+
+// Creates a node from dim raw values (copied into the vector store), adds it in the graph and returns it
+template<typename T, typename Distance>
+Id DirectedGraph<T, Distance>::createNode(const Elem* value, int dim, int category){
+
+    this->_checkMutable();
+
+    // the new value has no PQ or SQ code, and no fast-scan block
+    this->_pq.reset();
+    this->_sq.reset();
+    this->_fastscan.reset();
+
+    // copy the value into the next row of the contiguous storage (dim = 0 => node with empty value)
+    int row = -1;
+    if (dim > 0 && this->_metric == METRIC_MIPS){
+        // MIPS-to-L2 transform: with the extra coordinate every value has norm M, so |x - q|^2 = M^2 + |q|^2 - 2<x, q> for a query with a zero extra coordinate
+        if (this->_mips_norm < 0){ throw invalid_argument("The maximum norm of a MIPS graph must be set before creating nodes.\n"); }
+        vector<Elem> extended(value, value + dim);
+        float norm2 = row_innerProduct(value, value, dim);
+        extended.push_back((Elem) sqrt(max(0.0f, this->_mips_norm * this->_mips_norm - norm2)));
+        row = this->vectors.append(extended.data(), dim + 1);
+    }
+    else if (dim > 0){
+        row = this->vectors.append(value, dim);
+        if constexpr (is_floating_point<Elem>::value){
+            if (this->_metric == METRIC_COSINE) normalizeRow(this->vectors.row(row), dim);
+        }
+    }
+
+    // the values of a rotated graph are stored in principal component order
+    if constexpr (is_same<Elem, float>::value){
+        if (row >= 0 && this->_pca != nullptr) this->_pca->rotate(this->vectors.row(row), this->vectors.row(row));
+    }
+
+    // the sketches follow the rows of the vector store
+    if (row >= 0 && this->_sketch != nullptr) this->_sketch->append(this->vectors.row(row));
+
+    Node<T> node(this->n_nodes, category, row);
 
     // Add the value to graph's set of nodes
     this->nodes.push_back(node);
+    this->Nout.addNode();
 
     // if is valid category, add node belonging to it to corresponding map entry
     if (category >= 0) this->categories[category].insert(node.id);
@@ -25,13 +69,11 @@ Id DirectedGraph<T>::createNode(const T& value, int category){
 }
 
 // Adds a directed edge (from->to). Updates outNeighbors(from) and inNeighbors(to)
-template <typename T>
-bool DirectedGraph<T>::addEdge(const Id from, const Id to, optional<bool> noLock){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::addEdge(const Id from, const Id to){
+
+    this->_checkMutable();
 
-    // extract the noLock value and initialize accordingly
-    bool no_lock = (noLock == nullopt) ? false : noLock.value();
-    unique_lock<mutex> _lock(this->_mx_edges, defer_lock);  // defer_lock => initialize unlocked.
-    
     // At least one of the nodes is not present in nodeSet
     if (from >= this->n_nodes || to >= this->n_nodes){
         c_log << "Node is not present in nodeSet" << '\n';
@@ -44,50 +86,36 @@ bool DirectedGraph<T>::addEdge(const Id from, const Id to, optional<bool> noLock
         return false;
     }
 
-    if (args.n_threads > 1 && !no_lock){
-        _lock.lock();
-    }
+    NodeLockGuard node_lock(this->_node_locks, from, args.n_threads > 1);     // concurrent searches read the neighbors of from optimistically
 
-    int previous_size = this->Nout[from].size(); 
-    if (previous_size == 0) this->Nout[from].reserve(args.R + 1);   // reserve space to avoid rehashing and unnecessary race conditions
-    this->Nout[from].insert(to);
-    int next_size = this->Nout[from].size(); 
-
-    if(next_size == previous_size){
+    if(!this->Nout.insert(from, to)){
         c_log << "Cannot add edge. Edge already exists" << '\n';
 
         return false;
     }
     else this->n_edges++;
 
+    // the fast-scan blocks hold the previous neighbors
+    this->_fastscan.reset();
+
     return true;
 }
 
 // remove edge
-template <typename T>
-bool DirectedGraph<T>::removeEdge(const Id from, const Id to, optional<bool> noLock){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::removeEdge(const Id from, const Id to){
 
-    // extract the noLock value and initialize accordingly
-    bool no_lock = (noLock == nullopt) ? false : noLock.value();
-    unique_lock<mutex> _lock(this->_mx_edges, defer_lock);  // defer_lock => initialize unlocked.
+    this->_checkMutable();
 
-    if (args.n_threads > 1 && no_lock != true){
-        _lock.lock();
-    }
+    NodeLockGuard node_lock(this->_node_locks, from, args.n_threads > 1);
 
-    // Check if keys exist before accessing them (and removing them)
-    if (mapKeyExists(from, this->Nout)) {
-        // Key exists, access the value, if successfully removed, return true
-        if(this->Nout[from].erase(to)){
-            // Check if outgoing neighbors are empty, if so, remove entry from unordered map
-            if(this->Nout[from].empty()){
-                this->Nout.erase(from);
-            }
-            // Decrement the number of edges in graph
-            this->n_edges--;
+    // Check if node exists before accessing it, if the edge is successfully removed, return true
+    if (from >= 0 && from < this->n_nodes && this->Nout.erase(from, to)) {
+        // Decrement the number of edges in graph
+        this->n_edges--;
+        this->_fastscan.reset();
 
-            return true;
-        }
+        return true;
     }
 
     c_log << "WARNING: Trying to remove non-existing edge.\n" << '\n';
@@ -95,42 +123,28 @@ bool DirectedGraph<T>::removeEdge(const Id from, const Id to, optional<bool> noL
 }
 
 // clears all neighbors for a specific node
-template <typename T>
-bool DirectedGraph<T>::clearNeighbors(const Id id){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::clearNeighbors(const Id id){
+    this->_checkMutable();
+
     // Check if node exists before trying to access it
     if (id >= this->n_nodes){
         c_log << "ERROR: Node does not exist in the graph" << '\n';
         return false;
     }
 
-    unique_lock<mutex> _lock(this->_mx_edges, defer_lock);
-    if (args.n_threads > 1)
-        _lock.lock();
+    NodeLockGuard node_lock(this->_node_locks, id, args.n_threads > 1);
 
-    // Node has outgoing neighbors
-    if (mapKeyExists(id, this->Nout)){
-        // For each outgoing neighbor, remove the edge
-        unordered_set<Id> noutCopy(this->Nout[id].begin(), this->Nout[id].end());
+    // Drop the whole neighbor block of the node at once
+    this->n_edges -= this->Nout.clear(id);
+    this->_fastscan.reset();
 
-        for (const Id n : noutCopy){      
-            if (!this->removeEdge(id,n,true)){  // always call removeEdge with noLock = true. If parallel we have the lock, else (serial) lock is not needed
-                c_log << "ERROR: Failed to remove edge, something went wrong" << '\n';
-                return false;
-            }          
-        }      
-        // Check if node has been removed from neighbors map
-        if (mapKeyExists(id, this->Nout)){
-            
-            c_log << "ERROR: Something went wrong when clearing neighbors" << '\n';
-            return false;
-        }
-    }
     return true;
 }
 
 // Adds all nodes in the batch vector to as outgoing neighbors from specific node
-template <typename T>
-bool DirectedGraph<T>::addBatchNeigbors(const Id from, vector<Id> batch){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::addBatchNeigbors(const Id from, vector<Id> batch){
 
     // argument checks
     if (batch.empty()){
@@ -143,13 +157,9 @@ bool DirectedGraph<T>::addBatchNeigbors(const Id from, vector<Id> batch){
         return false;
     }
 
-    unique_lock<mutex> _lock(this->_mx_edges, defer_lock);
-    if (args.n_threads > 1)
-        _lock.lock();
-
     bool rv = true;
     for (const Id& to : batch){
-        if (!this->addEdge(from, to, true))
+        if (!this->addEdge(from, to))
             rv = false;
     }
 
@@ -157,8 +167,8 @@ bool DirectedGraph<T>::addBatchNeigbors(const Id from, vector<Id> batch){
 }
 
 // clears all edges in the graph
-template <typename T>
-bool DirectedGraph<T>::clearEdges(void){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::clearEdges(void){
     if (this->n_nodes){
         for (Node<T> node : this->nodes){
             if (!this->clearNeighbors(node.id)){
@@ -168,7 +178,7 @@ bool DirectedGraph<T>::clearEdges(void){
         }
     }
 
-    if (this->n_edges != 0 || !this->Nout.empty()){
+    if (this->n_edges != 0 || this->Nout.n_edges() != 0){
         c_log << "ERROR: Failed to clear edges in graph" << '\n';
         return false;
     }
@@ -177,14 +187,84 @@ bool DirectedGraph<T>::clearEdges(void){
 }
 
 
+// Return a snapshot of the out-neighbors as a map (key: node, value: set of outgoing neighbors). Nodes without out-neighbors are omitted.
+template <typename T, typename Distance>
+unordered_map<Id, unordered_set<Id>> DirectedGraph<T, Distance>::get_Nout() const {
+    unordered_map<Id, unordered_set<Id>> nout;
+    for (int i = 0; i < this->n_nodes; i++){
+        NeighborRange nb = this->Nout.neighbors(i);
+        if (!nb.empty()) nout[i] = unordered_set<Id>(nb.begin(), nb.end());
+    }
+    return nout;
+}
+
+// Return a copy of the value of a node (empty if the node has an empty value)
+template <typename T, typename Distance>
+T DirectedGraph<T, Distance>::getValue(Id id) const {
+    if (this->nodes[id].row < 0) { return T(); }
+    const Elem* row = this->getRow(id);
+    return T(row, row + this->vectors.dim());
+}
+
+// Copies a value of type T into an aligned, zero-padded row that can be passed to the row distance function (transformed for the metric like the values)
+template <typename T, typename Distance>
+AlignedRow<typename DirectedGraph<T, Distance>::Elem> DirectedGraph<T, Distance>::_padQuery(const T& xq) const {
+
+    AlignedRow<Elem> row(this->vectors.paddedDim());
+    this->_padQuery(xq.data(), xq.size(), row.data());
+    if constexpr (is_same<Elem, float>::value){
+        if (this->_pca != nullptr) this->_pca->rotate(row.data(), row.data());
+    }
+    return row;
+}
+
+// Copies the query xq (dim values) into the aligned row of the search context, padded and transformed like by _padQuery(const T&), without allocations
+template <typename T, typename Distance>
+const typename DirectedGraph<T, Distance>::Elem* DirectedGraph<T, Distance>::_padQuery(const Elem* xq, int dim, SearchContext& ctx) const {
+
+    // a rotated query is padded into the second half of the buffer, then rotated into the first half
+    int padded = this->vectors.paddedDim();
+    Elem* row = ctx.queryRow<Elem>(2 * padded);
+    if constexpr (is_same<Elem, float>::value){
+        if (this->_pca != nullptr){
+            this->_padQuery(xq, dim, row + padded);
+            this->_pca->rotate(row + padded, row);
+            memset(row + this->vectors.dim(), 0, (padded - this->vectors.dim()) * sizeof(Elem));
+            return row;
+        }
+    }
+    this->_padQuery(xq, dim, row);
+    return row;
+}
+
+// Copies the query xq (dim values) into the zero-padded row out, transformed for the metric (but not rotated)
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_padQuery(const Elem* xq, int dim, Elem* out) const {
+
+    // the queries of a MIPS graph may leave out the extra coordinate (it is zero for queries)
+    bool mips_query = this->_metric == METRIC_MIPS && dim + 1 == this->vectors.dim();
+    if (dim != this->vectors.dim() && !mips_query){ throw invalid_argument("Dimension Mismatch between Arguments"); }
+
+    if (mips_query){
+        memcpy(out, xq, dim * sizeof(Elem));
+        memset(out + dim, 0, (this->vectors.paddedDim() - dim) * sizeof(Elem));
+    }
+    else this->vectors.pad(xq, out);
+
+    if constexpr (is_floating_point<Elem>::value){
+        if (this->_metric == METRIC_COSINE) normalizeRow(out, this->vectors.dim());
+    }
+}
+
+
 // Implementation of already declared Graph Template: Vamana Indexing Dependencies ------------------------- //
 
 
 // ------------------------------------------------------------------------------------------------ MEDOID
 
 // Calculates the medoid of the nodes in the graph based on the given distance function
-template<typename T>
-const Id DirectedGraph<T>::medoid(optional<vector<Node<T>>> nodes_arg, optional<bool> update_stored){
+template<typename T, typename Distance>
+const Id DirectedGraph<T, Distance>::medoid(optional<vector<Node<T>>> nodes_arg, optional<bool> update_stored){
     c_log << "Medoid\n";
 
     // unrwapping from the "optional" template with appropriate values
@@ -240,20 +320,117 @@ const Id DirectedGraph<T>::medoid(optional<vector<Node<T>>> nodes_arg, optional<
     
 }
 
+// Sum of the distances from a node to the given nodes, or a partial sum greater than bound (two tiers on rotated graphs)
+template<typename T, typename Distance>
+float DirectedGraph<T, Distance>::_sumOfDistances(Id id, const vector<Node<T>>& nodes, float bound){
+
+    float dsum = 0;
+
+    if constexpr (HasBoundedDistance<Distance, Elem>::value){
+        if (this->_pca != nullptr){
+            // the sum on the leading coordinates is a lower bound of the whole sum: the rest of the rows is only read if it does not exceed bound
+            int leading = this->_pca->leading(), dim = this->vectors.dim();
+            const Elem* row = this->getRow(id);
+            for (const Node<T>& other_node : nodes) dsum += this->d(row, this->getRow(other_node.id), leading);
+            if (dsum > bound) return dsum;
+            for (const Node<T>& other_node : nodes) dsum += this->d(row + leading, this->getRow(other_node.id) + leading, dim - leading);
+            return dsum;
+        }
+    }
+
+    // we don't need to check if the other element is the same, because one's distance to itself is zero
+    for (const Node<T>& other_node : nodes) dsum += this->_dist(id, other_node.id);
+    return dsum;
+}
+
+// Adds the sums of the distances from every node to all the nodes into sums (n values), through tiles of the many-to-many kernels of the
+// distance policy: DISTANCE_TILE_QUERIES nodes against distanceTileRows(dim) nodes at a time, instead of one pair at a time.
+// The distances are symmetric: only the tiles on and above the diagonal are computed, and each distance is added to the sums of both of its
+// nodes. Only the row tiles first_tile, first_tile + tile_step, ... are computed (one stripe of _tiledMedoid: every tile_step-th row tile,
+// so that the shrinking rows of the triangle are spread evenly).
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_tileDistanceSums(const vector<Node<T>>& nodes, int first_tile, int tile_step, vector<float>& sums){
+
+    int n = nodes.size(), dim = this->vectors.dim();
+    vector<const Elem*> rows(n);
+    for (int i = 0; i < n; i++) rows[i] = this->getRow(nodes[i].id);
+
+    vector<float> norms(n);
+    if constexpr (is_same<Elem, float>::value) rowNorms(rows.data(), n, dim, norms.data());
+
+    int tile = distanceTileRows(dim);
+    vector<float> distances((size_t) DISTANCE_TILE_QUERIES * tile);
+    sums.assign(n, 0.0f);
+
+    for (int i0 = first_tile * DISTANCE_TILE_QUERIES; i0 < n; i0 += tile_step * DISTANCE_TILE_QUERIES){
+        int m = min(DISTANCE_TILE_QUERIES, n - i0);
+        for (int j0 = i0; j0 < n; j0 += tile){
+            int nb = min(tile, n - j0);
+            distanceMatrixRows(this->d, rows.data() + i0, norms.data() + i0, m, rows.data() + j0, norms.data() + j0, nb, dim, distances.data());
+            for (int i = 0; i < m; i++){
+                const float* row = distances.data() + (size_t) i * nb;
+                float dsum = 0;
+                // the pairs j <= i of the diagonal tiles are counted from the other node (or are the node itself)
+                for (int j = max(0, i0 + i + 1 - j0); j < nb; j++){
+                    dsum += row[j];
+                    sums[j0 + j] += row[j];
+                }
+                sums[i0 + i] += dsum;
+            }
+        }
+    }
+}
+
+// Medoid through the sums of the tiles of the upper triangle of the distances (see _tileDistanceSums).
+// The row tiles are split into the same stripes whatever the number of threads (every MEDOID_TILE_STRIPES-th tile), each stripe is summed
+// into its own partial sums by one of n_threads threads, and the partial sums are added up in stripe order: the float additions, and so the
+// medoid, are the same on any number of threads (the batch build relies on it, see _batch_Vamana).
+template<typename T, typename Distance>
+const Id DirectedGraph<T, Distance>::_tiledMedoid(vector<Node<T>>& nodes, int n_threads){
+
+    int n = nodes.size();
+    int n_stripes = min(MEDOID_TILE_STRIPES, (n + DISTANCE_TILE_QUERIES - 1) / DISTANCE_TILE_QUERIES);
+    n_threads = max(1, min(n_threads, n_stripes));
+
+    vector<vector<float>> sums(n_stripes);
+    auto stripes_fn = [&](int first_stripe){
+        for (int s = first_stripe; s < n_stripes; s += n_threads) this->_tileDistanceSums(nodes, s, n_stripes, sums[s]);
+    };
+
+    if (n_threads == 1) stripes_fn(0);
+    else{
+        vector<thread> threads;
+        for (int i = 0; i < n_threads; i++) threads.push_back(thread(stripes_fn, i));
+        for (thread& th : threads){ th.join(); }
+    }
+
+    Id med;
+    float dmin = numeric_limits<float>::max();
+    for (int j = 0; j < n; j++){
+        float dsum = 0;
+        for (const vector<float>& stripe_sums : sums) dsum += stripe_sums[j];
+        if (dsum < dmin){
+            dmin = dsum;
+            med = nodes[j].id;
+        }
+    }
+    return med;
+}
+
 // Implements medoid function using serial programming.
-template<typename T>
-const Id DirectedGraph<T>::_serial_medoid(vector<Node<T>>& nodes){
+template<typename T, typename Distance>
+const Id DirectedGraph<T, Distance>::_serial_medoid(vector<Node<T>>& nodes){
 
     Id med;
     float dmin = numeric_limits<float>::max(), dsum, dist;
 
-    for (const Node<T>& node : nodes){
-        dsum = 0;
+    // rotated graphs sum the distances in two tiers instead (see _sumOfDistances): most nodes are discarded on their leading coordinates
+    if constexpr (HasMatrixDistance<Distance, Elem>::value){
+        if (this->_pca == nullptr) return this->_tiledMedoid(nodes, 1);
+    }
 
-        for (const Node<T>& other_node : nodes){
-            // we don't need to check if the other element is the same, because one's distance to itself is zero
-            dsum += this->d(node.value, other_node.value);
-        }
+    for (const Node<T>& node : nodes){
+        dsum = this->_sumOfDistances(node.id, nodes, dmin);
 
         // updating best medoid if current total distance is smaller than the minimum total distance yet
         if (dsum < dmin){
@@ -265,8 +442,8 @@ const Id DirectedGraph<T>::_serial_medoid(vector<Node<T>>& nodes){
 }
 
 // Thread function for parallel medoid. Work inside the range defined by [start_index, end_index). Update minima by reference for the merging of the results.
-template<typename T>
-void DirectedGraph<T>::_thread_medoid_fn(vector<Node<T>>& nodes, int start_index, int end_index, Id& local_minimum, float& local_dmin){
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_thread_medoid_fn(vector<Node<T>>& nodes, int start_index, int end_index, Id& local_minimum, float& local_dmin){
 
     // There is no need for synchronization between threads, as the shared resources (nodes) is accessed in a read-only manner.
 
@@ -274,11 +451,8 @@ void DirectedGraph<T>::_thread_medoid_fn(vector<Node<T>>& nodes, int start_index
     float dsum, dist;
 
     for (int i = start_index; i < end_index; i++){
-        dsum = 0;
         const Node<T>& node = nodes[i];
-        // we don't need to check if the other element is the same, because one's distance to itself is zero
-        for (const Node<T>& other_node : nodes)
-            dsum += this->d(node.value, other_node.value);
+        dsum = this->_sumOfDistances(node.id, nodes, local_dmin);
 
         // updating best medoid if current total distance is smaller than the minimum total distance yet in the working range
         if (dsum < local_dmin){
@@ -289,8 +463,13 @@ void DirectedGraph<T>::_thread_medoid_fn(vector<Node<T>>& nodes, int start_index
 }
 
 // Implements medoid function using parallel programming with threads. Concurrency is set by the global constant args.n_threads.
-template<typename T>
-const Id DirectedGraph<T>::_parallel_medoid(vector<Node<T>>& nodes){
+template<typename T, typename Distance>
+const Id DirectedGraph<T, Distance>::_parallel_medoid(vector<Node<T>>& nodes){
+
+    // rotated graphs sum the distances in two tiers instead (see _sumOfDistances)
+    if constexpr (HasMatrixDistance<Distance, Elem>::value){
+        if (this->_pca == nullptr) return this->_tiledMedoid(nodes, args.n_threads);
+    }
 
     int chunk_size = nodes.size() / args.n_threads;          // how many nodes each thread will handle
     int remainder = nodes.size() - args.n_threads*chunk_size;      // amount of remaining nodes to be distributed evenly among threads
@@ -329,9 +508,53 @@ const Id DirectedGraph<T>::_parallel_medoid(vector<Node<T>>& nodes){
     return local_minima[min_index];
 }
 
+// Computes the distances from the padded row xq to the values of the n nodes ids[0..n) into out[0..n), DISTANCE_BATCH_SIZE rows per kernel call
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::distanceBatch(const Elem* xq, const Id* ids, int n, float* out){
+
+    const Elem* rows[DISTANCE_BATCH_SIZE];
+
+    for (int first = 0; first < n; first += DISTANCE_BATCH_SIZE){
+        int count = min(DISTANCE_BATCH_SIZE, n - first);
+        for (int i = 0; i < count; i++) rows[i] = this->getRow(ids[first + i]);
+        distanceBatchRows(this->d, xq, rows, count, this->vectors.dim(), out + first);
+    }
+}
+
+// Computes the bounded distances from the padded row xq to the values of the n nodes ids[0..n), DISTANCE_BATCH_SIZE rows per kernel call
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::distanceBounded(const Elem* xq, const Id* ids, int n, const float* bounds, float* out){
+
+    const Elem* rows[DISTANCE_BATCH_SIZE];
+
+    if constexpr (HasBoundedDistance<Distance, Elem>::value){
+        if (this->_pca != nullptr){
+            // two tiers on a rotated graph: the distances on the leading coordinates in one batch, finished on the rest of the rows within their bounds
+            int leading = this->_pca->leading(), dim = this->vectors.dim();
+            for (int first = 0; first < n; first += DISTANCE_BATCH_SIZE){
+                int count = min(DISTANCE_BATCH_SIZE, n - first);
+                for (int i = 0; i < count; i++) rows[i] = this->getRow(ids[first + i]);
+                distanceBatchRows(this->d, xq, rows, count, leading, out + first);
+                for (int i = 0; i < count; i++){
+                    if (out[first + i] <= bounds[first + i]) out[first + i] += this->d(rows[i] + leading, xq + leading, dim - leading);
+                }
+            }
+            return;
+        }
+    }
+
+    if (!args.earlyAbandon) return this->distanceBatch(xq, ids, n, out);
+
+    for (int first = 0; first < n; first += DISTANCE_BATCH_SIZE){
+        int count = min(DISTANCE_BATCH_SIZE, n - first);
+        for (int i = 0; i < count; i++) rows[i] = this->getRow(ids[first + i]);
+        distanceBoundedRows(this->d, xq, rows, count, this->vectors.dim(), bounds + first, out + first);
+    }
+}
+
 // Returns the node from given nodeSet with the minimum distance from a specific point in the nodespace (node is allowed to not exist in the graph)
-template<typename T>
-Id DirectedGraph<T>::_myArgMin(const unordered_set<Id>& nodeSet, T t){
+template<typename T, typename Distance>
+Id DirectedGraph<T, Distance>::_myArgMin(const unordered_set<Id>& nodeSet, T t){
 
     if (nodeSet.empty()) { throw invalid_argument("Set is Empty.\n"); }
 
@@ -339,23 +562,37 @@ Id DirectedGraph<T>::_myArgMin(const unordered_set<Id>& nodeSet, T t){
 
     if (nodeSet.size() == 1) { return *nodeSet.begin(); }
 
-    float minDist = numeric_limits<float>::max(), dist;
+    return this->_myArgMin(nodeSet, this->_padQuery(t).data());
+}
+
+// Returns the node from given nodeSet with the minimum distance from a padded row
+template<typename T, typename Distance>
+Id DirectedGraph<T, Distance>::_myArgMin(const unordered_set<Id>& nodeSet, const Elem* t){
+
+    if (nodeSet.empty()) { throw invalid_argument("Set is Empty.\n"); }
+
+    if (nodeSet.size() == 1) { return *nodeSet.begin(); }
+
+    // distances to all the nodes of the set in one batch
+    vector<Id> ids(nodeSet.begin(), nodeSet.end());
+    vector<float> dists(ids.size());
+    this->distanceBatch(t, ids.data(), ids.size(), dists.data());
+
+    float minDist = numeric_limits<float>::max();
     Id minId;
 
-    for (const Id id : nodeSet){
-        dist = this->d(this->nodes[id].value, t);
-       
-        if (dist <= minDist){    // New minimum distance found
-            minId = id;
-            minDist = dist;
+    for (int i = 0; i < ids.size(); i++){
+        if (dists[i] <= minDist){    // New minimum distance found
+            minId = ids[i];
+            minDist = dists[i];
         }
     }
     return minId;
 }
 
 // Retains the N closest elements of S to X based on distance d
-template<typename T>
-unordered_set<Id> DirectedGraph<T>::_closestN(int N, const unordered_set<Id>& S, T X){
+template<typename T, typename Distance>
+unordered_set<Id> DirectedGraph<T, Distance>::_closestN(int N, const unordered_set<Id>& S, T X){
 
     // check if the set is empty
     if (S.empty()){
@@ -380,15 +617,32 @@ unordered_set<Id> DirectedGraph<T>::_closestN(int N, const unordered_set<Id>& S,
     if(N >= S.size())
         return S;
 
-    // transform the set to a vector for partitioning around a pivot
-    vector<Id> Svec(S.begin(), S.end());
+    return this->_closestN(N, S, this->_padQuery(X).data());
+}
+
+// Retains the N closest elements of S to the padded row X based on distance d
+template<typename T, typename Distance>
+unordered_set<Id> DirectedGraph<T, Distance>::_closestN(int N, const unordered_set<Id>& S, const Elem* X){
+
+    if (N < 0){ throw invalid_argument("N must be greater than 0.\n"); }
 
-    // DistanceFromPointComparator<T> comparator(X, ASCENDING, this->d, cref(this->nodes));
+    if (N == 0){ return unordered_set<Id>(); }
+
+    // if N is greater than the set size, return the whole set
+    if(N >= S.size())
+        return S;
+
+    // transform the set to a vector for partitioning around a pivot, computing every distance from X once (in one batch)
+    vector<Id> ids(S.begin(), S.end());
+    vector<float> dists(ids.size());
+    this->distanceBatch(X, ids.data(), ids.size(), dists.data());
+
+    vector<pair<float, Id>> Svec(ids.size());
+    for (int i = 0; i < ids.size(); i++) Svec[i] = {dists[i], ids[i]};
 
     // partition the vector based on the distance from point X up around the N-th element
     nth_element(Svec.begin(), Svec.begin() + N, Svec.end(),
-                [X,this] (int id1, int id2) {return (this->d(X, this->nodes[id1].value) < d(X, this->nodes[id2].value));});
-                // lambda(id1,id2) = determines which of the two points corresponding to id1 and id2 is closest to X given metric distance d.
+                [] (const pair<float, Id>& p1, const pair<float, Id>& p2) {return p1.first < p2.first;});
 
 
     // the vector after the use of nth_element has the following properties:
@@ -398,7 +652,8 @@ unordered_set<Id> DirectedGraph<T>::_closestN(int N, const unordered_set<Id>& S,
     // https://en.cppreference.com/w/cpp/algorithm/nth_element
 
     // keep N first
-    unordered_set<Id> closest_nodes(Svec.begin(), Svec.begin() + N);
+    unordered_set<Id> closest_nodes;
+    for (int i = 0; i < N; i++) closest_nodes.insert(Svec[i].second);
 
     return closest_nodes;
 }
@@ -407,8 +662,8 @@ unordered_set<Id> DirectedGraph<T>::_closestN(int N, const unordered_set<Id>& S,
 // ------------------------------------------------------------------------------------------------ RGRAPH
 
 // adds R randomly selected outgoing neighbors for each node in the graph. Return TRUE if successful, FALSE otherwise
-template <typename T>
-bool DirectedGraph<T>::Rgraph(int R){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::Rgraph(int R){
 
     if (R < 0) { throw invalid_argument("R must be a positive integer.\n"); }
 
@@ -420,6 +675,10 @@ bool DirectedGraph<T>::Rgraph(int R){
 
     if (expected_total_edges > fully_connected_capacity) { throw invalid_argument("Total number of edges would exceed the fully connected capacity.\n"); }
 
+    this->_checkMutable();
+
+    this->Nout.reserve(this->n_nodes, this->Nout.maxDegree() + R);     // every node gains up to R neighbors
+
     if (R <= log(this->n_nodes)){ c_log << "WARNING: R <= logn and therefore the graph will not be well connected.\n"; }
     
     if (R == 0){ c_log << "WARNING: R is set to 0. No edges will be added.\n"; }
@@ -428,8 +687,8 @@ bool DirectedGraph<T>::Rgraph(int R){
     else{ return _parallel_Rgraph(R); }
 }
 
-template<typename T>
-bool DirectedGraph<T>::_serial_Rgraph(int R){
+template<typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_serial_Rgraph(int R){
 
     for (Node<T>& n : this->nodes){     // for each node
         for (int i = 0; i < R; i++){    // repeat R times: sample from set and add until valid
@@ -446,8 +705,8 @@ bool DirectedGraph<T>::_serial_Rgraph(int R){
     return true;
 }
 
-template<typename T>
-bool DirectedGraph<T>::_parallel_Rgraph(int R){
+template<typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_parallel_Rgraph(int R){
     int node_index = 0;
     mutex mx_index;
 
@@ -455,6 +714,7 @@ bool DirectedGraph<T>::_parallel_Rgraph(int R){
 
     vector<char> rvs(args.n_threads, true);   // return values of threads - actually bool type
 
+    this->Nout.pin(true);     // Rgraph reserved the slots of the new edges
     for (int i = 0; i < args.n_threads; i++){
 
         threads.push_back(thread(
@@ -468,7 +728,7 @@ bool DirectedGraph<T>::_parallel_Rgraph(int R){
 
     for (thread& th : threads)
         th.join();
-
+    this->Nout.pin(false);
 
     for (bool rv : rvs){
         if (rv == false){
@@ -482,8 +742,8 @@ bool DirectedGraph<T>::_parallel_Rgraph(int R){
 
 }
 
-template<typename T>
-void DirectedGraph<T>::_thread_Rgraph_fn(int& R, int& node_index, mutex& mx_index, char& rv){
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_thread_Rgraph_fn(int& R, int& node_index, mutex& mx_index, char& rv){
 
     mx_index.lock();
     while(node_index < this->n_nodes){
@@ -527,173 +787,432 @@ void DirectedGraph<T>::_thread_Rgraph_fn(int& R, int& node_index, mutex& mx_inde
 
 // Greedily searches the graph for the k nearest neighbors of query xq (in an area of size L), starting the search from the node s.
 // Returns a set with the k closest neighbors (returned_vector[0]) and a set of all visited nodes (returned_vector[1]).
-template <typename T>
-const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T>::greedySearch(Id s, T xq, int k, int L) {
+template <typename T, typename Distance>
+const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T, Distance>::greedySearch(Id s, const T& xq, int k, int L) {
 
     c_log << "Greedy Search\n";
 
+    if (this->isEmpty(xq)){ throw invalid_argument("No query was provided.\n"); }
+
+    SearchContext& ctx = searchContext();
+    this->search(s, xq.data(), xq.size(), k, L, ctx);
+    return this->_searchSets(ctx);
+}
+
+// Greedily searches the graph for the k nearest neighbors of query xq, returns them with their distances by increasing distance
+template <typename T, typename Distance>
+vector<pair<Id, float>> DirectedGraph<T, Distance>::greedySearchRanked(Id s, const T& xq, int k, int L) {
+
+    if (this->isEmpty(xq)){ throw invalid_argument("No query was provided.\n"); }
+
+    SearchContext& ctx = searchContext();
+    this->search(s, xq.data(), xq.size(), k, L, ctx);
+    return ctx.results;
+}
+
+// Greedy Search of the query row xq (dim values) on the search context ctx
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::search(Id s, const Elem* xq, int dim, int k, int L, SearchContext& ctx, int category){
+
     // argument checks
     if (s < 0 || s >= this->n_nodes){ throw invalid_argument("Invalid Index was provided.\n"); }
 
     if (this->nodes[s].empty()){ throw invalid_argument("No start node was provided.\n"); }
 
-    if (this->isEmpty(xq)){ throw invalid_argument("No query was provided.\n"); }
+    if (xq == nullptr || dim <= 0){ throw invalid_argument("No query was provided.\n"); }
 
     if (k < 0){ throw invalid_argument("K must be greater than or equal to 0.\n"); }
 
     if (L < k){ throw invalid_argument("L must be greater or equal to K.\n"); }
 
-    if (args.n_threads > 1){
+    const Elem* row = this->_padQuery(xq, dim, ctx);
+    if (category >= 0) this->_filteredGreedySearch(s, row, category, k, L, ctx);
+    else this->_greedySearch(s, row, k, L, ctx);
+}
 
+// Greedy Search on a padded query row (e.g. a row of the vector store)
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_greedySearch(Id s, const Elem* xq, int k, int L, SearchContext& ctx) {
 
-        unique_lock<mutex> _lock(this->_mx_cv);
-        while(this->_active_W == true){
-            this->_cv_reader.wait(_lock);
-        }
-        this->_active_GS++;
-        this->_cv_reader.notify_all();
+    if (this->_pq != nullptr || this->_sq != nullptr){
+        this->_withCodeDistance(xq, ctx, [&](const auto& codeDist, bool rerank) { this->_compressedGreedySearch(s, xq, k, L, codeDist, rerank, ctx); });
+    }
+    else this->_beam_greedySearch(s, xq, k, L, ctx);
+}
 
-    } // end of RAII scope => invalidation of _lock, and therefore releasing lock on mutex (automatically)
+// Beam Greedy Search
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_beam_greedySearch(Id s, const Elem* xq, int k, int L, SearchContext& ctx){
+
+    // The candidate list is the beam of the context (sorted by distance from xq, every distance is computed once), and every node is
+    // considered at most once (visited), so that its distance is not computed again and the beam holds distinct candidates.
+    SearchBeam& beam = ctx.beam;
+    VisitedTable& visited = ctx.visited;
+    beam.reset(L);
+    visited.reset(this->n_nodes);
+    ctx.expanded.clear();
+
+    // Initialize the beam with s
+    float ds;
+    this->distanceBatch(xq, &s, 1, &ds);
+    visited.insert(s);
+    beam.insert(ds, s);
+
+    // sketch prefilter: the sketch of the query is compared with the sketches of the neighbors before their exact distances
+    if (this->_sketch != nullptr){
+        ctx.sketch.resize(this->_sketch->words());
+        if (ctx.centered.size() < this->_sketch->paddedDim()) ctx.centered = AlignedRow<float>(this->_sketch->paddedDim());
+        this->_sketch->compute(xq, ctx.sketch.data(), ctx.centered.data());
+    }
 
-    pair<unordered_set<Id>, unordered_set<Id>> rv = (args.usePQueue)
-        ? this->_pqueue_greedySearch(s, xq, k, L)
-        : this->_set_greedySearch(s, xq, k, L);
-    
-    if (args.n_threads > 1){
-        unique_lock<mutex> _lock(this->_mx_cv);
-        if (--this->_active_GS == 0){
-            this->_cv_writer.notify_one();
+    // fast-scan estimates: the quantized ADC table of the query is computed once for the whole search
+    if (this->_fastscan != nullptr) this->_fastscan->prepareQuery(xq, ctx.fastscan);
+
+    // prefetching: while pmin is expanded, the out-neighbors of the next candidates, the visited stamps and nodes of the neighbors prefetchDistance
+    // positions ahead, and the rows of the neighbors that will get an exact distance (a whole batch ahead of the distances) are loaded
+    int ahead = args.prefetchDistance;
+
+    vector<Id>& unseen = ctx.ids;
+    Id pmin;
+    while((pmin = beam.next()) != -1){      // pmin is the unexpanded candidate with the minimum distance from query xq
+
+        ctx.expanded.push_back(pmin);
+        if (ahead > 0) this->_prefetchCandidates(beam);
+        bool sketching = this->_sketch != nullptr && beam.full();
+
+        // once the beam is full, neighbors whose sketch is clearly farther from the query than the sketch of the worst candidate are skipped.
+        // They are not marked visited: a later worst candidate gives a looser limit, under which they may still be reached from another node
+        int sketchLimit = sketching ? this->_sketch->hamming(ctx.sketch.data(), this->_nodeSketch(beam[beam.size() - 1].id)) + this->_sketch_margin : 0;
+        auto passesSketch = [&](Id j) { return !sketching || this->_sketch->hamming(ctx.sketch.data(), this->_nodeSketch(j)) <= sketchLimit; };
+
+        unseen.clear();
+        if (this->_fastscan != nullptr && beam.full()){
+            // once the beam is full, the fast-scan estimates of all the out-neighbors of pmin decide which of them get an exact distance
+            FastScanNeighbors nb = this->_fastscan->neighbors(pmin);
+            ctx.estimates.resize(nb.blocks() * FASTSCAN_BLOCK);
+            this->_fastscan->scan(ctx.fastscan, nb, ctx.estimates.data());
+            int limit = this->_fastscan->limit(ctx.fastscan, beam.worst() * (1 + this->_fastscan_margin));
+            for (int i = 0; i < nb.degree; i++){
+                Id j = nb.ids[i];
+                if (ctx.estimates[i] <= limit && !visited.contains(j) && passesSketch(j)){
+                    visited.insert(j);
+                    unseen.push_back(j);
+                    if (ahead > 0) this->_prefetchRow(j);
+                }
+            }
         }
+        else if (sketching){
+            NeighborRange nb = this->_readNeighbors(pmin, ctx.neighbors);
+            const Id* neighbors = nb.begin();
+            for (int i = 0; i < nb.size(); i++){
+                if (ahead > 0 && i + ahead < nb.size()) this->_prefetchNode(neighbors[i + ahead], visited);
+                Id j = neighbors[i];
+                if (!visited.contains(j) && passesSketch(j)){
+                    visited.insert(j);
+                    unseen.push_back(j);
+                    if (ahead > 0) this->_prefetchRow(j);
+                }
+            }
+        }
+        else this->_unseenNeighbors(pmin, -1, true, visited, ctx);
+        const Id* ids = unseen.data();
+        int n = unseen.size();
+
+        // distances of all the (remaining) unseen out-neighbors of pmin in one batch. Once the beam is full, only the neighbors closer than the worst
+        // candidate are inserted: their distances are abandoned as soon as they exceed the distance of the worst candidate
+        this->_beamDistances(xq, ids, n, ctx);
+        for (int i = 0; i < n; i++) beam.insert(ctx.dists[i], ids[i]);
     }
 
-    return rv;
+    this->_collectResults(k, ctx);
 }
 
-template <typename T>
-const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T>::_set_greedySearch(Id s, T xq, int k, int L){
-
-    // ofstream outFile = GS_costs_init();
-    // float _cost = 0;
+// Compressed Greedy Search
+template <typename T, typename Distance>
+template <typename CodeDistance>
+void DirectedGraph<T, Distance>::_compressedGreedySearch(Id s, const Elem* xq, int k, int L, const CodeDistance& codeDist, bool rerank, SearchContext& ctx){
 
-    // Create empty sets
-    unordered_set<Id> Lc = {s}, V, diff; // Initialize Lc with s
+    // Same traversal as the Beam Greedy Search, on the codes of the nodes instead of their rows
+    ctx.beam.reset(L);
+    ctx.visited.reset(this->n_nodes);
+    ctx.expanded.clear();
 
-    // _cost = 0;
-    // GS_costs_write(outFile, _cost);
+    ctx.visited.insert(s);
+    ctx.beam.insert(codeDist(s), s);
 
-    
-    while(!(diff = setSubtraction(Lc,V)).empty()){
-        // _cost = 0;
-        Id pmin = this->_myArgMin(diff, xq);    // pmin is the node with the minimum distance from query xq
-
-        // If node has outgoing neighbors
-        if (mapKeyExists(pmin, this->Nout)){
-            // int sz_before = Lc.size();
-            Lc.insert(this->Nout[pmin].begin(), this->Nout[pmin].end());
-            // int sz_after = Lc.size();
-            // _cost = sz_after - sz_before;    // how many successful insertions
+    Id pmin;
+    while((pmin = ctx.beam.next()) != -1){
+        ctx.expanded.push_back(pmin);
+        for (const Id& j : this->_readNeighbors(pmin, ctx.neighbors)){
+            if (ctx.visited.insert(j)) ctx.beam.insert(codeDist(j), j);
         }
-        
-        V.insert(pmin);
+    }
 
-        if (Lc.size() > L){
-            // _cost += Lc.size();
-            Lc = _closestN(L, Lc, xq);    // function: find N closest points from a specific xq from given set and return them
-        }
-        // GS_costs_write(outFile, _cost);
+    // the k results are the closest of the final L candidates by full precision distance
+    if (rerank) this->_rerank(xq, ctx);
+    this->_collectResults(k, ctx);
+}
+
+// Calls search(codeDist, rerank) with the distance of the nodes to xq on the codes of the graph
+template <typename T, typename Distance>
+template <typename Search>
+void DirectedGraph<T, Distance>::_withCodeDistance(const Elem* xq, SearchContext& ctx, const Search& search){
+
+    // PQ: ADC table of the query, computed once for the whole search. PQ distances are always re-ranked
+    if (this->_pq != nullptr){
+        ctx.table.resize(this->_pq->tableSize());
+        this->_pq->computeTable(xq, ctx.table.data());
+        const float* table = ctx.table.data();
+        search([&](Id id) { return this->_pq->distance(table, this->nodes[id].row); }, true);
+        return;
     }
 
-    pair<unordered_set<Id>, unordered_set<Id>> ret;
-    
-    // if (k < Lc.size())
-    //     _cost = Lc.size();
-    // else
-    //     _cost = 0;
-    // GS_costs_write(outFile, _cost);
+    // SQ: the query is prepared (scaled or quantized) once for the whole search
+    this->_sq->prepareQuery(xq, ctx.sq);
+    const SQQuery& q = ctx.sq;
+    search([&](Id id) { return this->_sq->distance(q, this->nodes[id].row); }, this->_sq_rerank);
+}
+
+// Distances from xq of the n nodes ids into ctx.dists: bounded by the distance of the worst candidate once the beam is full
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_beamDistances(const Elem* xq, const Id* ids, int n, SearchContext& ctx){
+    ctx.dists.resize(n);
+    if (ctx.beam.full()){
+        ctx.bounds.assign(n, ctx.beam.worst());
+        this->distanceBounded(xq, ids, n, ctx.bounds.data(), ctx.dists.data());
+    }
+    else this->distanceBatch(xq, ids, n, ctx.dists.data());
+}
 
-    ret.first = _closestN(k, Lc, xq);
-    ret.second = V;
+// Prefetches the out-neighbors of the next args.prefetchDistance unexpanded candidates of the beam
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_prefetchCandidates(const SearchBeam& beam) const {
+    int prefetched = 0;
+    for (int c = beam.cursor(); c < beam.size() && prefetched < args.prefetchDistance; c++){
+        if (beam[c].expanded) continue;
+        if (this->_fastscan != nullptr && beam.full()) this->_fastscan->prefetch(beam[c].id);
+        else this->Nout.prefetch(beam[c].id);
+        prefetched++;
+    }
+}
 
-    // outFile.close();
-    // greedySearchCount++;
+// Appends the unvisited out-neighbors of pmin (of the category, if >= 0) to ids, prefetching the nodes and stamps of the neighbors
+// args.prefetchDistance positions ahead, and the rows of the unvisited ones if rows
+template <typename T, typename Distance>
+template <typename Visited>
+void DirectedGraph<T, Distance>::_unseenNeighbors(Id pmin, int category, bool rows, Visited& visited, SearchContext& ctx){
+    NeighborRange nb = this->_readNeighbors(pmin, ctx.neighbors);
+    vector<Id>& ids = ctx.ids;
+    const Id* neighbors = nb.begin();
+    int ahead = args.prefetchDistance;
+    for (int i = 0; i < nb.size(); i++){
+        if (ahead > 0 && i + ahead < nb.size()) this->_prefetchNode(neighbors[i + ahead], visited);
+        Id j = neighbors[i];
+        if ((category < 0 || this->nodes[j].category == category) && visited.insert(j)){
+            ids.push_back(j);
+            if (ahead > 0 && rows) this->_prefetchRow(j);
+        }
+    }
+}
 
-    return ret;
+// Replaces the (approximate) distances of the candidates of the beam with the full precision distances from xq, and restores its order
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_rerank(const Elem* xq, SearchContext& ctx){
+    SearchBeam& beam = ctx.beam;
+    ctx.ids.resize(beam.size());
+    ctx.dists.resize(beam.size());
+    for (int i = 0; i < beam.size(); i++) ctx.ids[i] = beam[i].id;
+    this->distanceBatch(xq, ctx.ids.data(), beam.size(), ctx.dists.data());
+    for (int i = 0; i < beam.size(); i++) beam[i].dist = ctx.dists[i];
+    beam.sort();
 }
 
-template <typename T>
-const pair<unordered_set<Id>, unordered_set<Id>> DirectedGraph<T>::_pqueue_greedySearch(Id s, T xq, int k, int L){
+// Batch of Greedy Searches, one hop of every query in turn
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::searchBatch(const Id* s, const Elem* const* xq, const int* categories, int n, int dim, int k, int L, BatchSearchContext& batch){
 
-    // ofstream outFile = GS_costs_init();
-    // float _cost = 0;
-    
-    // Create empty sets and initialize the priority queue
-    unordered_set<Id> V, diff; 
-    function<bool(Id, Id)> comparator = 
-        [xq,this] (int id1, int id2) {
-            return (this->d(xq, this->nodes[id1].value) < this->d(xq, this->nodes[id2].value));   // descending comparator (maxHeap)
-        };
-
-    priority_queue<Id, vector<Id>, function<bool(Id, Id)>> Lc(comparator);
-
-    // Initialize Lc with s
-    // _cost = log(1); // = 0
-    // GS_costs_write(outFile, _cost);
-    Lc.push(s);
-        
-    while(!(diff = PQSubtraction(Lc,V)).empty()){
-        
-        Id pmin = this->_myArgMin(diff, xq);    // pmin is the node with the minimum distance from query xq
+    // argument checks
+    if (n < 0){ throw invalid_argument("The number of queries must be >= 0.\n"); }
 
-        V.insert(pmin);
+    if (xq == nullptr || dim <= 0){ throw invalid_argument("No query was provided.\n"); }
 
-        // If node has outgoing neighbors
-        if (mapKeyExists(pmin, this->Nout)){
+    if (k < 0){ throw invalid_argument("K must be greater than or equal to 0.\n"); }
 
-            // _cost = 0;
-            // if should insert
-            for (const Id& neighbor : this->Nout[pmin]){
-                if (Lc.size() < L){
-                    // _cost += log(Lc.size());
-                    Lc.push(neighbor);
-                }
-                else if (this->d(this->nodes[neighbor].value, xq) < this->d(this->nodes[Lc.top()].value, xq)){
-                    Lc.pop();
-                    // _cost += log(Lc.size());
-                    Lc.push(neighbor);
-                }
-            }
-            // GS_costs_write(outFile, _cost);
+    if (L < k){ throw invalid_argument("L must be greater or equal to K.\n"); }
+
+    for (int b = 0; b < n; b++){
+        if (s[b] < 0 || s[b] >= this->n_nodes){ throw invalid_argument("Invalid Index was provided.\n"); }
+        if (this->nodes[s[b]].empty()){ throw invalid_argument("No start node was provided.\n"); }
+    }
+
+    batch.reset(n, k);
+
+    // the compressed codes, the fast-scan blocks and the sketches decide which distances each search computes: the queries are searched one after the other
+    if (this->_pq != nullptr || this->_sq != nullptr || this->_fastscan != nullptr || this->_sketch != nullptr){
+        for (int b = 0; b < n; b++){
+            SearchContext& ctx = batch.queries[b];
+            this->search(s[b], xq[b], dim, k, L, ctx, (categories != nullptr) ? categories[b] : -1);
+            copy(ctx.results.begin(), ctx.results.end(), batch.results.begin() + (size_t) b * k);
+            batch.counts[b] = ctx.results.size();
         }
+        return;
     }
 
-    pair<unordered_set<Id>, unordered_set<Id>> ret;
+    // every search starts on its own context, as in the Beam (Filtered) Greedy Search, except for the visited table that they share
+    if (n > BATCH_MAX_QUERIES){ throw invalid_argument("A batch search holds at most " + to_string(BATCH_MAX_QUERIES) + " queries.\n"); }
+    batch.visited.reset(this->n_nodes);
+    for (int b = 0; b < n; b++){
+        SearchContext& ctx = batch.queries[b];
+        const Elem* row = this->_padQuery(xq[b], dim, ctx);
+        batch.rows[b] = row;
+        ctx.beam.reset(L);
+        ctx.expanded.clear();
+        batch.visited.insert(s[b], b);
+        if (categories == nullptr || categories[b] < 0 || this->nodes[s[b]].category == categories[b]){
+            float ds;
+            this->distanceBatch(row, &s[b], 1, &ds);
+            ctx.beam.insert(ds, s[b]);
+        }
+    }
 
-    // _cost = Lc.size();
-    // GS_costs_write(outFile, _cost);
+    // one hop of search b: the unseen neighbors of its closest unexpanded candidate (whose rows are prefetched). Returns false if the search is over
+    int ahead = args.prefetchDistance;
+    auto hop = [&](int b){
+        SearchContext& ctx = batch.queries[b];
+        ctx.ids.clear();
+        Id pmin = ctx.beam.next();
+        if (pmin == -1) return false;
+        ctx.expanded.push_back(pmin);
+        if (ahead > 0) this->_prefetchCandidates(ctx.beam);
+        BatchVisited visited{batch.visited, b};
+        this->_unseenNeighbors(pmin, (categories != nullptr) ? categories[b] : -1, true, visited, ctx);
+        return true;
+    };
+
+    // the hops of the searches are pipelined: the hop of search b + 1 is collected (its rows start loading) before the distances of the hop of search b
+    bool active = true;
+    while (active){
+        active = false;
+        if (n > 0) active |= hop(0);
+        for (int b = 0; b < n; b++){
+            if (b + 1 < n) active |= hop(b + 1);
+            SearchContext& ctx = batch.queries[b];
+            int count = ctx.ids.size();
+            if (count == 0) continue;
+            this->_beamDistances((const Elem*) batch.rows[b], ctx.ids.data(), count, ctx);
+            for (int i = 0; i < count; i++) ctx.beam.insert(ctx.dists[i], ctx.ids[i]);
+        }
+    }
 
-    int Lsize = Lc.size();
-    for (int i = 0; i < Lsize - k; i++){
-        if (!Lc.empty()){ Lc.pop(); }
+    for (int b = 0; b < n; b++){
+        SearchContext& ctx = batch.queries[b];
+        this->_collectResults(k, ctx);
+        copy(ctx.results.begin(), ctx.results.end(), batch.results.begin() + (size_t) b * k);
+        batch.counts[b] = ctx.results.size();
     }
+}
+
+// Trains product quantization codebooks of M subspaces on the values and encodes every value
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::trainPQ(int M){
+
+    if (this->vectors.empty()){ throw invalid_argument("Cannot train the PQ codebooks without vectors.\n"); }
+
+    // inner product metrics rank the codes by (negative) inner product, the others by squared distance
+    bool inner_product = this->_metric == METRIC_IP || this->_metric == METRIC_COSINE;
+    unique_ptr<ProductQuantizer> pq(new ProductQuantizer(this->vectors.dim(), M, inner_product));
+    pq->train(this->vectors);
+    pq->encode(this->vectors);
+    this->_pq = move(pq);
+    this->_sq.reset();
+
+    c_log << "PQ codes trained: " << M << " subspaces of " << this->_pq->centroids() << " centroids\n";
+}
+
+// Sketches the values for the prefilter of the exact distances
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::enableSketch(int bits, int margin){
 
-    Lsize = Lc.size();
-    for (int i = 0; i < Lsize; i++){
-        ret.first.insert(Lc.top());
-        if (!Lc.empty()){ Lc.pop(); }
+    if (this->vectors.empty()){ throw invalid_argument("Cannot sketch the values without vectors.\n"); }
+    if (margin < 0){ throw invalid_argument("The sketch margin must be >= 0.\n"); }
+
+    unique_ptr<BinarySketch> sketch(new BinarySketch(this->vectors.dim(), bits));
+    sketch->train(this->vectors);
+    sketch->encode(this->vectors);
+    this->_sketch = move(sketch);
+    this->_sketch_margin = margin;
+
+    c_log << "Sketches: " << bits << " bits per value, margin of " << margin << " bits\n";
+}
+
+// Lays out the 4-bit PQ codes of the out-neighbors of every node for the fast-scan estimates of the Beam Greedy Search
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::buildFastScan(int M, float margin){
+
+    if (this->_metric != METRIC_L2 && this->_metric != METRIC_MIPS){ throw invalid_argument("Only euclidean graphs support the fast-scan blocks.\n"); }
+    if (this->vectors.empty()){ throw invalid_argument("Cannot build the fast-scan blocks without vectors.\n"); }
+    if (margin < 0){ throw invalid_argument("The fast-scan margin must be >= 0.\n"); }
+
+    unique_ptr<FastScanBlocks> fastscan(new FastScanBlocks(this->vectors.dim(), M));
+    fastscan->train(this->vectors);
+    fastscan->build(this->Nout, [&](Id id) { return this->nodes[id].row; });
+    this->_fastscan = move(fastscan);
+    this->_fastscan_margin = margin;
+
+    c_log << "Fast-scan blocks: " << M << " subspaces of " << FASTSCAN_CENTROIDS << " centroids, "
+          << this->_fastscan->bytes() / (1024.0 * 1024.0) << " MB, margin of " << margin << '\n';
+}
+
+// Rotates the values onto their principal components
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::applyPCA(int leading){
+
+    if constexpr (!is_same<Elem, float>::value){ throw invalid_argument("Only float values support the PCA rotation.\n"); }
+    else{
+        if (this->_metric != METRIC_L2 && this->_metric != METRIC_MIPS){ throw invalid_argument("Only euclidean graphs support the PCA rotation.\n"); }
+        if (this->vectors.empty()){ throw invalid_argument("Cannot rotate the values without vectors.\n"); }
+        if (this->_mapped != nullptr){ throw invalid_argument("Cannot rotate the values of a memory-mapped index.\n"); }
+        this->_checkMutable();
+        if (this->_pca != nullptr){ throw invalid_argument("The values are already rotated.\n"); }
+
+        unique_ptr<PCARotation> pca(new PCARotation(this->vectors.dim(), leading));
+        pca->train(this->vectors);
+        for (int r = 0; r < this->vectors.size(); r++) pca->rotate(this->vectors.row(r), this->vectors.row(r));
+        this->_pca = move(pca);
+
+        // the codes and sketches of the values before the rotation are not valid for the rotated ones
+        this->_pq.reset();
+        this->_sq.reset();
+        this->_sketch.reset();
+        this->_fastscan.reset();
+
+        c_log << "PCA rotation: the " << leading << " leading components of " << this->vectors.dim() << " hold "
+              << this->_pca->leadingVariance() * 100 << "% of the variance\n";
     }
-    ret.second = V;
+}
 
-    // outFile.close();
-    // greedySearchCount++;
+// Scalar-quantizes the values
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::trainSQ(ScalarQuantization type, bool rerank){
 
-    return ret;
+    if (this->vectors.empty()){ throw invalid_argument("Cannot train the scalar quantizer without vectors.\n"); }
+
+    bool inner_product = this->_metric == METRIC_IP || this->_metric == METRIC_COSINE;
+    unique_ptr<ScalarQuantizer> sq(new ScalarQuantizer(type, this->vectors.dim(), inner_product));
+    sq->train(this->vectors);
+    sq->encode(this->vectors);
+    this->_sq = move(sq);
+    this->_sq_rerank = rerank;
+    this->_pq.reset();
+
+    c_log << "SQ codes: " << sqName(type) << ", " << this->_sq->codeBytes() << " bytes per value\n";
 }
 
 // ------------------------------------------------------------------------------------------------ ROBUST PRUNE
 
 // Prunes out-neighbors of node p up until a minimum threshold R of out-neighbors for node p, based on distance criteria with parameter a.
-template <typename T>
-void DirectedGraph<T>::robustPrune(Id p, unordered_set<Id> V, float a, int R){
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::robustPrune(Id p, unordered_set<Id> V, float a, int R){
 
     // argument checks
     if (p < 0 || p >= this->n_nodes){ throw invalid_argument("Invalid Index was provided.\n"); }
@@ -704,85 +1223,104 @@ void DirectedGraph<T>::robustPrune(Id p, unordered_set<Id> V, float a, int R){
 
     if (R <= 0) {throw invalid_argument("Parameter R must be > 0.\n"); }
 
-    {   // RAII scope
-        unique_lock<mutex> _lock(this->_mx_cv, defer_lock);
+    this->_checkMutable();
 
-        // Entry Section
-        if (args.n_threads > 1){
-            _lock.lock();
-            while(this->_active_GS != 0 || this->_active_W == true){
-                this->_cv_writer.wait(_lock);
-            }
-            this->_active_W = true; // also critical operation but for synchronization. Is under lock.
-        }
+    // the candidates are V and the current out-neighbors of p, which are replaced by the selected ones at once
+    NeighborRange nout_p = this->Nout.neighbors(p);
+    V.insert(nout_p.begin(), nout_p.end());
+    V.erase(p);
 
-        // Critical Section
-        if (mapKeyExists(p, this->Nout))
-            V.insert(this->Nout[p].begin(), this->Nout[p].end());
+    vector<Id> candidates(V.begin(), V.end()), selected;
+    this->_robustPruneSelect(p, candidates, a, R, selected);
 
-        this->clearNeighbors(p);          // calls remove edge
-        // End of Critical Section
+    this->_replaceNeighbors(p, selected);
+}
 
-        // Exit Section
-        if (args.n_threads > 1){
-            this->_active_W = false; // also critical operation but for synchronization. Is under lock.
-            this->_cv_writer.notify_one();
-            this->_cv_reader.notify_all();
-        }
+// Replaces the out-neighbors of p with ids in one write under the lock of p: concurrent searches see either the previous or the new neighbors,
+// never p without neighbors. The edge counts are not synchronized: threads that prune at once add up their own changes (see _thread_Vamana_fn)
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_replaceNeighbors(Id p, const vector<Id>& ids){
 
-    } // end of RAII scope => invalidation of _lock and freeing of mutex
+    if ((int) ids.size() > this->Nout.width() || this->Nout.compacted()) this->Nout.reserve(this->n_nodes, ids.size());
 
-    V.erase(p);
+    NodeLockGuard lock(this->_node_locks, p, args.n_threads > 1);
+    int change = this->Nout.replace(p, ids.data(), ids.size());
+    this->Nout.addEdgeCount(change);
+    this->n_edges += change;
+    this->_fastscan.reset();
+}
 
-    Id p_opt;
-    // assume neighbors have been cleared. They will be cleared afterwards for better synchronization between threads.
-    // No effect in the final outcome.
-    vector<Id> batch;
-    
-    while (!V.empty()){
-        p_opt = this->_myArgMin(V, this->nodes[p].value);
+// Robust prune selection of the out-neighbors of p among the candidates
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_robustPruneSelect(Id p, vector<Id>& candidates, float a, int R, vector<Id>& selected){
+
+    selected.clear();
+
+    // distances of the candidates from p, computed once (in one batch)
+    vector<float> dist_p(candidates.size()), dist_opt(candidates.size()), bounds;
+    this->distanceBatch(this->getRow(p), candidates.data(), candidates.size(), dist_p.data());
+
+    // sketch prefilter: sketch distances of the candidates from p, and the candidates that need an exact distance from p*
+    vector<int> sketch_p;
+    vector<Id> exact_ids;
+    vector<int> exact_index;
+    vector<float> exact_dist;
+    if (this->_sketch != nullptr){
+        sketch_p.resize(candidates.size());
+        for (int i = 0; i < candidates.size(); i++) sketch_p[i] = this->_sketch->hamming(this->_nodeSketch(p), this->_nodeSketch(candidates[i]));
+    }
+
+    while (!candidates.empty()){
+
+        // p_opt = p* = candidate closest to p
+        int i_opt = 0;
+        for (int i = 1; i < candidates.size(); i++){
+            if (dist_p[i] <= dist_p[i_opt]) i_opt = i;
+        }
+        Id p_opt = candidates[i_opt];
         
-        batch.push_back(p_opt); // store p_opts to a vector Id then addbatch 
+        selected.push_back(p_opt);
 
-        if (batch.size() == R)
+        if (selected.size() == R)
             break;
         
-        // *it = n = p', p_opt = p*
-        for (auto it = V.begin(); it != V.end(); /*no increment here*/){    // safe set iteration with mutable set during the iteration
-            if ( (a * this->d(this->nodes[p_opt].value, this->nodes[*it].value)) <= this->d(this->nodes[p].value, this->nodes[*it].value)){ 
-                it = V.erase(it);
+        // remove every candidate p' with a * d(p*, p') <= d(p, p'), keeping the rest in place (p* itself is removed: d(p*, p*) = 0).
+        // Only the distances up to d(p, p') / a decide a removal: the others are abandoned as soon as they exceed it.
+        if (this->_sketch != nullptr){
+            // a candidate whose sketch is clearly farther from p* than from p is kept without its exact distance from p*
+            exact_ids.clear();
+            exact_index.clear();
+            bounds.clear();
+            for (int i = 0; i < candidates.size(); i++){
+                dist_opt[i] = numeric_limits<float>::max();
+                if (this->_sketch->hamming(this->_nodeSketch(p_opt), this->_nodeSketch(candidates[i])) <= sketch_p[i] + this->_sketch_margin){
+                    exact_ids.push_back(candidates[i]);
+                    exact_index.push_back(i);
+                    bounds.push_back(dist_p[i] / a);
+                }
             }
-            else { it++; }  // incrementing here because V.erase() returns the next iterator on successful deletion
+            exact_dist.resize(exact_ids.size());
+            this->distanceBounded(this->getRow(p_opt), exact_ids.data(), exact_ids.size(), bounds.data(), exact_dist.data());
+            for (int m = 0; m < exact_ids.size(); m++) dist_opt[exact_index[m]] = exact_dist[m];
+        }
+        else{
+            bounds.resize(candidates.size());
+            for (int i = 0; i < candidates.size(); i++) bounds[i] = dist_p[i] / a;
+            this->distanceBounded(this->getRow(p_opt), candidates.data(), candidates.size(), bounds.data(), dist_opt.data());
         }
-    }
-    
-    // synchronize with greedy search
-
-    { // RAII scope
-        unique_lock<mutex> _lock(this->_mx_cv, defer_lock);
 
-        // Entry Section
-        if (args.n_threads > 1){
-            _lock.lock();
-            while(this->_active_GS != 0 || this->_active_W == true){
-                this->_cv_writer.wait(_lock);
+        int kept = 0;
+        for (int i = 0; i < candidates.size(); i++){
+            if (a * dist_opt[i] > dist_p[i]){
+                candidates[kept] = candidates[i];
+                dist_p[kept] = dist_p[i];
+                if (this->_sketch != nullptr) sketch_p[kept] = sketch_p[i];
+                kept++;
             }
-            this->_active_W = true;
         }
-
-        // Critical Section
-        this->addBatchNeigbors(p, batch);
-        // End of Critical Section
-
-        // Exit Section 
-        if (args.n_threads > 1){
-            this->_active_W = false;
-            this->_cv_writer.notify_one();
-            this->_cv_reader.notify_all();
-        }   
-    }// end of RAII scope => invalidation of _lock and freeing of mutex
-
-
+        candidates.resize(kept);
+        dist_p.resize(kept);
+    }
 }
 
 // ------------------------------------------------------------------------------------------------ VAMANA GRAPH
@@ -792,8 +1330,8 @@ void DirectedGraph<T>::robustPrune(Id p, unordered_set<Id> V, float a, int R){
 // + R the out-degree of each node in the graph (R >= 1)
 // + L the area parameter for searching (L >= k >= 1, where k is the desired number of neighbors)
 // + a the parameter for robust pruning (a >=1)
-template <typename T>
-bool DirectedGraph<T>::vamanaAlgorithm(int L, int R, float a){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::vamanaAlgorithm(int L, int R, float a){
     // check parameters if they are in legal range
     if (this->nodes.size() == 1) return true;   // no edges possible
 
@@ -803,11 +1341,18 @@ bool DirectedGraph<T>::vamanaAlgorithm(int L, int R, float a){
 
     if (a < 1) { throw invalid_argument("Parameter a must be >= 1.\n"); }
 
+    this->_checkMutable();
+
     c_log << "Initializing a random R-Regular Directed Graph with out-degree R = " << R << ". . ." << '\n';
     this->clearEdges();
 
+    // R neighbors + the reverse edge added before pruning (the parallel build prunes before adding it: R neighbors at most).
+    // The slots are reserved before the threads start: the store is never re-laid out while they read and write it.
+    this->Nout.reserve(this->n_nodes, R + 1);
+
 
-    if (args.useRGraph && this->Rgraph(R) == false)
+    // the batch build starts from an empty graph: its first batches are small enough to connect it
+    if (args.useRGraph && !args.batchBuild && this->Rgraph(R) == false)
         return false;
     c_log << "Graph initialized successfully!" << '\n';
 
@@ -817,13 +1362,23 @@ bool DirectedGraph<T>::vamanaAlgorithm(int L, int R, float a){
     vector<Id> nodes_ids(this->n_nodes);
     iota(nodes_ids.begin(), nodes_ids.end(), 0);
 
-    vector<Id> perm_id = permutation(nodes_ids);
-
-    bool rv = (args.n_threads > 1)
-        ? this->_parallel_Vamana(L, R, a, perm_id)
-        : this->_serial_Vamana(L, R, a, perm_id);
+    bool rv;
+    if (args.batchBuild){
+        uint32_t seed = (args.seed >= 0) ? args.seed : random_device()();
+        c_log << "Batch build with seed " << seed << '\n';
+        vector<Id> perm_id = permutation(nodes_ids, seed);
+        rv = this->_batch_Vamana(L, R, a, perm_id);
+    }
+    else{
+        vector<Id> perm_id = permutation(nodes_ids);
+        rv = (args.n_threads > 1)
+            ? this->_parallel_Vamana(L, R, a, perm_id)
+            : this->_serial_Vamana(L, R, a, perm_id);
+    }
 
-    if (args.extraRandomEdges > 0){
+    // the random edges are sampled with rand(): the batch build skips them to stay deterministic
+    if (args.extraRandomEdges > 0 && args.batchBuild) c_log << "WARNING: The batch build does not add the extra random edges.\n";
+    else if (args.extraRandomEdges > 0){
         this->Rgraph(args.extraRandomEdges); // adds additional random edges
     }
 
@@ -831,34 +1386,40 @@ bool DirectedGraph<T>::vamanaAlgorithm(int L, int R, float a){
     return rv;
 }
 
-template <typename T>
-bool DirectedGraph<T>::_serial_Vamana(int L, int R, float a, vector<Id>& permutation){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_serial_Vamana(int L, int R, float a, vector<Id>& permutation){
+
+    SearchContext ctx;      // reused by all the searches of the build
 
     for (const Id& si_id : permutation){
         Node<T>& si = this->nodes[si_id];
-        pair<unordered_set<Id>, unordered_set<Id>> rv = greedySearch(this->startingNode(), si.value, 0, L); // k = 0 instead of 1, same as the filtered vamana
+        _greedySearch(this->startingNode(), this->getRow(si.id), 0, L, ctx); // k = 0 instead of 1, same as the filtered vamana
 
-        // unordered_set<Id> Lc = rv.first; // not required.
-        unordered_set<Id> V = rv.second;
+        unordered_set<Id> V(ctx.expanded.begin(), ctx.expanded.end());
 
         this->robustPrune(si.id, V, a, R);
-        
-        if (mapKeyExists(si.id, this->Nout)){
-        
-            for (const Id j : this->Nout[si.id]){  // for every neighbor j of si
 
-                this->addEdge(j, si.id);   // does it in either case (simpler code, robust prune clears all neighbors after copying to candidate set V anyway)
-                if (this->Nout[j].size() > R)
-                    robustPrune(j, this->Nout[j], a, R);
-            }
+        NeighborRange nout_si = this->Nout.neighbors(si.id);
+        vector<Id> noutCopy_si(nout_si.begin(), nout_si.end());    // copy: adding edges may re-layout the adjacency store
+
+        for (const Id j : noutCopy_si){  // for every neighbor j of si
+
+            this->addEdge(j, si.id);   // does it in either case (simpler code, robust prune clears all neighbors after copying to candidate set V anyway)
+            if (this->Nout.degree(j) > R)
+                robustPrune(j, this->_neighborSet(j), a, R);
         }
     }
 
     return true;
 }
 
-template <typename T>
-void DirectedGraph<T>::_thread_Vamana_fn(int& L, int& R, float& a, vector<Id>& permutation, int& current_index, mutex& mx_index, char& rv){
+// Thread function of the parallel Vamana build. The threads share no lock apart from the lock of the node each write rewrites:
+// the searches read the neighbors optimistically (see _readNeighbors), and the edge count is added up per thread in edges.
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_thread_Vamana_fn(int& L, int& R, float& a, vector<Id>& permutation, int& current_index, mutex& mx_index, char& rv, int& edges){
+
+    SearchContext ctx;      // reused by all the searches of the thread
+    vector<Id> candidates, selected, pruned, previous;
 
     mx_index.lock();
     while(current_index < permutation.size()){
@@ -866,41 +1427,50 @@ void DirectedGraph<T>::_thread_Vamana_fn(int& L, int& R, float& a, vector<Id>& p
         int my_index = current_index++;
         mx_index.unlock();
 
-        Id si_id = permutation[my_index];
-        Node<T>& si = this->nodes[si_id];
-        pair<unordered_set<Id>, unordered_set<Id>> rv_gs = greedySearch(this->startingNode(), si.value, 0, L); // k = 0 instead of 1, same as the filtered vamana
-
-        // unordered_set<Id> Lc = rv_gs.first; // not required.
-        unordered_set<Id> V = rv_gs.second;
-
-        this->robustPrune(si.id, V, a, R);
-        
-        // Lock for check
+        Id si = permutation[my_index];
+        _greedySearch(this->startingNode(), this->getRow(si), 0, L, ctx); // k = 0 instead of 1, same as the filtered vamana
+
+        // robust prune of si on the expanded nodes and its current neighbors, computed unlocked
+        candidates.assign(ctx.expanded.begin(), ctx.expanded.end());
+        NeighborRange nout_si = this->_readNeighbors(si, ctx.neighbors);
+        previous.assign(nout_si.begin(), nout_si.end());
+        candidates.insert(candidates.end(), previous.begin(), previous.end());
+        sort(candidates.begin(), candidates.end());
+        candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+        candidates.erase(remove(candidates.begin(), candidates.end(), si), candidates.end());
+        this->_robustPruneSelect(si, candidates, a, R, selected);
         {
-            // RAII scope
-            unique_lock<mutex> _lock(this->_mx_edges);
-            if (mapKeyExists(si.id, this->Nout)){
-
-                unordered_set<Id> noutCopy_si(this->Nout[si.id].begin(), this->Nout[si.id].end());
-                // We have the lock, get a copy of nout[si.id]
-                for (const Id j : noutCopy_si){  // for every neighbor j of si
-
-                    unordered_set<Id> result(this->Nout[j].begin(), this->Nout[j].end());
-                    // this->addEdge(j, si.id, true);   // does it in either case (simpler code, robust prune clears all neighbors after copying to candidate set V anyway)
-                    result = unorderedSetUnion(result, unordered_set<Id>(si.id));
-                    _lock.unlock();
-                    if (result.size() > R){
-                        robustPrune(j, result, a, R);
-                    }
-                    else{
-                        this->addEdge(j, si.id);
-                    }
-
-                    _lock.lock();
-                    
+            NodeLockGuard lock(this->_node_locks, si);
+
+            // reverse edges that other threads added to si meanwhile are not dropped: they are pruned together with the selected neighbors
+            NeighborRange current = this->Nout.neighbors(si);
+            if (current.size() != previous.size() || !equal(current.begin(), current.end(), previous.begin())){
+                candidates.assign(selected.begin(), selected.end());
+                for (const Id& j : current){
+                    if (find(selected.begin(), selected.end(), j) == selected.end()) candidates.push_back(j);
                 }
+                if (candidates.size() > R) this->_robustPruneSelect(si, candidates, a, R, selected);
+                else selected.swap(candidates);
+            }
+            edges += this->Nout.replace(si, selected.data(), selected.size());
+        }
+
+        // reverse edges: every neighbor j of si gets the edge (j->si), and is pruned if it exceeds R neighbors. j stays locked meanwhile (the
+        // prune of R + 1 candidates is short), so that no edge added to j by another thread is lost
+        for (const Id j : selected){
+            NodeLockGuard lock(this->_node_locks, j);
+            if (this->Nout.contains(j, si)) continue;
+
+            if (this->Nout.degree(j) < R){
+                edges += this->Nout.append(j, si);
+                continue;
             }
 
+            NeighborRange nout_j = this->Nout.neighbors(j);
+            candidates.assign(nout_j.begin(), nout_j.end());
+            candidates.push_back(si);
+            this->_robustPruneSelect(j, candidates, a, R, pruned);
+            edges += this->Nout.replace(j, pruned.data(), pruned.size());
         }
 
         mx_index.lock();
@@ -908,16 +1478,19 @@ void DirectedGraph<T>::_thread_Vamana_fn(int& L, int& R, float& a, vector<Id>& p
     mx_index.unlock();
 }
 
-template <typename T>
-bool DirectedGraph<T>::_parallel_Vamana(int L, int R, float a, vector<Id>& permutation){
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_parallel_Vamana(int L, int R, float a, vector<Id>& permutation){
 
     int current_index = 0;
     mutex mx_index;
 
     vector<char> rvs(args.n_threads, true);
+    vector<int> edges(args.n_threads, 0);     // change of the edge count by every thread
     vector<thread> threads;
 
-    
+    if (!args.randomStart) this->medoid();    // the starting node of the searches is computed (and stored) once, before the threads look it up
+
+    this->Nout.pin(true);     // the slots reserved by vamanaAlgorithm are never re-laid out while the threads read them
     for (int i = 0; i < args.n_threads; i++){
 
         threads.push_back(thread(
@@ -929,11 +1502,17 @@ bool DirectedGraph<T>::_parallel_Vamana(int L, int R, float a, vector<Id>& permu
             ref(permutation),
             ref(current_index),
             ref(mx_index),
-            ref(rvs[i])));
+            ref(rvs[i]),
+            ref(edges[i])));
     }
 
     for (thread& th : threads)
         th.join();
+    this->Nout.pin(false);
+
+    int change = accumulate(edges.begin(), edges.end(), 0);
+    this->Nout.addEdgeCount(change);
+    this->n_edges += change;
 
     for (bool rv : rvs){
         if (rv == false){
@@ -945,14 +1524,373 @@ bool DirectedGraph<T>::_parallel_Vamana(int L, int R, float a, vector<Id>& permu
     return true;
 }
 
+template <typename T, typename Distance>
+bool DirectedGraph<T, Distance>::_batch_Vamana(int L, int R, float a, vector<Id>& permutation){
+
+    int n_threads = max(args.n_threads, 1);
+    int max_batch = max(1, (int) (VAMANA_BATCH_MAX_FRACTION * this->n_nodes));
+
+    // one starting node for every search. The medoid is computed on the first nodes of the (seeded) permutation instead of a sample drawn
+    // with rand(), and its sums do not depend on the number of threads (see _tiledMedoid): the build does not depend on either
+    Id start;
+    if (args.randomStart) start = permutation[0];
+    else if (this->_medoid != -1) start = this->_medoid;
+    else{
+        int n_sample = min(this->n_nodes, (int) ceil(args.threshold * this->n_nodes));
+        vector<Node<T>> sample;
+        for (int i = 0; i < n_sample; i++) sample.push_back(this->nodes[permutation[i]]);
+        start = this->medoid(sample, true);
+    }
+
+    vector<SearchContext> contexts(n_threads);                 // reused by all the searches of each thread
+    vector<vector<Id>> candidates(n_threads), pruned(n_threads);
+    vector<int> edges(n_threads, 0);                           // change of the edge count by every thread
+    vector<vector<Id>> selected(min(max_batch, this->n_nodes)); // new out-neighbors of every node of the batch
+    vector<pair<Id, Id>> reverse;                              // reverse edges (j, p) of the batch: j gains p
+    vector<int> groups;                                        // first reverse edge of every target node
+
+    this->_batch_building = true;
+
+    for (int begin = 0, size = 1; begin < this->n_nodes; begin += size, size = min(2 * size, max_batch)){
+
+        int count = min(size, this->n_nodes - begin);
+
+        // the nodes of the batch are searched and pruned on the graph of the previous batches, which no thread modifies meanwhile
+        this->_parallelFor(count, [&](int i, int t){
+            Id p = permutation[begin + i];
+            SearchContext& ctx = contexts[t];
+            _greedySearch(start, this->getRow(p), 0, L, ctx);     // k = 0 instead of 1, same as the filtered vamana
+
+            vector<Id>& V = candidates[t];
+            NeighborRange nout_p = this->Nout.neighbors(p);
+            V.assign(ctx.expanded.begin(), ctx.expanded.end());
+            V.insert(V.end(), nout_p.begin(), nout_p.end());
+            sort(V.begin(), V.end());
+            V.erase(unique(V.begin(), V.end()), V.end());
+            V.erase(remove(V.begin(), V.end(), p), V.end());
+            this->_robustPruneSelect(p, V, a, R, selected[i]);
+        });
+
+        // the nodes of the batch are distinct: every thread writes the neighbors of its own nodes
+        this->_parallelFor(count, [&](int i, int t){
+            edges[t] += this->Nout.replace(permutation[begin + i], selected[i].data(), selected[i].size());
+        });
+
+        // reverse edges, sorted by target then source (the same order on any number of threads)
+        reverse.clear();
+        for (int i = 0; i < count; i++){
+            for (const Id& j : selected[i]) reverse.push_back({j, permutation[begin + i]});
+        }
+        sort(reverse.begin(), reverse.end());
+
+        groups.clear();
+        for (int e = 0; e < reverse.size(); e++){
+            if (e == 0 || reverse[e].first != reverse[e - 1].first) groups.push_back(e);
+        }
+        groups.push_back(reverse.size());
+
+        // every target node j gains its sources, and is pruned if it exceeds R neighbors: one thread per target
+        this->_parallelFor(groups.size() - 1, [&](int g, int t){
+            Id j = reverse[groups[g]].first;
+            NeighborRange nout_j = this->Nout.neighbors(j);
+            vector<Id>& V = candidates[t];
+            V.assign(nout_j.begin(), nout_j.end());
+            for (int e = groups[g]; e < groups[g + 1]; e++){
+                if (!this->Nout.contains(j, reverse[e].second)) V.push_back(reverse[e].second);
+            }
+            if (V.size() == nout_j.size()) return;
+
+            if (V.size() <= R){
+                edges[t] += this->Nout.replace(j, V.data(), V.size());
+                return;
+            }
+            this->_robustPruneSelect(j, V, a, R, pruned[t]);
+            edges[t] += this->Nout.replace(j, pruned[t].data(), pruned[t].size());
+        });
+    }
 
+    this->_batch_building = false;
 
-// Stores the current state of a graph into the specified file.
+    int change = accumulate(edges.begin(), edges.end(), 0);
+    this->Nout.addEdgeCount(change);
+    this->n_edges += change;
+
+    return true;
+}
+
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_parallelFor(int n, const function<void(int, int)>& fn){
+
+    int n_threads = max(1, min(args.n_threads, n));
+    if (n_threads == 1){
+        for (int i = 0; i < n; i++) fn(i, 0);
+        return;
+    }
+
+    atomic<int> next(0);
+    vector<thread> threads;
+    for (int t = 0; t < n_threads; t++){
+        threads.push_back(thread([&fn, &next, n, t](){
+            for (int i = next++; i < n; i = next++) fn(i, t);
+        }));
+    }
+    for (thread& th : threads) th.join();
+}
+
+
+
+// Stores the current state of a graph into the specified file, in the binary index format (see index_io.hpp).
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::store(const string& filename) const{
+    if (filename == ""){ return; }
+
+    // create a new file if it did not exist, or replace any contents existing before
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){ throw invalid_argument("Could not open index file for writing.\n"); }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.elem_size = sizeof(Elem);
+    header.n_nodes = this->n_nodes;
+    header.n_rows = this->vectors.size();
+    header.n_edges = this->Nout.n_edges();
+    header.dim = this->vectors.dim();
+    header.padded_dim = this->vectors.paddedDim();
+    header.metric = this->_metric;
+    header.element_type = elementTypeOf<Elem>();
+    header.R = this->Nout.maxDegree();
+    header.medoid = this->_medoid;
+    header.n_filtered_medoids = this->filteredMedoids.size();
+    header.pca_leading = (this->_pca != nullptr) ? this->_pca->leading() : 0;
+    layoutIndexHeader(header);
+
+    // header and the small per-node blocks
+    vector<int32_t> filtered_medoids;
+    for (const pair<const int, Id>& cpair : this->filteredMedoids){
+        filtered_medoids.push_back(cpair.first);
+        filtered_medoids.push_back(cpair.second);
+    }
+
+    vector<int32_t> categories(this->n_nodes), rows(this->n_nodes);
+    for (int i = 0; i < this->n_nodes; i++){
+        categories[i] = this->nodes[i].category;
+        rows[i] = this->nodes[i].row;
+    }
+
+    pwriteAll(fd, &header, sizeof(header), 0);
+    pwriteAll(fd, filtered_medoids.data(), filtered_medoids.size() * sizeof(int32_t), header.filtered_medoids_offset);
+    pwriteAll(fd, categories.data(), categories.size() * sizeof(int32_t), header.categories_offset);
+    pwriteAll(fd, rows.data(), rows.size() * sizeof(int32_t), header.rows_offset);
+
+    // vector block: the padded rows of the vector store are written as they are
+    pwriteChunked(fd, this->vectors.row(0), header.n_rows, (size_t) header.padded_dim * sizeof(Elem), header.vectors_offset);
+
+    // adjacency block, in CSR form
+    static_assert(sizeof(Id) == sizeof(int32_t), "Id must be stored as an int32");
+    vector<int> offsets;
+    vector<Id> ids;
+    if (!this->Nout.compacted()) this->Nout.copyCompact(offsets, ids);
+    const int* csr_offsets = (this->Nout.compacted()) ? this->Nout.csrOffsets() : offsets.data();
+    const Id* csr_ids = (this->Nout.compacted()) ? this->Nout.csrIds() : ids.data();
+
+    pwriteChunked(fd, csr_offsets, header.n_nodes + 1, sizeof(int32_t), header.adjacency_offsets_offset);
+    pwriteChunked(fd, csr_ids, header.n_edges, sizeof(int32_t), header.adjacency_ids_offset);
+
+    // PCA rotation block: the components without their padding
+    if (this->_pca != nullptr){
+        vector<float> components((size_t) header.dim * header.dim);
+        for (int c = 0; c < header.dim; c++) memcpy(components.data() + (size_t) c * header.dim, this->_pca->components().row(c), header.dim * sizeof(float));
+        pwriteAll(fd, components.data(), components.size() * sizeof(float), header.pca_offset);
+    }
+
+    // the last block may end before an alignment boundary: make sure the file covers the whole layout
+    if (ftruncate(fd, header.file_size) != 0){ close(fd); throw invalid_argument("Failed to write to the index file.\n"); }
+
+    close(fd);
+
+    c_log << "Graph Instance stored successfully in \"" << filename << '\"' << '\n';
+}
+
+// Loads a graph state from the specified file. A Graph instance must already be instantiated with the appropriate distance and isEmpty functions.
+// Both the binary index format and the legacy text format are accepted (detected by the magic number of the binary format).
+// If mapped (default: args.mmapIndex), a binary index is memory-mapped and its vector and adjacency blocks are used in place (read-only, see _loadMapped).
+// A binary index is read and checked in full before it replaces the state of the graph: if loading it fails, the graph is left as it was.
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::load(const string& filename, optional<bool> mapped){
+    if (filename == ""){ return; }
+
+    bool use_mmap = (mapped == nullopt) ? args.mmapIndex : mapped.value();
+
+    if (!isBinaryIndex(filename)){
+        if (use_mmap) c_log << "WARNING: Text indices cannot be memory-mapped. Loading a copy instead.\n";
+        this->_resetLoaded();
+        this->_loadText(filename);
+    }
+    else if (use_mmap) this->_loadMapped(filename);
+    else this->_loadBinary(filename);
+}
+
+// Drops the state derived from the values of the graph, before a loaded index replaces them
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_resetLoaded(){
+
+    // the loaded index replaces the frozen one (freeze it again once loaded)
+    this->_frozen = false;
+
+    // the codes and sketches of the previous values are not valid for the loaded ones, which come with their own rotation (if any)
+    this->_pq.reset();
+    this->_sq.reset();
+    this->_sketch.reset();
+    this->_pca.reset();
+    this->_fastscan.reset();
+}
+
+// Rebuilds the node table, the categories and the filtered medoids from the small blocks of a binary index (into the given containers)
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_loadNodeTable(const IndexHeader& header, const int32_t* filtered_medoids, const int32_t* categories, const int32_t* rows,
+                                                vector<Node<T>>& nodes, unordered_map<int, unordered_set<Id>>& category_nodes, unordered_map<int, Id>& medoids) const{
+
+    for (int i = 0; i < header.n_filtered_medoids; i++){
+        if (filtered_medoids[2*i + 1] < 0 || filtered_medoids[2*i + 1] >= header.n_nodes){ throw invalid_argument("Index file is corrupted.\n"); }
+        medoids[filtered_medoids[2*i]] = filtered_medoids[2*i + 1];
+    }
+
+    nodes.reserve(header.n_nodes);
+    for (int i = 0; i < header.n_nodes; i++){
+        if (rows[i] < -1 || rows[i] >= header.n_rows || categories[i] < -1){ throw invalid_argument("Index file is corrupted.\n"); }
+        nodes.push_back(Node<T>(i, categories[i], rows[i]));
+        if (categories[i] >= 0) category_nodes[categories[i]].insert(i);
+    }
+}
+
+// Replaces the node table, the categories, the filtered medoids and the vectors of the graph with the loaded ones (swapped in, without copies)
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_swapLoaded(const IndexHeader& header, vector<Node<T>>& nodes, unordered_map<int, unordered_set<Id>>& category_nodes,
+                                             unordered_map<int, Id>& medoids, VectorStore<Elem>& vectors){
+    this->_resetLoaded();
+
+    this->n_nodes = header.n_nodes;
+    this->n_edges = header.n_edges;
+    this->_medoid = header.medoid;
+    this->nodes.swap(nodes);
+    this->categories.swap(category_nodes);
+    this->filteredMedoids.swap(medoids);
+    this->vectors.swap(vectors);
+}
+
+// Loads a graph state stored in the binary index format
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_loadBinary(const string& filename){
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0){ throw invalid_argument("Could not open index file.\n"); }
+
+    // everything is read into these first
+    IndexHeader header;
+    vector<Node<T>> nodes;
+    unordered_map<int, unordered_set<Id>> category_nodes;
+    unordered_map<int, Id> medoids;
+    VectorStore<Elem> vectors;
+    vector<int> offsets;
+    vector<Id> ids;
+    unique_ptr<PCARotation> pca;
+
+    try{
+        struct stat st;
+        preadAll(fd, &header, sizeof(header), 0);
+        if (fstat(fd, &st) != 0){ throw invalid_argument("Could not open index file.\n"); }
+        checkIndexHeader(header, st.st_size, elementTypeOf<Elem>(), sizeof(Elem), this->_metric);
+
+        // header and the small per-node blocks
+        vector<int32_t> filtered_medoids(2 * header.n_filtered_medoids), categories(header.n_nodes), rows(header.n_nodes);
+        preadAll(fd, filtered_medoids.data(), filtered_medoids.size() * sizeof(int32_t), header.filtered_medoids_offset);
+        preadAll(fd, categories.data(), categories.size() * sizeof(int32_t), header.categories_offset);
+        preadAll(fd, rows.data(), rows.size() * sizeof(int32_t), header.rows_offset);
+        this->_loadNodeTable(header, filtered_medoids.data(), categories.data(), rows.data(), nodes, category_nodes, medoids);
+
+        // vector block: chunks are read in parallel straight into the padded rows of the vector store
+        if (header.n_rows > 0){
+            vectors.setDimension(header.dim);
+            vectors.resize(header.n_rows);
+            preadChunked(fd, vectors.row(0), header.n_rows, (size_t) header.padded_dim * sizeof(Elem), header.vectors_offset);
+        }
+
+        // adjacency block: read straight into the CSR arrays of the (frozen) adjacency store
+        offsets.resize(header.n_nodes + 1);
+        ids.resize(header.n_edges);
+        preadChunked(fd, offsets.data(), offsets.size(), sizeof(int32_t), header.adjacency_offsets_offset);
+        preadChunked(fd, ids.data(), ids.size(), sizeof(int32_t), header.adjacency_ids_offset);
+        checkIndexAdjacency(header, offsets.data(), (const int32_t*) ids.data());
+
+        // PCA rotation block
+        if (header.pca_leading > 0){
+            vector<float> components((size_t) header.dim * header.dim);
+            preadAll(fd, components.data(), components.size() * sizeof(float), header.pca_offset);
+            pca.reset(new PCARotation(header.dim, header.pca_leading, components.data()));
+        }
+    }
+    catch (...) { close(fd); throw; }
+
+    close(fd);
+
+    this->_swapLoaded(header, nodes, category_nodes, medoids, vectors);
+    this->Nout.assignCompact(move(offsets), move(ids));
+    this->_pca = move(pca);
+    this->_mapped.reset();
+
+    c_log << "Graph Instance loaded successfully from \"" << filename << '\"' << '\n';
+}
+
+// Loads a graph state stored in the binary index format by memory-mapping the file.
+// The vector and adjacency blocks are used in place (no copy, pages are loaded on demand and shared between processes through the page cache).
+// Only the node table and the categories are rebuilt, in one sequential pass over their columns.
+// The vectors are read-only. Modifying the edges copies them out of the mapping first.
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_loadMapped(const string& filename){
+
+    unique_ptr<MappedFile> mapped(new MappedFile(filename));
+
+    IndexHeader header;
+    if (mapped->size() < sizeof(header)){ throw invalid_argument("Index file is truncated.\n"); }
+    memcpy(&header, mapped->data(), sizeof(header));
+    checkIndexHeader(header, mapped->size(), elementTypeOf<Elem>(), sizeof(Elem), this->_metric);
+
+    // the header checks keep every block within the mapping. The adjacency block is checked in full (which reads it all once)
+    const char* base = mapped->data();
+    const int* offsets = (const int*) (base + header.adjacency_offsets_offset);
+    checkIndexAdjacency(header, offsets, (const int32_t*) (base + header.adjacency_ids_offset));
+
+    vector<Node<T>> nodes;
+    unordered_map<int, unordered_set<Id>> category_nodes;
+    unordered_map<int, Id> medoids;
+    this->_loadNodeTable(header,
+        (const int32_t*) (base + header.filtered_medoids_offset),
+        (const int32_t*) (base + header.categories_offset),
+        (const int32_t*) (base + header.rows_offset),
+        nodes, category_nodes, medoids);
+
+    VectorStore<Elem> vectors;
+    if (header.n_rows > 0) vectors.attach((const Elem*) (base + header.vectors_offset), header.dim, header.n_rows);
+
+    // the rotation is copied out of the mapping (its rows are padded for the SIMD kernels)
+    unique_ptr<PCARotation> pca;
+    if (header.pca_leading > 0) pca.reset(new PCARotation(header.dim, header.pca_leading, (const float*) (base + header.pca_offset)));
+
+    this->_swapLoaded(header, nodes, category_nodes, medoids, vectors);
+    this->Nout.attachCompact(offsets, (const Id*) (base + header.adjacency_ids_offset), header.n_nodes, header.n_edges);
+    this->_pca = move(pca);
+    this->_mapped = move(mapped);       // releases the previous mapping, now that nothing points into it
+
+    c_log << "Graph Instance mapped successfully from \"" << filename << '\"' << '\n';
+}
+
+// Stores the current state of a graph into the specified file, in the legacy text format.
 // IMPORTANT: makes use of overloaded << operator to store the graph into a file.
 // Make sure SHOULD_OMIT flag in config.hpp file is set to 0
-template<typename T>
-void DirectedGraph<T>::store(const string& filename) const{
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::storeText(const string& filename) const{
     if (filename == ""){ return; }
+    if (this->_pca != nullptr){ throw invalid_argument("The PCA rotation cannot be stored in the text format.\n"); }
     fstream file;
 
     // create a new file if it did not exist, or replace any contents existing before
@@ -962,7 +1900,14 @@ void DirectedGraph<T>::store(const string& filename) const{
     file << '\n';
     file << this->n_nodes;
     file << '\n';
-    file << this->nodes;
+
+    // nodes are written as <[id|category|value], ...> (values are read back from the vector store)
+    file << '<';
+    for (int i = 0; i < this->n_nodes; i++){
+        if (i > 0) file << ", ";
+        file << '[' << this->nodes[i].id << '|' << this->nodes[i].category << '|' << this->getValue(i) << ']';
+    }
+    file << '>';
     file << '\n';
     file << this->_medoid;
     file << '\n';
@@ -970,18 +1915,17 @@ void DirectedGraph<T>::store(const string& filename) const{
     file << "\n";
     file << this->categories;
     file << '\n';
-    file << this->Nout;
+    file << this->get_Nout();
     
     file.close();
 
     c_log << "Graph Instance stored successfully in \"" << filename << '\"' << '\n';
 }
 
-// Loads a graph state from the specified file. A Graph instance must already be instantiated with the appropriate distance and isEmpty functions.
+// Loads a graph state stored in the legacy text format.
 // IMPORTANT: makes use of overloaded >> operator to load the graph from a file
-template<typename T>
-void DirectedGraph<T>::load(const string& filename){
-    if (filename == ""){ return; }
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::_loadText(const string& filename){
     fstream file;
 
     file.open(filename, ios::in);
@@ -990,7 +1934,30 @@ void DirectedGraph<T>::load(const string& filename){
     file.ignore(1);         // ignores \n
     file >> this->n_nodes;
     file.ignore(1);
-    file >> this->nodes;
+
+    // nodes: <[id|category|value], ...>. Values are appended to the vector store in id order
+    this->nodes.clear();
+    this->vectors.clear();
+    this->_mapped.reset();
+    file.ignore(1);         // ignores <
+    if (file.peek() == '>') file.ignore(1);
+    else {
+        int id, category;
+        T value;
+        while (file.ignore(1) && file >> id){      // ignores [
+            file.ignore(1);                         // ignores |
+            file >> category;
+            file.ignore(1);                         // ignores |
+            file >> value;
+            file.ignore(1);                         // ignores ]
+
+            int row = this->isEmpty(value) ? -1 : this->vectors.append(value.data(), value.size());
+            this->nodes.push_back(Node<T>(id, category, row));
+
+            if (file.peek() == '>') { file.ignore(1); break; }
+            file.ignore(2);                         // ignores ", "
+        }
+    }
     file.ignore(1);
     file >> this->_medoid;
     file.ignore(1);
@@ -998,31 +1965,58 @@ void DirectedGraph<T>::load(const string& filename){
     file.ignore(1);
     file >> this->categories;
     file.ignore(1); 
-    file >> this->Nout;
+
+    // edges: {(from, <to, ...>), ...}, inserted into the adjacency store and compacted (a loaded index is frozen)
+    unordered_map<Id, unordered_set<Id>> nout;
+    file >> nout;
+    this->Nout.reset();
+    this->Nout.resize(this->n_nodes);
+    for (const pair<const Id, unordered_set<Id>>& edges : nout)
+        for (const Id& to : edges.second)
+            this->Nout.insert(edges.first, to);
+    this->Nout.compact();
 
     file.close();
 
-    for (Node<T>& node : this->nodes)    // update isEmpty function (not serialized, argument in graph)
-        node.isEmpty = this->isEmpty;
-    
     c_log << "Graph Instance loaded successfully from \"" << filename << '\"' << '\n';
 }
 
 
-template<typename T>
-void DirectedGraph<T>::init(){
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::init(){
 
+    this->_frozen = false;
     this->clearEdges();
     this->n_edges = 0;
     this->n_nodes = 0;
     this->nodes.clear();
+    this->vectors.clear();
+    this->_mapped.reset();
+    this->_pq.reset();
+    this->_sq.reset();
+    this->_sketch.reset();
+    this->_pca.reset();
+    this->_fastscan.reset();
     this->_medoid = -1;
     this->filteredMedoids.clear();
     this->categories.clear();
-    this->Nout.clear();
-
-    this->_active_W = false;
-    this->_active_GS = 0;
+    this->Nout.reset();
 
     c_log << "Graph Successfully initialized to default values apart from function arguments.\n";
-}
\ No newline at end of file
+}
+// Makes the index read-only: the starting nodes are computed now (the searches would compute and store them on their first use otherwise),
+// and the edges are compacted
+template<typename T, typename Distance>
+void DirectedGraph<T, Distance>::freeze(){
+
+    if (this->n_nodes > 0 && !args.randomStart){
+        // the medoids of the categories are only the starting nodes of the filtered and stitched indexes
+        bool filtered_index = args.index_type == FILTERED_VAMANA || args.index_type == STITCHED_VAMANA;
+        if (filtered_index && !this->categories.empty()) this->findMedoids(args.threshold);
+        this->medoid();
+    }
+    this->compactEdges();
+    this->_frozen = true;
+
+    c_log << "Index frozen: read-only queries.\n";
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+
+#include "util.hpp"
+#include "vector_store.hpp"
+#include "pca.hpp"
+
+using namespace std;
+
+// This file defines the binary index file format written by DirectedGraph::store and read by DirectedGraph::load.
+//
+// Layout (all integers little-endian, as written by the host):
+//   IndexHeader                                        fixed-size header, see below
+//   filtered medoids   n_filtered_medoids x (int32 category, int32 id)
+//   category block     n_nodes x int32                 category of each node (-1 = no category)
+//   row block          n_nodes x int32                 row of each node in the vector block (-1 = empty value)
+//   vector block       n_rows x padded_dim x elem_size values, row-major, zero-padded exactly as in a VectorStore
+//   adjacency offsets  (n_nodes + 1) x int32           CSR offsets: node i owns ids [offsets[i], offsets[i+1])
+//   adjacency ids      n_edges x int32                 CSR out-neighbors
+//   PCA rotation       dim x dim x float32             principal components, one per row (only if pca_leading > 0)
+//
+// Every block starts at the byte offset recorded for it in the header, so readers can seek to any block directly.
+// The vector and adjacency blocks are read and written in chunks of INDEX_IO_CHUNK_BYTES by args.n_threads threads.
+// Blocks start on a VECTOR_ALIGNMENT-byte boundary and rows are padded like the VectorStore rows,
+// so a memory-mapped file (see DirectedGraph::load) can serve the vector and adjacency blocks in place, without copying them.
+//
+// The stored rows are the transformed values of the metric (unit length for cosine, with the extra coordinate for MIPS),
+// rotated by the PCA rotation of the index if it has one (see DirectedGraph::applyPCA).
+
+constexpr char INDEX_MAGIC[8] = {'D', 'G', 'I', 'N', 'D', 'E', 'X', '\0'};
+constexpr uint32_t INDEX_FORMAT_VERSION = 1;
+constexpr size_t INDEX_IO_CHUNK_BYTES = 8 << 20;     // 8 MiB per chunk
+
+struct IndexHeader{
+    char magic[8];                      // INDEX_MAGIC
+    uint32_t version;                   // INDEX_FORMAT_VERSION
+    uint32_t elem_size;                 // sizeof(T::value_type) of the stored values
+    int32_t element_type;               // ElementType of the values (the element size alone cannot tell uint8 from int8)
+    int32_t metric;                     // Metric of the index
+    int32_t n_nodes;
+    int32_t n_rows;                     // number of nodes with a non-empty value
+    int32_t n_edges;
+    int32_t dim;
+    int32_t padded_dim;                 // elements per stored row
+    int32_t R;                          // maximum out-degree
+    int32_t medoid;                     // -1 if not computed
+    int32_t n_filtered_medoids;
+    int32_t pca_leading;                // leading coordinates of the two-tier PCA distances (0 = the values are not rotated)
+    int32_t reserved;
+    uint64_t filtered_medoids_offset;   // byte offsets of the blocks, from the start of the file
+    uint64_t categories_offset;
+    uint64_t rows_offset;
+    uint64_t vectors_offset;
+    uint64_t adjacency_offsets_offset;
+    uint64_t adjacency_ids_offset;
+    uint64_t pca_offset;                // only if pca_leading > 0
+    uint64_t file_size;
+};
+
+// Returns true if the file starts with the magic number of the binary index format
+inline bool isBinaryIndex(const string& filename){
+    ifstream file(filename, ios::in | ios::binary);
+    char magic[8];
+    if (!file.read(magic, sizeof(magic))) { return false; }
+    return memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0;
+}
+
+// Rounds a byte offset up to the next VECTOR_ALIGNMENT boundary
+inline uint64_t alignIndexOffset(uint64_t offset){
+    return ((offset + VECTOR_ALIGNMENT - 1) / VECTOR_ALIGNMENT) * VECTOR_ALIGNMENT;
+}
+
+// Fills in the magic number, the version and the (aligned) block offsets of a header whose counts, padded_dim and pca_leading are already set
+inline void layoutIndexHeader(IndexHeader& header){
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_FORMAT_VERSION;
+
+    uint64_t offset = sizeof(IndexHeader);
+    header.filtered_medoids_offset = offset = alignIndexOffset(offset);     offset += (uint64_t) header.n_filtered_medoids * 2 * sizeof(int32_t);
+    header.categories_offset = offset = alignIndexOffset(offset);           offset += (uint64_t) header.n_nodes * sizeof(int32_t);
+    header.rows_offset = offset = alignIndexOffset(offset);                 offset += (uint64_t) header.n_nodes * sizeof(int32_t);
+    header.vectors_offset = offset = alignIndexOffset(offset);              offset += (uint64_t) header.n_rows * header.padded_dim * header.elem_size;
+    header.adjacency_offsets_offset = offset = alignIndexOffset(offset);    offset += (uint64_t) (header.n_nodes + 1) * sizeof(int32_t);
+    header.adjacency_ids_offset = offset = alignIndexOffset(offset);        offset += (uint64_t) header.n_edges * sizeof(int32_t);
+    if (header.pca_leading > 0){
+        header.pca_offset = offset = alignIndexOffset(offset);              offset += (uint64_t) header.dim * header.dim * sizeof(float);
+    }
+    header.file_size = offset;
+}
+
+// Reads the header of a binary index file
+inline IndexHeader readIndexHeader(const string& filename){
+    IndexHeader header;
+    ifstream file(filename, ios::in | ios::binary);
+    if (!file.read((char*) &header, sizeof(header))) { throw invalid_argument("Index file is truncated.\n"); }
+    return header;
+}
+
+// Reads the metric of a binary index file (e.g. to pick the distance policy of the graph that loads it)
+inline Metric readIndexMetric(const string& filename){
+    return (Metric) readIndexHeader(filename).metric;
+}
+
+// Reads the element type of a binary index file (e.g. to pick the value type of the graph that loads it)
+inline ElementType readIndexElementType(const string& filename){
+    return (ElementType) readIndexHeader(filename).element_type;
+}
+
+// Checks the header of a binary index against the element type, the element size and the metric of the graph loading it, and against itself:
+// the counts must be valid and the block offsets must be exactly the layout of the counts, within a file of file_size bytes
+inline void checkIndexHeader(const IndexHeader& header, uint64_t file_size, ElementType element_type, size_t elem_size, Metric metric){
+
+    if (header.version != INDEX_FORMAT_VERSION){ throw invalid_argument("Unsupported index format version.\n"); }
+
+    if (header.elem_size != elem_size){ throw invalid_argument("Element size of the index does not match the graph.\n"); }
+
+    if ((ElementType) header.element_type != element_type){ throw invalid_argument("Element type of the index does not match the graph.\n"); }
+
+    if ((Metric) header.metric != metric){ throw invalid_argument("Metric of the index does not match the graph.\n"); }
+
+    // counts
+    if (header.n_nodes < 0 || header.n_rows < 0 || header.n_rows > header.n_nodes || header.n_edges < 0 || header.dim < 0 || header.n_filtered_medoids < 0){
+        throw invalid_argument("Index file is corrupted.\n");
+    }
+    if (header.n_rows > 0 && header.dim == 0){ throw invalid_argument("Index file is corrupted.\n"); }
+    int per_block = VECTOR_ALIGNMENT / elem_size;
+    if (header.padded_dim != ((header.dim + per_block - 1) / per_block) * per_block){ throw invalid_argument("Index file is corrupted.\n"); }
+    if (header.medoid < -1 || header.medoid >= header.n_nodes){ throw invalid_argument("Index file is corrupted.\n"); }
+    if (header.pca_leading < 0 || (header.pca_leading > 0 && (header.pca_leading % PCA_LEADING_STEP != 0 || header.pca_leading >= header.dim))){
+        throw invalid_argument("Index file is corrupted.\n");
+    }
+
+    // block offsets
+    IndexHeader layout = header;
+    layout.pca_offset = 0;
+    layoutIndexHeader(layout);
+    if (memcmp(&layout, &header, sizeof(header)) != 0){ throw invalid_argument("Index file is corrupted.\n"); }
+
+    if (file_size < header.file_size){ throw invalid_argument("Index file is truncated.\n"); }
+}
+
+// Checks the CSR arrays of the adjacency block of a binary index: the offsets start at 0, never decrease and end at n_edges,
+// and the ids are nodes of the index
+inline void checkIndexAdjacency(const IndexHeader& header, const int32_t* offsets, const int32_t* ids){
+
+    if (offsets[0] != 0 || offsets[header.n_nodes] != header.n_edges){ throw invalid_argument("Index file is corrupted.\n"); }
+
+    for (int i = 0; i < header.n_nodes; i++){
+        if (offsets[i + 1] < offsets[i]){ throw invalid_argument("Index file is corrupted.\n"); }
+    }
+
+    for (int e = 0; e < header.n_edges; e++){
+        if (ids[e] < 0 || ids[e] >= header.n_nodes){ throw invalid_argument("Index file is corrupted.\n"); }
+    }
+}
+
+
+// Splits n_items items of item_bytes bytes each into chunks of about INDEX_IO_CHUNK_BYTES and calls fn(first, count) for every chunk.
+// Chunks are distributed among args.n_threads threads. Exceptions thrown by fn are rethrown in the calling thread.
+inline void forEachIndexChunk(size_t n_items, size_t item_bytes, const function<void(size_t, size_t)>& fn){
+
+    if (n_items == 0) { return; }
+
+    size_t chunk_items = max((size_t) 1, INDEX_IO_CHUNK_BYTES / max(item_bytes, (size_t) 1));
+    size_t n_chunks = (n_items + chunk_items - 1) / chunk_items;
+
+    size_t next_chunk = 0;
+    mutex mx_chunk;
+    exception_ptr error = nullptr;
+
+    auto worker = [&](){
+        while (true){
+            size_t my_chunk;
+            {
+                lock_guard<mutex> _lock(mx_chunk);
+                if (next_chunk >= n_chunks || error != nullptr) { return; }
+                my_chunk = next_chunk++;
+            }
+
+            size_t first = my_chunk * chunk_items;
+            try { fn(first, min(chunk_items, n_items - first)); }
+            catch (...) {
+                lock_guard<mutex> _lock(mx_chunk);
+                if (error == nullptr) error = current_exception();
+            }
+        }
+    };
+
+    int n_threads = (int) min((size_t) max(args.n_threads, 1), n_chunks);
+    if (n_threads == 1) { worker(); }
+    else{
+        vector<thread> threads;
+        for (int i = 0; i < n_threads; i++) threads.push_back(thread(worker));
+        for (thread& th : threads) th.join();
+    }
+
+    if (error != nullptr) { rethrow_exception(error); }
+}
+
+// Writes bytes bytes at offset of the file descriptor fd, retrying on partial writes
+inline void pwriteAll(int fd, const void* data, size_t bytes, uint64_t offset){
+    const char* ptr = (const char*) data;
+    while (bytes > 0){
+        ssize_t written = pwrite(fd, ptr, bytes, offset);
+        if (written <= 0) { throw invalid_argument("Failed to write to the index file.\n"); }
+        ptr += written;
+        offset += written;
+        bytes -= written;
+    }
+}
+
+// Reads bytes bytes at offset of the file descriptor fd, retrying on partial reads
+inline void preadAll(int fd, void* data, size_t bytes, uint64_t offset){
+    char* ptr = (char*) data;
+    while (bytes > 0){
+        ssize_t n_read = pread(fd, ptr, bytes, offset);
+        if (n_read <= 0) { throw invalid_argument("Index file is truncated.\n"); }
+        ptr += n_read;
+        offset += n_read;
+        bytes -= n_read;
+    }
+}
+
+// Writes a contiguous array in parallel chunks at offset of the file descriptor fd
+inline void pwriteChunked(int fd, const void* data, size_t n_items, size_t item_bytes, uint64_t offset){
+    forEachIndexChunk(n_items, item_bytes, [&](size_t first, size_t count){
+        pwriteAll(fd, (const char*) data + first * item_bytes, count * item_bytes, offset + first * item_bytes);
+    });
+}
+
+// Reads a contiguous array in parallel chunks from offset of the file descriptor fd
+inline void preadChunked(int fd, void* data, size_t n_items, size_t item_bytes, uint64_t offset){
+    forEachIndexChunk(n_items, item_bytes, [&](size_t first, size_t count){
+        preadAll(fd, (char*) data + first * item_bytes, count * item_bytes, offset + first * item_bytes);
+    });
+}
@@ -2,6 +2,7 @@
 
 #include "config.hpp"
 #include "util.hpp"
+#include "vector_store.hpp"
 #include "types.hpp"
 #include "id.hpp"
 #include "node_and_query.hpp"
@@ -14,15 +15,16 @@ using namespace std;
 // This file is an interface file that contains all the dependencies of the project. Simply include "interface.hpp" in your project and you're good to go!
 
 
-// specific read_query function for .vecs format (only for unfiltered queries. Return format is used to match read_queries_bin_contest function)
+// specific read_query function for .vecs and .<f|u8|i8>bin formats (only for unfiltered queries. Return format is used to match read_queries_bin_contest function)
 template <typename T>
 pair<vector<Query<T>>, vector<Query<T>>> read_queries_vecs(void){
 
-    vector<T> queries_raw = read_vecs<float>(args.queries_path, args.n_queries);
+    vector<T> queries_raw = read_vecs<typename T::value_type>(args.queries_path, args.n_queries);
     vector<Query<T>> unfiltered_queries;
+    unfilteredQueryIndices.clear();     // the queries may be read more than once (e.g. to evaluate the index again with PQ)
 
     for (int i = 0; i < queries_raw.size(); i++){
-        Query<T> q(i, -1, false, queries_raw[i], vectorEmpty<float>);
+        Query<T> q(i, -1, false, queries_raw[i], vectorEmpty<typename T::value_type>);
         unfiltered_queries.push_back(q);
         unfilteredQueryIndices.push_back(i);
     }
@@ -33,28 +35,30 @@ pair<vector<Query<T>>, vector<Query<T>>> read_queries_vecs(void){
     return queries;
 };
 
-// specific read_query function for .bin format with specifications as described in the SIGMOD 2024 contest
+// specific read_query function for .bin format with specifications as described in the SIGMOD 2024 contest (float rows, converted to T)
 template <typename T>
 pair<vector<Query<T>>, vector<Query<T>>> read_queries_bin_contest(void){
-    vector<T> queries_raw;
+    vector<vector<float>> queries_raw;
     ReadBin(args.queries_path, args.dim_query, ref(queries_raw));
 
     vector<Query<T>> unfiltered_queries;
     vector<Query<T>> filtered_queries;
+    unfilteredQueryIndices.clear();     // the queries may be read more than once (e.g. to evaluate the index again with PQ)
+    filteredQueryIndices.clear();
 
     for (int i = 0; i < queries_raw.size(); i++){
         T query_value(queries_raw[i].begin() + 4, queries_raw[i].end());
 
         if(args.unfiltered){
             if (queries_raw[i][0] == 0){   // get only the unfiltered queries.
-                Query<T> q(i, -1, false, query_value, vectorEmpty<float>);
+                Query<T> q(i, -1, false, query_value, vectorEmpty<typename T::value_type>);
                 unfiltered_queries.push_back(q);
                 unfilteredQueryIndices.push_back(i);
             }
         }
         if(args.filtered){
             if (queries_raw[i][0] == 1){   // get only the filtered queries.
-                Query<T> q(i, queries_raw[i][1], true, query_value, vectorEmpty<float>);
+                Query<T> q(i, queries_raw[i][1], true, query_value, vectorEmpty<typename T::value_type>);
                 filtered_queries.push_back(q);
                 filteredQueryIndices.push_back(i);
             }
@@ -77,14 +81,52 @@ pair<vector<Query<T>>, vector<Query<T>>> read_queries(void){
     // This function is to be passed in the index evaluation function.
 };
 
-bool endsWith(const string& str, const string& suffix) {
-    return str.size() >= suffix.size() &&
-           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+// Maximum norm of n rows of dimension dim, where row(i) points to the i-th row (for the MIPS-to-L2 transform, see DirectedGraph::setMipsNorm)
+template <typename RowFn>
+float maxRowNorm(int n, int dim, RowFn row){
+    float max_norm2 = 0.0f;
+    for (int i = 0; i < n; i++)
+        max_norm2 = max(max_norm2, row_innerProduct(row(i), row(i), dim));
+    return sqrt(max_norm2);
+}
+
+// Creates a node for every row of a dataset, copying each row straight from the file into the graph's vector storage.
+// The first skip values of every row are not part of the node's value. If categorized, the first value of a row is the node's category.
+template <typename T, typename Distance>
+void streamDataset(DirectedGraph<T, Distance>& DG, const DatasetReader<typename T::value_type>& reader, int skip, bool categorized){
+
+    c_log << "Streaming " << reader.size() << " points into the graph\n";
+
+    // a MIPS graph needs the maximum norm before the first node is created: one more sequential pass over the (mapped) file
+    if (DG.getMetric() == METRIC_MIPS) DG.setMipsNorm(maxRowNorm(reader.size(), reader.dim() - skip, [&](int i) { return reader.row(i) + skip; }));
+
+    if (reader.dim() > skip) DG.reserve(DG.get_n_nodes() + reader.size(), reader.dim() - skip);
+
+    for (int i = 0; i < reader.size(); i++){
+        const typename T::value_type* row = reader.row(i);
+        DG.createNode(row + skip, reader.dim() - skip, categorized ? (int) row[0] : -1);
+    }
+}
+
+// Creates a node for every row of text data: the first value of a row is the node's category, the value starts at the third one
+template <typename T, typename Distance>
+void createCategorizedNodes(DirectedGraph<T, Distance>& DG, const vector<vector<float>>& data){
+
+    if (DG.getMetric() == METRIC_MIPS && !data.empty())
+        DG.setMipsNorm(maxRowNorm(data.size(), data[0].size() - 2, [&](int i) { return data[i].data() + 2; }));
+
+    // Populate the Graph
+    for (const vector<float>& value : data){
+        int category = value[0];
+        // Ignore the first 2 dimensions when finding the value
+        if constexpr (is_same<typename T::value_type, float>::value) DG.createNode(value.data() + 2, value.size() - 2, category);
+        else DG.createNode(T(value.begin() + 2, value.end()), category);
+    }
 }
 
 // Creates the index on the graph based on the indexing type and return the duration in microseconds
-template <typename T>
-chrono::microseconds createIndex(DirectedGraph<T>& DG){
+template <typename T, typename Distance>
+chrono::microseconds createIndex(DirectedGraph<T, Distance>& DG){
     chrono::microseconds duration = (chrono::microseconds) 0;
     chrono::high_resolution_clock::time_point startTime, endTime;
 
@@ -93,24 +135,18 @@ chrono::microseconds createIndex(DirectedGraph<T>& DG){
 
     switch (args.index_type){
         case VAMANA:
-            // Read base vectors file
+            // Populate the Graph straight from the base vectors file (filtered data: ignore the first 2 dimensions)
             if(endsWith(args.data_path, ".bin")){
-                ReadBin(args.data_path, args.dim_data, data);
+                streamDataset(DG, DatasetReader<typename T::value_type>(args.data_path, args.dim_data), (args.unfiltered && !args.data_is_unfiltered) ? 2 : 0, false);
             }
             else{
-                data = read_vecs<float>(args.data_path, args.n_data);
-            }
-
-            // Populate the Graph
-            for (auto& v : data){
-                if (args.unfiltered && !args.data_is_unfiltered){
-                    v = T(v.begin() + 2, v.end());
-                }
-                DG.createNode(v);
+                streamDataset(DG, DatasetReader<typename T::value_type>(args.data_path, -1, args.n_data), (args.unfiltered && !args.data_is_unfiltered) ? 2 : 0, false);
             }
 
             // Start the timer and create the index using vamanaAlgorithm
             startTime = chrono::high_resolution_clock::now();
+            if (args.pcaLeading > 0) DG.applyPCA(args.pcaLeading);                            // the values are rotated before anything is computed on them
+            if (args.sketchBits > 0) DG.enableSketch(args.sketchBits, args.sketchMargin);     // the sketches prefilter the distances of the build
             DG.vamanaAlgorithm(args.L, args.R, args.a);
             endTime = chrono::high_resolution_clock::now();
 
@@ -123,7 +159,8 @@ chrono::microseconds createIndex(DirectedGraph<T>& DG){
 
             // Read data
             if(endsWith(args.data_path, ".bin")){
-                ReadBin(args.data_path, args.dim_data, data);
+                // Populate the Graph straight from the file (category in the first dimension)
+                streamDataset(DG, DatasetReader<typename T::value_type>(args.data_path, args.dim_data), 2, true);
             }else{
                 if(!data_file.is_open()){
                     cout << "Could not open file\n";
@@ -132,18 +169,14 @@ chrono::microseconds createIndex(DirectedGraph<T>& DG){
 
                 data_file >> data;
                 data_file.close();
-            }
 
-            // Populate the Graph
-            for (const T& value : data){
-                int category = value[0];
-                // Ignore the first 2 dimensions when finding the value
-                T newValue(value.begin() + 2, value.end());
-                DG.createNode(newValue, category);
+                createCategorizedNodes(DG, data);
             }
 
             // Start the timer and create the index using vamanaAlgorithm
             startTime = chrono::high_resolution_clock::now();
+            if (args.pcaLeading > 0) DG.applyPCA(args.pcaLeading);                            // the values are rotated before anything is computed on them
+            if (args.sketchBits > 0) DG.enableSketch(args.sketchBits, args.sketchMargin);     // the sketches prefilter the distances of the build
             DG.filteredVamanaAlgorithm(args.L, args.R, args.a, args.threshold);
             endTime = chrono::high_resolution_clock::now();
 
@@ -156,7 +189,8 @@ chrono::microseconds createIndex(DirectedGraph<T>& DG){
 
             // Read data
             if(endsWith(args.data_path, ".bin")){
-                ReadBin(args.data_path, args.dim_data, data);
+                // Populate the Graph straight from the file (category in the first dimension)
+                streamDataset(DG, DatasetReader<typename T::value_type>(args.data_path, args.dim_data), 2, true);
             }else{
                 if(!data_file.is_open()){
                     cout << "Could not open file\n";
@@ -165,18 +199,14 @@ chrono::microseconds createIndex(DirectedGraph<T>& DG){
 
                 data_file >> data;
                 data_file.close();
-            }
 
-            // Populate the Graph
-            for (const T& value : data){
-                int category = value[0];
-                // Ignore the first 2 dimensions when finding the value
-                T newValue(value.begin() + 2, value.end());
-                DG.createNode(newValue, category);
+                createCategorizedNodes(DG, data);
             }
             
             // Start the timer and create the index using vamanaAlgorithm
             startTime = chrono::high_resolution_clock::now();
+            if (args.pcaLeading > 0) DG.applyPCA(args.pcaLeading);                            // the values are rotated before anything is computed on them
+            if (args.sketchBits > 0) DG.enableSketch(args.sketchBits, args.sketchMargin);     // the sketches prefilter the distances of the build
             DG.stitchedVamanaAlgorithm(args.L, args.R, args.Rsmall, args.a);
             endTime = chrono::high_resolution_clock::now();
 
@@ -192,49 +222,114 @@ chrono::microseconds createIndex(DirectedGraph<T>& DG){
 }
 
 // Based on the qiven vector, the function returns the query's neighbors
-template <typename T>
-unordered_set<Id> DirectedGraph<T>::findNeighbors(Query<T> q){
-    // Set for storing the query's neighbors
-    unordered_set<Id> queryNeighbors;
-    
+template <typename T, typename Distance>
+unordered_set<Id> DirectedGraph<T, Distance>::findNeighbors(const Query<T>& q){
+    SearchContext& ctx = searchContext();
+    this->findNeighbors(q, ctx);
+    return this->_resultSet(ctx.results);
+}
+
+// Returns the query's neighbors with their distances, by increasing distance
+template <typename T, typename Distance>
+vector<pair<Id, float>> DirectedGraph<T, Distance>::findNeighborsRanked(const Query<T>& q){
+    SearchContext& ctx = searchContext();
+    this->findNeighbors(q, ctx);
+    return ctx.results;
+}
+
+// Finds the query's neighbors on the search context ctx (into ctx.results)
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::findNeighbors(const Query<T>& q, SearchContext& ctx){
+
     // Check index_type
     if(args.index_type == VAMANA){
-        queryNeighbors = this->greedySearch(this->startingNode(), q.value, args.k, args.L).first;
+        this->search(this->startingNode(), q.value.data(), q.value.size(), args.k, args.L, ctx);
     }
-    else if(args.index_type == FILTERED_VAMANA || args.index_type == STITCHED_VAMANA){                      // in both cases we call filteredGreedySearch
+    else if(args.index_type == FILTERED_VAMANA || args.index_type == STITCHED_VAMANA){                      // in both cases we run the filtered search
         if (q.category != -1){  // filtered query case
-            queryNeighbors = this->filteredGreedySearch(this->startingNode(q.category), q, args.k, args.L).first;
+            this->search(this->startingNode(q.category), q.value.data(), q.value.size(), args.k, args.L, ctx, q.category);
         }
         else{   // unfiltered query: get K neighbors of each category and get the closest K of the union of the neighbors of each category
 
             if (!args.accumulateUnfiltered){
-                queryNeighbors = this->filteredGreedySearch(this->startingNode(), q, args.k, args.L).first; // CONSIDER OPTIMIZATIONS FOR UNFILTERED QUERIES STARTING NODE - TODO
+                this->search(this->startingNode(), q.value.data(), q.value.size(), args.k, args.L, ctx); // CONSIDER OPTIMIZATIONS FOR UNFILTERED QUERIES STARTING NODE - TODO
             }
-            else {  // costs |C| * findNeighbors + O(|C|*100) (nth element)
-                for (pair<int, unordered_set<Id>> cpair : this->categories){                    // unfiltered query => find K neighbors in all categories
-                    unordered_set<Id> queryNeighbors_f;                                         // and take the best K of all n_categories*K neighbor candidates
-                    q.category = cpair.first;                                                   // update the category of the query
-                    queryNeighbors_f = findNeighbors(q);                             // find the neighbors of that category
-                    queryNeighbors.insert(queryNeighbors_f.begin(), queryNeighbors_f.end());    // insert them in the neighbor-candidate set
+            else {  // costs |C| * search + O(|C|*100) (partial sort), the distances come with the results of each category
+                ctx.merged.clear();
+                for (const pair<const int, unordered_set<Id>>& cpair : this->categories){      // unfiltered query => find K neighbors in all categories
+                    this->search(this->startingNode(cpair.first), q.value.data(), q.value.size(), args.k, args.L, ctx, cpair.first);
+                    ctx.merged.insert(ctx.merged.end(), ctx.results.begin(), ctx.results.end());  // and take the best K of all n_categories*K neighbor candidates
                 }
-                queryNeighbors = this->_closestN(args.k, queryNeighbors, q.value);         // keep the closest K neighbors of all neighbor candidates
+                // keep the closest K neighbors of all neighbor candidates (a node has a single category: the candidates are distinct)
+                int k = min(args.k, (int) ctx.merged.size());
+                partial_sort(ctx.merged.begin(), ctx.merged.begin() + k, ctx.merged.end(),
+                    [](const pair<Id, float>& r1, const pair<Id, float>& r2) { return r1.second < r2.second || (r1.second == r2.second && r1.first < r2.first); });
+                ctx.results.assign(ctx.merged.begin(), ctx.merged.begin() + k);
             }
         }
     }
-    
-    // Return the set containing the query's neighbors
-    return queryNeighbors;
 }
 
-// Thread function for parallel querying.
-template <typename T>
-void DirectedGraph<T>::_thread_findQueryNeighbors_fn(vector<Query<T>>& queries, mutex& mx_query_index, int& query_index, vector<unordered_set<Id>>& returnVec){
+// Thread function for parallel querying. Every thread searches on its own search context.
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_thread_findQueryNeighbors_fn(vector<Query<T>>& queries, mutex& mx_query_index, int& query_index, vector<vector<pair<Id, float>>>& returnVec){
+    SearchContext ctx;
     mx_query_index.lock();
     while(query_index < queries.size()){
         int my_q_index = query_index++;     // store current and increment
         mx_query_index.unlock();
 
-        returnVec[my_q_index] = findNeighbors(queries[my_q_index]);
+        this->findNeighbors(queries[my_q_index], ctx);
+        returnVec[my_q_index] = ctx.results;
+
+        mx_query_index.lock();
+    }
+    mx_query_index.unlock();
+}
+
+// Thread function for batched querying: the thread takes args.queryBatch queries at a time and searches them together (see searchBatch).
+// Larger batches than searchBatch supports are taken in chunks of BATCH_MAX_QUERIES. Accumulated unfiltered queries are searched one by one.
+template <typename T, typename Distance>
+void DirectedGraph<T, Distance>::_thread_findQueryBatchNeighbors_fn(vector<Query<T>>& queries, mutex& mx_query_index, int& query_index, vector<vector<pair<Id, float>>>& returnVec){
+    BatchSearchContext batch;
+    SearchContext ctx;
+    vector<Id> starts;
+    vector<const Elem*> rows;
+    vector<int> categories, indices;
+    int batch_size = min(args.queryBatch, BATCH_MAX_QUERIES);
+
+    mx_query_index.lock();
+    while(query_index < queries.size()){
+        int first = query_index;    // store current and increment
+        query_index = min(first + batch_size, (int) queries.size());
+        int last = query_index;
+        mx_query_index.unlock();
+
+        starts.clear();
+        rows.clear();
+        categories.clear();
+        indices.clear();
+        for (int q = first; q < last; q++){
+            const Query<T>& query = queries[q];
+            bool filtered_index = args.index_type == FILTERED_VAMANA || args.index_type == STITCHED_VAMANA;
+            if (!filtered_index && args.index_type != VAMANA) continue;
+
+            if (filtered_index && query.category == -1 && args.accumulateUnfiltered){
+                this->findNeighbors(query, ctx);
+                returnVec[q] = ctx.results;
+                continue;
+            }
+            int category = (filtered_index) ? query.category : -1;
+            starts.push_back((category != -1) ? this->startingNode(category) : this->startingNode());
+            rows.push_back(query.value.data());
+            categories.push_back(category);
+            indices.push_back(q);
+        }
+
+        if (!indices.empty()){
+            this->searchBatch(starts.data(), rows.data(), categories.data(), indices.size(), queries[indices[0]].value.size(), args.k, args.L, batch);
+            for (int b = 0; b < indices.size(); b++) returnVec[indices[b]].assign(batch.resultsOf(b), batch.resultsOf(b) + batch.counts[b]);
+        }
 
         mx_query_index.lock();
     }
@@ -243,24 +338,43 @@ void DirectedGraph<T>::_thread_findQueryNeighbors_fn(vector<Query<T>>& queries,
 
 // Returns the neighbors of all queries found in the given queries_path file.
 // If the file is .vecs format read_arg corresponds to the number of queries and, if the file is in .bin format, it corresponds to the dimension of the query vector
-template <typename T>
-vector<unordered_set<Id>> DirectedGraph<T>::findQueriesNeighbors(vector<Query<T>> queries){
+template <typename T, typename Distance>
+vector<unordered_set<Id>> DirectedGraph<T, Distance>::findQueriesNeighbors(vector<Query<T>> queries){
+
+    vector<vector<pair<Id, float>>> ranked = this->findQueriesNeighborsRanked(queries);
+
+    vector<unordered_set<Id>> returnVec(max(args.n_queries, (int) ranked.size()));
+    for (int i = 0; i < ranked.size(); i++) returnVec[i] = this->_resultSet(ranked[i]);
+
+    // Return the vector
+    return returnVec;
+}
+
+// Returns the neighbors of all queries with their distances, by increasing distance
+template <typename T, typename Distance>
+vector<vector<pair<Id, float>>> DirectedGraph<T, Distance>::findQueriesNeighborsRanked(vector<Query<T>> queries){
 
     c_log << "In Queries Neighbors" << '\n';
     
 
-    vector<unordered_set<Id>> returnVec(args.n_queries);
+    vector<vector<pair<Id, float>>> returnVec(queries.size());
     vector<thread> threads;
     mutex mx_query_index;
     int query_index = 0;
 
-    if (args.index_type == FILTERED_VAMANA || STITCHED_VAMANA && !args.randomStart){
-        this->findMedoids(args.threshold);    // compute the medoids to ensure the dictionary is complete and won't be resized/rehashed, invalidating any references of other threads.
+    // a frozen index already has its medoids and compact edges (see freeze)
+    if (!this->_frozen){
+        if ((args.index_type == FILTERED_VAMANA || args.index_type == STITCHED_VAMANA) && !args.randomStart){
+            this->findMedoids(args.threshold);    // compute the medoids to ensure the dictionary is complete and won't be resized/rehashed, invalidating any references of other threads.
+        }
+
+        this->compactEdges();   // the index is not modified while querying: search over the compact neighbor arrays
     }
 
     // load and launch threads.
     for (int i = 0; i < args.n_threads; i++){
-        threads.push_back(thread(&DirectedGraph::_thread_findQueryNeighbors_fn, this, ref(queries), ref(mx_query_index), ref(query_index), ref(returnVec)));
+        if (args.queryBatch > 1) threads.push_back(thread(&DirectedGraph::_thread_findQueryBatchNeighbors_fn, this, ref(queries), ref(mx_query_index), ref(query_index), ref(returnVec)));
+        else threads.push_back(thread(&DirectedGraph::_thread_findQueryNeighbors_fn, this, ref(queries), ref(mx_query_index), ref(query_index), ref(returnVec)));
     }
     
     // collect the threads
@@ -273,8 +387,8 @@ vector<unordered_set<Id>> DirectedGraph<T>::findQueriesNeighbors(vector<Query<T>
 }
 
 // Evaluate given index based on its types and return a pair containing average recall score and duration
-template <typename T>
-pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> evaluateIndex(DirectedGraph<T>& DG, function<pair<vector<Query<T>>,vector<Query<T>>>(void)> readQueries){
+template <typename T, typename Distance>
+pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> evaluateIndex(DirectedGraph<T, Distance>& DG, function<pair<vector<Query<T>>,vector<Query<T>>>(void)> readQueries){
 
     chrono::microseconds duration = (chrono::microseconds) 0;
     chrono::high_resolution_clock::time_point startTime, endTime;
@@ -306,7 +420,7 @@ pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> evalu
 
     // Start the timer
     startTime = chrono::high_resolution_clock::now();
-    vector<unordered_set<Id>> queriesNeighbors = DG.findQueriesNeighbors(queries.first);
+    vector<vector<pair<Id, float>>> queriesNeighbors = DG.findQueriesNeighborsRanked(queries.first);
     // End the timer
     endTime = chrono::high_resolution_clock::now();
 
@@ -337,7 +451,7 @@ pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> evalu
 
     // Start the timer
     startTime = chrono::high_resolution_clock::now();
-    queriesNeighbors = DG.findQueriesNeighbors(queries.second);
+    queriesNeighbors = DG.findQueriesNeighborsRanked(queries.second);
     // End the timer
     endTime = chrono::high_resolution_clock::now();
 
@@ -365,70 +479,56 @@ pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> evalu
     return ret;
 }
 
+// Exact k nearest rows of every query row through the many-to-many kernels of the host (see exactNeighbors)
+inline void hostExactNeighbors(const float* const* queries, int n_queries, const float* const* rows, int n_rows, int dim, int k, vector<vector<int>>& out){
+    if (simd_level == SIMD_AVX512) exactNeighbors(L2Distance<SIMD_AVX512>(), queries, n_queries, rows, n_rows, dim, k, out);
+    else if (simd_level == SIMD_AVX2) exactNeighbors(L2Distance<SIMD_AVX2>(), queries, n_queries, rows, n_rows, dim, k, out);
+    else exactNeighbors(L2Distance<SIMD_SCALAR>(), queries, n_queries, rows, n_rows, dim, k, out);
+}
+
 template <typename T>
 vector<vector<Id>> generateGroundtruth(vector<vector<T>>& data, vector<vector<T>>& queries){
 
-    // Create map category -> set of pair<nodeId, value>
-    unordered_map<int, unordered_map<Id,vector<T>>> categories;
-    for (int i=0; i<data.size(); i++){
-        vector<T> vec = data[i];
-        int category = vec[0];
-        vector<T> value(vec.begin() + 2, vec.end());
-        pair<Id, vector<T>> nodePair(i,value);
-        categories[category].insert(nodePair);
+    // Aligned rows of the values (ignore the category and the timestamp) and of the queries (ignore the type, the category and the range)
+    VectorStore<float> values, queryValues;
+    for (const vector<T>& vec : data){
+        vector<float> value(vec.begin() + 2, vec.end());
+        values.append(value.data(), value.size());
+    }
+    for (const vector<T>& query : queries){
+        vector<float> queryValue(query.begin() + 4, query.end());
+        queryValues.append(queryValue.data(), queryValue.size());
     }
 
-    // Initialize neighbors vector
-    vector<vector<Id>> queryNeighbors;
-
-    // For each query
-    for(int i = 0; i < queries.size(); i++){
-        c_log << "Generating groundtruth for query: " << i << '\n';
-
-        vector<T> query = queries[i];
-        vector<T> queryValue(query.begin() + 4, query.end());
-        int category = query[1];
+    // Create map category -> indices of its values, and category -> indices of its queries (-1: unfiltered queries)
+    unordered_map<int, vector<int>> categories;
+    map<int, vector<int>> categoryQueries;
+    for (int i = 0; i < (int) data.size(); i++) categories[(int) data[i][0]].push_back(i);
+    for (int i = 0; i < (int) queries.size(); i++) categoryQueries[(int) queries[i][1]].push_back(i);
 
-        T distance;
-        unordered_map <Id, T> distances; 
+    // Initialize neighbors vector
+    vector<vector<Id>> queryNeighbors(queries.size());
 
-        // Query is filtered
-        if (category != -1){
-            // Iterate over same-category nodes and calculate the distance for each of them
-            for (pair<Id, vector<T>> vecPair : categories[category]){
-                distances[vecPair.first] = euclideanDistance(queryValue,vecPair.second);
-            }
-        }
-        // Query is unfiltered 
-        else{
-            // Iterate over all nodes and calculate the distance for each of them
-            for (int i=0; i<data.size(); i++){
-                vector<T> vec = data[i];
-                vector<T> value(vec.begin() + 2, vec.end());
-                distances[i] = euclideanDistance(queryValue, value);
-            }
-        }
+    // The queries of a category are scanned together against the values of the category (filtered) or all the values (unfiltered)
+    for (const auto& [category, queryIndices] : categoryQueries){
+        c_log << "Generating groundtruth for " << queryIndices.size() << " queries of category: " << category << '\n';
 
-        // Convert distances map to a vector of pairs
-        vector<pair<Id, T>> distancesVec(distances.begin(), distances.end());
-
-        // Sort distancesVec by the second element (distance) in ascending order
-        sort(distancesVec.begin(), distancesVec.end(),
-             [](const pair<Id, T>& a, const pair<Id, T>& b) {
-                 return a.second < b.second;
-             });
-
-        // Extract sorted Ids based on distances and store in sortedIds
-        vector<Id> neighbors;
-        int minimum = (distancesVec.size() > 100) ? 100 : distancesVec.size();
-        for (int k = 0; k < minimum; k++){
-            auto& p = distancesVec[k];
-            neighbors.push_back(p.first);
+        vector<int> all;
+        if (category == -1){
+            all.resize(data.size());
+            iota(all.begin(), all.end(), 0);
         }
+        const vector<int>& candidates = (category == -1) ? all : categories[category];
 
-        // Add sorted Ids for this query to the result
-        queryNeighbors.push_back(neighbors);
+        vector<const float*> rows, queryRows;
+        for (int i : candidates) rows.push_back(values.row(i));
+        for (int q : queryIndices) queryRows.push_back(queryValues.row(q));
 
+        // Keep the 100 nearest values of every query, closest first
+        vector<vector<int>> nearest;
+        hostExactNeighbors(queryRows.data(), queryRows.size(), rows.data(), rows.size(), values.dim(), 100, nearest);
+        for (int q = 0; q < (int) queryIndices.size(); q++)
+            for (int r : nearest[q]) queryNeighbors[queryIndices[q]].push_back((Id) candidates[r]);
     }
 
     return queryNeighbors;
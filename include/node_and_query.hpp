@@ -7,20 +7,20 @@
 
     // overloads the less operator <
     template <typename T>    
-    bool Node<T>::operator<(const Node& n) const{ return (this->value < n.value); }// less is defined by the value of the Node
+    bool Node<T>::operator<(const Node& n) const{ return (this->id < n.id); }// less is defined by the id of the Node (values live in the graph's vector store)
 
     // overloads the equality operator ==
     template <typename T>      
-    bool Node<T>::operator==(const Node& n) const { return ((this->value == n.value) && (this->category == n.category)); }// same value and same category is considered the same  
+    bool Node<T>::operator==(const Node& n) const { return ((this->id == n.id) && (this->category == n.category) && (this->row == n.row)); }// same id, category and row in the vector store
 
-    // overloads the ostream operator <<        Node: [int|int|T]
+    // overloads the ostream operator <<        Node: [int|int|int]
     template <typename T>
     ostream& operator<<(ostream& stream, const Node<T>& node){
 
         stream << "[" 
         << node.id << "|"
         << node.category << "|"
-        << node.value << "]";
+        << node.row << "]";
 
         return stream;  // return stream to allow chaining 
     }
@@ -36,23 +36,23 @@
         int category;
         stream >> category;
         stream.ignore(1);       // ignore |
-        T value;
-        stream >> value;
+        int row;
+        stream >> row;
         stream.ignore(1);       // ignore ]
 
         // updating the _class
         node.id = id;
         node.category = category;
-        node.value = value;
+        node.row = row;
 
         return stream;  // return stream to allow chaining
     }
 
 // Node method implementation:
 
-    // a Node is empty when its value is empty
+    // a Node is empty when it has no value in the vector store
     template <typename T>
-    bool Node<T>::empty(){ return (this->isEmpty(this->value)); }
+    bool Node<T>::empty(){ return (this->row < 0); }
 
 
 // Query Overloads:
@@ -109,4 +109,4 @@
 
     // a Query is empty when either the category is -1 or the value is empty
     template <typename T>
-    bool Query<T>::empty(){ return (this->category == -1 || this->isEmpty(this->value)); }
\ No newline at end of file
+    bool Query<T>::empty() const { return (this->category == -1 || this->isEmpty(this->value)); }
\ No newline at end of file
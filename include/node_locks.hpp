@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "util.hpp"
+
+using namespace std;
+
+// Included by types.hpp right after the definition of Id.
+// This file implements the locks of the out-neighbors of the nodes while an index is modified by several threads (e.g. the parallel Vamana build).
+//
+// Every node maps to one of NODE_LOCK_STRIPES sequence locks (node id modulo the number of stripes): a version that is odd while a writer holds
+// the lock of the stripe. A writer locks the node it rewrites only, so writers of different nodes (almost always different stripes) never wait
+// for each other. Readers take no lock: they copy the neighbors of a node and retry if the version changed meanwhile (optimistic reads).
+//
+// A thread holds at most one node lock at a time, and does not read neighbors while holding one (the read would wait for its own stripe).
+
+constexpr int NODE_LOCK_STRIPES = 1 << 16;  // power of two
+
+class NodeLocks{
+
+    private:
+        unique_ptr<atomic<uint32_t>[]> _versions;  // version of every stripe: even while unlocked, odd while locked
+
+        atomic<uint32_t>& _stripe(Id id) const { return this->_versions[id & (NODE_LOCK_STRIPES - 1)]; }
+
+    public:
+        NodeLocks() : _versions(new atomic<uint32_t>[NODE_LOCK_STRIPES]) {
+            for (int i = 0; i < NODE_LOCK_STRIPES; i++) this->_versions[i].store(0, memory_order_relaxed);
+        }
+
+        NodeLocks(const NodeLocks&) = delete;
+        NodeLocks& operator=(const NodeLocks&) = delete;
+
+        // Locks the stripe of a node (spins while another writer holds it)
+        void lock(Id id){
+            atomic<uint32_t>& version = this->_stripe(id);
+            uint32_t v = version.load(memory_order_relaxed);
+            while ((v & 1) || !version.compare_exchange_weak(v, v + 1, memory_order_acquire, memory_order_relaxed)){
+                _mm_pause();
+                v = version.load(memory_order_relaxed);
+            }
+        }
+
+        // Unlocks the stripe of a node: readers that overlapped the write retry
+        void unlock(Id id) { this->_stripe(id).fetch_add(1, memory_order_release); }
+
+        // Calls read() (which copies the neighbors of the node) until no writer of the stripe of the node overlapped it
+        template <typename Read>
+        void read(Id id, const Read& read) const {
+            const atomic<uint32_t>& version = this->_stripe(id);
+            while (true){
+                uint32_t before = version.load(memory_order_acquire);
+                if (before & 1){
+                    _mm_pause();
+                    continue;
+                }
+                read();
+                atomic_thread_fence(memory_order_acquire);
+                if (version.load(memory_order_relaxed) == before) return;
+            }
+        }
+};
+
+// Holds the lock of a node for its scope (no lock if !enabled, e.g. in a serial build)
+class NodeLockGuard{
+
+    private:
+        NodeLocks& _locks;
+        Id _id;
+        bool _enabled;
+
+    public:
+        NodeLockGuard(NodeLocks& locks, Id id, bool enabled = true) : _locks(locks), _id(id), _enabled(enabled) {
+            if (this->_enabled) this->_locks.lock(id);
+        }
+        ~NodeLockGuard() { if (this->_enabled) this->_locks.unlock(this->_id); }
+
+        NodeLockGuard(const NodeLockGuard&) = delete;
+        NodeLockGuard& operator=(const NodeLockGuard&) = delete;
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cmath>
+#include <numeric>
+
+#include "util.hpp"
+#include "vector_store.hpp"
+
+using namespace std;
+
+// This file implements the PCA rotation of the values of a graph, for the two-tier distances (see DirectedGraph::applyPCA).
+//
+// The rotation maps a row x to its coordinates on the principal components of the values, by decreasing variance: y_c = <x, v_c>.
+// It is orthonormal, so euclidean distances and inner products are the same before and after it, but most of the squared distance
+// between two rotated rows lies in their leading coordinates. The squared euclidean distance on the first leading() coordinates is a lower
+// bound of the full one: a node whose leading distance already exceeds a bound (e.g. the distance of the worst candidate of a search)
+// is decided without reading the rest of its row.
+//
+// The components are the eigenvectors of the covariance matrix of (a sample of) the rows: Householder reduction of the covariance matrix
+// to a tridiagonal one, then the implicit QL algorithm on the tridiagonal matrix (the symmetric eigensolver of EISPACK tred2 / tql2).
+
+constexpr int PCA_TRAIN_SAMPLE = 10000;     // maximum number of rows the covariance matrix is computed on
+constexpr int PCA_LEADING_STEP = 16;        // leading coordinates are a multiple of 16 floats: the rest of every row stays VECTOR_ALIGNMENT-byte aligned
+
+class PCARotation{
+
+    private:
+        int _dim;                           // dimension of the rotated rows
+        int _leading;                       // coordinates of the first tier of the distances
+        VectorStore<float> _components;     // _dim principal components of unit length (aligned, zero-padded rows), by decreasing variance
+        vector<float> _variances;           // variance of the training rows along each component (empty if the components were given)
+
+        // Eigen-decomposition of the symmetric n x n matrix a (row-major): on return values holds the eigenvalues and vectors[i * n ...] the
+        // eigenvector of values[i], unsorted
+        static void _symmetricEigen(int n, vector<double>& a, vector<double>& values, vector<double>& vectors);
+
+    public:
+
+        // Rotation of rows of dimension dim, whose first leading coordinates are the first tier of the distances (train it before use)
+        PCARotation(int dim, int leading) : _dim(dim), _leading(leading) {
+            if (dim <= 0) { throw invalid_argument("Dimension must be a positive integer.\n"); }
+            if (leading <= 0 || leading % PCA_LEADING_STEP != 0 || leading >= dim){
+                throw invalid_argument("The number of leading PCA components must be a positive multiple of 16, smaller than the dimension.\n");
+            }
+            this->_components.setDimension(dim);
+        }
+
+        // Rotation with the given components (dim x dim floats, one component per row, e.g. read from an index file)
+        PCARotation(int dim, int leading, const float* components) : PCARotation(dim, leading) {
+            this->_components.reserve(dim);
+            for (int c = 0; c < dim; c++) this->_components.append(components + (size_t) c * dim, dim);
+        }
+
+        int dim() const { return this->_dim; }
+        int leading() const { return this->_leading; }
+
+        // Principal components, one per row of the store
+        const VectorStore<float>& components() const { return this->_components; }
+
+        // Fraction of the variance of the training rows in the leading coordinates (0 if the components were given)
+        float leadingVariance() const {
+            if (this->_variances.empty()) { return 0.0f; }
+            double total = accumulate(this->_variances.begin(), this->_variances.end(), 0.0);
+            double leading = accumulate(this->_variances.begin(), this->_variances.begin() + this->_leading, 0.0);
+            return (total > 0) ? (float) (leading / total) : 0.0f;
+        }
+
+        // Computes the principal components of (at most PCA_TRAIN_SAMPLE rows spread over) the rows of the vector store
+        void train(const VectorStore<float>& vectors){
+
+            if (vectors.dim() != this->_dim) { throw invalid_argument("Dimension Mismatch between Arguments"); }
+            if (vectors.empty()) { throw invalid_argument("Cannot train the PCA rotation without vectors.\n"); }
+
+            int n = min(vectors.size(), PCA_TRAIN_SAMPLE), dim = this->_dim;
+
+            // the centered sample, transposed: one row per coordinate, so that every covariance is an inner product of two rows
+            vector<double> mean(dim, 0.0);
+            for (int i = 0; i < n; i++){
+                const float* row = vectors.row((int) ((long long) i * vectors.size() / n));
+                for (int j = 0; j < dim; j++) mean[j] += row[j];
+            }
+            for (int j = 0; j < dim; j++) mean[j] /= n;
+
+            VectorStore<float> columns;
+            columns.setDimension(n);
+            columns.resize(dim);
+            for (int i = 0; i < n; i++){
+                const float* row = vectors.row((int) ((long long) i * vectors.size() / n));
+                for (int j = 0; j < dim; j++) columns.row(j)[i] = (float) (row[j] - mean[j]);
+            }
+
+            vector<double> covariance((size_t) dim * dim);
+            for (int j = 0; j < dim; j++){
+                for (int k = j; k < dim; k++){
+                    double c = simd_row_dot_kernel(columns.row(j), columns.row(k), n) / max(n - 1, 1);
+                    covariance[(size_t) j * dim + k] = covariance[(size_t) k * dim + j] = c;
+                }
+            }
+
+            vector<double> values, eigenvectors;
+            _symmetricEigen(dim, covariance, values, eigenvectors);
+
+            vector<int> order(dim);
+            iota(order.begin(), order.end(), 0);
+            sort(order.begin(), order.end(), [&](int i1, int i2){ return values[i1] > values[i2]; });
+
+            this->_components.clear();
+            this->_components.setDimension(dim);
+            this->_components.reserve(dim);
+            this->_variances.clear();
+            vector<float> component(dim);
+            for (int c : order){
+                for (int j = 0; j < dim; j++) component[j] = (float) eigenvectors[(size_t) c * dim + j];
+                this->_components.append(component.data(), dim);
+                this->_variances.push_back((float) max(values[c], 0.0));
+            }
+        }
+
+        // Rotates the row x into out (both padded rows of the dimension of the rotation, out may be x: the rotation then goes through a temporary row)
+        void rotate(const float* x, float* out) const {
+            if (x != out){
+                for (int c = 0; c < this->_dim; c++) out[c] = simd_row_dot_kernel(this->_components.row(c), x, this->_dim);
+                return;
+            }
+            AlignedRow<float> rotated(this->_components.paddedDim());
+            for (int c = 0; c < this->_dim; c++) rotated.data()[c] = simd_row_dot_kernel(this->_components.row(c), x, this->_dim);
+            memcpy(out, rotated.data(), this->_dim * sizeof(float));
+        }
+};
+
+inline void PCARotation::_symmetricEigen(int n, vector<double>& a, vector<double>& values, vector<double>& vectors){
+
+    vector<double>& V = a;      // V[i * n + j], reduced in place
+    vector<double> d(n), e(n);
+
+    // Householder reduction to tridiagonal form (d: diagonal, e: subdiagonal), accumulating the transformations in V
+    for (int j = 0; j < n; j++) d[j] = V[(size_t) (n - 1) * n + j];
+
+    for (int i = n - 1; i > 0; i--){
+        double scale = 0.0, h = 0.0;
+        for (int k = 0; k < i; k++) scale += fabs(d[k]);
+
+        if (scale == 0.0){
+            e[i] = d[i - 1];
+            for (int j = 0; j < i; j++){
+                d[j] = V[(size_t) (i - 1) * n + j];
+                V[(size_t) i * n + j] = 0.0;
+                V[(size_t) j * n + i] = 0.0;
+            }
+        }
+        else{
+            for (int k = 0; k < i; k++){
+                d[k] /= scale;
+                h += d[k] * d[k];
+            }
+            double f = d[i - 1];
+            double g = (f > 0) ? -sqrt(h) : sqrt(h);
+            e[i] = scale * g;
+            h -= f * g;
+            d[i - 1] = f - g;
+            for (int j = 0; j < i; j++) e[j] = 0.0;
+
+            for (int j = 0; j < i; j++){
+                f = d[j];
+                V[(size_t) j * n + i] = f;
+                g = e[j] + V[(size_t) j * n + j] * f;
+                for (int k = j + 1; k <= i - 1; k++){
+                    g += V[(size_t) k * n + j] * d[k];
+                    e[k] += V[(size_t) k * n + j] * f;
+                }
+                e[j] = g;
+            }
+            f = 0.0;
+            for (int j = 0; j < i; j++){
+                e[j] /= h;
+                f += e[j] * d[j];
+            }
+            double hh = f / (h + h);
+            for (int j = 0; j < i; j++) e[j] -= hh * d[j];
+            for (int j = 0; j < i; j++){
+                f = d[j];
+                g = e[j];
+                for (int k = j; k <= i - 1; k++) V[(size_t) k * n + j] -= (f * e[k] + g * d[k]);
+                d[j] = V[(size_t) (i - 1) * n + j];
+                V[(size_t) i * n + j] = 0.0;
+            }
+        }
+        d[i] = h;
+    }
+
+    for (int i = 0; i < n - 1; i++){
+        V[(size_t) (n - 1) * n + i] = V[(size_t) i * n + i];
+        V[(size_t) i * n + i] = 1.0;
+        double h = d[i + 1];
+        if (h != 0.0){
+            for (int k = 0; k <= i; k++) d[k] = V[(size_t) k * n + i + 1] / h;
+            for (int j = 0; j <= i; j++){
+                double g = 0.0;
+                for (int k = 0; k <= i; k++) g += V[(size_t) k * n + i + 1] * V[(size_t) k * n + j];
+                for (int k = 0; k <= i; k++) V[(size_t) k * n + j] -= g * d[k];
+            }
+        }
+        for (int k = 0; k <= i; k++) V[(size_t) k * n + i + 1] = 0.0;
+    }
+    for (int j = 0; j < n; j++){
+        d[j] = V[(size_t) (n - 1) * n + j];
+        V[(size_t) (n - 1) * n + j] = 0.0;
+    }
+    V[(size_t) (n - 1) * n + n - 1] = 1.0;
+    e[0] = 0.0;
+
+    // the eigenvectors are the columns of V: the QL rotations below combine two of them at a time, so they work on the rows of its transpose W
+    vectors.assign((size_t) n * n, 0.0);
+    for (int i = 0; i < n; i++)
+        for (int k = 0; k < n; k++) vectors[(size_t) i * n + k] = V[(size_t) k * n + i];
+    vector<double>& W = vectors;
+
+    // implicit QL iterations on the tridiagonal matrix
+    for (int i = 1; i < n; i++) e[i - 1] = e[i];
+    e[n - 1] = 0.0;
+
+    double f = 0.0, tst1 = 0.0;
+    const double eps = pow(2.0, -52.0);
+    for (int l = 0; l < n; l++){
+
+        // find a small subdiagonal element
+        tst1 = max(tst1, fabs(d[l]) + fabs(e[l]));
+        int m = l;
+        while (m < n - 1 && fabs(e[m]) > eps * tst1) m++;
+
+        // if m == l, d[l] is already an eigenvalue, otherwise iterate
+        if (m > l){
+            do{
+                // compute the implicit shift
+                double g = d[l];
+                double p = (d[l + 1] - g) / (2.0 * e[l]);
+                double r = hypot(p, 1.0);
+                if (p < 0) r = -r;
+                d[l] = e[l] / (p + r);
+                d[l + 1] = e[l] * (p + r);
+                double dl1 = d[l + 1];
+                double h = g - d[l];
+                for (int i = l + 2; i < n; i++) d[i] -= h;
+                f += h;
+
+                // implicit QL transformation
+                p = d[m];
+                double c = 1.0, c2 = c, c3 = c;
+                double el1 = e[l + 1];
+                double s = 0.0, s2 = 0.0;
+                for (int i = m - 1; i >= l; i--){
+                    c3 = c2;
+                    c2 = c;
+                    s2 = s;
+                    g = c * e[i];
+                    h = c * p;
+                    r = hypot(p, e[i]);
+                    e[i + 1] = s * r;
+                    s = e[i] / r;
+                    c = p / r;
+                    p = c * d[i] - s * g;
+                    d[i + 1] = h + s * (c * g + s * d[i]);
+
+                    // accumulate the transformation into the eigenvectors i and i + 1
+                    double* wi = W.data() + (size_t) i * n;
+                    double* wi1 = W.data() + (size_t) (i + 1) * n;
+                    for (int k = 0; k < n; k++){
+                        h = wi1[k];
+                        wi1[k] = s * wi[k] + c * h;
+                        wi[k] = c * wi[k] - s * h;
+                    }
+                }
+                p = -s * s2 * c3 * el1 * e[l] / dl1;
+                e[l] = s * p;
+                d[l] = c * p;
+
+            } while (fabs(e[l]) > eps * tst1);
+        }
+        d[l] += f;
+        e[l] = 0.0;
+    }
+
+    values = d;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include <thread>
+
+#include "util.hpp"
+#include "vector_store.hpp"
+
+using namespace std;
+
+// This file implements product quantization (PQ) of the values of a graph, used by the compressed greedy search (see DirectedGraph::trainPQ).
+//
+// The dimensions are split into M contiguous subspaces (their sizes differ by at most one). Every subspace gets a codebook of up to
+// PQ_CENTROIDS centroids, trained with k-means on a sample of the rows, and every row is encoded as M bytes: its closest centroid in each subspace.
+//
+// Searching uses asymmetric distance computation (ADC): once per query, a lookup table holds the distance of the query's sub-vector to
+// every centroid of its subspace (M x PQ_CENTROIDS floats). The distance of the query to a code is then the sum of M table lookups,
+// so a hop of the search reads M bytes per neighbor instead of its whole row.
+
+constexpr int PQ_CENTROIDS = 256;           // centroids per subspace (one byte per subspace in the codes)
+constexpr int PQ_TRAIN_SAMPLE = 65536;      // maximum number of rows the codebooks are trained on
+constexpr int PQ_KMEANS_ITERATIONS = 20;
+
+class ProductQuantizer{
+
+    private:
+        int _dim;                       // dimension of the encoded rows
+        int _M;                         // number of subspaces (bytes per code)
+        int _ksub;                      // centroids per subspace
+        int _max_ksub;                  // centroids per subspace asked for (fewer if the training sample is smaller)
+        bool _inner_product;            // the tables hold negative inner products instead of squared distances
+        vector<int> _offsets;           // subspace m spans the dimensions [_offsets[m], _offsets[m+1])
+        vector<float> _centroids;       // the codebook of subspace m starts at _ksub * _offsets[m], one centroid of _subDim(m) floats after the other
+        vector<uint8_t> _codes;         // n_rows x M codes, in the row order of the encoded vector store
+
+        int _subDim(int m) const { return this->_offsets[m + 1] - this->_offsets[m]; }
+
+        const float* _codebook(int m) const { return this->_centroids.data() + (size_t) this->_ksub * this->_offsets[m]; }
+        float* _codebook(int m) { return this->_centroids.data() + (size_t) this->_ksub * this->_offsets[m]; }
+
+        // Index of the centroid of subspace m closest to the sub-vector x (of _subDim(m) floats)
+        int _closestCentroid(int m, const float* x) const {
+            int dsub = this->_subDim(m), best = 0;
+            float dmin = numeric_limits<float>::max();
+            const float* c = this->_codebook(m);
+            for (int k = 0; k < this->_ksub; k++, c += dsub){
+                float d = row_euclideanDistance(x, c, dsub);
+                if (d < dmin){ dmin = d; best = k; }
+            }
+            return best;
+        }
+
+        // k-means on the sub-vectors of subspace m of the n training rows (row-major, _dim floats each)
+        void _trainSubspace(int m, const vector<float>& sample, int n){
+
+            int dsub = this->_subDim(m);
+            float* codebook = this->_codebook(m);
+            vector<float> x((size_t) n * dsub);
+            for (int i = 0; i < n; i++)
+                memcpy(&x[(size_t) i * dsub], &sample[(size_t) i * this->_dim + this->_offsets[m]], dsub * sizeof(float));
+
+            // initial centroids: _ksub rows spread over the sample
+            for (int k = 0; k < this->_ksub; k++)
+                memcpy(codebook + (size_t) k * dsub, &x[(size_t) (k * (long long) n / this->_ksub) * dsub], dsub * sizeof(float));
+
+            vector<int> assignment(n);
+            vector<int> counts(this->_ksub);
+            vector<float> sums((size_t) this->_ksub * dsub);
+
+            for (int iteration = 0; iteration < PQ_KMEANS_ITERATIONS; iteration++){
+
+                bool changed = false;
+                for (int i = 0; i < n; i++){
+                    int k = this->_closestCentroid(m, &x[(size_t) i * dsub]);
+                    if (iteration == 0 || k != assignment[i]) changed = true;
+                    assignment[i] = k;
+                }
+                if (!changed) break;
+
+                fill(counts.begin(), counts.end(), 0);
+                fill(sums.begin(), sums.end(), 0.0f);
+                for (int i = 0; i < n; i++){
+                    counts[assignment[i]]++;
+                    for (int j = 0; j < dsub; j++) sums[(size_t) assignment[i] * dsub + j] += x[(size_t) i * dsub + j];
+                }
+
+                for (int k = 0; k < this->_ksub; k++){
+                    // an empty cluster takes over a sample row, so that no centroid is wasted
+                    if (counts[k] == 0){
+                        memcpy(codebook + (size_t) k * dsub, &x[(size_t) ((k * 7919LL + iteration) % n) * dsub], dsub * sizeof(float));
+                        continue;
+                    }
+                    for (int j = 0; j < dsub; j++) codebook[(size_t) k * dsub + j] = sums[(size_t) k * dsub + j] / counts[k];
+                }
+            }
+        }
+
+        // Runs fn(i) for i in [0, n), split among args.n_threads threads
+        static void _parallelFor(int n, const function<void(int)>& fn){
+            int n_threads = max(1, min(args.n_threads, n));
+            vector<thread> threads;
+            for (int t = 0; t < n_threads; t++){
+                threads.push_back(thread([&fn, t, n, n_threads](){
+                    for (int i = t; i < n; i += n_threads) fn(i);
+                }));
+            }
+            for (thread& th : threads) th.join();
+        }
+
+    public:
+
+        // Quantizer of rows of dimension dim into M subspaces of (up to) centroids centroids each (e.g. 16 for 4-bit codes, see fastscan.hpp).
+        // inner_product: the ADC tables rank by inner product (METRIC_IP, METRIC_COSINE)
+        ProductQuantizer(int dim, int M, bool inner_product, int centroids = PQ_CENTROIDS) : _dim(dim), _M(M), _ksub(0), _max_ksub(centroids), _inner_product(inner_product) {
+            if (dim <= 0) { throw invalid_argument("Dimension must be a positive integer.\n"); }
+            if (M <= 0 || M > dim) { throw invalid_argument("The number of PQ subspaces must be in [1, dim].\n"); }
+            if (centroids <= 0 || centroids > PQ_CENTROIDS) { throw invalid_argument("The number of PQ centroids must be in [1, 256].\n"); }
+
+            this->_offsets.resize(M + 1);
+            for (int m = 0; m <= M; m++) this->_offsets[m] = (int) ((long long) m * dim / M);
+        }
+
+        int dim() const { return this->_dim; }
+        int M() const { return this->_M; }
+        int centroids() const { return this->_ksub; }
+
+        // Floats in an ADC table (see computeTable)
+        int tableSize() const { return this->_M * PQ_CENTROIDS; }
+
+        // Bytes held by the codes and the codebooks
+        size_t bytes() const { return this->_codes.size() + this->_centroids.size() * sizeof(float); }
+
+        // Trains the codebooks on (at most PQ_TRAIN_SAMPLE rows spread over) the rows of the vector store. Subspaces are trained in parallel.
+        template <typename E>
+        void train(const VectorStore<E>& vectors){
+
+            if (vectors.dim() != this->_dim) { throw invalid_argument("Dimension Mismatch between Arguments"); }
+            if (vectors.empty()) { throw invalid_argument("Cannot train the PQ codebooks without vectors.\n"); }
+
+            int n = min(vectors.size(), PQ_TRAIN_SAMPLE);
+            vector<float> sample((size_t) n * this->_dim);
+            for (int i = 0; i < n; i++){
+                const E* row = vectors.row((int) ((long long) i * vectors.size() / n));
+                for (int j = 0; j < this->_dim; j++) sample[(size_t) i * this->_dim + j] = (float) row[j];
+            }
+
+            this->_ksub = min(this->_max_ksub, n);
+            this->_centroids.assign((size_t) this->_ksub * this->_dim, 0.0f);
+            _parallelFor(this->_M, [&](int m) { this->_trainSubspace(m, sample, n); });
+        }
+
+        // Encodes every row of the vector store (replacing any previous codes). Rows are encoded in parallel.
+        template <typename E>
+        void encode(const VectorStore<E>& vectors){
+
+            if (this->_ksub == 0) { throw invalid_argument("The PQ codebooks must be trained before encoding.\n"); }
+
+            this->_codes.assign((size_t) vectors.size() * this->_M, 0);
+            _parallelFor(vectors.size(), [&](int r){
+                vector<float> x(this->_dim);
+                const E* row = vectors.row(r);
+                for (int j = 0; j < this->_dim; j++) x[j] = (float) row[j];
+                for (int m = 0; m < this->_M; m++)
+                    this->_codes[(size_t) r * this->_M + m] = (uint8_t) this->_closestCentroid(m, x.data() + this->_offsets[m]);
+            });
+        }
+
+        // Code (M bytes) of a row of the encoded vector store
+        const uint8_t* code(int row) const { return this->_codes.data() + (size_t) row * this->_M; }
+
+        // Fills the ADC table of the query xq (dim values): table[m * PQ_CENTROIDS + k] = distance of the sub-vector m of xq to centroid k
+        template <typename E>
+        void computeTable(const E* xq, float* table) const {
+            vector<float> x(this->_dim);
+            for (int j = 0; j < this->_dim; j++) x[j] = (float) xq[j];
+
+            for (int m = 0; m < this->_M; m++){
+                int dsub = this->_subDim(m);
+                const float* c = this->_codebook(m);
+                const float* xm = x.data() + this->_offsets[m];
+                for (int k = 0; k < this->_ksub; k++, c += dsub)
+                    table[m * PQ_CENTROIDS + k] = (this->_inner_product) ? -row_innerProduct(xm, c, dsub) : row_euclideanDistance(xm, c, dsub);
+            }
+        }
+
+        // Approximate distance of the query of an ADC table to a row: the sum of M table lookups
+        float distance(const float* table, int row) const {
+            const uint8_t* code = this->code(row);
+            float sum = 0.0f;
+            for (int m = 0; m < this->_M; m++, table += PQ_CENTROIDS) sum += table[code[m]];
+            return sum;
+        }
+};
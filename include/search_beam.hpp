@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+
+#include "util.hpp"
+#include "vector_store.hpp"
+#include "sq.hpp"
+
+using namespace std;
+
+// Included by types.hpp right after the fast-scan blocks (needs Id and FastScanQuery).
+// This file implements the search core of the greedy searches: the candidate list (SearchBeam) and the set of the nodes whose distance
+// has already been computed (VisitedTable), kept in a search context that every search of a thread reuses (see SearchContext).
+//
+// The beam holds at most L candidates sorted by distance from the query, each one flagged once expanded. A cursor points at the closest
+// unexpanded candidate: expanding it is O(1), and an insertion in front of the cursor moves the cursor back to the new candidate.
+// An insertion is a binary search and a shift of the farther candidates (L is small: one or two cache lines of them).
+//
+// The visited table holds an epoch stamp per node: a node is visited in the current search if its stamp equals the epoch of the search.
+// Starting a new search increments the epoch, so the table is never cleared (except when the epoch wraps around).
+
+
+// Candidate of the beam: a node and its distance from the query
+struct BeamCandidate{
+    float dist;
+    Id id;
+    bool expanded;
+};
+
+class SearchBeam{
+
+    private:
+        vector<BeamCandidate> _candidates;  // _size candidates by increasing distance (ties by id), room for _capacity + 1
+        int _capacity;                      // L
+        int _size;
+        int _cursor;                        // position of the closest unexpanded candidate (_size if every candidate is expanded)
+
+    public:
+        SearchBeam() : _capacity(0), _size(0), _cursor(0) {}
+
+        // Empties the beam and sets its capacity
+        void reset(int L){
+            if (L < 0) { throw invalid_argument("L must be greater than or equal to 0.\n"); }
+            this->_capacity = L;
+            this->_size = 0;
+            this->_cursor = 0;
+            if (this->_candidates.size() < (size_t) L + 1) this->_candidates.resize(L + 1);
+        }
+
+        int size() const { return this->_size; }
+        int capacity() const { return this->_capacity; }
+        int cursor() const { return this->_cursor; }
+        bool full() const { return this->_size >= this->_capacity; }
+
+        // Distance of the farthest candidate (the bound of the search once the beam is full)
+        float worst() const { return this->_candidates[this->_size - 1].dist; }
+
+        // Candidates by increasing distance
+        const BeamCandidate& operator[](int i) const { return this->_candidates[i]; }
+        BeamCandidate& operator[](int i) { return this->_candidates[i]; }
+
+        // Inserts a candidate while the beam holds fewer than L, otherwise replaces the farthest candidate if the new one is closer.
+        // Returns false if the candidate was not inserted.
+        bool insert(float dist, Id id){
+
+            if (this->full() && (this->_capacity == 0 || dist >= this->worst())) return false;
+
+            // first candidate farther than the new one
+            int lo = 0, hi = this->_size;
+            while (lo < hi){
+                int mid = (lo + hi) / 2;
+                const BeamCandidate& c = this->_candidates[mid];
+                if (c.dist < dist || (c.dist == dist && c.id < id)) lo = mid + 1;
+                else hi = mid;
+            }
+
+            memmove(&this->_candidates[lo + 1], &this->_candidates[lo], (this->_size - lo) * sizeof(BeamCandidate));
+            this->_candidates[lo] = BeamCandidate{dist, id, false};
+            if (this->_size < this->_capacity) this->_size++;   // otherwise the farthest candidate falls off the end
+            if (lo < this->_cursor) this->_cursor = lo;
+            return true;
+        }
+
+        // Marks the closest unexpanded candidate as expanded and returns it (-1 if every candidate is expanded)
+        Id next(){
+            if (this->_cursor >= this->_size) return -1;
+            BeamCandidate& c = this->_candidates[this->_cursor];
+            c.expanded = true;
+            Id id = c.id;
+            while (this->_cursor < this->_size && this->_candidates[this->_cursor].expanded) this->_cursor++;
+            return id;
+        }
+
+        // Restores the order of the beam after its distances were replaced (e.g. re-ranked), every candidate stays expanded
+        void sort(){
+            std::sort(this->_candidates.begin(), this->_candidates.begin() + this->_size,
+                [](const BeamCandidate& c1, const BeamCandidate& c2) { return c1.dist < c2.dist || (c1.dist == c2.dist && c1.id < c2.id); });
+            this->_cursor = this->_size;
+        }
+};
+
+class VisitedTable{
+
+    private:
+        vector<uint32_t> _stamps;   // epoch of the last search that visited each node
+        uint32_t _epoch;
+
+    public:
+        VisitedTable() : _epoch(0) {}
+
+        // Starts a new search on a graph of n_nodes nodes: no node is visited
+        void reset(int n_nodes){
+            if (this->_stamps.size() < (size_t) n_nodes) this->_stamps.resize(n_nodes, 0);
+            if (++this->_epoch == 0){
+                fill(this->_stamps.begin(), this->_stamps.end(), 0);
+                this->_epoch = 1;
+            }
+        }
+
+        bool contains(Id id) const { return this->_stamps[id] == this->_epoch; }
+
+        // Prefetches the stamp of a node (e.g. of a neighbor about to be checked)
+        void prefetch(Id id) const { _mm_prefetch((const char*) &this->_stamps[id], _MM_HINT_T0); }
+
+        // Marks a node as visited. Returns false if it already was
+        bool insert(Id id){
+            if (this->_stamps[id] == this->_epoch) return false;
+            this->_stamps[id] = this->_epoch;
+            return true;
+        }
+};
+
+// State of the greedy searches of one thread (candidates, visited nodes, results and the buffers of the query), reused from one search to the next:
+// once it has grown to the size of the graph and of the queries, a search allocates nothing. The worker threads of the build and of the queries
+// own one each, the other searches use the one of their thread (see searchContext()). A context serves one search at a time.
+struct SearchContext{
+    SearchBeam beam;
+    VisitedTable visited;
+    vector<pair<Id, float>> results;    // the k closest nodes found by the last search and their distances from the query, by increasing distance
+    vector<pair<Id, float>> merged;     // results of the searches of every category of an accumulated unfiltered query (see findNeighbors)
+    vector<Id> expanded;            // nodes expanded by the last search, in expansion order
+    vector<Id> neighbors;           // copy of the out-neighbors of the expanded node while other threads modify the edges (see NodeLocks)
+    vector<Id> ids;                 // unseen neighbors of the expanded node
+    vector<uint16_t> estimates;     // fast-scan estimates of the neighbors of the expanded node
+    vector<float> dists, bounds;
+
+    AlignedRow<uint8_t> query;      // the padded query (see queryRow)
+    vector<uint64_t> sketch;        // sketch of the query
+    AlignedRow<float> centered;     // the centered query the sketch is computed on
+    FastScanQuery fastscan;         // quantized ADC table of the query
+    vector<float> table;            // PQ ADC table of the query
+    SQQuery sq;                     // the query prepared for the SQ codes
+
+    // Aligned buffer of (at least) n elements of type E for the padded query
+    template <typename E>
+    E* queryRow(int n){
+        size_t bytes = (size_t) n * sizeof(E);
+        if (this->query.size() < bytes) this->query = AlignedRow<uint8_t>(bytes);
+        return (E*) this->query.data();
+    }
+};
+
+constexpr int BATCH_MAX_QUERIES = 32;   // queries of a batch search (one bit each in the shared visited table)
+
+// Visited table shared by the searches of a batch: an epoch stamp and a mask of the searches that visited each node, in one word per node,
+// so that the batch reads a single table instead of one per search
+class BatchVisitedTable{
+
+    private:
+        vector<uint64_t> _entries;  // epoch of the last batch that visited each node (high 32 bits) and the searches of that batch that did (low 32 bits)
+        uint32_t _epoch;
+
+    public:
+        BatchVisitedTable() : _epoch(0) {}
+
+        // Starts a new batch on a graph of n_nodes nodes: no node is visited by any search
+        void reset(int n_nodes){
+            if (this->_entries.size() < (size_t) n_nodes) this->_entries.resize(n_nodes, 0);
+            if (++this->_epoch == 0){
+                fill(this->_entries.begin(), this->_entries.end(), 0);
+                this->_epoch = 1;
+            }
+        }
+
+        // Marks a node as visited by search b of the batch. Returns false if it already was
+        bool insert(Id id, int b){
+            uint64_t& entry = this->_entries[id];
+            uint64_t mask = ((uint64_t) 1) << b;
+            if ((entry >> 32) != this->_epoch) entry = (uint64_t) this->_epoch << 32;
+            if (entry & mask) return false;
+            entry |= mask;
+            return true;
+        }
+
+        void prefetch(Id id) const { _mm_prefetch((const char*) &this->_entries[id], _MM_HINT_T0); }
+};
+
+// Visited nodes of search b of a batch (same interface as VisitedTable, see DirectedGraph::_unseenNeighbors)
+struct BatchVisited{
+    BatchVisitedTable& table;
+    int b;
+
+    bool insert(Id id) { return this->table.insert(id, this->b); }
+    void prefetch(Id id) const { this->table.prefetch(id); }
+};
+
+// State of the batch searches of one thread (see DirectedGraph::searchBatch): a search context per query of the batch (whose visited
+// tables are not used), the visited table they share, and the results of the batch in a preallocated [B x k] buffer
+struct BatchSearchContext{
+    vector<SearchContext> queries;
+    BatchVisitedTable visited;
+    vector<const void*> rows;           // the padded row of every query
+    vector<pair<Id, float>> results;    // the results of query b start at b * k (counts[b] of them, by increasing distance)
+    vector<int> counts;
+    int k = 0;
+
+    // Sizes the batch for n queries of k results
+    void reset(int n, int k){
+        if (this->queries.size() < (size_t) n) this->queries.resize(n);
+        if (this->rows.size() < (size_t) n) this->rows.resize(n);
+        if (this->results.size() < (size_t) n * k) this->results.resize((size_t) n * k);
+        if (this->counts.size() < (size_t) n) this->counts.resize(n);
+        this->k = k;
+    }
+
+    // Results of query b of the last batch
+    const pair<Id, float>* resultsOf(int b) const { return this->results.data() + (size_t) b * this->k; }
+};
+
+// Search context of the calling thread
+inline SearchContext& searchContext(){
+    static thread_local SearchContext context;
+    return context;
+}
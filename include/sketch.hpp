@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+
+#include "util.hpp"
+#include "vector_store.hpp"
+
+using namespace std;
+
+// This file implements the binary sketches of the values of a graph, used as a prefilter of the exact distances (see DirectedGraph::enableSketch).
+//
+// The sketch of a row is one bit per random hyperplane: bit b is set when <x - mean, r_b> >= 0, with r_b a random gaussian direction and
+// mean the mean of (a sample of) the rows, so that the hyperplanes go through the data instead of the origin. The hamming distance of two
+// sketches (a popcount over SKETCH_WORD_BITS-bit words) estimates the angle between the centered rows: rows close to each other agree on most bits.
+//
+// Searching and pruning compare sketch distances before computing exact ones: a node whose sketch is clearly farther (by a margin of bits)
+// than the sketch of a reference node (the worst candidate of the search, the pruned node) is decided without its exact distance.
+
+constexpr int SKETCH_WORD_BITS = 64;
+constexpr int SKETCH_TRAIN_SAMPLE = 65536;  // maximum number of rows the mean is computed on
+constexpr uint32_t SKETCH_SEED = 0x5eed;    // the hyperplanes are the same on every run
+
+class BinarySketch{
+
+    private:
+        int _dim;                       // dimension of the sketched rows
+        int _bits;                      // bits per sketch (multiple of SKETCH_WORD_BITS)
+        int _words;                     // words per sketch
+        vector<float> _mean;            // the hyperplanes go through the mean of the rows
+        VectorStore<float> _planes;     // _bits normals of the hyperplanes (aligned, zero-padded rows for the SIMD inner product kernel)
+        vector<uint64_t> _sketches;     // n_rows x _words sketches, in the row order of the vector store
+
+    public:
+
+        // Sketches of bits bits (a positive multiple of SKETCH_WORD_BITS) of rows of dimension dim
+        BinarySketch(int dim, int bits) : _dim(dim), _bits(bits), _words(bits / SKETCH_WORD_BITS) {
+            if (dim <= 0) { throw invalid_argument("Dimension must be a positive integer.\n"); }
+            if (bits <= 0 || bits % SKETCH_WORD_BITS != 0) { throw invalid_argument("The number of sketch bits must be a positive multiple of 64.\n"); }
+
+            this->_mean.assign(dim, 0.0f);
+            this->_planes.setDimension(dim);
+            this->_planes.reserve(bits);
+            mt19937 rng(SKETCH_SEED);
+            normal_distribution<float> gaussian(0.0f, 1.0f);
+            vector<float> plane(dim);
+            for (int b = 0; b < bits; b++){
+                for (float& x : plane) x = gaussian(rng);
+                this->_planes.append(plane.data(), dim);
+            }
+        }
+
+        int dim() const { return this->_dim; }
+        int bits() const { return this->_bits; }
+        int words() const { return this->_words; }
+        int size() const { return this->_sketches.size() / this->_words; }
+
+        // Bytes held by the sketches
+        size_t bytes() const { return this->_sketches.size() * sizeof(uint64_t); }
+
+        // Centers the hyperplanes on the mean of (at most SKETCH_TRAIN_SAMPLE rows spread over) the rows of the vector store
+        template <typename E>
+        void train(const VectorStore<E>& vectors){
+
+            if (vectors.dim() != this->_dim) { throw invalid_argument("Dimension Mismatch between Arguments"); }
+            if (vectors.empty()) { return; }    // hyperplanes through the origin
+
+            int n = min(vectors.size(), SKETCH_TRAIN_SAMPLE);
+            vector<double> sum(this->_dim, 0.0);
+            for (int i = 0; i < n; i++){
+                const E* row = vectors.row((int) ((long long) i * vectors.size() / n));
+                for (int j = 0; j < this->_dim; j++) sum[j] += (double) row[j];
+            }
+            for (int j = 0; j < this->_dim; j++) this->_mean[j] = (float) (sum[j] / n);
+        }
+
+        // Floats of the zero-padded row a sketch is computed on (see compute)
+        int paddedDim() const { return this->_planes.paddedDim(); }
+
+        // Writes the sketch of the row x (dim values) into out (words() words)
+        template <typename E>
+        void compute(const E* x, uint64_t* out) const {
+            AlignedRow<float> centered(this->paddedDim());
+            this->compute(x, out, centered.data());
+        }
+
+        // Same as compute(x, out), centering x into the aligned, zero-padded row centered (paddedDim() floats) given by the caller
+        template <typename E>
+        void compute(const E* x, uint64_t* out, float* centered) const {
+
+            for (int j = 0; j < this->_dim; j++) centered[j] = (float) x[j] - this->_mean[j];
+
+            memset(out, 0, this->_words * sizeof(uint64_t));
+            for (int b = 0; b < this->_bits; b++){
+                if (simd_row_dot_kernel(centered, this->_planes.row(b), this->_dim) >= 0.0f)
+                    out[b / SKETCH_WORD_BITS] |= (uint64_t) 1 << (b % SKETCH_WORD_BITS);
+            }
+        }
+
+        // Sketches every row of the vector store (replacing any previous sketches)
+        template <typename E>
+        void encode(const VectorStore<E>& vectors){
+            this->_sketches.assign((size_t) vectors.size() * this->_words, 0);
+            for (int r = 0; r < vectors.size(); r++) this->compute(vectors.row(r), &this->_sketches[(size_t) r * this->_words]);
+        }
+
+        // Sketches the next row of the vector store (e.g. the value of a new node)
+        template <typename E>
+        void append(const E* row){
+            this->_sketches.resize(this->_sketches.size() + this->_words);
+            this->compute(row, &this->_sketches[this->_sketches.size() - this->_words]);
+        }
+
+        // Sketch (words() words) of a row of the sketched vector store
+        const uint64_t* sketch(int row) const { return this->_sketches.data() + (size_t) row * this->_words; }
+
+        // Number of bits that differ between two sketches
+        int hamming(const uint64_t* s1, const uint64_t* s2) const {
+            int distance = 0;
+            for (int w = 0; w < this->_words; w++) distance += __builtin_popcountll(s1[w] ^ s2[w]);
+            return distance;
+        }
+};
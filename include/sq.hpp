@@ -0,0 +1,324 @@
+#pragma once
+
+#include <cstdint>
+
+#include "util.hpp"
+#include "vector_store.hpp"
+
+using namespace std;
+
+// This file implements scalar quantization (SQ) of the values of a graph, used by the compressed greedy search (see DirectedGraph::trainSQ).
+//
+// Every element of a value is encoded on its own (see ScalarQuantization in config.hpp):
+//   SQ_INT8          1 byte: uint8 code with a scale and an offset per dimension, learned from the minimum and maximum of each dimension
+//   SQ_INT8_VECTOR   1 byte: int8 code in [-127, 127] with one scale per value (symmetric). The query is quantized the same way
+//                    and the distances come from integer dot products (_mm256_maddubs_epi16)
+//   SQ_FP16          2 bytes: IEEE half precision (decoded with _mm256_cvtph_ps)
+// The AVX2 kernels decode the codes on the fly, 8 (float decodes) or 32 (integer dot product) elements per instruction.
+// Rows of codes are zero-padded up to a multiple of SQ_ROW_ELEMENTS elements, so the kernels have no tail.
+
+constexpr int SQ_ROW_ELEMENTS = 32;
+
+
+// --------------------------------------------------------------------------------------------------------------- Half precision
+
+// IEEE half precision -> single precision (scalar fallback of _mm256_cvtph_ps)
+inline float halfToFloat(uint16_t h){
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+
+    float f;
+    if (exp == 0){
+        f = ldexp((float) mant, -24);                               // zero or subnormal
+        return (sign) ? -f : f;
+    }
+
+    uint32_t bits = (exp == 31) ? (sign | 0x7f800000 | (mant << 13))     // inf, nan
+                                : (sign | ((uint32_t) (exp - 15 + 127) << 23) | (mant << 13));
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Single precision -> IEEE half precision, rounding to the nearest even (out of range values become infinite)
+inline uint16_t floatToHalf(float f){
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exp = (int) ((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff) { return sign | 0x7c00 | (mant ? 0x200 : 0); }
+    if (exp >= 31) { return sign | 0x7c00; }
+
+    if (exp <= 0){
+        if (exp < -10) { return sign; }                             // underflows to zero
+        mant |= 0x800000;                                           // subnormal: shift the implicit bit in
+        int shift = 14 - exp;
+        uint32_t h = mant >> shift, rem = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) h++;
+        return sign | h;
+    }
+
+    uint32_t h = ((uint32_t) exp << 10) | (mant >> 13), rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;            // a carry into the exponent is still the correct rounding
+    return sign | h;
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Kernels
+
+// sum of w[i] * (c[i] - q[i])^2 over n uint8 codes (n multiple of 8)
+__attribute__((target("avx2,fma")))
+inline float sqInt8L2Avx2(const uint8_t* c, const float* q, const float* w, int n){
+    __m256 sum = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8){
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (c + i))));
+        __m256 diff = _mm256_sub_ps(x, _mm256_loadu_ps(q + i));
+        sum = _mm256_fmadd_ps(_mm256_mul_ps(diff, diff), _mm256_loadu_ps(w + i), sum);
+    }
+    return _hsum256(sum);
+}
+
+// sum of c[i] * q[i] over n uint8 codes (n multiple of 8)
+__attribute__((target("avx2,fma")))
+inline float sqInt8DotAvx2(const uint8_t* c, const float* q, int n){
+    __m256 sum = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8){
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (c + i))));
+        sum = _mm256_fmadd_ps(x, _mm256_loadu_ps(q + i), sum);
+    }
+    return _hsum256(sum);
+}
+
+// integer dot product of n int8 codes in [-127, 127] (n multiple of 32)
+__attribute__((target("avx2")))
+inline int sqInt8VectorDotAvx2(const int8_t* a, const int8_t* b, int n){
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < n; i += 32){
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        // maddubs multiplies unsigned by signed bytes: |a| times b with the sign of a. |a|, |b| <= 127, so the pair sums cannot saturate
+        __m256i pairs = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(pairs, ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+    return _mm_cvtsi128_si32(s);
+}
+
+// sum of (c[i] - q[i])^2 over n half precision codes (n multiple of 8)
+__attribute__((target("avx2,fma,f16c")))
+inline float sqFp16L2Avx2(const uint16_t* c, const float* q, int n){
+    __m256 sum = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8){
+        __m256 diff = _mm256_sub_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (c + i))), _mm256_loadu_ps(q + i));
+        sum = _mm256_fmadd_ps(diff, diff, sum);
+    }
+    return _hsum256(sum);
+}
+
+// sum of c[i] * q[i] over n half precision codes (n multiple of 8)
+__attribute__((target("avx2,fma,f16c")))
+inline float sqFp16DotAvx2(const uint16_t* c, const float* q, int n){
+    __m256 sum = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8)
+        sum = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (c + i))), _mm256_loadu_ps(q + i), sum);
+    return _hsum256(sum);
+}
+
+
+// --------------------------------------------------------------------------------------------------------------- Quantizer
+
+// A query prepared for the distances to the codes of a ScalarQuantizer (see ScalarQuantizer::prepareQuery)
+struct SQQuery{
+    AlignedRow<float> values;       // SQ_INT8: the query in code units (L2) or scaled by the dimension scales (IP). SQ_FP16: the query
+    AlignedRow<int8_t> codes;       // SQ_INT8_VECTOR: the quantized query
+    float scale = 1.0f;             // SQ_INT8_VECTOR: scale of the quantized query
+    float norm2 = 0.0f;             // SQ_INT8_VECTOR: squared norm of the query
+    float bias = 0.0f;              // SQ_INT8 (IP): inner product of the query with the dimension offsets
+};
+
+class ScalarQuantizer{
+
+    private:
+        ScalarQuantization _type;
+        int _dim;                       // dimension of the encoded rows
+        int _padded;                    // elements per row of codes (multiple of SQ_ROW_ELEMENTS)
+        bool _inner_product;            // distances are negative inner products instead of squared distances
+        int _n_rows;
+        vector<uint8_t> _codes;         // _n_rows x codeBytes(), in the row order of the encoded vector store
+        vector<float> _offset, _scale;  // SQ_INT8: x[i] ~ _offset[i] + _scale[i] * code[i]
+        vector<float> _weight;          // SQ_INT8: _scale[i]^2, zero in the padding
+        vector<float> _row_scale;       // SQ_INT8_VECTOR: x[i] ~ _row_scale[row] * code[i]
+        vector<float> _row_norm2;       // SQ_INT8_VECTOR: squared norm of every row (before quantization)
+
+        static bool _avx2() { return simd_level >= SIMD_AVX2; }
+
+    public:
+
+        // Quantizer of rows of dimension dim. inner_product: distances rank by inner product (METRIC_IP, METRIC_COSINE)
+        ScalarQuantizer(ScalarQuantization type, int dim, bool inner_product) : _type(type), _dim(dim), _inner_product(inner_product), _n_rows(0) {
+            if (dim <= 0) { throw invalid_argument("Dimension must be a positive integer.\n"); }
+            if (type != SQ_INT8 && type != SQ_INT8_VECTOR && type != SQ_FP16) { throw invalid_argument("Unknown scalar quantization type.\n"); }
+            this->_padded = (dim + SQ_ROW_ELEMENTS - 1) / SQ_ROW_ELEMENTS * SQ_ROW_ELEMENTS;
+        }
+
+        ScalarQuantization type() const { return this->_type; }
+        int dim() const { return this->_dim; }
+
+        // Bytes of the codes of one row
+        int codeBytes() const { return this->_padded * ((this->_type == SQ_FP16) ? 2 : 1); }
+
+        // Bytes held by the codes and the per-dimension and per-row parameters
+        size_t bytes() const {
+            return this->_codes.size() + (this->_offset.size() + this->_scale.size() + this->_weight.size() + this->_row_scale.size() + this->_row_norm2.size()) * sizeof(float);
+        }
+
+        // Learns the parameters of the codes from the rows of the vector store (SQ_INT8: the range of every dimension)
+        template <typename E>
+        void train(const VectorStore<E>& vectors){
+
+            if (vectors.dim() != this->_dim) { throw invalid_argument("Dimension Mismatch between Arguments"); }
+            if (vectors.empty()) { throw invalid_argument("Cannot train the scalar quantizer without vectors.\n"); }
+            if (this->_type != SQ_INT8) { return; }
+
+            vector<float> lo(this->_dim, numeric_limits<float>::max()), hi(this->_dim, numeric_limits<float>::lowest());
+            for (int r = 0; r < vectors.size(); r++){
+                const E* row = vectors.row(r);
+                for (int j = 0; j < this->_dim; j++){
+                    lo[j] = min(lo[j], (float) row[j]);
+                    hi[j] = max(hi[j], (float) row[j]);
+                }
+            }
+
+            this->_offset.assign(this->_padded, 0.0f);
+            this->_scale.assign(this->_padded, 1.0f);
+            this->_weight.assign(this->_padded, 0.0f);
+            for (int j = 0; j < this->_dim; j++){
+                this->_offset[j] = lo[j];
+                this->_scale[j] = (hi[j] > lo[j]) ? (hi[j] - lo[j]) / 255.0f : 1.0f;   // constant dimensions are encoded exactly by their offset
+                this->_weight[j] = this->_scale[j] * this->_scale[j];
+            }
+        }
+
+        // Encodes every row of the vector store (replacing any previous codes)
+        template <typename E>
+        void encode(const VectorStore<E>& vectors){
+
+            if (this->_type == SQ_INT8 && this->_offset.empty()) { throw invalid_argument("The scalar quantizer must be trained before encoding.\n"); }
+
+            this->_n_rows = vectors.size();
+            this->_codes.assign((size_t) this->_n_rows * this->codeBytes(), 0);
+            if (this->_type == SQ_INT8_VECTOR){
+                this->_row_scale.assign(this->_n_rows, 1.0f);
+                this->_row_norm2.assign(this->_n_rows, 0.0f);
+            }
+
+            for (int r = 0; r < this->_n_rows; r++){
+                const E* row = vectors.row(r);
+                uint8_t* code = this->_codes.data() + (size_t) r * this->codeBytes();
+
+                if (this->_type == SQ_INT8){
+                    for (int j = 0; j < this->_dim; j++)
+                        code[j] = (uint8_t) min(255.0f, max(0.0f, roundf(((float) row[j] - this->_offset[j]) / this->_scale[j])));
+                }
+                else if (this->_type == SQ_INT8_VECTOR){
+                    float max_abs = 0.0f;
+                    for (int j = 0; j < this->_dim; j++) max_abs = max(max_abs, fabsf((float) row[j]));
+                    float scale = (max_abs > 0.0f) ? max_abs / 127.0f : 1.0f;
+                    for (int j = 0; j < this->_dim; j++)
+                        ((int8_t*) code)[j] = (int8_t) min(127.0f, max(-127.0f, roundf((float) row[j] / scale)));
+                    this->_row_scale[r] = scale;
+                    this->_row_norm2[r] = row_innerProduct(row, row, this->_dim);
+                }
+                else{
+                    for (int j = 0; j < this->_dim; j++) ((uint16_t*) code)[j] = floatToHalf((float) row[j]);
+                }
+            }
+        }
+
+        // Prepares the query xq (dim values) for the distances to the codes, once per search
+        template <typename E>
+        SQQuery prepareQuery(const E* xq) const {
+            SQQuery q;
+            this->prepareQuery(xq, q);
+            return q;
+        }
+
+        // Same as prepareQuery(xq), into q: the rows of a q prepared before by this quantizer are reused
+        template <typename E>
+        void prepareQuery(const E* xq, SQQuery& q) const {
+
+            if (q.values.size() != this->_padded) q.values = AlignedRow<float>(this->_padded);
+            q.scale = 1.0f;
+            q.norm2 = 0.0f;
+            q.bias = 0.0f;
+            float* values = q.values.data();
+
+            if (this->_type == SQ_INT8){
+                for (int j = 0; j < this->_dim; j++){
+                    if (this->_inner_product) {
+                        values[j] = (float) xq[j] * this->_scale[j];
+                        q.bias += (float) xq[j] * this->_offset[j];
+                    }
+                    else values[j] = ((float) xq[j] - this->_offset[j]) / this->_scale[j];
+                }
+            }
+            else if (this->_type == SQ_INT8_VECTOR){
+                if (q.codes.size() != this->_padded) q.codes = AlignedRow<int8_t>(this->_padded);
+                float max_abs = 0.0f;
+                for (int j = 0; j < this->_dim; j++) max_abs = max(max_abs, fabsf((float) xq[j]));
+                q.scale = (max_abs > 0.0f) ? max_abs / 127.0f : 1.0f;
+                for (int j = 0; j < this->_dim; j++)
+                    q.codes.data()[j] = (int8_t) min(127.0f, max(-127.0f, roundf((float) xq[j] / q.scale)));
+                q.norm2 = row_innerProduct(xq, xq, this->_dim);
+            }
+            else{
+                for (int j = 0; j < this->_dim; j++) values[j] = (float) xq[j];
+            }
+        }
+
+        // Approximate distance of a prepared query to a row: squared distance, or negative inner product
+        float distance(const SQQuery& q, int row) const {
+
+            const uint8_t* code = this->_codes.data() + (size_t) row * this->codeBytes();
+            int n = this->_padded;
+
+            if (this->_type == SQ_INT8){
+                if (this->_inner_product){
+                    float dot = 0.0f;
+                    if (_avx2()) dot = sqInt8DotAvx2(code, q.values.data(), n);
+                    else for (int j = 0; j < n; j++) dot += code[j] * q.values.data()[j];
+                    return -(q.bias + dot);
+                }
+                if (_avx2()) { return sqInt8L2Avx2(code, q.values.data(), this->_weight.data(), n); }
+                float sum = 0.0f;
+                for (int j = 0; j < n; j++){
+                    float diff = code[j] - q.values.data()[j];
+                    sum += this->_weight[j] * diff * diff;
+                }
+                return sum;
+            }
+
+            if (this->_type == SQ_INT8_VECTOR){
+                int idot = 0;
+                if (_avx2()) idot = sqInt8VectorDotAvx2((const int8_t*) code, q.codes.data(), n);
+                else for (int j = 0; j < n; j++) idot += ((const int8_t*) code)[j] * q.codes.data()[j];
+                float dot = this->_row_scale[row] * q.scale * idot;
+                return (this->_inner_product) ? -dot : this->_row_norm2[row] + q.norm2 - 2.0f * dot;
+            }
+
+            const uint16_t* half = (const uint16_t*) code;
+            if (_avx2()) { return (this->_inner_product) ? -sqFp16DotAvx2(half, q.values.data(), n) : sqFp16L2Avx2(half, q.values.data(), n); }
+            float sum = 0.0f;
+            for (int j = 0; j < n; j++){
+                float x = halfToFloat(half[j]);
+                sum += (this->_inner_product) ? -x * q.values.data()[j] : (x - q.values.data()[j]) * (x - q.values.data()[j]);
+            }
+            return sum;
+        }
+};
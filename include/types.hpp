@@ -16,8 +16,14 @@
 #include <optional>
 #include <sys/stat.h>
 #include <string>
+#include <memory>
 
 #include "util.hpp"
+#include "vector_store.hpp"
+#include "pq.hpp"
+#include "sq.hpp"
+#include "sketch.hpp"
+#include "pca.hpp"
 
 using namespace std;
 
@@ -26,7 +32,7 @@ using namespace std;
 // They are all linked together in the interface.hpp file
 
 
-template <typename T>
+template <typename T, typename Distance = DynamicDistance<typename T::value_type>>
 class DirectedGraph;    // forward declaration for nodes and queries
 
 struct Id {
@@ -50,23 +56,29 @@ namespace std { // Hash based on the integer value
     template <> struct hash<Id> { size_t operator()(const Id& id) const noexcept { return hash<int>()(id.value);} };
 }                                                                       /* actual hash implementation = hash with id.value (hash<int>)*/
 
+#include "adjacency.hpp"    // edge storage of the graph (needs Id)
+#include "node_locks.hpp"   // locks of the out-neighbors of the nodes while several threads modify the edges (needs Id)
+#include "fastscan.hpp"     // 4-bit codes of the out-neighbors of every node (needs Id and the adjacency store)
+#include "search_beam.hpp"  // candidate list and visited table of the greedy searches (needs Id)
+#include "index_io.hpp"
+
+constexpr float VAMANA_BATCH_MAX_FRACTION = 0.02f;     // largest batch of the batch build, as a fraction of the nodes (see DirectedGraph::_batch_Vamana)
 
 // Node class
+// A node does not own its value: the value lives in the graph's VectorStore at the node's row index (see DirectedGraph::getValue, DirectedGraph::getRow).
 template <typename T>
 class Node{
     
     public:
         Id id;
         int category;
-        T value;
-        function<bool(const T&)> isEmpty;   // pointer to the isEmpty method
+        int row;        // row index of the node's value in the graph's VectorStore. -1 if the node has an empty value
 
         // Constructor
-        Node(Id id = -1, int category = -1, T value = {}, function<bool(const T&)> isEmpty = alwaysEmpty<T>){
+        Node(Id id = -1, int category = -1, int row = -1){
             this->id = id;
             this->category = category;
-            this->value = value;
-            this->isEmpty = isEmpty;
+            this->row = row;
         }
 
         bool operator<(const Node& n) const;
@@ -98,41 +110,75 @@ class Query{
         bool operator<(const Query& q);
         bool operator==(const Query& q);
 
-        bool empty();
+        bool empty() const;
 };
 
 // Directed Graph Class Template:
-// This implementation of a Directed Graph Class makes use of dictionaries/maps for adjacency lists.
+// This implementation of a Directed Graph Class keeps the adjacency lists in an AdjacencyStore (contiguous neighbor block per node).
+// The values of the nodes are stored contiguously in a VectorStore, so the Content Type T must be a contiguous container (vector-like: value_type, data(), size()).
 // To instantiate such a Directed Graph Object, you will need to specify the Content Type T, as well as provide:
-// 1. Distance Function: T x T -> float <=> float distance_function(T,T)
+// 1. Distance: either a distance policy type (second template parameter, e.g. DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>>, see distance.hpp),
+//    whose kernel is inlined into the search and prune loops (preferred for the built-in distances),
+//    or, with the default DynamicDistance policy, a distance function on raw rows, float distance_function(const T::value_type*, const T::value_type*, int dim),
+//    or on values, float distance_function(T,T) (rows are copied into temporary T values on every call)
 // 2. (Optional) Content type T Valid Check Function: T -> bool <=> bool isEmpty(T) (Default is an AlwaysValid function that returns false for any input)
 //
-// IMPORTANT: If you are planning to use DirectedGraph::store and DirectedGraph::load methods to save an instance of your DirectedGraph class,
+// DirectedGraph::store and DirectedGraph::load use a binary index format (see index_io.hpp) that only requires T::value_type to be trivially copyable.
+// IMPORTANT: If you are planning to use the legacy text format (DirectedGraph::storeText, or loading an index stored in it),
 // you must have the operators "<<" and ">>" overloaded FOR I/O OPERATIONS for your specific content type T.
 // See more on: https://stackoverflow.com/questions/476272/how-can-i-properly-overload-the-operator-for-an-ostream
 //              https://stackoverflow.com/questions/69803296/overloading-istream-operator
 // Such overloads already exist in the config.hpp file. More instructions for the implementation can be found there. 
-template <typename T>
+template <typename T, typename Distance>
 class DirectedGraph{
 
+    public:
+        using Elem = typename T::value_type;                // element type of the stored values
+
     private:
         int n_edges;                                        // number of edges present in the graph
         int n_nodes;                                        // number of nodes present in the graph
         vector<Node<T>> nodes;                              // vector containing all the nodes in the graph
+        VectorStore<Elem> vectors;                          // contiguous aligned storage for the values of all nodes (indexed by Node::row)
+        unique_ptr<MappedFile> _mapped;                     // memory-mapped index file serving vectors and Nout in place (nullptr if not mapped)
         Id _medoid;                                         // medoid node's id. Used to avoid recalculation of medoid if we want to access it more than once
         unordered_map<int, Id> filteredMedoids;             // map containing each category key and its corresponding medoid node
         unordered_map<int, unordered_set<Id>> categories;   // a map containing all unique categories in the data and their corresponding nodes that belong to each
-        unordered_map<Id, unordered_set<Id>> Nout;          // key: node, value: set of outgoing neighbors 
-        function<float(const T&, const T&)> d;              // Graph's distance function
+        AdjacencyStore Nout;                                // outgoing neighbors of every node (fixed-width slot blocks, or CSR once compacted)
+        Distance d;                                         // Graph's distance policy on raw rows of dimension vectors.dim()
+        Metric _metric;                                     // metric of the values (transforms applied on insertion and on queries, see setMetric)
+        float _mips_norm;                                   // maximum norm of the values of a METRIC_MIPS graph (-1 if not set)
+        unique_ptr<ProductQuantizer> _pq;                   // PQ codes of the values for the compressed greedy search (nullptr if not trained, see trainPQ)
+        unique_ptr<ScalarQuantizer> _sq;                    // SQ codes of the values for the compressed greedy search (nullptr if not trained, see trainSQ)
+        bool _sq_rerank;                                    // re-rank the candidates of the SQ greedy search with the full precision distance
+        unique_ptr<BinarySketch> _sketch;                   // binary sketches of the values, prefilter of the exact distances (nullptr if disabled, see enableSketch)
+        int _sketch_margin;                                 // bits by which a sketch distance must exceed the reference one to skip the exact distance
+        unique_ptr<FastScanBlocks> _fastscan;               // 4-bit codes of the out-neighbors of every node, estimates of the Beam Greedy Search (nullptr if not built, see buildFastScan)
+        float _fastscan_margin;                             // relative slack of the fast-scan estimates over the distance of the worst candidate
+        unique_ptr<PCARotation> _pca;                       // rotation of the values onto their principal components, for the two-tier distances (nullptr if not applied, see applyPCA)
         function<bool(const T&)> isEmpty;                   // typename T valid check
 
-        mutex _mx_edges;                                    // Mutex for edges modification
+        NodeLocks _node_locks;                              // locks of the out-neighbors of every node while several threads modify the edges (see node_locks.hpp)
+        bool _frozen;                                       // read-only index: the searches read the neighbors directly and modifications throw (see freeze)
+        bool _batch_building;                               // batch build in progress: the edges only change between its search phases (see _batch_Vamana)
+
+        // True if other threads may modify the edges while this one searches: the searches then read the neighbors optimistically (see _readNeighbors)
+        bool _concurrentEdges() const { return args.n_threads > 1 && !this->_frozen && !this->_batch_building; }
+
+        // Returns the out-neighbors of a node. If the edges may be modified concurrently, they are copied into buffer (optimistic read, see NodeLocks)
+        NeighborRange _readNeighbors(Id id, vector<Id>& buffer) const {
+            if (!this->_concurrentEdges()) return this->Nout.neighbors(id);
+            this->_node_locks.read(id, [&](){
+                NeighborRange nb = this->Nout.neighbors(id);
+                buffer.assign(nb.begin(), nb.end());
+            });
+            return NeighborRange(buffer.data(), buffer.data() + buffer.size());
+        }
 
-        mutex _mx_cv;                                       // Mutex for Condition Variables
-        condition_variable _cv_reader;                      // Condition Variable for Readers-Writers synchronization between Greedy Search (R) and Edges Modifications (add/remove)
-        condition_variable _cv_writer;                      // Condition Variable for Readers-Writers synchronization between Greedy Search (R) and Edges Modifications (add/remove)
-        int _active_GS;                                     // How many Readers are active
-        bool _active_W;                                     // If a writer is active
+        // Throws if the index is frozen (called by every modification of the nodes, the edges or the values)
+        void _checkMutable() const {
+            if (this->_frozen){ throw invalid_argument("Cannot modify a frozen index.\n"); }
+        }
 
         // Implements medoid function using serial programming.
         const Id _serial_medoid(vector<Node<T>>& nodes);
@@ -143,8 +189,117 @@ class DirectedGraph{
         // Thread function for parallel medoid. Work inside the range defined by [start_index, end_index). Update minima by reference for the merging of the results.
         void _thread_medoid_fn(vector<Node<T>>& nodes, int start_index, int end_index, Id& local_minimum, float& local_dmin);
 
+        // Sum of the distances from a node to the given nodes. Rotated graphs sum the distances on the leading coordinates first, and return that
+        // partial sum as soon as it exceeds bound (the best sum so far: the node cannot be the medoid).
+        float _sumOfDistances(Id id, const vector<Node<T>>& nodes, float bound);
+
+        // Sums of the distances from every node to all the nodes (into sums), through the many-to-many kernels of the policy, on the row tiles
+        // first_tile, first_tile + tile_step, ... of the upper triangle of the distances only (partial sums of one stripe of _tiledMedoid)
+        void _tileDistanceSums(const vector<Node<T>>& nodes, int first_tile, int tile_step, vector<float>& sums);
+
+        // Medoid through the tiled sums of the distances, on n_threads threads. The result does not depend on the number of threads.
+        const Id _tiledMedoid(vector<Node<T>>& nodes, int n_threads);
+
+        // Distance between the values of two nodes of the graph
+        float _dist(Id a, Id b) { return this->d(this->getRow(a), this->getRow(b), this->vectors.dim()); }
+
+        // Distance between the value of a node of the graph and a padded row (see _padQuery)
+        float _dist(Id a, const Elem* xq) { return this->d(this->getRow(a), xq, this->vectors.dim()); }
+
+        // Sketch of the value of a node (the sketches must be enabled)
+        const uint64_t* _nodeSketch(Id id) const { return this->_sketch->sketch(this->nodes[id].row); }
+
+        // Copy of the out-neighbors of a node, as a candidate set for robustPrune
+        unordered_set<Id> _neighborSet(Id id) const {
+            NeighborRange nb = this->Nout.neighbors(id);
+            return unordered_set<Id>(nb.begin(), nb.end());
+        }
+
+        // Copies the k closest candidates of the beam of a finished search (and their distances) into ctx.results
+        void _collectResults(int k, SearchContext& ctx) const {
+            ctx.results.clear();
+            for (int i = 0; i < min(k, ctx.beam.size()); i++) ctx.results.emplace_back(ctx.beam[i].id, ctx.beam[i].dist);
+        }
+
+        // Returns the set of the ids of ranked results
+        static unordered_set<Id> _resultSet(const vector<pair<Id, float>>& results){
+            unordered_set<Id> ids;
+            for (const pair<Id, float>& r : results) ids.insert(r.first);
+            return ids;
+        }
+
+        // Returns the results of the last search on ctx (returned.first) and the nodes it expanded (returned.second)
+        pair<unordered_set<Id>, unordered_set<Id>> _searchSets(const SearchContext& ctx) const {
+            pair<unordered_set<Id>, unordered_set<Id>> ret;
+            ret.first = _resultSet(ctx.results);
+            ret.second.insert(ctx.expanded.begin(), ctx.expanded.end());
+            return ret;
+        }
+
+        // Distances from the padded row xq of the n nodes ids into ctx.dists, bounded by the distance of the worst candidate once the beam is full
+        void _beamDistances(const Elem* xq, const Id* ids, int n, SearchContext& ctx);
+
+        // Prefetches the out-neighbors of the next args.prefetchDistance unexpanded candidates of the beam (the nodes the search expands next)
+        void _prefetchCandidates(const SearchBeam& beam) const;
+
+        // Appends the out-neighbors of pmin (of the category, if >= 0) that the search has not visited yet to ctx.ids, and marks them visited.
+        // If rows, the rows of those neighbors are prefetched (see args.prefetchDistance).
+        template <typename Visited>
+        void _unseenNeighbors(Id pmin, int category, bool rows, Visited& visited, SearchContext& ctx);
+
+        // Prefetches the node (row index and category) and the visited stamp of a neighbor a search is about to check
+        template <typename Visited>
+        void _prefetchNode(Id id, const Visited& visited) const {
+            _mm_prefetch((const char*) &this->nodes[id], _MM_HINT_T0);
+            visited.prefetch(id);
+        }
+
+        // Prefetches the row of a node whose distance a search is about to compute
+        void _prefetchRow(Id id) const { prefetchRow(this->getRow(id), this->vectors.paddedDim() * sizeof(Elem)); }
+
+        // Copies a value of type T into an aligned, zero-padded row that can be passed to the row distance function (transformed for the metric like the values)
+        AlignedRow<Elem> _padQuery(const T& xq) const;
+
+        // Same as _padQuery(const T&) for the query xq of dim values, into the query row of the search context (no allocation)
+        const Elem* _padQuery(const Elem* xq, int dim, SearchContext& ctx) const;
+
+        // Copies the query xq (dim values) into the zero-padded row out (of vectors.paddedDim() elements), transformed for the metric but not rotated
+        void _padQuery(const Elem* xq, int dim, Elem* out) const;
+
+        // Greedy Search on a padded query row, on the search context ctx.
+        void _greedySearch(Id s, const Elem* xq, int k, int L, SearchContext& ctx);
+
+        // Filtered Greedy Search on a padded query row of the given category, on the search context ctx.
+        void _filteredGreedySearch(Id s, const Elem* xq, int category, int k, int L, SearchContext& ctx);
+
+        // Filtered Greedy Search of a query on the search context ctx (an unfiltered Greedy Search from the starting node if the query has no category)
+        void _filteredGreedySearch(Id s, const Query<T>& q, int k, int L, SearchContext& ctx);
+
+        // Drops the state derived from the values of the graph (frozen flag, codes, sketches, rotation), before a loaded index replaces them
+        void _resetLoaded();
+
+        // Rebuilds the node table, the categories and the filtered medoids from the small blocks of a binary index (into the given containers)
+        void _loadNodeTable(const IndexHeader& header, const int32_t* filtered_medoids, const int32_t* categories, const int32_t* rows,
+                            vector<Node<T>>& nodes, unordered_map<int, unordered_set<Id>>& category_nodes, unordered_map<int, Id>& medoids) const;
+
+        // Replaces the node table, the categories, the filtered medoids and the vectors of the graph with the loaded ones (swapped in, without copies)
+        void _swapLoaded(const IndexHeader& header, vector<Node<T>>& nodes, unordered_map<int, unordered_set<Id>>& category_nodes,
+                         unordered_map<int, Id>& medoids, VectorStore<Elem>& vectors);
+
+        // Loads a graph state stored in the binary index format
+        void _loadBinary(const string& filename);
+
+        // Loads a graph state stored in the binary index format by memory-mapping the file (vectors and edges are used in place)
+        void _loadMapped(const string& filename);
+
+        // Loads a graph state stored in the legacy text format
+        void _loadText(const string& filename);
+
         // Thread function for parallel querying.
-        void _thread_findQueryNeighbors_fn(vector<Query<T>>& queries, mutex& mx_query_index, int& query_index, vector<unordered_set<Id>>& returnVec);
+        void _thread_findQueryNeighbors_fn(vector<Query<T>>& queries, mutex& mx_query_index, int& query_index, vector<vector<pair<Id, float>>>& returnVec);
+
+        // Thread function of findQueriesNeighbors with args.queryBatch > 1: takes args.queryBatch queries at a time and searches them with searchBatch
+        void _thread_findQueryBatchNeighbors_fn(vector<Query<T>>& queries, mutex& mx_query_index, int& query_index, vector<vector<pair<Id, float>>>& returnVec);
 
         bool _serial_Rgraph(int R);
 
@@ -156,13 +311,34 @@ class DirectedGraph{
 
         bool _parallel_Vamana(int L, int R, float a, vector<Id>& permutation);
 
-        void _thread_Vamana_fn(int& L, int& R, float& a, vector<Id>& permutation, int& current_index, mutex& mx_index, char& rv);
+        // Thread function of the parallel Vamana build: every write locks the node it rewrites only, and the changes of the degrees are added up in edges
+        void _thread_Vamana_fn(int& L, int& R, float& a, vector<Id>& permutation, int& current_index, mutex& mx_index, char& rv, int& edges);
+
+        // Batch build of the Vamana graph: the permutation is inserted in batches of doubling size (up to VAMANA_BATCH_MAX_FRACTION of the nodes).
+        // The nodes of a batch are searched and pruned in parallel on the graph of the previous batches, then their neighbors and the reverse
+        // edges (grouped by target node) are written in parallel, one node per thread: no locks, and the same graph on any number of threads.
+        bool _batch_Vamana(int L, int R, float a, vector<Id>& permutation);
+
+        // Runs fn(i, t) for i in [0, n) on args.n_threads threads, t the index (in [0, args.n_threads)) of the thread that runs i
+        void _parallelFor(int n, const function<void(int, int)>& fn);
+
+        // Robust prune selection: the out-neighbors of p among the candidates (distinct, p excluded) into selected (at most R), by increasing
+        // distance from p, dropping every candidate p' with a * d(p*, p') <= d(p, p') once p* is selected. Does not modify the graph.
+        void _robustPruneSelect(Id p, vector<Id>& candidates, float a, int R, vector<Id>& selected);
+
+        // Filtered robust prune selection: same as _robustPruneSelect, except that a candidate of the category of p is not dropped by a p* of
+        // another category. Does not modify the graph.
+        void _filteredRobustPruneSelect(Id p, vector<Id>& candidates, float a, int R, vector<Id>& selected);
+
+        // Replaces the out-neighbors of p with ids at once, under the lock of p (see robustPrune)
+        void _replaceNeighbors(Id p, const vector<Id>& ids);
 
         bool _serial_filteredVamana(int L, int  R, float a, float t, vector<Id>& perm);
 
         bool _parallel_filteredVamana(int L, int  R, float a, float t, vector<pair<int, vector<Id>>>& sorted_categories);
 
-        void _thread_filteredVamana_fn(int& L, int& R, float& a, float& t, int& current_index, mutex& mx, char& rv, vector<pair<int, vector<Id>>>& sorted_categories);
+        // Thread function of the parallel filtered Vamana build (one category at a time): same writes as _thread_Vamana_fn, through the node locks
+        void _thread_filteredVamana_fn(int& L, int& R, float& a, float& t, int& current_index, mutex& mx, char& rv, vector<pair<int, vector<Id>>>& sorted_categories, int& edges);
 
         // Implements stitchedVamana algorithm using serial programming
         bool _serial_stitchedVamana(int L, int Rstitched, int Rsmall, float a); 
@@ -173,52 +349,201 @@ class DirectedGraph{
         // Thread function for parallel stitchedVamana index creation
         void _thread_stitchedVamana_fn(int& L, int& Rstitched, int& Rsmall, float& a, int& category_index, mutex& mx_category_index, mutex& mx_merge, vector<int>& category_names, char& rv);
 
-        // Set Greedy Search
-        const pair<unordered_set<Id>, unordered_set<Id>> _set_greedySearch(Id s, T xq, int k, int L);
+        // Beam Greedy Search: best-first traversal on the beam of the search context (see search_beam.hpp)
+        void _beam_greedySearch(Id s, const Elem* xq, int k, int L, SearchContext& ctx);
+
+        // Beam Filtered Greedy Search: same as the Beam Greedy Search, on the nodes of the query's category
+        void _beam_filteredGreedySearch(Id s, const Elem* xq, int category, int k, int L, SearchContext& ctx);
+
+        // Compressed Greedy Search: traverses on the approximate distances codeDist(id) of the compressed values (PQ or SQ codes).
+        // If rerank, the final L candidates are re-ranked with the full precision distance before the k closest are collected.
+        template <typename CodeDistance>
+        void _compressedGreedySearch(Id s, const Elem* xq, int k, int L, const CodeDistance& codeDist, bool rerank, SearchContext& ctx);
 
-        // Pqueue Greedy Search
-        const pair<unordered_set<Id>, unordered_set<Id>> _pqueue_greedySearch(Id s, T xq, int k, int L);
+        // Compressed Filtered Greedy Search: same as the Compressed Greedy Search, on the nodes of the query's category
+        template <typename CodeDistance>
+        void _compressedFilteredGreedySearch(Id s, const Elem* xq, int category, int k, int L, const CodeDistance& codeDist, bool rerank, SearchContext& ctx);
 
-        // Set Filtered Greedy Search
-        const pair<unordered_set<Id>, unordered_set<Id>> _set_filteredGreedySearch(Id s, Query<T> q, int k, int L);
+        // Calls search(codeDist, rerank) with the distance of the nodes to xq on the codes of the graph (PQ codes if trained, otherwise SQ codes).
+        // The table or the prepared query of xq is kept in ctx.
+        template <typename Search>
+        void _withCodeDistance(const Elem* xq, SearchContext& ctx, const Search& search);
 
-        // Pqueue Filtered Greedy Search
-        const pair<unordered_set<Id>, unordered_set<Id>> _pqueue_filteredGreedySearch(Id s, Query<T> q, int k, int L);
+        // Replaces the (ADC) distances of the candidates of the beam of ctx with the full precision distances from xq, and restores its order
+        void _rerank(const Elem* xq, SearchContext& ctx);
 
 
     public:
 
-        // Constructor: Initialize an empty graph
-        DirectedGraph(function<float(const T&, const T&)> distance_function, function<bool(const T&)> is_Empty) {
-            this->d = distance_function;
+        // Constructor: Initialize an empty graph with a distance policy (e.g. L2Distance<SIMD_AVX2>())
+        DirectedGraph(Distance distance, function<bool(const T&)> is_Empty) {
+            this->d = distance;
             this->isEmpty = is_Empty;
+            this->_metric = METRIC_L2;
+            this->_mips_norm = -1;
+            this->_sq_rerank = false;
+            this->_sketch_margin = 0;
+            this->_fastscan_margin = 0;
             this->n_nodes = 0;
             this->n_edges = 0;
+            this->_frozen = false;
+            this->_batch_building = false;
 
             this->init();
             c_log << "Graph created!" << '\n';
         }
 
+        // Constructor: Initialize an empty graph with a distance function on raw rows (e.g. row_euclideanDistance<float>, simd_row_euclideanDistance). DynamicDistance graphs only.
+        DirectedGraph(function<float(const Elem*, const Elem*, int)> distance_function, function<bool(const T&)> is_Empty)
+            : DirectedGraph(Distance(distance_function), is_Empty) {}
+
+        // Constructor: Initialize an empty graph with a distance function on values of type T. DynamicDistance graphs only.
+        // The rows are copied into temporary T values on every call: use the row distance constructor for the built-in distances.
+        DirectedGraph(function<float(const T&, const T&)> distance_function, function<bool(const T&)> is_Empty)
+            : DirectedGraph(
+                [distance_function](const Elem* t1, const Elem* t2, int dim) { return distance_function(T(t1, t1 + dim), T(t2, t2 + dim)); },
+                is_Empty) {}
+
         // Return a set of all Nodes in the graph
         vector<Node<T>>& getNodes() { return this->nodes; }
 
+        // Return the storage of the values of the nodes
+        const VectorStore<Elem>& getVectors() const { return this->vectors; }
+
+        // Return a pointer to the (aligned, zero-padded) row holding the value of a node
+        const Elem* getRow(Id id) const { return this->vectors.row(this->nodes[id].row); }
+
+        // Return a copy of the value of a node (empty if the node has an empty value)
+        T getValue(Id id) const;
+
         // Return the number of edges in the graph
         const int& get_n_edges() const { return this->n_edges; }
 
         // Return the number of nodes in the graph
         const int& get_n_nodes() const { return this->n_nodes; }
 
-        // Return Nout map
-        const unordered_map<Id, unordered_set<Id>>& get_Nout() const { return this->Nout; }
+        // Return a snapshot of the out-neighbors as a map (key: node, value: set of outgoing neighbors). Nodes without out-neighbors are omitted.
+        unordered_map<Id, unordered_set<Id>> get_Nout() const;
+
+        // Return the out-neighbors of a node
+        NeighborRange getNeighbors(Id id) const { return this->Nout.neighbors(id); }
+
+        // Return the storage of the edges
+        const AdjacencyStore& getAdjacency() const { return this->Nout; }
+
+        // Converts the edges into their compact read-only form (after the index is built). Any later modification expands them again.
+        void compactEdges() { this->Nout.compact(); }
+
+        // Makes the index read-only once it is built or loaded: computes the starting nodes of the searches (the medoid, and the medoids of the
+        // categories for the filtered and stitched indexes) and compacts the edges.
+        // The greedy searches of a frozen index read the neighbors in place, without the optimistic reads of an index that other threads may
+        // be modifying (see NodeLocks), while creating nodes, modifying edges, pruning, running the index algorithms or rotating the values throws. The codes the searches use
+        // (PQ, SQ, sketches, fast-scan blocks) can still be replaced between queries. init and load unfreeze the index.
+        void freeze();
+
+        // Makes a frozen index modifiable again
+        void unfreeze() { this->_frozen = false; }
+
+        // Return true if the index is frozen (see freeze)
+        bool frozen() const { return this->_frozen; }
+
+        // Return the metric of the values of the graph
+        Metric getMetric() const { return this->_metric; }
+
+        // Sets the metric of the values of the graph (before any node is created). The distance policy must match it:
+        //   METRIC_L2, METRIC_MIPS  L2Distance         METRIC_MIPS values get an extra coordinate sqrt(M^2 - |x|^2) (see setMipsNorm), queries a zero one
+        //   METRIC_IP               IPDistance
+        //   METRIC_COSINE           CosineDistance     values and queries are normalized to unit length
+        void setMetric(Metric metric){
+            if (this->n_nodes > 0 && metric != this->_metric) { throw invalid_argument("Cannot change the metric of a non-empty graph.\n"); }
+            if (metric != METRIC_L2 && !is_floating_point<Elem>::value) { throw invalid_argument("Only floating point values support the " + metricName(metric) + " metric.\n"); }
+            this->_metric = metric;
+        }
+
+        // Sets the maximum norm M of the values of a METRIC_MIPS graph, before any node is created (e.g. computed in a first pass over the dataset)
+        void setMipsNorm(float max_norm){
+            if (this->n_nodes > 0 && max_norm != this->_mips_norm) { throw invalid_argument("Cannot change the maximum norm of a non-empty graph.\n"); }
+            this->_mips_norm = max_norm;
+        }
+
+        // Trains product quantization codebooks of M subspaces on the values and encodes every value (M bytes each), replacing any SQ codes.
+        // From then on, greedy searches traverse the graph on the PQ codes and re-rank their final L candidates with the full precision distance.
+        // Creating nodes or loading another index drops the codes.
+        void trainPQ(int M);
+
+        // Return the product quantizer of the values (nullptr if not trained)
+        const ProductQuantizer* getPQ() const { return this->_pq.get(); }
+
+        // Drops the PQ codes: greedy searches use the full precision distance again
+        void dropPQ() { this->_pq.reset(); }
+
+        // Scalar-quantizes the values (see ScalarQuantization in config.hpp), replacing any PQ codes.
+        // From then on, greedy searches traverse the graph on the codes. If rerank, their final L candidates are re-ranked with the full precision distance.
+        // Creating nodes or loading another index drops the codes.
+        void trainSQ(ScalarQuantization type, bool rerank);
+
+        // Return the scalar quantizer of the values (nullptr if not trained)
+        const ScalarQuantizer* getSQ() const { return this->_sq.get(); }
+
+        // Drops the SQ codes: greedy searches use the full precision distance again
+        void dropSQ() { this->_sq.reset(); }
+
+        // Sketches the values with bits random hyperplanes through their mean (see sketch.hpp), and keeps sketching new values.
+        // From then on, the Beam Greedy Search and robustPrune skip the exact distance of a node whose sketch distance exceeds
+        // the one of their reference node (the worst candidate, the pruned node) by more than margin bits.
+        // Loading another index disables the sketches.
+        void enableSketch(int bits, int margin);
+
+        // Return the sketches of the values (nullptr if disabled)
+        const BinarySketch* getSketch() const { return this->_sketch.get(); }
+
+        // Disables the sketch prefilter: every distance is exact again
+        void disableSketch() { this->_sketch.reset(); }
+
+        // Encodes the values with a 4-bit product quantizer of M subspaces and lays out the codes of the out-neighbors of every node next to
+        // their ids (see fastscan.hpp). From then on, the Beam Greedy Search estimates the distances of all the out-neighbors of a node at once,
+        // and computes the exact distances of the neighbors whose estimate is within (1 + margin) times the distance of the worst candidate only.
+        // The blocks are built from the current edges: modifying the graph (nodes, edges) or loading another index drops them.
+        // Euclidean (L2 and MIPS) graphs only.
+        void buildFastScan(int M, float margin);
+
+        // Return the fast-scan blocks of the graph (nullptr if not built)
+        const FastScanBlocks* getFastScan() const { return this->_fastscan.get(); }
+
+        // Drops the fast-scan blocks: every distance of the Beam Greedy Search is exact again
+        void dropFastScan() { this->_fastscan.reset(); }
+
+        // Rotates the values onto their principal components (see pca.hpp), and keeps rotating the new values and the queries: the stored rows
+        // (and getValue) are in principal component order. From then on, the bounded distances of the searches and the prunes (see distanceBounded)
+        // and the distance sums of the medoid are computed in two tiers: on the first leading coordinates, then on the rest of the rows
+        // only for the nodes that the first tier does not rule out. Euclidean (L2 and MIPS) graphs of float values only.
+        // Drops the PQ/SQ codes and the sketches. The rotation is stored with the index.
+        void applyPCA(int leading);
+
+        // Return the PCA rotation of the values (nullptr if not applied)
+        const PCARotation* getPCA() const { return this->_pca.get(); }
+
+        // Makes room for n_nodes nodes with values of dimension dim, so that creating them does not reallocate (e.g. before streaming a dataset in)
+        void reserve(int n_nodes, int dim){
+            this->vectors.setDimension((this->_metric == METRIC_MIPS) ? dim + 1 : dim);
+            this->vectors.reserve(n_nodes);
+            this->nodes.reserve(n_nodes);
+            this->Nout.reserve(n_nodes, this->Nout.width());
+        }
 
         // Creates a node, adds it in the graph and returns it
         Id createNode(const T& value, int category = -1);
 
-        // Adds a directed edge (from->to). Updates outNeighbors(from) and inNeighbors(to)
-        bool addEdge(const Id from, const Id to, optional<bool> noLock = nullopt);
+        // Creates a node from dim raw values (copied into the vector store and transformed for the metric), adds it in the graph and returns it
+        Id createNode(const Elem* value, int dim, int category = -1);
+
+        // Adds a directed edge (from->to). Updates outNeighbors(from) and inNeighbors(to).
+        // The edge counts are not synchronized: threads that modify the edges at once use the node locks and replace()/append() of the
+        // adjacency store instead (see _thread_Vamana_fn), or serialize their calls (see _thread_Rgraph_fn).
+        bool addEdge(const Id from, const Id to);
 
         // Remove edge
-        bool removeEdge(const Id from, const Id to, optional<bool> noLock = nullopt);
+        bool removeEdge(const Id from, const Id to);
 
         // Clears all neighbors for a specific node
         bool clearNeighbors(const Id id);
@@ -241,24 +566,58 @@ class DirectedGraph{
         // implements filtered medoid function using serial programming.
         const unordered_map<int, Id> _filtered_medoid(float threshold);
 
+        // Computes the distances from the padded row xq to the values of the n nodes ids[0..n) into out[0..n), in batches (see distanceBatchRows)
+        void distanceBatch(const Elem* xq, const Id* ids, int n, float* out);
+
+        // Same as distanceBatch, except that out[i] is only exact if it is at most bounds[i]: otherwise it is some value greater than bounds[i].
+        // With args.earlyAbandon, the computation of a distance stops once it exceeds its bound (see distanceBoundedRows), otherwise every distance is exact.
+        void distanceBounded(const Elem* xq, const Id* ids, int n, const float* bounds, float* out);
+
         // returns the Id of the node in nodeSet which is closest to the point t, using the distance function provided
         Id _myArgMin(const unordered_set<Id>& nodeSet, T t);
 
+        // returns the Id of the node in nodeSet which is closest to the padded row t
+        Id _myArgMin(const unordered_set<Id>& nodeSet, const Elem* t);
+
         // returns a set with the Ids of the N nodes in set S which are closest to point X
         unordered_set<Id> _closestN(int N, const unordered_set<Id>& S, T X);
 
+        // returns a set with the Ids of the N nodes in set S which are closest to the padded row X
+        unordered_set<Id> _closestN(int N, const unordered_set<Id>& S, const Elem* X);
+
         // Returns a filtered set
         unordered_set<Id> filterSet(unordered_set<Id> S, int filter);
 
+        // Returns the out-neighbors of node p that are not in V and belong to the category filter (all categories for filter = -1)
+        unordered_set<Id> _filteredNeighbors(Id p, const unordered_set<Id>& V, int filter);
+
         // creates a random R graph with the existing nodes. Return TRUE if successful, FALSE otherwise
         bool Rgraph(int R);
 
         // Greedily searches the graph for the k nearest neighbors of query xq (in an area of size L), starting the search from the node s.
         // Returns a set with the k closest neighbors (returned.first) and a set of all visited nodes (returned.second).
-        const pair<unordered_set<Id>, unordered_set<Id>> greedySearch(Id s, T xq, int k, int L);
+        const pair<unordered_set<Id>, unordered_set<Id>> greedySearch(Id s, const T& xq, int k, int L);
 
         // Returns a set with the k closest neighbors (returned.first) and a set of all visited nodes (returned.second).
-        const pair<unordered_set<Id>, unordered_set<Id>> filteredGreedySearch(Id s, Query<T> q, int k, int L);
+        const pair<unordered_set<Id>, unordered_set<Id>> filteredGreedySearch(Id s, const Query<T>& q, int k, int L);
+
+        // Same as greedySearch, returns the k closest neighbors with their distances from xq, by increasing distance
+        // (the distances of the distance function of the graph, approximate on codes that are not re-ranked)
+        vector<pair<Id, float>> greedySearchRanked(Id s, const T& xq, int k, int L);
+
+        // Same as filteredGreedySearch, returns the k closest neighbors with their distances from the query, by increasing distance
+        vector<pair<Id, float>> filteredGreedySearchRanked(Id s, const Query<T>& q, int k, int L);
+
+        // Greedy Search from s for the k nearest neighbors of the query xq (dim values), on the search context ctx: ctx.results gets the k closest
+        // nodes and their distances by increasing distance, and ctx.expanded the visited nodes. A category >= 0 restricts the search to the nodes of that category.
+        // Once ctx has grown to the graph and the query sizes, a search allocates nothing (see SearchContext).
+        void search(Id s, const Elem* xq, int dim, int k, int L, SearchContext& ctx, int category = -1);
+
+        // Greedy Searches of the n queries xq[b] (dim values each) from the nodes s[b], restricted to the categories categories[b] >= 0
+        // (nullptr: unfiltered), all at once on the batch context: the searches advance one hop each in turn, the rows of the next hop loading while
+        // the distances of the current one are computed, and they share one visited table. batch.results gets the k closest nodes of every query.
+        // Runs no synchronization with index modifications (see freeze). The results are the ones of search.
+        void searchBatch(const Id* s, const Elem* const* xq, const int* categories, int n, int dim, int k, int L, BatchSearchContext& batch);
 
         // Prunes out-neighbors of node p up until a minimum threshold R of out-neighbors for node p, based on distance criteria with parameter a.
         void robustPrune(Id p, unordered_set<Id> V, float a, int R);
@@ -280,23 +639,36 @@ class DirectedGraph{
         // Performs the stitched vamana algorithm to create the filtered index
         bool stitchedVamanaAlgorithm(int L, int Rstitched, int Rsmall, float a);
 
-        // Stores the current state of a graph into the specified file.
-        // IMPORTANT: makes use of overloaded << operator to store the graph into a file.
+        // Stores the current state of a graph into the specified file, in the binary index format (see index_io.hpp).
         void store(const string& filename) const;
 
-        // Loads a graph state from the specified file. A Graph instance must already be instantiated with the appropriate distance and isEmpty functions.
-        // IMPORTANT: makes use of overloaded >> operator to load the graph from a file
-        void load(const string& filename);
+        // Stores the current state of a graph into the specified file, in the legacy text format.
+        // IMPORTANT: makes use of overloaded << operator to store the graph into a file.
+        void storeText(const string& filename) const;
+
+        // Loads a graph state from the specified file (binary or legacy text format). A Graph instance must already be instantiated with the appropriate distance and isEmpty functions.
+        // If mapped (default: args.mmapIndex), a binary index is memory-mapped and used in place (read-only vectors).
+        // IMPORTANT: the text format makes use of overloaded >> operator to load the graph from a file
+        void load(const string& filename, optional<bool> mapped = nullopt);
 
         // Initializes the Graph to its initial default state (apart from distance and isEmpty functions)
         void init();
 
 
         // Based on the qiven vector, the function returns the query's neighbors
-        unordered_set<Id> findNeighbors(Query<T> q);
+        unordered_set<Id> findNeighbors(const Query<T>& q);
+
+        // Finds the neighbors of a query on the search context ctx (into ctx.results, see search)
+        void findNeighbors(const Query<T>& q, SearchContext& ctx);
+
+        // Returns the query's neighbors with their distances from the query, by increasing distance
+        vector<pair<Id, float>> findNeighborsRanked(const Query<T>& q);
 
         // Returns the neighbors of all queries found in the given queries_path file.
         // If the file is .vecs format read_arg corresponds to the number of queries and, if the file is in .bin format, it corresponds to the dimension of the query vector
         vector<unordered_set<Id>> findQueriesNeighbors(vector<Query<T>> queries);
 
+        // Same as findQueriesNeighbors, returns the neighbors of every query with their distances, by increasing distance
+        vector<vector<pair<Id, float>>> findQueriesNeighborsRanked(vector<Query<T>> queries);
+
 };
\ No newline at end of file
@@ -25,9 +25,14 @@
 #include <mutex>
 #include <condition_variable>
 #include <immintrin.h>  // compiler intrinsics for SIMD optimization
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "assert.h"
 
 #include "config.hpp"
+#include "distance.hpp"
 
 using namespace std;
 
@@ -123,53 +128,41 @@ float euclideanDistance(const T& t1, const T& t2){
     // return sqrt(sum);    // because we only care about comparisons, sqrt is not needed [x1 < x2 <=> sqrt(x1) < sqrt(x2), ∀ x1,x2 > 0]
 }
 
-// euclidean distance leveraging SIMD parallelism using 256bit registers, specifically for float vectors of dimension 100 or 128 (exactly).
-float simd_euclideanDistance(const vector<float>& t1, const vector<float>& t2){
+// calculates the euclidean distance between two rows of dimension dim given as raw pointers (e.g. rows of a VectorStore).
+template <typename E>
+float row_euclideanDistance(const E* t1, const E* t2, int dim){
 
-    int dim = t1.size();
-    
-    if (dim != t2.size()){ throw invalid_argument("Dimension Mismatch between Arguments"); }
-    if (dim != 100 && dim != 128){ throw invalid_argument("Argument Containers are not of 100 or 128 dimensions"); }
-
-    __m256 sum = _mm256_setzero_ps();   // initialize a 256-bit register to zero value
-
-    if (dim == 128){
-        for (int i = 0; i < 128; i += 8){
-            // std::vector stores data sequentially, but it is not guaranteed that the memory is aligned in 32-bit segments. Therefore we can leverage pointer memory access, but in an unaligned fashion (loadu)
-            __m256 vec1 = _mm256_loadu_ps(&t1[i]);   // load (unaligned) packed single precision (= float) value into a 256-bit register
-            __m256 vec2 = _mm256_loadu_ps(&t2[i]);   // load (unaligned) packed single precision (= float) value into a 256-bit register
-            __m256 diff = _mm256_sub_ps(vec1, vec2); // subtract values using 256-bit register operations
-            sum = _mm256_fmadd_ps(diff, diff, sum);  // fused multiply-add operation: multiply diff*diff and add with sum. returns sum = diff*diff + sum
-        }
-        float results[8];
-        _mm256_storeu_ps(results, sum); // store the results of the 256-register to 8 float variables.
+    float sum = 0.0f;
 
-        return results[0] + results[1] + results[2] + results[3] + results[4] + results[5] + results[6] + results[7];   // sum up the values and return
+    for (int i = 0; i < dim; i++){
+        float diff = (float) t1[i] - (float) t2[i];
+        sum += diff * diff;
     }
 
-    // Case dim == 100
+    return sum;
+}
 
-    for (int i = 0; i < 96; i += 8){ 
-        // std::vector stores data sequentially, but it is not guaranteed that the memory is aligned in 32-bit segments. Therefore we can leverage pointer memory access, but in an unaligned fashion (loadu)
-        __m256 vec1 = _mm256_loadu_ps(&t1[i]);   // load (unaligned) packed single precision (= float) value into a 256-bit register
-        __m256 vec2 = _mm256_loadu_ps(&t2[i]);   // load (unaligned) packed single precision (= float) value into a 256-bit register
-        __m256 diff = _mm256_sub_ps(vec1, vec2); // subtract values using 256-bit register operations
-        sum = _mm256_fmadd_ps(diff, diff, sum);  // fused multiply-add operation: multiply diff*diff and add with sum. returns diff*diff + sum
-    }
-    float results[8], result;
-    _mm256_storeu_ps(results, sum); // store the results of the 256-register to 8 float variables.
-
-    result = results[0] + results[1] + results[2] + results[3] + results[4] + results[5] + results[6] + results[7];   // sum up the values and return
-
-    // handle remaining 4 values using an 128-bit register
-    __m128 rem1 = _mm_loadu_ps(&t1[96]);
-    __m128 rem2 = _mm_loadu_ps(&t2[96]);
-    __m128 diff_rem = _mm_sub_ps(rem1, rem2);
-    __m128 sq_diff_rem = _mm_mul_ps(diff_rem, diff_rem);
-    float result_rem[4];
-    _mm_store_ps(result_rem, sq_diff_rem);
-    
-    return result + result_rem[0] + result_rem[1] + result_rem[2] + result_rem[3];
+// calculates the inner product of two rows of dimension dim given as raw pointers
+template <typename E>
+float row_innerProduct(const E* t1, const E* t2, int dim){
+
+    float sum = 0.0f;
+
+    for (int i = 0; i < dim; i++)
+        sum += (float) t1[i] * (float) t2[i];
+
+    return sum;
+}
+
+// Scales a row of dimension dim to unit length, in place (rows of zeros are left as they are)
+template <typename E>
+void normalizeRow(E* row, int dim){
+
+    float norm = sqrt(row_innerProduct(row, row, dim));
+    if (norm == 0.0f) { return; }
+
+    for (int i = 0; i < dim; i++)
+        row[i] /= norm;
 }
 
 // Wrapper function that checks for existence of element in the set
@@ -272,62 +265,153 @@ vector<T> permutation(const vector<T>& s) {
     return vec;
 }
 
-// Returns a vector of vectors from specified .<f|i|b>vecs file
-template <typename T>
-vector<vector<T>> read_vecs(string file_path, int n_vec){
+// returns the random permutation of the elements of s drawn from seed (the same permutation for the same seed)
+template<typename T>
+vector<T> permutation(const vector<T>& s, uint32_t seed) {
+    vector<T> vec(s.begin(), s.end());
 
-    // Open file in binary mode
-    ifstream file(file_path, ios::binary);
+    mt19937 rng(seed);
+    shuffle(vec.begin(), vec.end(), rng);
 
-    // To be returned
-    vector<vector<T>> vectors;
+    return vec;
+}
 
-    if (!file.is_open()) {
-        cerr << "Error opening file: " << file_path << '\n';
-        return vectors; // empty
-    }
+// Read-only memory mapping of a whole file. The mapping is released when the object is destroyed.
+class MappedFile{
 
-    int dim,cnt=0, vec_size;
-    char *dim_buffer, *vec_buffer;
-    // Read file
-    for (int i = 0; i<n_vec && !file.eof(); i++) {
+    private:
+        void* _data;
+        size_t _bytes;
 
-        dim_buffer = (char*) malloc(sizeof(T));
+    public:
+        MappedFile() : _data(nullptr), _bytes(0) {}
 
-        // Read dimension (4 - int)
-        file.read(dim_buffer, 4);
-        
-        memcpy(&dim, dim_buffer, 4);
+        // Maps the whole file (read-only, shared with other processes through the page cache)
+        MappedFile(const string& filename) : MappedFile() {
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0){ throw invalid_argument("Could not open file: " + filename + "\n"); }
 
-        if (dim > 0){
-            cnt++;
-            vec_size = dim * sizeof(T);
-            // Allocate memory for vec_buffer
-            vec_buffer = (char*) malloc(vec_size);
+            struct stat st;
+            if (fstat(fd, &st) != 0){ close(fd); throw invalid_argument("Could not open file: " + filename + "\n"); }
+            this->_bytes = st.st_size;
 
-            // Create vector with correct dimension
-            vector<T> vec(dim);
+            if (this->_bytes > 0){
+                this->_data = mmap(nullptr, this->_bytes, PROT_READ, MAP_SHARED, fd, 0);
+                if (this->_data == MAP_FAILED){ this->_data = nullptr; close(fd); throw invalid_argument("Could not map file: " + filename + "\n"); }
+            }
+            close(fd);  // the mapping stays valid after closing the descriptor
+        }
 
-            // Read vector and assign values to it (d*sizeof(T) - 4 | 4 | 1 for T: float | int | char)
-            file.read(vec_buffer, vec_size);
+        ~MappedFile() { if (this->_data != nullptr) munmap(this->_data, this->_bytes); }
 
-            memcpy(vec.data(), vec_buffer, vec_size);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
 
-            // Add vector to vectors
-            vectors.push_back(vec);
+        const char* data() const { return (const char*) this->_data; }
+        size_t size() const { return this->_bytes; }
+
+        // Hints the kernel that the mapping will be read front to back (aggressive read-ahead, early reclaim of read pages)
+        void adviseSequential() const { if (this->_data != nullptr) madvise(this->_data, this->_bytes, MADV_SEQUENTIAL); }
+};
+
+// Returns true if str ends with suffix (e.g. a file extension)
+bool endsWith(const string& str, const string& suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
 
+// Row-by-row, zero-copy view over a memory-mapped dataset file. Rows are read in place: no per-row allocation, no intermediate containers.
+// Supported layouts (elements of type E):
+//   .bin                 uint32 N, followed by N rows of bin_dim elements           (construct with bin_dim > 0)
+//   .<f|i|b>vecs         every row is an int32 dimension followed by that many elements (construct with bin_dim <= 0). All rows must have the same dimension.
+//   .<f|u8|i8>bin        uint32 N and uint32 dim, followed by N rows of dim elements (big-ann-benchmarks format, construct with bin_dim <= 0)
+// At most n_max rows are exposed (n_max < 0: all rows of the file).
+template <typename E>
+class DatasetReader{
+
+    private:
+        MappedFile _file;
+        const char* _first;     // first element of the first row
+        size_t _stride;         // bytes from one row to the next
+        int _n_rows;
+        int _dim;
+
+    public:
+        DatasetReader(const string& file_path, int bin_dim = -1, int n_max = -1) : _file(file_path), _first(nullptr), _stride(0), _n_rows(0), _dim(0) {
+
+            this->_file.adviseSequential();
+            const char* data = this->_file.data();
+            size_t bytes = this->_file.size();
+
+            if (bin_dim <= 0 && (endsWith(file_path, ".fbin") || endsWith(file_path, ".u8bin") || endsWith(file_path, ".i8bin"))){
+                if (bytes < 2 * sizeof(uint32_t)) { throw invalid_argument("Dataset file is truncated: " + file_path + "\n"); }
+
+                uint32_t header[2];     // N, dim
+                memcpy(header, data, sizeof(header));
+                if (header[1] == 0) { throw invalid_argument("Invalid dimension in dataset file: " + file_path + "\n"); }
+
+                this->_dim = header[1];
+                this->_stride = (size_t) this->_dim * sizeof(E);
+                this->_first = data + sizeof(header);
+                this->_n_rows = min((size_t) header[0], (bytes - sizeof(header)) / this->_stride);    // only complete rows
+            }
+            else if (bin_dim > 0){
+                if (bytes < sizeof(uint32_t)) { throw invalid_argument("Dataset file is truncated: " + file_path + "\n"); }
+
+                uint32_t N;
+                memcpy(&N, data, sizeof(uint32_t));
+                this->_dim = bin_dim;
+                this->_stride = (size_t) bin_dim * sizeof(E);
+                this->_first = data + sizeof(uint32_t);
+                this->_n_rows = min((size_t) N, (bytes - sizeof(uint32_t)) / this->_stride);    // only complete rows
+            }
+            else if (bytes >= sizeof(int32_t)){
+                int32_t dim;
+                memcpy(&dim, data, sizeof(int32_t));
+                if (dim <= 0) { throw invalid_argument("Invalid dimension in dataset file: " + file_path + "\n"); }
+
+                this->_dim = dim;
+                this->_stride = sizeof(int32_t) + (size_t) dim * sizeof(E);
+                this->_first = data + sizeof(int32_t);
+                this->_n_rows = bytes / this->_stride;
+
+                for (int i = 0; i < this->_n_rows && (n_max < 0 || i < n_max); i++){
+                    memcpy(&dim, this->_first + i * this->_stride - sizeof(int32_t), sizeof(int32_t));
+                    if (dim != this->_dim) { throw invalid_argument("Inconsistent dimensions in dataset file: " + file_path + "\n"); }
+                }
+            }
+
+            if (n_max >= 0) this->_n_rows = min(this->_n_rows, n_max);
         }
-        if (dim_buffer != NULL)
-            free(dim_buffer);
-        if (vec_buffer != NULL)
-            free(vec_buffer);
-        dim = 0;
+
+        int size() const { return this->_n_rows; }
+        int dim() const { return this->_dim; }
+
+        // Returns a pointer to the dim() elements of row i, inside the mapping (valid while the reader exists)
+        const E* row(int i) const { return (const E*) (this->_first + i * this->_stride); }
+};
+
+// Returns a vector of vectors from specified .<f|i|b>vecs or .<f|u8|i8>bin file
+template <typename T>
+vector<vector<T>> read_vecs(string file_path, int n_vec){
+
+    // To be returned
+    vector<vector<T>> vectors;
+
+    struct stat st;
+    if (stat(file_path.c_str(), &st) != 0) {
+        cerr << "Error opening file: " << file_path << '\n';
+        return vectors; // empty
     }
 
-    c_log << "Total vectors read: " << cnt << '\n';
+    // Read file (one allocation per vector, copied straight from the mapped file)
+    DatasetReader<T> reader(file_path, -1, n_vec);
+    vectors.reserve(reader.size());
+    for (int i = 0; i < reader.size(); i++){
+        vectors.emplace_back(reader.row(i), reader.row(i) + reader.dim());
+    }
 
-    // Close the file
-    file.close();
+    c_log << "Total vectors read: " << reader.size() << '\n';
 
     c_log << file_path << " read successfully, returning vectors." << '\n';
     return vectors;
@@ -355,27 +439,17 @@ void SaveKNN(const std::vector<std::vector<uint32_t>> &knns,
 /// @brief Reading binary data vectors. Raw data store as a (N x dim)
 /// @param file_path file path of binary data
 /// @param data returned 2D data vectors
+/// To ingest a dataset without materializing it, iterate over a DatasetReader instead.
 void ReadBin(const std::string &file_path,
              const int num_dimensions,
              std::vector<std::vector<float>> &data) {
   c_log << "Reading Data: " << file_path << '\n';
-  std::ifstream ifs;
-  ifs.open(file_path, std::ios::binary);
-  assert(ifs.is_open());
-  uint32_t N;  // num of points
-  ifs.read((char *)&N, sizeof(uint32_t));
-  data.resize(N);
-  c_log << "# of points: " << N << '\n';
-  std::vector<float> buff(num_dimensions);
-  int counter = 0;
-  while (ifs.read((char *)buff.data(), num_dimensions * sizeof(float))) {
-    std::vector<float> row(num_dimensions);
-    for (int d = 0; d < num_dimensions; d++) {
-      row[d] = static_cast<float>(buff[d]);
-    }
-    data[counter++] = std::move(row);
+  DatasetReader<float> reader(file_path, num_dimensions);
+  data.resize(reader.size());
+  c_log << "# of points: " << reader.size() << '\n';
+  for (int i = 0; i < reader.size(); i++) {
+    data[i].assign(reader.row(i), reader.row(i) + num_dimensions);
   }
-  ifs.close();
   c_log << "Finished Reading Data\n";
 }
 
@@ -415,6 +489,19 @@ float k_recall(const Container1& c1, const Container2& c2){
     return (float) cnt / c1.size();
 }
 
+// Same as k_recall, for ranked results (ids and their distances)
+template <typename I, typename Container2>
+float k_recall(const vector<pair<I, float>>& ranked, const Container2& c2){
+
+    if (ranked.empty()) { return 0.0f; }
+
+    int cnt = 0;
+    for (const pair<I, float>& r : ranked){
+        if (find(c2.begin(), c2.end(), r.first) != c2.end()) { cnt++; }
+    }
+    return (float) cnt / ranked.size();
+}
+
 // Measures the time it takes for the given function to run. Absorbs any function returns.
 // See use example in implementation.
 template <typename Func, typename ...Args>
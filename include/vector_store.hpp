@@ -0,0 +1,227 @@
+#pragma once
+
+#include "util.hpp"
+
+using namespace std;
+
+// This file implements the VectorStore class template, the storage engine for the values of the nodes of a DirectedGraph.
+//
+// All values are kept in a single row-major buffer instead of one heap allocation per node: row i holds the value of the node with row index i.
+// Every row starts on a VECTOR_ALIGNMENT-byte boundary and is zero-padded up to paddedDim() elements, so SIMD kernels can use aligned loads
+// and process whole registers without any tail handling (the zero padding contributes nothing to the distances).
+// A store can also be attached to external, read-only memory laid out the same way (e.g. a memory-mapped index file, see attach()).
+
+constexpr size_t VECTOR_ALIGNMENT = 64;     // bytes. Cache line size, satisfies both 256-bit and 512-bit aligned loads
+
+
+// Allocates an uninitialized VECTOR_ALIGNMENT-byte aligned buffer of n elements. Returns nullptr for n = 0.
+template <typename E>
+E* alignedAlloc(size_t n){
+
+    if (n == 0) { return nullptr; }
+
+    size_t bytes = n * sizeof(E);
+    bytes = ((bytes + VECTOR_ALIGNMENT - 1) / VECTOR_ALIGNMENT) * VECTOR_ALIGNMENT;    // aligned_alloc requires a multiple of the alignment
+
+    E* ptr = (E*) aligned_alloc(VECTOR_ALIGNMENT, bytes);
+    if (ptr == nullptr) { throw bad_alloc(); }
+
+    return ptr;
+}
+
+
+// Aligned heap buffer holding a single zero-padded row outside of a VectorStore (e.g. a query), so that it can be passed to the row distance kernels.
+template <typename E>
+class AlignedRow{
+
+    private:
+        E* _data;
+        int _size;
+
+    public:
+
+        // Constructor: allocates a zero-filled row of size elements
+        AlignedRow(int size = 0) : _data(alignedAlloc<E>(size)), _size(size) {
+            if (size > 0) memset(this->_data, 0, size * sizeof(E));
+        }
+
+        ~AlignedRow() { free(this->_data); }
+
+        AlignedRow(const AlignedRow&) = delete;
+        AlignedRow& operator=(const AlignedRow&) = delete;
+
+        AlignedRow(AlignedRow&& other) noexcept : _data(other._data), _size(other._size) { other._data = nullptr; other._size = 0; }
+
+        AlignedRow& operator=(AlignedRow&& other) noexcept {
+            if (this != &other){
+                free(this->_data);
+                this->_data = other._data;
+                this->_size = other._size;
+                other._data = nullptr;
+                other._size = 0;
+            }
+            return *this;
+        }
+
+        E* data() { return this->_data; }
+        const E* data() const { return this->_data; }
+        int size() const { return this->_size; }
+};
+
+
+// Contiguous, aligned, dimension-padded row-major arena of vectors with elements of type E.
+template <typename E>
+class VectorStore{
+
+    private:
+        E* _data;               // aligned row-major buffer of _capacity * _padded_dim elements
+        int _dim;               // dimension of the stored values (0 while no dimension has been set)
+        int _padded_dim;        // _dim rounded up so that each row occupies a multiple of VECTOR_ALIGNMENT bytes
+        int _n_rows;            // number of rows in use
+        int _capacity;          // number of rows that fit in the buffer without reallocating
+        bool _attached;         // true if _data is external read-only memory (not owned, never modified)
+
+        // Moves the rows into a new buffer able to hold capacity rows
+        void _reallocate(int capacity){
+            this->_checkWritable();
+            E* data = alignedAlloc<E>((size_t) capacity * this->_padded_dim);
+            if (this->_n_rows > 0) memcpy(data, this->_data, (size_t) this->_n_rows * this->_padded_dim * sizeof(E));
+            free(this->_data);
+            this->_data = data;
+            this->_capacity = capacity;
+        }
+
+        void _checkWritable() const {
+            if (this->_attached) { throw invalid_argument("Cannot modify a read-only vector store.\n"); }
+        }
+
+        // Releases the buffer (if owned)
+        void _release(){
+            if (!this->_attached) free(this->_data);
+            this->_data = nullptr;
+            this->_attached = false;
+        }
+
+    public:
+
+        // Constructor: Initialize an empty store. The dimension is fixed by the first appended row (or by setDimension)
+        VectorStore() : _data(nullptr), _dim(0), _padded_dim(0), _n_rows(0), _capacity(0), _attached(false) {}
+
+        ~VectorStore() { this->_release(); }
+
+        VectorStore(const VectorStore&) = delete;
+        VectorStore& operator=(const VectorStore&) = delete;
+
+        // Rounds dim up so that a row of dim elements of type E occupies a multiple of VECTOR_ALIGNMENT bytes
+        static int padDimension(int dim){
+            const int per_block = VECTOR_ALIGNMENT / sizeof(E);
+            return ((dim + per_block - 1) / per_block) * per_block;
+        }
+
+        int dim() const { return this->_dim; }
+        int paddedDim() const { return this->_padded_dim; }
+        int size() const { return this->_n_rows; }
+        int capacity() const { return this->_capacity; }
+        bool empty() const { return this->_n_rows == 0; }
+        bool readOnly() const { return this->_attached; }
+
+        // Total number of bytes held by the buffer
+        size_t bytes() const { return (size_t) this->_capacity * this->_padded_dim * sizeof(E); }
+
+        // Returns a pointer to the (aligned, zero-padded) row i. Rows of an attached store must not be written.
+        const E* row(int i) const { return this->_data + (size_t) i * this->_padded_dim; }
+        E* row(int i) { return this->_data + (size_t) i * this->_padded_dim; }
+
+        // Serves n_rows rows of dimension dim in place from external memory (not copied, not owned, never modified).
+        // data must be VECTOR_ALIGNMENT-byte aligned and laid out like this store: rows of padDimension(dim) elements, zero-padded.
+        // The memory must outlive the store (or the next clear()).
+        void attach(const E* data, int dim, int n_rows){
+
+            if (dim <= 0 && n_rows > 0) { throw invalid_argument("Dimension must be a positive integer.\n"); }
+
+            if ((uintptr_t) data % VECTOR_ALIGNMENT != 0) { throw invalid_argument("Attached rows must be aligned.\n"); }
+
+            this->clear();
+            this->_data = const_cast<E*>(data);
+            this->_attached = true;
+            this->_dim = dim;
+            this->_padded_dim = padDimension(dim);
+            this->_n_rows = n_rows;
+            this->_capacity = n_rows;
+        }
+
+        // Fixes the dimension of the rows. Only allowed while the store is empty.
+        void setDimension(int dim){
+
+            if (dim <= 0) { throw invalid_argument("Dimension must be a positive integer.\n"); }
+
+            if (this->_n_rows != 0 && dim != this->_dim) { throw invalid_argument("Cannot change the dimension of a non-empty store.\n"); }
+
+            if (dim == this->_dim) { return; }
+
+            this->_release();
+            this->_capacity = 0;
+            this->_dim = dim;
+            this->_padded_dim = padDimension(dim);
+        }
+
+        // Reserves space for n_rows rows to avoid reallocations while appending. The dimension must already be set.
+        void reserve(int n_rows){
+            if (this->_dim == 0) { throw invalid_argument("Cannot reserve rows before the dimension is set.\n"); }
+            if (n_rows > this->_capacity) this->_reallocate(n_rows);
+        }
+
+        // Sets the number of rows to n_rows, zero-filling the new rows (to be filled in place through row(i)). The dimension must already be set.
+        void resize(int n_rows){
+            this->_checkWritable();
+            if (this->_dim == 0) { throw invalid_argument("Cannot resize the store before the dimension is set.\n"); }
+            if (n_rows > this->_capacity) this->_reallocate(n_rows);
+            if (n_rows > this->_n_rows)
+                memset(this->row(this->_n_rows), 0, (size_t) (n_rows - this->_n_rows) * this->_padded_dim * sizeof(E));
+            this->_n_rows = n_rows;
+        }
+
+        // Copies dim values into a new zero-padded row and returns its row index
+        int append(const E* values, int dim){
+
+            this->_checkWritable();
+
+            if (this->_dim == 0) this->setDimension(dim);
+
+            if (dim != this->_dim) { throw invalid_argument("Dimension Mismatch between Arguments"); }
+
+            if (this->_n_rows == this->_capacity)
+                this->_reallocate(max(16, 2 * this->_capacity));     // amortized O(1) appends
+
+            E* dst = this->_data + (size_t) this->_n_rows * this->_padded_dim;
+            memcpy(dst, values, dim * sizeof(E));
+            memset(dst + dim, 0, (this->_padded_dim - dim) * sizeof(E));
+
+            return this->_n_rows++;
+        }
+
+        // Copies a value of dimension dim() into out, zero-padding it up to paddedDim(). out must hold paddedDim() elements.
+        void pad(const E* values, E* out) const {
+            memcpy(out, values, this->_dim * sizeof(E));
+            memset(out + this->_dim, 0, (this->_padded_dim - this->_dim) * sizeof(E));
+        }
+
+        // Releases all rows (or detaches from external memory) and resets the dimension
+        void clear(){
+            this->_release();
+            this->_dim = 0;
+            this->_padded_dim = 0;
+            this->_n_rows = 0;
+            this->_capacity = 0;
+        }
+
+        // Exchanges the rows (owned or attached) of two stores
+        void swap(VectorStore& other) noexcept {
+            std::swap(this->_data, other._data);
+            std::swap(this->_dim, other._dim);
+            std::swap(this->_padded_dim, other._padded_dim);
+            std::swap(this->_n_rows, other._n_rows);
+            std::swap(this->_capacity, other._capacity);
+            std::swap(this->_attached, other._attached);
+        }
+};
@@ -0,0 +1,20 @@
+# Thread scaling of the Vamana index creation on the 1m contest data (no queries): one run per number of threads, for the build that
+# inserts one node at a time and for the batch build (same seed on every number of threads: the same graph).
+# No extra random edges: the batch build skips them, and both builds are compared on the same graph parameters
+vamana_args="--vamana -data data/contest-data-release-1m.bin -queries data/contest-queries-release-1m.bin -groundtruth data/contest-groundtruth-custom-1m.txt -dim_data 102 -dim_query 104 -n_data 1000000 -n_queries 10000 -n_groundtruths 10000 --stat --only_unfiltered -distance 1 --no_rgraph --no_query"
+
+n_threads=(1 2 4 8 16 32 64)
+
+main_exe="./bin/main"
+
+mkdir -p evaluations/scaling
+
+for threads in "${n_threads[@]}"; do
+    args="$vamana_args -n_threads $threads"
+    echo "Vamana-1m-${threads} $main_exe $args"
+    $main_exe $args > "evaluations/scaling/Vamana-1m-${threads}.txt"
+
+    args="$vamana_args -n_threads $threads --batch_build -seed 1"
+    echo "Vamana-batch-1m-${threads} $main_exe $args"
+    $main_exe $args > "evaluations/scaling/Vamana-batch-1m-${threads}.txt"
+done
@@ -0,0 +1,33 @@
+#include "interface.hpp"
+
+using namespace std;
+
+// Converts a stored index (e.g. under storedIndices/) between the legacy text format and the binary index format.
+// The input format is detected automatically. The output is written in the binary format, or in the text format if --text is given.
+int main (int argc, char* argv[]) {
+
+    // program_name input_index output_index [--text]
+    if (argc < 3){
+        cerr << "Usage: " << argv[0] << " input_index output_index [--text]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    string input_path = argv[1];
+    string output_path = argv[2];
+    bool to_text = (argc > 3 && string(argv[3]) == "--text");
+
+    args.n_threads = max(1u, thread::hardware_concurrency());  // chunked parallel I/O
+
+    // the distance function is not part of the stored index
+    DirectedGraph<vector<float>> DG(row_euclideanDistance<float>, vectorEmpty<float>);
+
+    DG.load(input_path);
+    cout << "Index loaded successfully from: " << input_path << " (" << DG.get_n_nodes() << " nodes, " << DG.get_n_edges() << " edges)" << endl;
+
+    if (to_text) DG.storeText(output_path);
+    else DG.store(output_path);
+
+    cout << "Index stored successfully at: " << output_path << (to_text ? " (text format)" : " (binary format)") << endl;
+
+    return 0;
+}
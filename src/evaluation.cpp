@@ -10,6 +10,51 @@ void benchmark_euclidean(function<float(T,T)> d ,vector<T> vectors){
     }
 }
 
+// Neighbor expansion: distances from a query to R random neighbors, per pair (one kernel call per row) or in one batch (DirectedGraph::distanceBatch)
+template <typename Distance>
+void benchmark_distanceBatch(DirectedGraph<vector<float>, Distance>& DG, Distance d, vector<vector<Id>> neighbor_lists, const float* xq, bool batched){
+
+    int dim = DG.getVectors().dim();
+    vector<float> out(DISTANCE_BATCH_SIZE);
+    volatile float sink = 0.0f;
+
+    for (const vector<Id>& neighbors : neighbor_lists){
+        if (batched){
+            DG.distanceBatch(xq, neighbors.data(), neighbors.size(), out.data());
+        }
+        else{
+            for (int i = 0; i < neighbors.size(); i++) out[i] = d(DG.getRow(neighbors[i]), xq, dim);
+        }
+        sink = sink + out[0];
+    }
+}
+
+template <typename Distance>
+void compare_distanceBatch(Distance d, int n_nodes, int dim, int R, int n_lists){
+
+    mt19937 rng(42);
+    uniform_real_distribution<float> value(0.0f, 1.0f);
+    uniform_int_distribution<int> node(0, n_nodes - 1);
+
+    DirectedGraph<vector<float>, Distance> DG(d, vectorEmpty<float>);
+    DG.reserve(n_nodes, dim);
+    vector<float> v(dim);
+    for (int i = 0; i < n_nodes; i++){
+        for (float& x : v) x = value(rng);
+        DG.createNode(v);
+    }
+
+    vector<vector<Id>> neighbor_lists(n_lists, vector<Id>(R));
+    for (vector<Id>& neighbors : neighbor_lists)
+        for (Id& id : neighbors) id = node(rng);
+
+    AlignedRow<float> xq(DG.getVectors().paddedDim());
+    for (int i = 0; i < dim; i++) xq.data()[i] = value(rng);
+
+    cout << "Neighbor expansion, dim " << dim << ", R " << R << ":" << endl;
+    measureTime("Per-pair distances", benchmark_distanceBatch<Distance>, ref(DG), d, neighbor_lists, xq.data(), false);
+    measureTime("Batched distances", benchmark_distanceBatch<Distance>, ref(DG), d, neighbor_lists, xq.data(), true);
+}
 
 // Evaluation Metrics to Consider:
 // Index Creation Time
@@ -63,7 +108,13 @@ int main(int argc, char* argv[]){
     // double parallel_time = measureTime("Parallel Euclidean", benchmark_euclidean<float>, parallel_euclideanDistance<float>, vectors);
     // double parallel_time = measureTime("Parallel Euclidean", benchmark_euclidean<vector<float>>, parallel_euclideanDistance<vector<float>>, vectors);
     double serial_time = measureTime("Serial Euclidean", benchmark_euclidean<vector<float>>, euclideanDistance<vector<float>>, vectors128);
-    double simd_time = measureTime("SIMD Euclidean128", benchmark_euclidean<vector<float>>, simd_euclideanDistance, vectors128);
+    double simd_time = measureTime("SIMD Euclidean", benchmark_euclidean<vector<float>>, simd_euclideanDistance, vectors128);
+
+    // per-pair vs batched distances (random data, 1M nodes: rows are not in cache)
+    for (int dim : {32, 100, 128}){
+        if (simd_level == SIMD_AVX512) compare_distanceBatch(L2Distance<SIMD_AVX512>(), 1000000, dim, 64, 200000);
+        else compare_distanceBatch(L2Distance<SIMD_AVX2>(), 1000000, dim, 64, 200000);
+    }
 
     return 0;
 }
\ No newline at end of file
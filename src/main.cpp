@@ -1,38 +1,45 @@
 #include "interface.hpp"
 using namespace std;
 
-DirectedGraph<vector<float>>* DGptr = nullptr;
+// Prints the query time and the average recall of an evaluation (see evaluateIndex)
+void printResults(const pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>>& results, const string& label){
+    if(args.unfiltered){
+        cout << "Time to query the index (unfiltered)" << label << ": " << FormatMicroseconds(results.first.second) << endl;
+        cout << "Average recall score for unfiltered queries" << label << ": " << results.first.first << endl;
+    }
+    
+    if(args.filtered){
+        cout << "Time to query the index (filtered)" << label << ": " << FormatMicroseconds(results.second.second) << endl;
+        cout << "Average recall score for filtered queries" << label << ": " << results.second.first << endl;
+    }
+}
 
-int main(int argc, char* argv[]) {
+// Trains codes of the values with train() (which returns a description of their memory), evaluates the queries again on them
+// and reports the change of the recall against the full precision results
+template <typename Graph, typename ReadQueries, typename Train>
+void evaluateCodes(Graph& DG, ReadQueries readQueries, const pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>>& results, const string& name, Train train){
+    chrono::high_resolution_clock::time_point startTime = chrono::high_resolution_clock::now();
+    string memory = train();
+    chrono::microseconds duration = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - startTime);
+    cout << "Time to train the " << name << " codes: " << FormatMicroseconds(duration) << endl;
 
-    args.parseArgs(argc,argv);
+    const auto& vectors = DG.getVectors();
+    size_t vector_bytes = (size_t) vectors.size() * vectors.dim() * sizeof(vectors.row(0)[0]);
+    cout << memory << " instead of " << (float) vector_bytes / (1 << 20) << " MiB of vectors" << endl;
 
-    for (int i = 0; i < argc; i++)
-        s_log << argv[i] << ' ';
-    s_log << '\n';
+    pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> code_results = evaluateIndex(DG, readQueries);
+    printResults(code_results, " with " + name);
 
-    args.printArgs();
+    if(args.unfiltered) cout << "Recall change with " << name << " (unfiltered): " << code_results.first.first - results.first.first << endl;
+    if(args.filtered) cout << "Recall change with " << name << " (filtered): " << code_results.second.first - results.second.first << endl;
+}
+
+// Creates (or loads), stores and evaluates the index on a graph with the given distance policy
+template <typename T, typename Distance>
+int runIndex(DirectedGraph<T, Distance>& DG){
+
+    DG.setMetric(args.metric);
 
-    // choose distance function depending on the argument
-    if (args.euclideanType == 0){
-        DGptr = new DirectedGraph<vector<float>>(euclideanDistance<vector<float>>, vectorEmpty<float>);
-    }
-    else if (args.euclideanType == 1){
-        DGptr = new DirectedGraph<vector<float>>(simd_euclideanDistance, vectorEmpty<float>);
-    }
-    else if (args.euclideanType == 2){
-        DGptr = new DirectedGraph<vector<float>>(parallel_euclideanDistance<vector<float>>, vectorEmpty<float>);
-    }
-    else if (args.euclideanType == 3){
-        cout << "In main.cpp, instantiate the DirectedGraph template with your desired datatype after implementing your requirements.\n";
-        c_log << "In main.cpp, instantiate the DirectedGraph template with your desired datatype after implementing your requirements.\n";
-        // DGptr = new DirectedGraph<YOUR_TYPE_HERE>(customDistance<YOUR_TYPE_HERE>, customEmpty<YOUR_TYPE_HERE>);
-    }
-    else { throw invalid_argument("distance must be in {0,1,2,3}. | 0 - euclidean, 1 - simd_euclidean, 2 - parallel euclidean, 3 - custom"); }
-    
-    // dereferencing the pointer (functions were built expecting a reference and not a pointer. Changing them would be too much unnecessary work)
-    DirectedGraph<vector<float>>& DG = *DGptr;
-    
     // Create the indexed graph if instructed from command line arguments, based on indexing type
     if (!args.no_create){
         chrono::microseconds duration;
@@ -42,8 +49,13 @@ int main(int argc, char* argv[]) {
     }
         
     // Load graph if instructed from command line arguments
-    else
+    else{
         DG.load(args.graph_load_path);
+        if (args.sketchBits > 0) DG.enableSketch(args.sketchBits, args.sketchMargin);
+    }
+
+    // the index is only queried from here on: the searches run without synchronization
+    DG.freeze();
 
     c_log << "Index is ready\n";
     // Store graph if instructed from command line arguments
@@ -60,21 +72,124 @@ int main(int argc, char* argv[]) {
     timeinfo = localtime(&time_now);
 
     c_log << "Starting index evaluation on "<< asctime(timeinfo); // https://cplusplus.com/reference/ctime/localtime/, https://cplusplus.com/reference/ctime/time/
-    pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> results = evaluateIndex<vector<float>>(ref(DG), (args.index_type == VAMANA && !endsWith(args.queries_path, ".bin")) ? read_queries_vecs<vector<float>> : read_queries_bin_contest<vector<float>>);
+    function<pair<vector<Query<T>>, vector<Query<T>>>(void)> readQueries = (args.index_type == VAMANA && !endsWith(args.queries_path, ".bin")) ? read_queries_vecs<T> : read_queries_bin_contest<T>;
+    pair<pair<float, chrono::microseconds>, pair<float, chrono::microseconds>> results = evaluateIndex(DG, readQueries);
 
     // print recall and duration
     c_log << "Evaluation Finished.\n";
+    printResults(results, "");
 
-    if(args.unfiltered){
-        cout << "Time to query the index (unfiltered): " << FormatMicroseconds(results.first.second) << endl;
-        cout << "Average recall score for unfiltered queries: " << results.first.first << endl;
+    // Evaluate the queries again on the PQ (or SQ) codes, and report the memory of the codes and the change of the recall
+    if (args.pqSubspaces > 0){
+        evaluateCodes(DG, readQueries, results, "PQ", [&](){
+            DG.trainPQ(args.pqSubspaces);
+            size_t pq_bytes = DG.getPQ()->bytes();
+            return "PQ codes and codebooks: " + to_string((float) pq_bytes / (1 << 20)) + " MiB (" + to_string(args.pqSubspaces) + " bytes per vector)";
+        });
     }
-    
-    if(args.filtered){
-        cout << "Time to query the index (filtered): " << FormatMicroseconds(results.second.second) << endl;
-        cout << "Average recall score for filtered queries: " << results.second.first << endl;
+
+    if (args.sq != SQ_NONE){
+        evaluateCodes(DG, readQueries, results, "SQ", [&](){
+            DG.trainSQ(args.sq, args.sqRerank);
+            const ScalarQuantizer* sq = DG.getSQ();
+            return "SQ codes (" + string(sqName(args.sq)) + (args.sqRerank ? ", re-ranked" : "") + "): " + to_string((float) sq->bytes() / (1 << 20))
+                + " MiB (" + to_string(sq->codeBytes()) + " bytes per vector)";
+        });
+    }
+
+    // the fast-scan estimates replace exact distances of the full precision greedy search only: the codes of the previous evaluations are dropped
+    if (args.fastScanSubspaces > 0){
+        evaluateCodes(DG, readQueries, results, "fast-scan", [&](){
+            DG.dropPQ();
+            DG.dropSQ();
+            DG.buildFastScan(args.fastScanSubspaces, args.fastScanMargin);
+            return "Fast-scan blocks: " + to_string((float) DG.getFastScan()->bytes() / (1 << 20)) + " MiB (" + to_string(args.fastScanSubspaces) + " subspaces of 4 bits)";
+        });
     }
     
-    delete DGptr;
+    return 0;
+}
+
+// Creates the graph with the distance policy of the metric (see Metric in config.hpp), on the kernels of one SIMD family
+template <SimdLevel LEVEL>
+int runMetric(){
+    if (args.metric == METRIC_IP){
+        auto DG = make_unique<DirectedGraph<vector<float>, IPDistance<LEVEL>>>(IPDistance<LEVEL>(), vectorEmpty<float>);
+        return runIndex(*DG);
+    }
+    if (args.metric == METRIC_COSINE){
+        auto DG = make_unique<DirectedGraph<vector<float>, CosineDistance<LEVEL>>>(CosineDistance<LEVEL>(), vectorEmpty<float>);
+        return runIndex(*DG);
+    }
+    // METRIC_L2 and METRIC_MIPS (euclidean distance on the transformed values)
+    auto DG = make_unique<DirectedGraph<vector<float>, L2Distance<LEVEL>>>(L2Distance<LEVEL>(), vectorEmpty<float>);
+    return runIndex(*DG);
+}
+
+// Creates the graph for the element type of the values (see ElementType in config.hpp): 8-bit values are stored as they are,
+// with the integer L2 kernels of one SIMD family. Float values go through the distance policy of the metric.
+template <SimdLevel LEVEL>
+int runElementType(){
+    if (args.elementType == ELEMENT_UINT8){
+        auto DG = make_unique<DirectedGraph<vector<uint8_t>, L2Distance<LEVEL>>>(L2Distance<LEVEL>(), vectorEmpty<uint8_t>);
+        return runIndex(*DG);
+    }
+    if (args.elementType == ELEMENT_INT8){
+        auto DG = make_unique<DirectedGraph<vector<int8_t>, L2Distance<LEVEL>>>(L2Distance<LEVEL>(), vectorEmpty<int8_t>);
+        return runIndex(*DG);
+    }
+    return runMetric<LEVEL>();
+}
+
+int main(int argc, char* argv[]) {
+
+    args.parseArgs(argc,argv);
+
+    for (int i = 0; i < argc; i++)
+        s_log << argv[i] << ' ';
+    s_log << '\n';
+
+    // a binary index records its metric and element type: load it with the ones it was built for
+    if (args.graph_load_path != "" && isBinaryIndex(args.graph_load_path)){
+        Metric metric = readIndexMetric(args.graph_load_path);
+        if (metric != args.metric) cout << "The index was built for the " << metricName(metric) << " metric. Using it instead of " << metricName(args.metric) << endl;
+        args.metric = metric;
+        args.elementType = readIndexElementType(args.graph_load_path);
+    }
+
+    // 8-bit values come from .bvecs / .u8bin / .i8bin files (the contest .bin files hold float rows with their categories)
+    if (args.elementType != ELEMENT_FLOAT && !args.no_create && (args.index_type != VAMANA || endsWith(args.data_path, ".bin"))){
+        throw invalid_argument("Only vamana indices on .bvecs, .u8bin or .i8bin files support " + elementName(args.elementType) + " values.\n");
+    }
+
+    args.printArgs();
+
+    // choose the distance policy depending on the argument (built-in distances are compiled into the graph, see distance.hpp)
+    // the graphs are allocated on the heap (functions were built expecting a reference)
+    if (args.euclideanType == 0){
+        return runElementType<SIMD_SCALAR>();
+    }
+    else if (args.euclideanType == 1){
+        // widest SIMD kernel family supported by the host (chosen at startup from CPUID)
+        c_log << "SIMD distance kernels: " << simdLevelName(simd_level) << '\n';
+        if (simd_level == SIMD_AVX512) return runElementType<SIMD_AVX512>();
+        if (simd_level == SIMD_AVX2) return runElementType<SIMD_AVX2>();
+        return runElementType<SIMD_SCALAR>();
+    }
+    else if (args.metric != METRIC_L2){ throw invalid_argument("Only distances 0 and 1 support the " + metricName(args.metric) + " metric.\n"); }
+    else if (args.elementType != ELEMENT_FLOAT){ throw invalid_argument("Only distances 0 and 1 support " + elementName(args.elementType) + " values.\n"); }
+    else if (args.euclideanType == 2){
+        // type-erased distance function (DynamicDistance policy)
+        auto DG = make_unique<DirectedGraph<vector<float>>>(parallel_euclideanDistance<vector<float>>, vectorEmpty<float>);
+        return runIndex(*DG);
+    }
+    else if (args.euclideanType == 3){
+        cout << "In main.cpp, instantiate the DirectedGraph template with your desired datatype after implementing your requirements.\n";
+        c_log << "In main.cpp, instantiate the DirectedGraph template with your desired datatype after implementing your requirements.\n";
+        // auto DG = make_unique<DirectedGraph<YOUR_TYPE_HERE>>(customDistance<YOUR_TYPE_HERE>, customEmpty<YOUR_TYPE_HERE>);
+        // return runIndex(*DG);
+    }
+    else { throw invalid_argument("distance must be in {0,1,2,3}. | 0 - euclidean, 1 - simd_euclidean, 2 - parallel euclidean, 3 - custom"); }
+
     return 0;
 }
\ No newline at end of file
@@ -44,6 +44,10 @@ void test_Store_and_Load(){
     // Compare the two nodes if they are similar
     TEST_CHECK(nodes1 == nodes2);
 
+    // Compare the values of the nodes stored in the vector stores
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+
     // Retrieve the two maps containing the neighbors
     unordered_map<Id, unordered_set<Id>> m1 = DG.get_Nout();
     unordered_map<Id, unordered_set<Id>> m2 = DG2.get_Nout();
@@ -98,6 +102,10 @@ void test_Store_and_Load(){
     // Compare the two nodes if they are similar
     TEST_CHECK(nodes1 == nodes2);
 
+    // Compare the values of the nodes stored in the vector stores
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+
     // Retrieve the two maps containing the neighbors
     m1 = DG.get_Nout();
     m2 = DG2.get_Nout();
@@ -134,6 +142,10 @@ void test_Store_and_Load(){
     // Compare the two nodes if they are similar
     TEST_CHECK(nodes1 == nodes2);
 
+    // Compare the values of the nodes stored in the vector stores
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+
     // Retrieve the two maps containing the neighbors
     m1 = DG.get_Nout();
     m2 = DG2.get_Nout();
@@ -145,7 +157,310 @@ void test_Store_and_Load(){
     remove(filename.c_str());
 }
 
+void test_indexFormats(){
+
+    string filename = "graph_instance.bin";
+    string text_filename = "graph_instance.txt";
+    args.n_threads = 4;
+
+    DirectedGraph<vector<float>> DG(euclideanDistance<vector<float>>, vectorEmpty<float>);
+
+    // 50 nodes of 3 categories, with a random graph and filtered medoids
+    for (int i = 0; i < 50; i++){
+        vector<float> v = {(float) i, (float) (i % 7), 0.5f * i, 1.0f, -2.0f * i};
+        DG.createNode(v, i % 3);
+    }
+    DG.Rgraph(6);
+    DG.findMedoids(1.0);
+    DG.medoid();
+
+    // ------------------------------------------------------------------------------------------- Binary format round trip
+
+    DG.store(filename);
+    TEST_CHECK(isBinaryIndex(filename));
+
+    DirectedGraph<vector<float>> DG2(euclideanDistance<vector<float>>, vectorEmpty<float>);
+    DG2.load(filename);
+
+    TEST_CHECK(DG.get_n_nodes() == DG2.get_n_nodes());
+    TEST_CHECK(DG.get_n_edges() == DG2.get_n_edges());
+    TEST_CHECK(DG.getNodes() == DG2.getNodes());
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+    TEST_CHECK(DG.get_Nout() == DG2.get_Nout());
+    TEST_CHECK(DG.medoid() == DG2.medoid());
+    TEST_CHECK(DG.findMedoids(1.0) == DG2.findMedoids(1.0));
+
+    // ------------------------------------------------------------------------------------------- Text format is detected on load
+
+    DG.storeText(text_filename);
+    TEST_CHECK(!isBinaryIndex(text_filename));
+
+    DirectedGraph<vector<float>> DG3(euclideanDistance<vector<float>>, vectorEmpty<float>);
+    DG3.load(text_filename);
+
+    TEST_CHECK(DG.getNodes() == DG3.getNodes());
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(DG.getValue(i) == DG3.getValue(i));
+    TEST_CHECK(DG.get_Nout() == DG3.get_Nout());
+
+    // ------------------------------------------------------------------------------------------- Memory-mapped binary index
+
+    {
+        DirectedGraph<vector<float>> DG4(euclideanDistance<vector<float>>, vectorEmpty<float>);
+        DG4.load(filename, true);
+
+        TEST_CHECK(DG4.getVectors().readOnly());
+        TEST_CHECK(DG.getNodes() == DG4.getNodes());
+        for (int i = 0; i < DG.get_n_nodes(); i++)
+            TEST_CHECK(DG.getValue(i) == DG4.getValue(i));
+        TEST_CHECK(DG.get_Nout() == DG4.get_Nout());
+        TEST_CHECK(DG.medoid() == DG4.medoid());
+
+        // rows are served in place, aligned for the SIMD kernels
+        TEST_CHECK((uintptr_t) DG4.getRow(0) % VECTOR_ALIGNMENT == 0);
+
+        // the vectors are read-only, the edges are copied out of the mapping when modified
+        try{
+            DG4.createNode(vector<float>{1, 2, 3, 4, 5});
+            TEST_CHECK(false);  // control should not reach here
+        }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Cannot modify a read-only vector store.\n"); }
+
+        Id to = *DG4.getNeighbors(0).begin();
+        TEST_CHECK(DG4.removeEdge(0, to));
+        TEST_CHECK(!DG4.getAdjacency().compacted());
+        TEST_CHECK(DG4.get_n_edges() == DG.get_n_edges() - 1);
+    }
+
+    // ------------------------------------------------------------------------------------------- Corrupted index
+
+    IndexHeader header = readIndexHeader(filename);
+    string original;
+    {
+        ifstream file(filename, ios::in | ios::binary);
+        original.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    int32_t first_offsets[3];
+    memcpy(first_offsets, original.data() + header.adjacency_offsets_offset, sizeof(first_offsets));
+    TEST_CHECK(first_offsets[1] > 0 && first_offsets[2] < header.n_edges);
+
+    // one corrupted int32 each: (byte offset in the file, value)
+    vector<pair<uint64_t, int32_t>> corruptions = {
+        {offsetof(IndexHeader, n_edges), -1},                                                       // negative count
+        {offsetof(IndexHeader, n_rows), header.n_nodes + 1},                                        // more rows than nodes
+        {offsetof(IndexHeader, vectors_offset), (int32_t) header.vectors_offset + 64},              // offset off the layout (past the file)
+        {offsetof(IndexHeader, file_size), (int32_t) header.file_size + 64},                        // size off the layout
+        {offsetof(IndexHeader, medoid), header.n_nodes},                                            // medoid out of range
+        {offsetof(IndexHeader, pca_leading), 3},                                                    // not a multiple of 16
+        {header.rows_offset + (header.n_nodes - 1) * sizeof(int32_t), header.n_rows + 5},           // row out of range
+        {header.rows_offset, -2},                                                                   // row below -1 (empty)
+        {header.filtered_medoids_offset + sizeof(int32_t), header.n_nodes},                         // filtered medoid out of range
+        {header.adjacency_offsets_offset + sizeof(int32_t), first_offsets[2] + 1},                  // decreasing CSR offsets
+        {header.adjacency_ids_offset, header.n_nodes},                                              // edge to a node out of range
+    };
+
+    for (const pair<uint64_t, int32_t>& corruption : corruptions){
+        {
+            ofstream file(filename, ios::out | ios::binary | ios::trunc);
+            file.write(original.data(), original.size());
+            file.seekp(corruption.first);
+            file.write((const char*) &corruption.second, sizeof(int32_t));
+        }
+
+        // a failed load leaves the graph as it was, copied or mapped
+        for (bool mapped : {false, true}){
+            try{
+                DG2.load(filename, mapped);
+                TEST_CHECK(false);  // control should not reach here
+                TEST_MSG("byte %llu, mapped %d", (unsigned long long) corruption.first, (int) mapped);
+            }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Index file is corrupted.\n"); TEST_MSG("%s", ia.what()); }
+
+            TEST_CHECK(DG.getNodes() == DG2.getNodes());
+            for (int i = 0; i < DG.get_n_nodes(); i++)
+                TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+            TEST_CHECK(DG.get_Nout() == DG2.get_Nout());
+            TEST_CHECK(DG.get_n_edges() == DG2.get_n_edges());
+        }
+    }
+
+    // ------------------------------------------------------------------------------------------- Unsupported version
+
+    {
+        fstream file(filename, ios::in | ios::out | ios::binary);
+        uint32_t version = INDEX_FORMAT_VERSION + 1;
+        file.seekp(offsetof(IndexHeader, version));
+        file.write((const char*) &version, sizeof(version));
+    }
+
+    try{
+        DG2.load(filename);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Unsupported index format version.\n"); }
+
+    remove(filename.c_str());
+    remove(text_filename.c_str());
+    args.n_threads = 1;
+}
+
+void test_indexMetric(){
+
+    string filename = "graph_instance.bin";
+    args.n_threads = 1;
+
+    vector<vector<float>> values;
+    for (int i = 0; i < 30; i++) values.push_back({(float) i, 1.0f + (i % 4), -0.5f * i});
+
+    // ------------------------------------------------------------------------------------------- Cosine: values are stored at unit length
+
+    DirectedGraph<vector<float>, CosineDistance<SIMD_SCALAR>> DG(CosineDistance<SIMD_SCALAR>(), vectorEmpty<float>);
+    DG.setMetric(METRIC_COSINE);
+    for (const vector<float>& v : values) DG.createNode(v);
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(fabs(row_innerProduct(DG.getRow(i), DG.getRow(i), 3) - 1.0f) <= 0.001f);
+    DG.Rgraph(4);
+
+    try{
+        DG.setMetric(METRIC_IP);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Cannot change the metric of a non-empty graph.\n"); }
+
+    // the metric is stored in the header, and must match the graph loading the index
+    DG.store(filename);
+    TEST_CHECK(readIndexMetric(filename) == METRIC_COSINE);
+
+    DirectedGraph<vector<float>, CosineDistance<SIMD_SCALAR>> DG2(CosineDistance<SIMD_SCALAR>(), vectorEmpty<float>);
+    DG2.setMetric(METRIC_COSINE);
+    DG2.load(filename);
+    TEST_CHECK(DG.get_Nout() == DG2.get_Nout());
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+
+    DirectedGraph<vector<float>> DG3(euclideanDistance<vector<float>>, vectorEmpty<float>);
+    try{
+        DG3.load(filename);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Metric of the index does not match the graph.\n"); }
+
+    // ------------------------------------------------------------------------------------------- MIPS: values get the extra coordinate
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_SCALAR>> DG4(L2Distance<SIMD_SCALAR>(), vectorEmpty<float>);
+    DG4.setMetric(METRIC_MIPS);
+    try{
+        DG4.createNode(values[0]);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "The maximum norm of a MIPS graph must be set before creating nodes.\n"); }
+
+    float max_norm = maxRowNorm(values.size(), 3, [&](int i) { return values[i].data(); });
+    DG4.setMipsNorm(max_norm);
+    for (const vector<float>& v : values) DG4.createNode(v);
+
+    // every stored value has norm M, and the L2 order of a query (without the extra coordinate) is its inner product order
+    TEST_CHECK(DG4.getVectors().dim() == 4);
+    for (int i = 0; i < DG4.get_n_nodes(); i++)
+        TEST_CHECK(fabs(row_innerProduct(DG4.getRow(i), DG4.getRow(i), 4) - max_norm * max_norm) <= 0.01f);
+
+    DG4.Rgraph(6);
+    vector<float> xq = {1.0f, 2.0f, -1.0f};
+    Id best = 0;
+    for (int i = 1; i < (int) values.size(); i++)
+        if (row_innerProduct(values[i].data(), xq.data(), 3) > row_innerProduct(values[best].data(), xq.data(), 3)) best = i;
+    unordered_set<Id> all_nodes;
+    for (int i = 0; i < DG4.get_n_nodes(); i++) all_nodes.insert(i);
+    TEST_CHECK(DG4._myArgMin(all_nodes, xq) == best);
+
+    DG4.store(filename);
+    TEST_CHECK(readIndexMetric(filename) == METRIC_MIPS);
+
+    remove(filename.c_str());
+}
+
+void test_indexElementType(){
+
+    string filename = "graph_instance.bin";
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    // uint8 values are stored as they are, and searched with the integer kernels
+    DirectedGraph<vector<uint8_t>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<uint8_t>);
+    for (int i = 0; i < 100; i++) DG.createNode(vector<uint8_t>({(uint8_t) i, (uint8_t) (255 - i), (uint8_t) (2 * i), 7}));
+    DG.vamanaAlgorithm(20, 6, 1.2f);
+
+    vector<uint8_t> xq = {50, 205, 100, 7};     // the value of node 50
+    TEST_CHECK(DG.greedySearch(DG.medoid(), xq, 1, 20).first == unordered_set<Id>({50}));
+
+    // the element type is stored in the header, and must match the graph loading the index
+    DG.store(filename);
+    TEST_CHECK(readIndexElementType(filename) == ELEMENT_UINT8);
+
+    DirectedGraph<vector<uint8_t>, L2Distance<SIMD_AVX2>> DG2(L2Distance<SIMD_AVX2>(), vectorEmpty<uint8_t>);
+    DG2.load(filename);
+    TEST_CHECK(DG.get_Nout() == DG2.get_Nout());
+    for (int i = 0; i < DG.get_n_nodes(); i++)
+        TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+
+    DirectedGraph<vector<int8_t>, L2Distance<SIMD_AVX2>> DG3(L2Distance<SIMD_AVX2>(), vectorEmpty<int8_t>);
+    try{
+        DG3.load(filename);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Element type of the index does not match the graph.\n"); }
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG4(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    try{
+        DG4.load(filename);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Element size of the index does not match the graph.\n"); }
+
+    remove(filename.c_str());
+}
+
+void test_indexPCA(){
+
+    string filename = "graph_instance.bin";
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(31);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 200; i++){
+        vector<float> v(40);
+        for (int j = 0; j < 40; j++) v[j] = value(rng) * 4.0f / (1 + j);
+        DG.createNode(v);
+    }
+    DG.applyPCA(16);
+    DG.vamanaAlgorithm(20, 6, 1.2f);
+
+    // the rotation is stored with the index: the loaded graph (copied or mapped) rotates the queries the same way
+    DG.store(filename);
+    vector<float> xq(40, 0.25f);
+    unordered_set<Id> found = DG.greedySearch(DG.medoid(), xq, 5, 20).first;
+
+    for (bool mapped : {false, true}){
+        DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG2(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+        DG2.load(filename, mapped);
+        TEST_CHECK(DG2.getPCA() != nullptr && DG2.getPCA()->leading() == 16 && DG2.getPCA()->dim() == 40);
+        for (int c = 0; c < 40; c++)
+            TEST_CHECK(memcmp(DG.getPCA()->components().row(c), DG2.getPCA()->components().row(c), 40 * sizeof(float)) == 0);
+        for (int i = 0; i < DG.get_n_nodes(); i++)
+            TEST_CHECK(DG.getValue(i) == DG2.getValue(i));
+        TEST_CHECK(DG2.greedySearch(DG2.medoid(), xq, 5, 20).first == found);
+    }
+
+    // the text format has no room for it
+    try{
+        DG.storeText("graph_instance.txt");
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "The PCA rotation cannot be stored in the text format.\n"); }
+
+    remove(filename.c_str());
+    remove("graph_instance.txt");
+}
+
 TEST_LIST = {
     { "test_Store_and_Load", test_Store_and_Load},
+    { "test_indexFormats", test_indexFormats},
+    { "test_indexMetric", test_indexMetric},
+    { "test_indexElementType", test_indexElementType},
+    { "test_indexPCA", test_indexPCA},
     { NULL, NULL }     // zeroed record marking the end of the list
 };
\ No newline at end of file
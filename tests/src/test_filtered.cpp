@@ -84,6 +84,47 @@ void test_filteredVamanaAlgorithm(){
 
 }
 
+void test_parallelFilteredVamana(){
+
+    args.randomStart = false;
+    args.threshold = 0.5f;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(71);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1200; i++){
+        vector<float> v(16);
+        for (float& x : v) x = value(rng);
+        DG.createNode(v, i % 4);
+    }
+
+    // the threads build one category each, writing through the node locks and committing their edge counts at the end
+    args.n_threads = 4;
+    TEST_CHECK(DG.filteredVamanaAlgorithm(40, 12, 1.2f, 0.5f));
+
+    int n_edges = 0;
+    for (Id id = 0; id < 1200; ++id){
+        NeighborRange nb = DG.getNeighbors(id);
+        n_edges += nb.size();
+        TEST_CHECK(nb.size() <= 12);
+        for (const Id& j : nb) TEST_CHECK(DG.getNodes()[j].category == DG.getNodes()[id].category && j != id);
+    }
+    TEST_CHECK(DG.get_n_edges() == n_edges && DG.getAdjacency().n_edges() == n_edges);
+
+    // the graph of every category is navigable: searching the value of a node finds the node itself
+    SearchContext ctx;
+    int found = 0;
+    for (int q = 0; q < 1200; q += 12){
+        int category = DG.getNodes()[q].category;
+        DG.search(DG.startingNode(category), DG.getRow(q), 16, 1, 40, ctx, category);
+        found += ctx.results[0].first == q;
+    }
+    TEST_CHECK(found >= 95);
+    TEST_MSG("found %d of 100", found);
+
+    args.n_threads = 1;
+}
+
 void test_stitchedVamanaAlgorithm(){
     
     DirectedGraph<vector<float>> DG(euclideanDistance<vector<float>>, vectorEmpty<float>);
@@ -155,6 +196,7 @@ TEST_LIST = {
     { "test_filteredGreedySearch", test_filteredGreedySearch},
     { "test_filteredRobustPrune", test_filteredRobustPrune},
     { "test_filteredVamanaAlgorithm", test_filteredVamanaAlgorithm},
+    { "test_parallelFilteredVamana", test_parallelFilteredVamana},
     { "test_stitchedVamanaAlgorithm", test_stitchedVamanaAlgorithm},
     { "test_filterSet", test_filterSet},
     { NULL, NULL }     // zeroed record marking the end of the list
@@ -3,6 +3,23 @@
 
 using namespace std;
 
+// Allocation counter of test_searchContext: the allocation functions of the C library (that operator new ends up in) are counted while set
+static bool count_allocations = false;
+static long allocations = 0;
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+extern "C" void* malloc(size_t size){
+    if (count_allocations) allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size){
+    if (count_allocations) allocations++;
+    return __libc_memalign(alignment, size);
+}
+
 void test_graphCreation(void){
     
 
@@ -47,9 +64,26 @@ void test_createNode(void){
     TEST_MSG("NodeSet is empty after node creation");
 
     // Ensure that nodeSet includes the node
-    vector<float> retValue = DG.getNodes()[id].value;
+    vector<float> retValue = DG.getValue(id);
     TEST_ASSERT(retValue == value);
     TEST_MSG("Inserted node = Node");
+
+    // The value is stored in an aligned, zero-padded row of the vector store
+    const float* row = DG.getRow(id);
+    TEST_CHECK(((uintptr_t) row) % VECTOR_ALIGNMENT == 0);
+    for (int i = value.size(); i < DG.getVectors().paddedDim(); i++)
+        TEST_CHECK(row[i] == 0.0f);
+
+    // Empty values create nodes without a row
+    Id empty_id = DG.createNode(vector<float>());
+    TEST_CHECK(DG.getNodes()[empty_id].empty());
+    TEST_CHECK(DG.getValue(empty_id).empty());
+
+    // Values of a different dimension are rejected
+    try{
+        DG.createNode(vector<float>{1.0f, 2.0f});
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Dimension Mismatch between Arguments"); }
     
 }
 
@@ -293,6 +327,40 @@ void test_medoid(void){
     // Ensure both methods yield the same result
     TEST_CHECK(computedMedoidSerialId == computedMedoidParallelId); // Ensure both methods return the same result
     TEST_MSG("Ids are not equal\n");
+
+    // many-to-many kernels over several tiles: the threads split the upper triangle of the distances, and find the serial medoid
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG3(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(11);
+    normal_distribution<float> value(0.0f, 1.0f);
+    vector<Node<vector<float>>> sample;
+    for (int i = 0; i < 300; i++){
+        vector<float> v(24);
+        for (float& x : v) x = value(rng);
+        sample.push_back(DG3.getNodes()[DG3.createNode(v)]);
+    }
+    args.n_threads = 1;
+    Id serial = DG3.medoid(sample, false);
+    args.n_threads = 3;
+    TEST_CHECK(DG3.medoid(sample, false) == serial);
+
+    // a sample of many tiles (more than MEDOID_TILE_STRIPES), every value twice: the exact sums tie in pairs, and the float sums must
+    // still be added in the same order on any number of threads to pick the same node of a pair
+    vector<Node<vector<float>>> large_sample;
+    for (int i = 0; i < 1600; i++){
+        vector<float> v(24);
+        for (float& x : v) x = value(rng);
+        large_sample.push_back(DG3.getNodes()[DG3.createNode(v)]);
+        large_sample.push_back(DG3.getNodes()[DG3.createNode(v)]);
+    }
+    args.n_threads = 1;
+    Id large_serial = DG3.medoid(large_sample, false);
+    for (int n_threads : {3, 8}){
+        args.n_threads = n_threads;
+        TEST_CHECK(DG3.medoid(large_sample, false) == large_serial);
+        TEST_MSG("%d threads", n_threads);
+    }
+    args.n_threads = 1;
+
     // dimension mismatch will not be tested, as we assume that all elements in the set must be able to be passed on to the given distance function without error.
     // this case is handled in the euclideanDistance unit test.
 }
@@ -400,7 +468,7 @@ void test_myArgMin(void){
 
     Id xmin = DG._myArgMin(s, xq);
     vector<float> ymin = {2.0f, 2.0f, 2.0f, 2.0f, 2.0f, 2.0f, 2.0f, 2.0f, 2.0f, 2.0f};
-    TEST_CHECK(DG.getNodes()[xmin].value == ymin);
+    TEST_CHECK(DG.getValue(xmin) == ymin);
 
 
     // empty arguments check:
@@ -535,7 +603,7 @@ void test_greedySearch(void){
     // // Unitialized id
     Id s;
     try{
-        pair<unordered_set<Id>, unordered_set<Id>> ret = DG.greedySearch(s, DG.getNodes()[0].value, 4, 5);
+        pair<unordered_set<Id>, unordered_set<Id>> ret = DG.greedySearch(s, DG.getValue(0), 4, 5);
         TEST_CHECK(false);  // Control should not reach here 
     }catch(invalid_argument& ia){ TEST_CHECK((string(ia.what()) == "Invalid Index was provided.\n")); }
     
@@ -632,6 +700,54 @@ void test_vamanaAlgorithm(void){
     return;
 }
 
+void test_distancePolicy(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    // a graph with a compile-time distance policy behaves like one with the equivalent type-erased distance function
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DGp(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    DirectedGraph<vector<float>> DGd(row_euclideanDistance<float>, vectorEmpty<float>);
+
+    mt19937 rng(7);
+    uniform_real_distribution<float> value(-10.0f, 10.0f);
+    for (int i = 0; i < 200; i++){
+        vector<float> v(20);
+        for (float& x : v) x = value(rng);
+        DGp.createNode(v);
+        DGd.createNode(v);
+    }
+
+    TEST_CHECK(DGp.medoid(DGp.getNodes(), false) == DGd.medoid(DGd.getNodes(), false));
+    args.n_threads = 3;     // the threads sum the distances of their ranges through the many-to-many kernels as well
+    TEST_CHECK(DGp.medoid(DGp.getNodes(), false) == DGd.medoid(DGd.getNodes(), false));
+    args.n_threads = 1;
+
+    vector<float> xq(20, 1.0f);
+    unordered_set<Id> all;
+    for (int i = 0; i < 200; i++) all.insert(i);
+    TEST_CHECK(DGp._myArgMin(all, xq) == DGd._myArgMin(all, xq));
+    TEST_CHECK(DGp._closestN(10, all, xq) == DGd._closestN(10, all, xq));
+
+    // batched distances (more ids than one kernel call takes) match the per-pair distances
+    vector<Id> ids;
+    for (int i = 0; i < 200; i++) ids.push_back(199 - i);
+    vector<float> batch_p(200), batch_d(200);
+    AlignedRow<float> q(DGp.getVectors().paddedDim());
+    copy(xq.begin(), xq.end(), q.data());
+    DGp.distanceBatch(q.data(), ids.data(), ids.size(), batch_p.data());
+    DGd.distanceBatch(q.data(), ids.data(), ids.size(), batch_d.data());
+    for (int i = 0; i < 200; i++){
+        float expected = euclideanDistance(DGd.getValue(ids[i]), xq);
+        TEST_CHECK(fabs(batch_p[i] - expected) <= 0.001f * expected);
+        TEST_CHECK(fabs(batch_d[i] - expected) <= 0.001f * expected);
+    }
+
+    // index creation and search with the policy
+    TEST_CHECK(DGp.vamanaAlgorithm(20, 8, 1.2f));
+    TEST_CHECK(DGp.greedySearch(0, xq, 5, 20).first.size() == 5);
+}
+
 void test_init(void){
     
     DirectedGraph<vector<float>> DG(euclideanDistance<vector<float>>, vectorEmpty<float>);
@@ -733,6 +849,733 @@ void test_startingNode(){
 }
 
 
+void test_adjacencyStore(void){
+
+    AdjacencyStore adj(2);
+    adj.resize(3);
+
+    TEST_CHECK(adj.size() == 3);
+    TEST_CHECK(adj.n_edges() == 0);
+    TEST_CHECK(adj.neighbors(0).empty());
+
+    // insertions and duplicates
+    TEST_CHECK(adj.insert(0, 1));
+    TEST_CHECK(adj.insert(0, 2));
+    TEST_CHECK(!adj.insert(0, 1));
+    TEST_CHECK(adj.degree(0) == 2);
+    TEST_CHECK(adj.contains(0, 2));
+    TEST_CHECK(!adj.contains(1, 0));
+
+    // running out of slots re-lays out the store without losing edges
+    TEST_CHECK(adj.insert(1, 0));
+    TEST_CHECK(adj.insert(0, 0));
+    TEST_CHECK(adj.width() > 2);
+    TEST_CHECK(adj.degree(0) == 3);
+    TEST_CHECK(adj.contains(0, 1) && adj.contains(0, 2) && adj.contains(0, 0));
+    TEST_CHECK(adj.contains(1, 0));
+    TEST_CHECK(adj.n_edges() == 4);
+
+    // removal
+    TEST_CHECK(adj.erase(0, 1));
+    TEST_CHECK(!adj.erase(0, 1));
+    TEST_CHECK(!adj.contains(0, 1));
+    TEST_CHECK(adj.degree(0) == 2);
+
+    // compact form keeps the same neighbors
+    adj.compact();
+    TEST_CHECK(adj.compacted());
+    TEST_CHECK(adj.degree(0) == 2 && adj.degree(1) == 1 && adj.degree(2) == 0);
+    NeighborRange nb = adj.neighbors(0);
+    unordered_set<Id> n0(nb.begin(), nb.end());
+    TEST_CHECK(n0 == unordered_set<Id>({0, 2}));
+
+    // modifying a compact store expands it again
+    TEST_CHECK(adj.insert(2, 1));
+    TEST_CHECK(!adj.compacted());
+    TEST_CHECK(adj.contains(2, 1) && adj.contains(0, 2) && adj.contains(1, 0));
+    TEST_CHECK(adj.n_edges() == 4);
+
+    TEST_CHECK(adj.clear(0) == 2);
+    TEST_CHECK(adj.n_edges() == 2);
+
+    // a pinned store is never re-laid out: a node out of slots throws instead
+    int width = adj.width();
+    for (Id to = 0; to < width; ++to) adj.insert(1, to);
+    adj.pin(true);
+    try{
+        adj.insert(1, width);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Cannot re-lay out a pinned adjacency store.\n"); }
+    TEST_CHECK(!adj.append(1, width));
+    adj.pin(false);
+    TEST_CHECK(adj.insert(1, width) && adj.width() > width);
+
+    adj.reset();
+    TEST_CHECK(adj.size() == 0);
+    TEST_CHECK(adj.n_edges() == 0);
+}
+
+void test_pqGreedySearch(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+
+    mt19937 rng(11);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(16);
+        for (float& x : v) x = value(rng) + (i % 4) * 3.0f;     // 4 clusters
+        DG.createNode(v);
+    }
+    TEST_CHECK(DG.vamanaAlgorithm(40, 12, 1.2f));
+
+    vector<float> xq(16, 1.5f);
+    unordered_set<Id> exact = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+
+    // the PQ search returns k nodes ranked by the full precision distance, close to the exact search
+    DG.trainPQ(4);
+    TEST_CHECK(DG.getPQ() != nullptr && DG.getPQ()->M() == 4);
+    unordered_set<Id> approx = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    TEST_CHECK(approx.size() == 10);
+    TEST_CHECK(k_recall(approx, exact) >= 0.8f);
+
+    // new values have no code: creating a node drops the PQ codes
+    DG.createNode(xq);
+    TEST_CHECK(DG.getPQ() == nullptr);
+}
+
+void test_sqGreedySearch(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+
+    mt19937 rng(13);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(16);
+        for (float& x : v) x = value(rng) + (i % 4) * 3.0f;     // 4 clusters
+        DG.createNode(v);
+    }
+    TEST_CHECK(DG.vamanaAlgorithm(40, 12, 1.2f));
+
+    vector<float> xq(16, 1.5f);
+    unordered_set<Id> exact = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+
+    // the SQ search returns k nodes close to the exact search, with or without re-ranking
+    for (ScalarQuantization type : {SQ_INT8, SQ_INT8_VECTOR, SQ_FP16}){
+        for (bool rerank : {false, true}){
+            DG.trainSQ(type, rerank);
+            TEST_CHECK(DG.getSQ() != nullptr && DG.getSQ()->type() == type);
+            unordered_set<Id> approx = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+            TEST_CHECK(approx.size() == 10);
+            TEST_CHECK(k_recall(approx, exact) >= 0.8f);
+        }
+    }
+
+    // PQ and SQ codes replace each other
+    DG.trainPQ(4);
+    TEST_CHECK(DG.getPQ() != nullptr && DG.getSQ() == nullptr);
+    DG.trainSQ(SQ_FP16, false);
+    TEST_CHECK(DG.getPQ() == nullptr && DG.getSQ() != nullptr);
+
+    // new values have no code: creating a node drops the SQ codes
+    DG.createNode(xq);
+    TEST_CHECK(DG.getSQ() == nullptr);
+}
+
+void test_sketchPrefilter(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    try{
+        DG.enableSketch(128, 8);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Cannot sketch the values without vectors.\n"); }
+
+    mt19937 rng(17);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(32);
+        for (float& x : v) x = value(rng) + (i % 4) * 3.0f;     // 4 clusters
+        DG.createNode(v);
+    }
+
+    // the prefilter serves the build (robustPrune) and the searches
+    DG.enableSketch(128, 8);
+    TEST_CHECK(DG.getSketch() != nullptr && DG.getSketch()->size() == 1000);
+    TEST_CHECK(DG.vamanaAlgorithm(40, 12, 1.2f));
+
+    // the query is closer to one cluster: a query midway between two clusters has its 10 nearest neighbors tied between them,
+    // and the sketches (angles around the mean of the values) cannot tell which of the two the exact search ends in
+    vector<float> xq(32, 1.0f);
+    unordered_set<Id> approx = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    DG.disableSketch();
+    unordered_set<Id> exact = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    TEST_CHECK(approx.size() == 10);
+    TEST_CHECK(k_recall(approx, exact) >= 0.8f);
+
+    // new values are sketched as they are created
+    DG.enableSketch(64, 0);
+    DG.createNode(xq);
+    TEST_CHECK(DG.getSketch()->size() == 1001);
+}
+
+void test_earlyAbandon(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(23);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(128);
+        for (float& x : v) x = value(rng) + (i % 4) * 3.0f;
+        DG.createNode(v);
+    }
+
+    // the prunes of the build keep the same candidates, whatever the distances that were abandoned
+    args.earlyAbandon = true;
+    TEST_CHECK(DG.vamanaAlgorithm(40, 12, 1.2f));
+
+    // the searches return the same nodes with and without abandoning the distances
+    vector<float> xq(128, 1.5f);
+    unordered_set<Id> abandoned = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    args.earlyAbandon = false;
+    unordered_set<Id> exact = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    TEST_CHECK(abandoned.size() == 10);
+    TEST_CHECK(abandoned == exact);
+}
+
+void test_pcaTwoTier(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> plain(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    try{
+        DG.applyPCA(16);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Cannot rotate the values without vectors.\n"); }
+
+    // 1000 values of dimension 64, most of their variance in a few directions
+    mt19937 rng(29);
+    normal_distribution<float> value(0.0f, 1.0f);
+    vector<vector<float>> values;
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(64);
+        for (int j = 0; j < 64; j++) v[j] = value(rng) * 8.0f / (1 + j % 16) + (i % 4) * 3.0f;
+        values.push_back(v);
+        DG.createNode(v);
+        plain.createNode(v);
+    }
+
+    DG.applyPCA(16);
+    TEST_CHECK(DG.getPCA() != nullptr && DG.getPCA()->leading() == 16);
+    try{
+        DG.applyPCA(16);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "The values are already rotated.\n"); }
+
+    // the rotation keeps the distances: the medoid of the two-tier sums is the medoid of the values (of the tiled sums of the plain graph)
+    TEST_CHECK(DG.medoid(DG.getNodes(), false) == plain.medoid(plain.getNodes(), false));
+    args.n_threads = 3;
+    TEST_CHECK(DG.medoid(DG.getNodes(), false) == plain.medoid(plain.getNodes(), false));
+    args.n_threads = 1;
+    TEST_CHECK(DG.medoid() == plain.medoid());
+    TEST_CHECK(DG.vamanaAlgorithm(40, 12, 1.2f));
+
+    // the queries are rotated like the values: the search finds the nearest values
+    vector<float> xq(64, 1.5f);
+    vector<pair<float, Id>> exact;
+    for (int i = 0; i < (int) values.size(); i++) exact.push_back({euclideanDistance(values[i], xq), i});
+    sort(exact.begin(), exact.end());
+    unordered_set<Id> nearest;
+    for (int i = 0; i < 10; i++) nearest.insert(exact[i].second);
+
+    unordered_set<Id> found = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    TEST_CHECK(found.size() == 10);
+    TEST_CHECK(k_recall(found, nearest) >= 0.8f);
+
+    // new values are rotated as they are created: their distances to the other values are the same
+    DG.createNode(xq);
+    TEST_CHECK(fabs(euclideanDistance(DG.getValue(1000), DG.getValue(0)) - euclideanDistance(xq, values[0])) <= 1e-3f * euclideanDistance(xq, values[0]));
+
+    // only float values can be rotated
+    DirectedGraph<vector<uint8_t>, L2Distance<SIMD_AVX2>> DG8(L2Distance<SIMD_AVX2>(), vectorEmpty<uint8_t>);
+    DG8.createNode(vector<uint8_t>(32, 1));
+    try{
+        DG8.applyPCA(16);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Only float values support the PCA rotation.\n"); }
+}
+
+void test_fastScanSearch(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    try{
+        DG.buildFastScan(16, 0.1f);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Cannot build the fast-scan blocks without vectors.\n"); }
+
+    mt19937 rng(31);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(64);
+        for (float& x : v) x = value(rng) + (i % 4) * 3.0f;     // 4 clusters
+        DG.createNode(v);
+    }
+    TEST_CHECK(DG.vamanaAlgorithm(40, 24, 1.2f));
+
+    vector<float> xq(64, 1.5f);
+    unordered_set<Id> exact = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    DG.buildFastScan(16, 0.1f);
+    TEST_CHECK(DG.getFastScan() != nullptr && DG.getFastScan()->size() == 1000);
+    unordered_set<Id> approx = DG.greedySearch(DG.medoid(), xq, 10, 40).first;
+    TEST_CHECK(approx.size() == 10);
+    TEST_CHECK(k_recall(approx, exact) >= 0.8f);
+
+    // the blocks hold the edges they were built from: modifying the edges drops them
+    TEST_CHECK(DG.removeEdge(0, *DG.getNeighbors(0).begin()));
+    TEST_CHECK(DG.getFastScan() == nullptr);
+
+    // the 4-bit codes estimate euclidean distances only
+    DirectedGraph<vector<float>, IPDistance<SIMD_AVX2>> IG(IPDistance<SIMD_AVX2>(), vectorEmpty<float>);
+    IG.setMetric(METRIC_IP);
+    IG.createNode(xq);
+    try{
+        IG.buildFastScan(16, 0.1f);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Only euclidean graphs support the fast-scan blocks.\n"); }
+}
+
+void test_searchContext(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(37);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(48);
+        for (float& x : v) x = value(rng) + (i % 4) * 3.0f;
+        DG.createNode(v, i % 4);
+    }
+    TEST_CHECK(DG.vamanaAlgorithm(40, 24, 1.2f));
+    Id s = DG.medoid();
+
+    vector<vector<float>> queries(20, vector<float>(48));
+    for (vector<float>& xq : queries) for (float& x : xq) x = value(rng) + 1.5f;
+
+    // the context returns the same neighbors as the legacy search
+    SearchContext ctx;
+    DG.search(s, queries[0].data(), 48, 10, 40, ctx);
+    TEST_CHECK(ctx.results.size() == 10);
+    unordered_set<Id> legacy = DG.greedySearch(s, queries[0], 10, 40).first;
+    unordered_set<Id> ids;
+    for (const pair<Id, float>& r : ctx.results) ids.insert(r.first);
+    TEST_CHECK(ids == legacy);
+
+    // once the context has grown (first queries), a search allocates nothing: unfiltered, filtered and with the sketch prefilter
+    for (const vector<float>& xq : queries) DG.search(s, xq.data(), 48, 10, 40, ctx);
+    for (const vector<float>& xq : queries) DG.search(s, xq.data(), 48, 10, 40, ctx, 2);
+    allocations = 0;
+    count_allocations = true;
+    for (const vector<float>& xq : queries) DG.search(s, xq.data(), 48, 10, 40, ctx);
+    for (const vector<float>& xq : queries) DG.search(s, xq.data(), 48, 10, 40, ctx, 2);
+    count_allocations = false;
+    TEST_CHECK(allocations == 0);
+    TEST_MSG("%ld allocations in 40 searches", allocations);
+
+    DG.enableSketch(128, 8);
+    for (const vector<float>& xq : queries) DG.search(s, xq.data(), 48, 10, 40, ctx);
+    allocations = 0;
+    count_allocations = true;
+    for (const vector<float>& xq : queries) DG.search(s, xq.data(), 48, 10, 40, ctx);
+    count_allocations = false;
+    TEST_CHECK(allocations == 0);
+    TEST_MSG("%ld allocations in 20 sketch searches", allocations);
+
+    // the counter sees the allocations of the legacy search (its returned sets)
+    count_allocations = true;
+    DG.greedySearch(s, queries[0], 10, 40);
+    count_allocations = false;
+    TEST_CHECK(allocations > 0);
+}
+
+void test_prefetch(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(41);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++){
+        vector<float> v(40);
+        for (float& x : v) x = value(rng) + (i % 3) * 2.0f;
+        DG.createNode(v, i % 3);
+    }
+    TEST_CHECK(DG.vamanaAlgorithm(40, 24, 1.2f));
+    Id s = DG.medoid();
+
+    // prefetching only changes when the memory is loaded: the searches find the same neighbors, expanded in the same order
+    SearchContext ctx;
+    for (int q = 0; q < 10; q++){
+        vector<float> xq(40);
+        for (float& x : xq) x = value(rng) + 2.0f;
+        for (int category : {-1, q % 3}){
+            args.prefetchDistance = 0;
+            DG.search(s, xq.data(), 40, 10, 40, ctx, category);
+            vector<pair<Id, float>> results = ctx.results;
+            vector<Id> expanded = ctx.expanded;
+            for (int distance : {1, 4, 64}){
+                args.prefetchDistance = distance;
+                DG.search(s, xq.data(), 40, 10, 40, ctx, category);
+                TEST_CHECK(ctx.results == results);
+                TEST_CHECK(ctx.expanded == expanded);
+            }
+        }
+    }
+
+    args.prefetchDistance = 2;
+}
+
+void test_rankedSearch(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+    args.randomStart = false;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(43);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 600; i++){
+        vector<float> v(24);
+        for (float& x : v) x = value(rng) + (i % 3) * 2.0f;
+        DG.createNode(v, i % 3);
+    }
+    TEST_CHECK(DG.filteredVamanaAlgorithm(40, 24, 1.2f, 1));
+    L2Distance<SIMD_AVX2> d;
+
+    // the ranked results are the results of the legacy search, by increasing distance, with the distances of the graph
+    Id q = 7;
+    vector<pair<Id, float>> ranked = DG.greedySearchRanked(DG.medoid(), DG.getValue(q), 10, 40);
+    TEST_CHECK(ranked.size() == 10);
+    TEST_CHECK(ranked[0].first == q && ranked[0].second == 0.0f);
+    unordered_set<Id> ids;
+    for (int i = 0; i < ranked.size(); i++){
+        ids.insert(ranked[i].first);
+        TEST_CHECK(fabs(ranked[i].second - d(DG.getRow(q), DG.getRow(ranked[i].first), 24)) <= 1e-3f);
+        if (i > 0) TEST_CHECK(ranked[i - 1].second <= ranked[i].second);
+    }
+    TEST_CHECK(ids == DG.greedySearch(DG.medoid(), DG.getValue(q), 10, 40).first);
+    TEST_CHECK(k_recall(ranked, vector<Id>(ids.begin(), ids.end())) == 1.0f);
+
+    Query<vector<float>> fq(0, 1, true, DG.getValue(q), vectorEmpty<float>);
+    vector<pair<Id, float>> franked = DG.filteredGreedySearchRanked(DG.startingNode(1), fq, 10, 40);
+    TEST_CHECK(franked.size() == 10);
+    for (const pair<Id, float>& r : franked) TEST_CHECK(DG.getNodes()[r.first].category == 1);
+
+    // accumulated unfiltered query: the closest k of the results of every category, merged on their distances
+    args.index_type = FILTERED_VAMANA;
+    args.accumulateUnfiltered = true;
+    args.k = 10;
+    args.L = 40;
+    DG.findMedoids(args.threshold);
+    Query<vector<float>> uq(1, -1, true, DG.getValue(q), vectorEmpty<float>);
+    vector<pair<Id, float>> merged = DG.findNeighborsRanked(uq);
+    TEST_CHECK(merged.size() == 10);
+    TEST_CHECK(merged[0].first == q);
+    vector<pair<Id, float>> candidates;
+    for (int c = 0; c < 3; c++){
+        Query<vector<float>> cq(2, c, true, DG.getValue(q), vectorEmpty<float>);
+        vector<pair<Id, float>> r = DG.findNeighborsRanked(cq);
+        candidates.insert(candidates.end(), r.begin(), r.end());
+    }
+    sort(candidates.begin(), candidates.end(), [](const pair<Id, float>& r1, const pair<Id, float>& r2) { return r1.second < r2.second; });
+    for (int i = 0; i < 10; i++) TEST_CHECK(merged[i].second == candidates[i].second);
+    ids.clear();
+    for (const pair<Id, float>& r : merged) ids.insert(r.first);
+    TEST_CHECK(DG.findNeighbors(uq) == ids);
+
+    args.accumulateUnfiltered = false;
+    args.index_type = EMPTY;
+}
+
+void test_searchBatch(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+    args.randomStart = false;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(47);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 800; i++){
+        vector<float> v(32);
+        for (float& x : v) x = value(rng) + (i % 4) * 2.0f;
+        DG.createNode(v, i % 4);
+    }
+    TEST_CHECK(DG.filteredVamanaAlgorithm(40, 24, 1.2f, 1));
+    DG.findMedoids(args.threshold);
+
+    vector<vector<float>> values(20, vector<float>(32));
+    for (vector<float>& xq : values) for (float& x : xq) x = value(rng) + 3.0f;
+    vector<const float*> rows;
+    vector<int> categories;
+    vector<Id> starts;
+    for (int b = 0; b < 20; b++){
+        rows.push_back(values[b].data());
+        categories.push_back((b % 2 == 0) ? -1 : b % 4);
+        starts.push_back((categories[b] == -1) ? DG.startingNode() : DG.startingNode(categories[b]));
+    }
+
+    // the batch finds the results of the searches of the queries one by one, plain and filtered, with and without the sketch prefilter
+    SearchContext ctx;
+    BatchSearchContext batch;
+    for (int sketch = 0; sketch < 2; sketch++){
+        if (sketch) DG.enableSketch(128, 8);
+        DG.searchBatch(starts.data(), rows.data(), categories.data(), 20, 32, 10, 40, batch);
+        for (int b = 0; b < 20; b++){
+            DG.search(starts[b], rows[b], 32, 10, 40, ctx, categories[b]);
+            TEST_CHECK(batch.counts[b] == ctx.results.size());
+            TEST_CHECK(equal(ctx.results.begin(), ctx.results.end(), batch.resultsOf(b)));
+        }
+    }
+
+    try{
+        DG.searchBatch(starts.data(), rows.data(), categories.data(), 20, 32, 10, 5, batch);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "L must be greater or equal to K.\n"); }
+
+    // the searches that run hop by hop share one visited table: at most BATCH_MAX_QUERIES of them
+    DG.disableSketch();
+    vector<const float*> many_rows(BATCH_MAX_QUERIES + 1, rows[0]);
+    vector<int> many_categories(BATCH_MAX_QUERIES + 1, categories[0]);
+    vector<Id> many_starts(BATCH_MAX_QUERIES + 1, starts[0]);
+    try{
+        DG.searchBatch(many_starts.data(), many_rows.data(), many_categories.data(), BATCH_MAX_QUERIES + 1, 32, 10, 40, batch);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "A batch search holds at most " + to_string(BATCH_MAX_QUERIES) + " queries.\n"); }
+    DG.enableSketch(128, 8);
+
+    // findQueriesNeighbors in batches of 8 queries returns the neighbors of the queries one by one
+    args.index_type = FILTERED_VAMANA;
+    args.k = 10;
+    args.L = 40;
+    args.n_queries = 20;
+    vector<Query<vector<float>>> queries;
+    for (int b = 0; b < 20; b++) queries.push_back(Query<vector<float>>(b, categories[b], categories[b] != -1, values[b], vectorEmpty<float>));
+    vector<vector<pair<Id, float>>> single = DG.findQueriesNeighborsRanked(queries);
+    args.queryBatch = 8;
+    vector<vector<pair<Id, float>>> batched = DG.findQueriesNeighborsRanked(queries);
+    TEST_CHECK(batched == single);
+
+    // batches larger than BATCH_MAX_QUERIES are searched in chunks
+    vector<Query<vector<float>>> twice(queries);
+    twice.insert(twice.end(), queries.begin(), queries.end());
+    args.n_queries = 40;
+    args.queryBatch = 64;
+    batched = DG.findQueriesNeighborsRanked(twice);
+    TEST_CHECK(batched.size() == 40);
+    TEST_CHECK(equal(single.begin(), single.end(), batched.begin()) && equal(single.begin(), single.end(), batched.begin() + 20));
+
+    args.queryBatch = 1;
+    args.index_type = EMPTY;
+}
+
+void test_freeze(void){
+
+    args.n_threads = 1;
+    args.threshold = 1;
+    args.randomStart = false;
+    args.index_type = FILTERED_VAMANA;     // freeze computes the medoids of the categories
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(53);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 600; i++){
+        vector<float> v(24);
+        for (float& x : v) x = value(rng) + (i % 3) * 2.0f;
+        DG.createNode(v, i % 3);
+    }
+    TEST_CHECK(DG.filteredVamanaAlgorithm(40, 24, 1.2f, 1));
+    TEST_CHECK(!DG.frozen());
+
+    vector<vector<float>> values(10, vector<float>(24));
+    for (vector<float>& xq : values) for (float& x : xq) x = value(rng) + 2.0f;
+    SearchContext ctx;
+    vector<vector<pair<Id, float>>> results;
+    for (int q = 0; q < 10; q++){
+        int category = (q % 2 == 0) ? -1 : q % 3;
+        DG.search((category == -1) ? DG.startingNode() : DG.startingNode(category), values[q].data(), 24, 10, 40, ctx, category);
+        results.push_back(ctx.results);
+    }
+
+    // the searches of a frozen index (without synchronization, even with several threads) find the same neighbors
+    DG.freeze();
+    TEST_CHECK(DG.frozen());
+    TEST_CHECK(DG.getAdjacency().compacted());
+    args.n_threads = 4;
+    for (int q = 0; q < 10; q++){
+        int category = (q % 2 == 0) ? -1 : q % 3;
+        DG.search((category == -1) ? DG.startingNode() : DG.startingNode(category), values[q].data(), 24, 10, 40, ctx, category);
+        TEST_CHECK(ctx.results == results[q]);
+    }
+    args.n_threads = 1;
+
+    // and reject every modification
+    int n_edges = DG.get_n_edges();
+    Id from = 0, to = *DG.getNeighbors(0).begin();
+    TEST_EXCEPTION(DG.addEdge(from, (to + 1) % 600), invalid_argument);
+    TEST_EXCEPTION(DG.removeEdge(from, to), invalid_argument);
+    TEST_EXCEPTION(DG.clearNeighbors(from), invalid_argument);
+    TEST_EXCEPTION(DG.createNode(values[0]), invalid_argument);
+    TEST_EXCEPTION(DG.robustPrune(from, {to}, 1.2f, 24), invalid_argument);
+    TEST_EXCEPTION(DG.filteredRobustPrune(from, {to}, 1.2f, 24), invalid_argument);
+    TEST_EXCEPTION(DG.vamanaAlgorithm(40, 24, 1.2f), invalid_argument);
+    try{
+        DG.addEdge(from, to);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Cannot modify a frozen index.\n"); }
+    TEST_CHECK(DG.get_n_edges() == n_edges);
+    TEST_CHECK(DG.get_n_nodes() == 600);
+
+    // unfrozen, the index can be modified again
+    DG.unfreeze();
+    TEST_CHECK(DG.removeEdge(from, to));
+    TEST_CHECK(DG.get_n_edges() == n_edges - 1);
+
+    DG.freeze();
+    DG.init();
+    TEST_CHECK(!DG.frozen());
+    args.index_type = EMPTY;
+}
+
+void test_parallelVamana(void){
+
+    args.threshold = 1;
+    args.randomStart = false;
+    args.useRGraph = false;
+
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    mt19937 rng(59);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 2000; i++){
+        vector<float> v(16);
+        for (float& x : v) x = value(rng);
+        DG.createNode(v);
+    }
+
+    // the threads write the neighbors of one node at a time: every node ends up with at most R distinct neighbors, and the edge count adds up
+    args.n_threads = 4;
+    TEST_CHECK(DG.vamanaAlgorithm(40, 16, 1.2f));
+    int n_edges = 0;
+    for (Id id = 0; id < 2000; ++id){
+        NeighborRange nb = DG.getNeighbors(id);
+        n_edges += nb.size();
+        TEST_CHECK(nb.size() <= 16);
+        TEST_CHECK(find(nb.begin(), nb.end(), id) == nb.end());
+        TEST_CHECK(unordered_set<Id>(nb.begin(), nb.end()).size() == nb.size());
+    }
+    TEST_CHECK(DG.get_n_edges() == n_edges);
+    TEST_CHECK(DG.getAdjacency().n_edges() == n_edges);
+
+    // the graph is navigable: searching the value of a node finds the node itself, with the optimistic reads and once frozen
+    SearchContext ctx;
+    int found = 0;
+    for (int q = 0; q < 2000; q += 20){
+        DG.search(DG.medoid(), DG.getRow(q), 16, 1, 40, ctx);
+        found += ctx.results[0].first == q;
+        vector<pair<Id, float>> results = ctx.results;
+        DG.freeze();
+        DG.search(DG.medoid(), DG.getRow(q), 16, 1, 40, ctx);
+        TEST_CHECK(ctx.results == results);
+        DG.unfreeze();
+    }
+    TEST_CHECK(found >= 95);
+    TEST_MSG("found %d of 100", found);
+
+    args.n_threads = 1;
+    args.useRGraph = true;
+}
+
+void test_batchVamana(void){
+
+    args.threshold = 0.1f;          // the default of the vamana index: the medoid is computed on a sample of the nodes
+    args.randomStart = false;
+    args.batchBuild = true;
+    args.seed = 7;
+    args.extraRandomEdges = 4;      // skipped by the batch build
+
+    // 4000 nodes: the medoid sample (400 nodes) spans several tiles of the medoid sums
+    mt19937 rng(61);
+    normal_distribution<float> value(0.0f, 1.0f);
+    vector<vector<float>> values(4000, vector<float>(16));
+    for (vector<float>& v : values){
+        for (float& x : v) x = value(rng);
+    }
+
+    // the same seed gives the same graph on one thread, three and eight
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG1(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG3(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    DirectedGraph<vector<float>, L2Distance<SIMD_AVX2>> DG8(L2Distance<SIMD_AVX2>(), vectorEmpty<float>);
+    for (const vector<float>& v : values){
+        DG1.createNode(v);
+        DG3.createNode(v);
+        DG8.createNode(v);
+    }
+
+    args.n_threads = 1;
+    TEST_CHECK(DG1.vamanaAlgorithm(40, 16, 1.2f));
+    args.n_threads = 3;
+    TEST_CHECK(DG3.vamanaAlgorithm(40, 16, 1.2f));
+    args.n_threads = 8;
+    TEST_CHECK(DG8.vamanaAlgorithm(40, 16, 1.2f));
+
+    TEST_CHECK(DG1.medoid() == DG3.medoid() && DG1.medoid() == DG8.medoid());
+
+    int n_edges = 0;
+    for (Id id = 0; id < 4000; ++id){
+        NeighborRange nb1 = DG1.getNeighbors(id), nb3 = DG3.getNeighbors(id), nb8 = DG8.getNeighbors(id);
+        n_edges += nb1.size();
+        TEST_CHECK(nb1.size() == nb3.size() && equal(nb1.begin(), nb1.end(), nb3.begin()));
+        TEST_CHECK(nb1.size() == nb8.size() && equal(nb1.begin(), nb1.end(), nb8.begin()));
+        TEST_CHECK(nb1.size() <= 16);
+        TEST_CHECK(find(nb1.begin(), nb1.end(), id) == nb1.end());
+        TEST_CHECK(unordered_set<Id>(nb1.begin(), nb1.end()).size() == nb1.size());
+    }
+    TEST_CHECK(DG1.get_n_edges() == n_edges && DG3.get_n_edges() == n_edges && DG8.get_n_edges() == n_edges);
+    TEST_CHECK(DG8.getAdjacency().n_edges() == n_edges);
+
+    // the graph is navigable: searching the value of a node finds the node itself
+    SearchContext ctx;
+    int found = 0;
+    for (int q = 0; q < 4000; q += 40){
+        DG8.search(DG8.medoid(), DG8.getRow(q), 16, 1, 40, ctx);
+        found += ctx.results[0].first == q;
+    }
+    TEST_CHECK(found >= 95);
+    TEST_MSG("found %d of 100", found);
+
+    args.n_threads = 1;
+    args.batchBuild = false;
+    args.seed = -1;
+    args.extraRandomEdges = 0;
+}
+
 TEST_LIST = {
     { "test_graphCreation", test_graphCreation },
     { "test_createNode", test_createNode },
@@ -746,7 +1589,22 @@ TEST_LIST = {
     { "test_greedySearch", test_greedySearch},
     { "test_robustPrune", test_robustPrune},
     { "test_vamanaAlgorithm", test_vamanaAlgorithm},
+    { "test_distancePolicy", test_distancePolicy},
+    { "test_pqGreedySearch", test_pqGreedySearch},
+    { "test_sqGreedySearch", test_sqGreedySearch},
+    { "test_sketchPrefilter", test_sketchPrefilter},
+    { "test_earlyAbandon", test_earlyAbandon},
+    { "test_pcaTwoTier", test_pcaTwoTier},
+    { "test_fastScanSearch", test_fastScanSearch},
+    { "test_searchContext", test_searchContext},
+    { "test_prefetch", test_prefetch},
+    { "test_rankedSearch", test_rankedSearch},
+    { "test_searchBatch", test_searchBatch},
+    { "test_freeze", test_freeze},
+    { "test_parallelVamana", test_parallelVamana},
+    { "test_batchVamana", test_batchVamana},
     { "test_init", test_init},
     { "test_startingNode", test_startingNode},
+    { "test_adjacencyStore", test_adjacencyStore},
     { NULL, NULL }     // zeroed record marking the end of the list
 };
\ No newline at end of file
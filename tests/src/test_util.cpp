@@ -62,7 +62,7 @@ void test_simd_euclideanDistance(void){
     try{
         float res = simd_euclideanDistance(v1,v2);
         TEST_CHECK(false); // control should not reach here
-    }catch(const invalid_argument& ia) { TEST_CHECK(string(ia.what()) == "Argument Containers are not of 100 or 128 dimensions"); };
+    }catch(const invalid_argument& ia) { TEST_CHECK(string(ia.what()) == "Argument Containers are empty"); };
 
     // ------------------------------------------------------------------------------------------- Different dimensions check
     v1 = {0.23f, 1.01f, 33.0f};
@@ -98,6 +98,658 @@ void test_simd_euclideanDistance(void){
     result = simd_euclideanDistance(v128_2,v128_1);
     TEST_CHECK(fabs(result - expected) <= tol);
     TEST_MSG("Symmetry check");
+
+    // ------------------------------------------------------------------------------------------- Any dimension, every kernel family supported by the host
+    for (int dim : {1, 3, 7, 8, 15, 17, 33, 96, 100, 128, 130, 960}){
+        v1.resize(dim);
+        v2.resize(dim);
+        for (int i = 0; i < dim; i++){
+            v1[i] = (float) (i % 7);
+            v2[i] = (float) (i % 5);
+        }
+        expected = euclideanDistance(v1, v2);
+
+        result = simd_euclideanDistance(v1, v2);
+        TEST_CHECK(fabs(result - expected) <= tol);
+        TEST_MSG("dim %d: expected %.3f, got %.3f", dim, expected, result);
+
+        for (int level = SIMD_SCALAR; level <= simd_level; level++){
+            result = l2Kernel((SimdLevel) level)(v1.data(), v2.data(), dim);
+            TEST_CHECK(fabs(result - expected) <= tol);
+            TEST_MSG("%s, dim %d: expected %.3f, got %.3f", simdLevelName((SimdLevel) level).c_str(), dim, expected, result);
+        }
+    }
+}
+
+void test_simd_row_euclideanDistance(void){
+
+    float tol = 0.001f; // For result comparison (precision issues)
+
+    // ------------------------------------------------------------------------------------------- Dimensions other than 100 and 128
+    for (int dim : {3, 8, 96, 100, 128, 130, 960}){
+        int padded = VectorStore<float>::padDimension(dim);
+        AlignedRow<float> r1(padded), r2(padded);
+
+        for (int i = 0; i < dim; i++){
+            r1.data()[i] = (float) i;
+            r2.data()[i] = (float) (i + 2);
+        }
+
+        float expected = 4.0f * dim;     // (i - (i+2))^2 = 4 for every dimension
+        float result = simd_row_euclideanDistance(r1.data(), r2.data(), dim);
+        TEST_CHECK(fabs(result - expected) <= tol);
+        TEST_MSG("dim %d: expected %.3f, got %.3f", dim, expected, result);
+
+        // same result as the scalar row kernel
+        TEST_CHECK(fabs(row_euclideanDistance(r1.data(), r2.data(), dim) - result) <= tol);
+
+        // same result for every kernel family supported by the host
+        for (int level = SIMD_SCALAR; level <= simd_level; level++)
+            TEST_CHECK(fabs(l2RowKernel((SimdLevel) level)(r1.data(), r2.data(), dim) - result) <= tol);
+    }
+}
+
+void test_int8RowKernels(void){
+
+    mt19937 rng(7);
+    uniform_int_distribution<int> value(0, 255);
+
+    for (int dim : {3, 32, 64, 100, 128, 130}){
+        int padded = VectorStore<uint8_t>::padDimension(dim);
+        AlignedRow<uint8_t> u1(padded), u2(padded);
+        AlignedRow<int8_t> s1(padded), s2(padded);
+
+        for (int i = 0; i < dim; i++){
+            u1.data()[i] = (i % 2 == 0) ? 255 : (uint8_t) value(rng);     // extreme differences: no overflow in the integer sums
+            u2.data()[i] = (i % 2 == 0) ? 0 : (uint8_t) value(rng);
+            s1.data()[i] = (int8_t) (u1.data()[i] - 128);
+            s2.data()[i] = (int8_t) (u2.data()[i] - 128);
+        }
+
+        // the same differences in both types: the same exact distance, for every kernel family supported by the host
+        float expected = row_euclideanDistance(u1.data(), u2.data(), dim);
+        TEST_CHECK(l2IntScalar(u1.data(), u2.data(), dim) == expected);
+        TEST_CHECK(L2Distance<SIMD_SCALAR>()(s1.data(), s2.data(), dim) == expected);
+        if (simd_level >= SIMD_AVX2){
+            TEST_CHECK(L2Distance<SIMD_AVX2>()(u1.data(), u2.data(), dim) == expected);
+            TEST_CHECK(L2Distance<SIMD_AVX2>()(s1.data(), s2.data(), dim) == expected);
+            TEST_MSG("dim %d: expected %.0f", dim, expected);
+        }
+    }
+}
+
+void test_boundedKernels(void){
+
+    for (int dim : {8, 32, 100, 128, 130, 960}){
+        int padded = VectorStore<float>::padDimension(dim);
+        AlignedRow<float> r1(padded), r2(padded);
+        memset(r1.data(), 0, padded * sizeof(float));
+        memset(r2.data(), 0, padded * sizeof(float));
+        for (int i = 0; i < dim; i++){
+            r1.data()[i] = (float) (i % 7);
+            r2.data()[i] = (float) (i % 3);
+        }
+
+        // every kernel family supported by the host: the exact distance (the same value as the row kernel) within the bound, a greater value beyond it
+        for (int level = SIMD_SCALAR; level <= simd_level; level++){
+            float exact = l2RowKernel((SimdLevel) level)(r1.data(), r2.data(), dim);
+            float within, beyond;
+            if (level == SIMD_AVX512){
+                within = l2RowBoundedDispatch<SIMD_AVX512>(r1.data(), r2.data(), dim, exact);
+                beyond = l2RowBoundedDispatch<SIMD_AVX512>(r1.data(), r2.data(), dim, 1.0f);
+            }
+            else if (level == SIMD_AVX2){
+                within = l2RowBoundedDispatch<SIMD_AVX2>(r1.data(), r2.data(), dim, exact);
+                beyond = l2RowBoundedDispatch<SIMD_AVX2>(r1.data(), r2.data(), dim, 1.0f);
+            }
+            else{
+                within = l2RowBoundedDispatch<SIMD_SCALAR>(r1.data(), r2.data(), dim, exact);
+                beyond = l2RowBoundedDispatch<SIMD_SCALAR>(r1.data(), r2.data(), dim, 1.0f);
+            }
+            TEST_CHECK(within == exact);
+            TEST_CHECK(beyond > 1.0f && beyond <= exact);
+            TEST_MSG("%s, dim %d: exact %.3f, within %.3f, beyond %.3f", simdLevelName((SimdLevel) level).c_str(), dim, exact, within, beyond);
+        }
+
+        // policies: per-row bounds, and the exact distances for policies without bounded kernels
+        const float* rows[2] = {r1.data(), r2.data()};
+        float bounds[2] = {0.0f, numeric_limits<float>::max()}, out[2];
+        distanceBoundedRows(L2Distance<SIMD_SCALAR>(), r2.data(), rows, 2, dim, bounds, out);
+        TEST_CHECK(out[0] > 0.0f && out[1] == 0.0f);
+        distanceBoundedRows(DynamicDistance<float>(row_euclideanDistance<float>), r2.data(), rows, 2, dim, bounds, out);
+        TEST_CHECK(out[0] == row_euclideanDistance(r1.data(), r2.data(), dim) && out[1] == 0.0f);
+    }
+
+    // 8-bit rows
+    for (int dim : {32, 100, 128, 200}){
+        int padded = VectorStore<uint8_t>::padDimension(dim);
+        AlignedRow<uint8_t> u1(padded), u2(padded);
+        memset(u1.data(), 0, padded);
+        memset(u2.data(), 0, padded);
+        for (int i = 0; i < dim; i++) u1.data()[i] = 255;
+
+        float exact = row_euclideanDistance(u1.data(), u2.data(), dim);
+        const uint8_t* rows[1] = {u1.data()};
+        float within[1] = {exact}, beyond[1] = {1.0f}, out[1];
+        TEST_CHECK(l2IntBoundedScalar(u1.data(), u2.data(), dim, exact) == exact);
+        TEST_CHECK(l2IntBoundedScalar(u1.data(), u2.data(), dim, 1.0f) > 1.0f);
+        if (simd_level >= SIMD_AVX2){
+            L2Distance<SIMD_AVX2>().bounded(u2.data(), rows, 1, dim, within, out);
+            TEST_CHECK(out[0] == exact);
+            L2Distance<SIMD_AVX2>().bounded(u2.data(), rows, 1, dim, beyond, out);
+            TEST_CHECK(out[0] > 1.0f && out[0] <= exact);
+            TEST_MSG("dim %d: exact %.0f, got %.0f", dim, exact, out[0]);
+        }
+    }
+}
+
+void test_matrixKernels(void){
+
+    mt19937 rng(16);
+    uniform_real_distribution<float> value(-2.0f, 2.0f);
+
+    for (int dim : {5, 100, 128, 960}){
+        // 9 x 13 rows: register blocks of every shape
+        VectorStore<float> a, b;
+        vector<float> v(dim);
+        for (int i = 0; i < 9; i++){ for (float& x : v) x = value(rng); a.append(v.data(), dim); }
+        for (int j = 0; j < 13; j++){ for (float& x : v) x = value(rng); b.append(v.data(), dim); }
+        b.append(a.row(3), dim);    // a row of a: distance 0
+        int m = a.size(), n = b.size();
+
+        vector<const float*> rows_a, rows_b;
+        for (int i = 0; i < m; i++) rows_a.push_back(a.row(i));
+        for (int j = 0; j < n; j++) rows_b.push_back(b.row(j));
+        vector<float> norms_a(m), norms_b(n), l2(m * n), ip(m * n), cosine(m * n), dynamic(m * n);
+        rowNorms(rows_a.data(), m, dim, norms_a.data());
+        rowNorms(rows_b.data(), n, dim, norms_b.data());
+
+        // every policy matches its per-pair distance (the norm decomposition of L2 up to rounding), the policies without kernels as well
+        distanceMatrixRows(L2Distance<SIMD_AVX2>(), rows_a.data(), norms_a.data(), m, rows_b.data(), norms_b.data(), n, dim, l2.data());
+        distanceMatrixRows(IPDistance<SIMD_AVX2>(), rows_a.data(), norms_a.data(), m, rows_b.data(), norms_b.data(), n, dim, ip.data());
+        distanceMatrixRows(CosineDistance<SIMD_SCALAR>(), rows_a.data(), norms_a.data(), m, rows_b.data(), norms_b.data(), n, dim, cosine.data());
+        distanceMatrixRows(DynamicDistance<float>(row_euclideanDistance<float>), rows_a.data(), nullptr, m, rows_b.data(), nullptr, n, dim, dynamic.data());
+        for (int i = 0; i < m; i++){
+            for (int j = 0; j < n; j++){
+                float exact = row_euclideanDistance(a.row(i), b.row(j), dim), dot = row_innerProduct(a.row(i), b.row(j), dim);
+                float tol = 1e-4f * (norms_a[i] + norms_b[j]);
+                TEST_CHECK(fabs(l2[i * n + j] - exact) <= tol);
+                TEST_CHECK(fabs(ip[i * n + j] + dot) <= tol && fabs(cosine[i * n + j] - (1.0f - dot)) <= tol);
+                TEST_CHECK(dynamic[i * n + j] == exact);
+                TEST_MSG("dim %d, pair (%d, %d): %.4f, expected %.4f", dim, i, j, l2[i * n + j], exact);
+            }
+        }
+        TEST_CHECK(l2[3 * n + n - 1] >= 0.0f && l2[3 * n + n - 1] <= 1e-4f * norms_a[3]);
+
+        // the exact k-NN scan returns the k nearest rows of b, closest first
+        vector<vector<int>> nearest;
+        exactNeighbors(L2Distance<SIMD_AVX2>(), rows_a.data(), m, rows_b.data(), n, dim, 4, nearest);
+        TEST_CHECK((int) nearest.size() == m);
+        for (int i = 0; i < m; i++){
+            vector<pair<float, int>> sorted;
+            for (int j = 0; j < n; j++) sorted.push_back({row_euclideanDistance(a.row(i), b.row(j), dim), j});
+            sort(sorted.begin(), sorted.end());
+            TEST_CHECK(nearest[i].size() == 4);
+            for (int r = 0; r < 4 && r < (int) nearest[i].size(); r++) TEST_CHECK(nearest[i][r] == sorted[r].second);
+        }
+        TEST_CHECK(nearest[3][0] == n - 1);
+    }
+}
+
+void test_innerProductKernels(void){
+
+    float tol = 0.001f;
+
+    for (int dim : {3, 8, 32, 96, 100, 128, 130, 960}){
+        int padded = VectorStore<float>::padDimension(dim);
+        AlignedRow<float> r1(padded), r2(padded);
+        memset(r1.data(), 0, padded * sizeof(float));
+        memset(r2.data(), 0, padded * sizeof(float));
+
+        for (int i = 0; i < dim; i++){
+            r1.data()[i] = (float) (i % 5);
+            r2.data()[i] = (i % 2) ? 1.0f : -0.5f;
+        }
+
+        float expected = row_innerProduct(r1.data(), r2.data(), dim);
+
+        // every kernel family supported by the host, and the policies built on them
+        for (int level = SIMD_SCALAR; level <= simd_level; level++){
+            float result = dotRowKernel((SimdLevel) level)(r1.data(), r2.data(), dim);
+            TEST_CHECK(fabs(result - expected) <= tol);
+            TEST_MSG("%s, dim %d: expected %.3f, got %.3f", simdLevelName((SimdLevel) level).c_str(), dim, expected, result);
+        }
+        TEST_CHECK(fabs(IPDistance<SIMD_SCALAR>()(r1.data(), r2.data(), dim) + expected) <= tol);
+        TEST_CHECK(fabs(CosineDistance<SIMD_SCALAR>()(r1.data(), r2.data(), dim) - (1.0f - expected)) <= tol);
+
+        // batch kernels agree with the single-row kernels
+        const float* rows[3] = {r1.data(), r2.data(), r1.data()};
+        float out[3];
+        if (simd_level == SIMD_AVX512) IPDistance<SIMD_AVX512>().batch(r2.data(), rows, 3, dim, out);
+        else if (simd_level == SIMD_AVX2) IPDistance<SIMD_AVX2>().batch(r2.data(), rows, 3, dim, out);
+        else IPDistance<SIMD_SCALAR>().batch(r2.data(), rows, 3, dim, out);
+        TEST_CHECK(fabs(out[0] + expected) <= tol);
+        TEST_CHECK(fabs(out[1] + row_innerProduct(r2.data(), r2.data(), dim)) <= tol);
+        TEST_CHECK(out[0] == out[2]);
+    }
+
+    // normalization to unit length (rows of zeros are left as they are)
+    vector<float> v = {3.0f, 0.0f, 4.0f}, zero = {0.0f, 0.0f, 0.0f};
+    normalizeRow(v.data(), v.size());
+    normalizeRow(zero.data(), zero.size());
+    TEST_CHECK(fabs(v[0] - 0.6f) <= tol && v[1] == 0.0f && fabs(v[2] - 0.8f) <= tol);
+    TEST_CHECK(zero == vector<float>({0.0f, 0.0f, 0.0f}));
+}
+
+void test_productQuantizer(void){
+
+    args.n_threads = 2;
+
+    try{
+        ProductQuantizer pq(8, 9, false);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "The number of PQ subspaces must be in [1, dim].\n"); }
+
+    // 100 rows of dimension 10 (subspaces of 2 and 3 dimensions)
+    VectorStore<float> vectors;
+    mt19937 rng(3);
+    uniform_real_distribution<float> value(-5.0f, 5.0f);
+    for (int i = 0; i < 100; i++){
+        vector<float> v(10);
+        for (float& x : v) x = value(rng);
+        vectors.append(v.data(), v.size());
+    }
+    vector<float> xq(10, 0.5f);
+
+    // with fewer rows than PQ_CENTROIDS every row is a centroid of its own: the ADC distances are exact
+    for (bool inner_product : {false, true}){
+        ProductQuantizer pq(10, 4, inner_product);
+        pq.train(vectors);
+        pq.encode(vectors);
+        TEST_CHECK(pq.centroids() == 100);
+        TEST_CHECK(pq.bytes() == 100 * 4 + 100 * 10 * sizeof(float));
+
+        vector<float> table(pq.tableSize());
+        pq.computeTable(xq.data(), table.data());
+        for (int r = 0; r < vectors.size(); r++){
+            float expected = (inner_product) ? -row_innerProduct(vectors.row(r), xq.data(), 10) : row_euclideanDistance(vectors.row(r), xq.data(), 10);
+            TEST_CHECK(fabs(pq.distance(table.data(), r) - expected) <= 0.001f * max(1.0f, fabs(expected)));
+        }
+    }
+
+    args.n_threads = 1;
+}
+
+void test_scalarQuantizer(void){
+
+    // half precision: exact for small integers and powers of two, round to nearest otherwise
+    for (float x : {0.0f, 1.0f, -2.0f, 0.5f, 1024.0f, -65504.0f}) TEST_CHECK(halfToFloat(floatToHalf(x)) == x);
+    TEST_CHECK(fabs(halfToFloat(floatToHalf(0.1f)) - 0.1f) <= 0.0001f);
+
+    // 200 rows of dimension 20 (padded in the codes)
+    VectorStore<float> vectors;
+    mt19937 rng(5);
+    uniform_real_distribution<float> value(-3.0f, 3.0f);
+    for (int i = 0; i < 200; i++){
+        vector<float> v(20);
+        for (float& x : v) x = value(rng);
+        v[7] = 1.0f;        // constant dimension
+        vectors.append(v.data(), v.size());
+    }
+    vector<float> xq(20);
+    for (float& x : xq) x = value(rng);
+
+    // every type approximates the squared distance and the negative inner product within a small relative error
+    for (ScalarQuantization type : {SQ_INT8, SQ_INT8_VECTOR, SQ_FP16}){
+        for (bool inner_product : {false, true}){
+            ScalarQuantizer sq(type, 20, inner_product);
+            sq.train(vectors);
+            sq.encode(vectors);
+            TEST_CHECK(sq.codeBytes() >= ((type == SQ_FP16) ? 40 : 20));
+
+            SQQuery q = sq.prepareQuery(xq.data());
+            for (int r = 0; r < vectors.size(); r++){
+                float expected = (inner_product) ? -row_innerProduct(vectors.row(r), xq.data(), 20) : row_euclideanDistance(vectors.row(r), xq.data(), 20);
+                float tolerance = (type == SQ_FP16) ? 0.01f : 0.05f;
+                TEST_CHECK(fabs(sq.distance(q, r) - expected) <= tolerance * max(10.0f, fabs(expected)));
+            }
+        }
+    }
+
+    // the AVX2 kernels match the scalar sums
+    if (simd_level >= SIMD_AVX2){
+        vector<uint8_t> c(32);
+        vector<int8_t> a(32), b(32);
+        vector<uint16_t> h(32);
+        vector<float> qf(32), w(32);
+        float l2 = 0.0f, dot = 0.0f, hl2 = 0.0f, hdot = 0.0f;
+        int idot = 0;
+        for (int j = 0; j < 32; j++){
+            c[j] = (uint8_t) (j * 7); a[j] = (int8_t) (j * 5 - 80); b[j] = (int8_t) (60 - j * 4);
+            qf[j] = value(rng); w[j] = 0.5f + j * 0.01f; h[j] = floatToHalf(value(rng));
+            l2 += w[j] * (c[j] - qf[j]) * (c[j] - qf[j]);
+            dot += c[j] * qf[j];
+            idot += a[j] * b[j];
+            hl2 += (halfToFloat(h[j]) - qf[j]) * (halfToFloat(h[j]) - qf[j]);
+            hdot += halfToFloat(h[j]) * qf[j];
+        }
+        TEST_CHECK(fabs(sqInt8L2Avx2(c.data(), qf.data(), w.data(), 32) - l2) <= 0.001f * l2);
+        TEST_CHECK(fabs(sqInt8DotAvx2(c.data(), qf.data(), 32) - dot) <= 0.001f * max(1.0f, fabs(dot)));
+        TEST_CHECK(sqInt8VectorDotAvx2(a.data(), b.data(), 32) == idot);
+        TEST_CHECK(fabs(sqFp16L2Avx2(h.data(), qf.data(), 32) - hl2) <= 0.001f * hl2);
+        TEST_CHECK(fabs(sqFp16DotAvx2(h.data(), qf.data(), 32) - hdot) <= 0.001f * max(1.0f, fabs(hdot)));
+    }
+}
+
+void test_binarySketch(void){
+
+    try{
+        BinarySketch sketch(8, 100);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "The number of sketch bits must be a positive multiple of 64.\n"); }
+
+    // 200 rows of dimension 16 around 2 centers
+    VectorStore<float> vectors;
+    mt19937 rng(9);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 200; i++){
+        vector<float> v(16);
+        for (float& x : v) x = value(rng) + ((i % 2) ? 10.0f : -10.0f);
+        vectors.append(v.data(), v.size());
+    }
+
+    BinarySketch sketch(16, 128);
+    sketch.train(vectors);
+    sketch.encode(vectors);
+    TEST_CHECK(sketch.size() == 200 && sketch.words() == 2);
+    TEST_CHECK(sketch.bytes() == 200 * 2 * sizeof(uint64_t));
+
+    // the same row has the same sketch, rows of the same center are closer than rows of the other one
+    TEST_CHECK(sketch.hamming(sketch.sketch(0), sketch.sketch(0)) == 0);
+    int same = 0, other = 0;
+    for (int i = 2; i < 200; i += 2){
+        same += sketch.hamming(sketch.sketch(0), sketch.sketch(i));
+        other += sketch.hamming(sketch.sketch(0), sketch.sketch(i + 1));
+    }
+    TEST_CHECK(same < other);
+
+    // sketching a row again gives its sketch
+    vector<uint64_t> out(sketch.words());
+    sketch.compute(vectors.row(5), out.data());
+    TEST_CHECK(sketch.hamming(out.data(), sketch.sketch(5)) == 0);
+    sketch.append(vectors.row(5));
+    TEST_CHECK(sketch.size() == 201 && sketch.hamming(sketch.sketch(200), sketch.sketch(5)) == 0);
+}
+
+void test_pcaRotation(void){
+
+    try{
+        PCARotation pca(32, 20);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "The number of leading PCA components must be a positive multiple of 16, smaller than the dimension.\n"); }
+
+    // 500 rows of dimension 48, the variance of coordinate j decays with j
+    VectorStore<float> vectors;
+    mt19937 rng(15);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 500; i++){
+        vector<float> v(48);
+        for (int j = 0; j < 48; j++) v[j] = value(rng) * 10.0f / (1 + j) + 3.0f;
+        vectors.append(v.data(), v.size());
+    }
+
+    PCARotation pca(48, 16);
+    pca.train(vectors);
+    TEST_CHECK(pca.dim() == 48 && pca.leading() == 16 && pca.components().size() == 48);
+    TEST_CHECK(pca.leadingVariance() > 0.9f && pca.leadingVariance() <= 1.0f);
+
+    // the components are orthonormal
+    float maxError = 0.0f;
+    for (int c1 = 0; c1 < 48; c1++)
+        for (int c2 = 0; c2 < 48; c2++){
+            float dot = simd_row_dot_kernel(pca.components().row(c1), pca.components().row(c2), 48);
+            maxError = max(maxError, fabs(dot - ((c1 == c2) ? 1.0f : 0.0f)));
+        }
+    TEST_CHECK(maxError < 1e-4f);
+
+    // the rotation keeps the distances, and the leading distance is (up to rounding) a lower bound of them
+    AlignedRow<float> r1(vectors.paddedDim()), r2(vectors.paddedDim());
+    for (int i = 0; i < 20; i++){
+        pca.rotate(vectors.row(i), r1.data());
+        pca.rotate(vectors.row(i + 1), r2.data());
+        float d = simd_row_euclideanDistance(vectors.row(i), vectors.row(i + 1), 48);
+        float rotated = simd_row_euclideanDistance(r1.data(), r2.data(), 48);
+        float leading = simd_row_euclideanDistance(r1.data(), r2.data(), 16);
+        TEST_CHECK(fabs(d - rotated) <= 1e-3f * d);
+        TEST_CHECK(leading <= rotated * (1 + 1e-4f));
+    }
+
+    // a rotation built from the same components rotates the same, also in place
+    vector<float> components;
+    for (int c = 0; c < 48; c++) components.insert(components.end(), pca.components().row(c), pca.components().row(c) + 48);
+    PCARotation copy(48, 16, components.data());
+    TEST_CHECK(copy.leadingVariance() == 0.0f);
+    pca.rotate(vectors.row(7), r1.data());
+    memcpy(r2.data(), vectors.row(7), 48 * sizeof(float));
+    copy.rotate(r2.data(), r2.data());
+    TEST_CHECK(memcmp(r1.data(), r2.data(), 48 * sizeof(float)) == 0);
+}
+
+void test_fastScan(void){
+
+    try{
+        FastScanBlocks blocks(300, 300);
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "The number of fast-scan subspaces must be in [1, min(dim, 256)].\n"); }
+
+    // 200 rows of dimension 20 (5 subspaces: an odd number, the last pair of a block has one subspace)
+    VectorStore<float> vectors;
+    mt19937 rng(21);
+    normal_distribution<float> value(0.0f, 1.0f);
+    for (int i = 0; i < 200; i++){
+        vector<float> v(20);
+        for (float& x : v) x = value(rng);
+        vectors.append(v.data(), v.size());
+    }
+
+    // node 0 has 40 out-neighbors (2 blocks), node 1 has 3, node 2 none
+    AdjacencyStore adj(4);
+    adj.resize(3);
+    for (int j = 1; j <= 40; j++) adj.insert(0, 4 * j);
+    for (int j = 1; j <= 3; j++) adj.insert(1, j);
+
+    FastScanBlocks blocks(20, 5);
+    blocks.train(vectors);
+    blocks.build(adj, [](Id id) { return (int) id; });
+    TEST_CHECK(blocks.M() == 5 && blocks.size() == 3 && blocks.quantizer().centroids() == FASTSCAN_CENTROIDS);
+
+    FastScanNeighbors nb = blocks.neighbors(0);
+    TEST_CHECK(nb.degree == 40 && nb.blocks() == 2);
+    for (int j = 0; j < 40; j++) TEST_CHECK(nb.ids[j] == adj.neighbors(0).begin()[j]);
+    TEST_CHECK(blocks.neighbors(1).degree == 3 && blocks.neighbors(2).degree == 0);
+
+    // the AVX2 kernel and the scalar one sum the same bytes
+    FastScanQuery q;
+    blocks.prepareQuery(vectors.row(7), q);
+    vector<uint16_t> scalar(FASTSCAN_BLOCK), avx2(FASTSCAN_BLOCK);
+    for (int b = 0; b < nb.blocks(); b++){
+        fastScanBlockScalar(nb.codes + b * 3 * 32, q.lut.data(), 3, scalar.data());
+        fastScanBlockAvx2(nb.codes + b * 3 * 32, q.lut.data(), 3, avx2.data());
+        TEST_CHECK(scalar == avx2);
+    }
+
+    // the estimates are the PQ distances of the codes, up to the rounding of the table (half a unit per subspace)
+    vector<float> table(blocks.quantizer().tableSize());
+    blocks.quantizer().computeTable(vectors.row(7), table.data());
+    vector<uint16_t> estimates(nb.blocks() * FASTSCAN_BLOCK);
+    blocks.scan(q, nb, estimates.data());
+    for (int j = 0; j < 40; j++){
+        float pq = blocks.quantizer().distance(table.data(), nb.ids[j]);
+        TEST_CHECK(fabs(blocks.estimate(q, estimates[j]) - pq) <= 2.5f / q.scale + 1e-3f);
+        TEST_CHECK(estimates[j] <= blocks.limit(q, pq + 2.5f / q.scale + 1e-3f));
+    }
+    TEST_CHECK(blocks.limit(q, q.bias - 1.0f) == -1);
+}
+
+void test_searchBeam(void){
+
+    SearchBeam beam;
+    beam.reset(3);
+    TEST_CHECK(beam.size() == 0 && beam.capacity() == 3 && !beam.full());
+    TEST_CHECK(beam.next() == -1);
+
+    // the candidates are kept sorted, the closest unexpanded one is expanded first
+    TEST_CHECK(beam.insert(5.0f, 1));
+    TEST_CHECK(beam.insert(2.0f, 2));
+    TEST_CHECK(beam.next() == 2);
+    TEST_CHECK(beam.insert(7.0f, 3));
+    TEST_CHECK(beam.full() && beam.worst() == 7.0f);
+
+    // a full beam rejects farther candidates and drops its farthest one for closer candidates, which move the cursor back
+    TEST_CHECK(!beam.insert(8.0f, 4));
+    TEST_CHECK(beam.insert(1.0f, 5));
+    TEST_CHECK(beam.size() == 3 && beam.worst() == 5.0f);
+    TEST_CHECK(beam[0].id == 5 && beam[1].id == 2 && beam[2].id == 1);
+    TEST_CHECK(beam[1].expanded && !beam[0].expanded);
+    TEST_CHECK(beam.next() == 5);
+    TEST_CHECK(beam.next() == 1);
+    TEST_CHECK(beam.next() == -1);
+
+    // re-ranking replaces the distances and restores the order
+    beam[0].dist = 9.0f;
+    beam.sort();
+    TEST_CHECK(beam[0].id == 2 && beam[2].id == 5 && beam.next() == -1);
+
+    // a new search starts with no visited node, without clearing the table
+    VisitedTable visited;
+    visited.reset(10);
+    TEST_CHECK(visited.insert(3));
+    TEST_CHECK(!visited.insert(3));
+    TEST_CHECK(visited.contains(3) && !visited.contains(4));
+    visited.reset(20);
+    TEST_CHECK(!visited.contains(3));
+    TEST_CHECK(visited.insert(3) && visited.insert(15));
+}
+
+void test_vectorStore(void){
+
+    VectorStore<float> store;
+    TEST_CHECK(store.empty());
+    TEST_CHECK(store.dim() == 0);
+
+    // the first row fixes the dimension, rows are padded to a multiple of VECTOR_ALIGNMENT bytes
+    vector<float> v1 = {1.f, 2.f, 3.f};
+    vector<float> v2 = {4.f, 5.f, 6.f};
+    TEST_CHECK(store.append(v1.data(), v1.size()) == 0);
+    TEST_CHECK(store.append(v2.data(), v2.size()) == 1);
+    TEST_CHECK(store.dim() == 3);
+    TEST_CHECK(store.paddedDim() == VECTOR_ALIGNMENT / sizeof(float));
+    TEST_CHECK(store.size() == 2);
+
+    // rows are aligned, hold the values and are zero-padded
+    for (int r = 0; r < 2; r++){
+        const float* row = store.row(r);
+        TEST_CHECK(((uintptr_t) row) % VECTOR_ALIGNMENT == 0);
+        for (int i = 0; i < 3; i++) TEST_CHECK(row[i] == (r == 0 ? v1[i] : v2[i]));
+        for (int i = 3; i < store.paddedDim(); i++) TEST_CHECK(row[i] == 0.f);
+    }
+
+    // rows survive reallocations
+    for (int i = 0; i < 1000; i++) store.append(v2.data(), v2.size());
+    TEST_CHECK(store.size() == 1002);
+    TEST_CHECK(store.row(0)[2] == 3.f);
+    TEST_CHECK(store.row(1001)[0] == 4.f);
+
+    // dimension mismatch
+    vector<float> v3 = {1.f, 2.f};
+    try{
+        store.append(v3.data(), v3.size());
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Dimension Mismatch between Arguments"); }
+
+    // padding a query
+    AlignedRow<float> q(store.paddedDim());
+    store.pad(v1.data(), q.data());
+    TEST_CHECK(simd_row_euclideanDistance(q.data(), store.row(0), store.dim()) == 0.f);
+
+    // clear resets the dimension
+    store.clear();
+    TEST_CHECK(store.empty());
+    TEST_CHECK(store.dim() == 0);
+    TEST_CHECK(store.append(v3.data(), v3.size()) == 0);
+}
+
+void test_datasetReader(void){
+
+    vector<vector<float>> rows = {{1.f, 2.f, 3.f}, {4.f, 5.f, 6.f}, {7.f, 8.f, 9.f}};
+    string vecs_path = "test_dataset.fvecs", bin_path = "test_dataset.bin";
+
+    // .fvecs: every row is prefixed by its dimension
+    ofstream vecs_file(vecs_path, ios::binary);
+    for (const auto& r : rows){
+        int dim = r.size();
+        vecs_file.write((const char*) &dim, sizeof(int));
+        vecs_file.write((const char*) r.data(), dim * sizeof(float));
+    }
+    vecs_file.close();
+
+    // .bin: number of rows, then the raw rows
+    ofstream bin_file(bin_path, ios::binary);
+    uint32_t N = rows.size();
+    bin_file.write((const char*) &N, sizeof(uint32_t));
+    for (const auto& r : rows) bin_file.write((const char*) r.data(), r.size() * sizeof(float));
+    bin_file.close();
+
+    // rows are served in place, in order
+    DatasetReader<float> vecs_reader(vecs_path);
+    TEST_CHECK(vecs_reader.size() == 3);
+    TEST_CHECK(vecs_reader.dim() == 3);
+    for (int i = 0; i < 3; i++) TEST_CHECK(vector<float>(vecs_reader.row(i), vecs_reader.row(i) + 3) == rows[i]);
+
+    DatasetReader<float> bin_reader(bin_path, 3);
+    TEST_CHECK(bin_reader.size() == 3);
+    for (int i = 0; i < 3; i++) TEST_CHECK(vector<float>(bin_reader.row(i), bin_reader.row(i) + 3) == rows[i]);
+
+    // at most n_max rows
+    TEST_CHECK(DatasetReader<float>(vecs_path, -1, 2).size() == 2);
+
+    // the materializing readers agree
+    TEST_CHECK(read_vecs<float>(vecs_path, 2) == vector<vector<float>>(rows.begin(), rows.begin() + 2));
+    vector<vector<float>> data;
+    ReadBin(bin_path, 3, data);
+    TEST_CHECK(data == rows);
+
+    // streaming into a graph strips the first values of each row
+    DirectedGraph<vector<float>> DG(euclideanDistance<vector<float>>, vectorEmpty<float>);
+    streamDataset(DG, bin_reader, 1, true);
+    TEST_CHECK(DG.get_n_nodes() == 3);
+    TEST_CHECK(DG.getNodes()[2].category == 7);
+    TEST_CHECK(DG.getValue(DG.getNodes()[2].id) == vector<float>({8.f, 9.f}));
+
+    // .u8bin: number of rows and dimension, then the raw rows of bytes
+    string u8bin_path = "test_dataset.u8bin";
+    ofstream u8bin_file(u8bin_path, ios::binary);
+    uint32_t u8bin_header[2] = {3, 2};
+    u8bin_file.write((const char*) u8bin_header, sizeof(u8bin_header));
+    vector<uint8_t> bytes = {1, 2, 3, 4, 250, 255};
+    u8bin_file.write((const char*) bytes.data(), bytes.size());
+    u8bin_file.close();
+
+    DatasetReader<uint8_t> u8bin_reader(u8bin_path);
+    TEST_CHECK(u8bin_reader.size() == 3);
+    TEST_CHECK(u8bin_reader.dim() == 2);
+    TEST_CHECK(vector<uint8_t>(u8bin_reader.row(2), u8bin_reader.row(2) + 2) == vector<uint8_t>({250, 255}));
+    TEST_CHECK(elementTypeOfFile(u8bin_path) == ELEMENT_UINT8 && elementTypeOfFile(vecs_path) == ELEMENT_FLOAT);
+
+    remove(vecs_path.c_str());
+    remove(bin_path.c_str());
+    remove(u8bin_path.c_str());
+
+    // missing file
+    try{
+        DatasetReader<float> missing("no_such_dataset.fvecs");
+        TEST_CHECK(false);  // control should not reach here
+    }catch(invalid_argument& ia){ TEST_CHECK(string(ia.what()) == "Could not open file: no_such_dataset.fvecs\n"); }
 }
 
 void test_setIn(void){  
@@ -326,6 +978,19 @@ void test_permutation(void){
 TEST_LIST = {
     { "test_euclideanDistance", test_euclideanDistance },
     { "test_simd_euclideanDistance", test_simd_euclideanDistance },
+    { "test_simd_row_euclideanDistance", test_simd_row_euclideanDistance },
+    { "test_int8RowKernels", test_int8RowKernels },
+    { "test_boundedKernels", test_boundedKernels },
+    { "test_matrixKernels", test_matrixKernels },
+    { "test_innerProductKernels", test_innerProductKernels },
+    { "test_productQuantizer", test_productQuantizer },
+    { "test_scalarQuantizer", test_scalarQuantizer },
+    { "test_binarySketch", test_binarySketch },
+    { "test_pcaRotation", test_pcaRotation },
+    { "test_fastScan", test_fastScan },
+    { "test_searchBeam", test_searchBeam },
+    { "test_vectorStore", test_vectorStore },
+    { "test_datasetReader", test_datasetReader },
     { "test_setIn", test_setIn },
     { "test_mapKeyExists", test_mapKeyExists},
     { "test_setSubtraction", test_setSubtraction },